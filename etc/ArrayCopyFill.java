@@ -0,0 +1,105 @@
+import java.util.Arrays;
+
+public class ArrayCopyFill {
+    public static void main(String[] args) {
+        int[] ints = new int[64];
+        for (int i = 0; i < ints.length; i++) {
+            ints[i] = i * i;
+        }
+        // Overlapping copies in either direction behave as if the source was copied to a temporary array first
+        System.arraycopy(ints, 0, ints, 1, 63);
+        System.out.println(hash(ints));
+        System.arraycopy(ints, 10, ints, 0, 54);
+        System.out.println(hash(ints));
+        // Empty ranges are allowed right at the end of the array
+        System.arraycopy(ints, 64, ints, 0, 0);
+        System.arraycopy(ints, 0, ints, 64, 0);
+        Arrays.fill(ints, 64, 64, -1);
+        System.out.println(hash(ints));
+
+        // Values whose bytes are all the same and values whose bytes differ
+        Arrays.fill(ints, 0x01010101);
+        System.out.println(hash(ints));
+        Arrays.fill(ints, 60, 64, 0x01020304);
+        Arrays.fill(ints, 0, 1, -1);
+        System.out.println(hash(ints));
+
+        byte[] bytes = new byte[37];
+        Arrays.fill(bytes, (byte) -1);
+        Arrays.fill(bytes, 5, 9, (byte) 7);
+        System.arraycopy(bytes, 3, bytes, 30, 7);
+        System.out.println(sum(bytes));
+
+        short[] shorts = new short[9];
+        Arrays.fill(shorts, (short) -300);
+        Arrays.fill(shorts, 4, 9, (short) 257);
+        System.out.println(shorts[3] + shorts[4]);
+
+        char[] chars = new char[5];
+        Arrays.fill(chars, 'x');
+        Arrays.fill(chars, 1, 2, 'y');
+        System.out.println(chars[1]);
+        System.out.println(chars[4]);
+        // Characters past ASCII print encoded as UTF-8
+        Arrays.fill(chars, 2, 4, '\u00e9');
+        System.out.println(chars[3]);
+        System.out.println('\u20ac');
+
+        boolean[] flags = new boolean[10];
+        Arrays.fill(flags, 2, 5, true);
+        System.arraycopy(flags, 0, flags, 5, 5);
+        System.out.println(count(flags));
+
+        // Strings can be copied into an Object[] without checking every element
+        String[] words = new String[4];
+        words[0] = "a";
+        words[1] = "b";
+        words[3] = "d";
+        Object[] objects = new Object[6];
+        System.arraycopy(words, 0, objects, 2, 4);
+        Arrays.fill(objects, 0, 2, "z");
+        for (int i = 0; i < objects.length; i++) {
+            System.out.println(objects[i]);
+        }
+
+        // Big enough to outlive the young arrays it keeps getting pointed at
+        int[][] cells = new int[20000][];
+        for (int i = 0; i < 600000; i++) {
+            int[] cell = new int[i % 8 + 1];
+            cell[i % 8] = i;
+            cells[i % 20000] = cell;
+        }
+        System.arraycopy(cells, 0, cells, 10000, 10000);
+        int total = 0;
+        for (int i = 0; i < cells.length; i++) {
+            total += cells[i][i % 8];
+        }
+        System.out.println(total);
+    }
+
+    private static int hash(int[] values) {
+        int hash = 1;
+        for (int i = 0; i < values.length; i++) {
+            hash = 31 * hash + values[i];
+        }
+        return hash;
+    }
+
+    private static int sum(byte[] values) {
+        int sum = 0;
+        for (int i = 0; i < values.length; i++) {
+            sum += values[i];
+        }
+        return sum;
+    }
+
+    private static int count(boolean[] values) {
+        int count = 0;
+        for (int i = 0; i < values.length; i++) {
+            if (values[i]) {
+                count++;
+            }
+        }
+        return count;
+    }
+}
@@ -0,0 +1,53 @@
+public class GcStress {
+    private int value;
+    private GcStress left;
+    private GcStress right;
+
+    // Run with a small heap, e.g. -Xmx4m -Xmn1m. The tree outlives many young collections and ends up in the old
+    // generation, where it keeps getting pointed at young subtrees
+    public static void main(String[] args) {
+        GcStress root = build(14, 1);
+        System.out.println(check(root));
+        for (int round = 0; round < 160; round++) {
+            replace(root, round);
+            int garbage = 0;
+            for (int i = 0; i < 100; i++) {
+                garbage += check(build(8, i));
+            }
+            if (round % 32 == 31) {
+                System.out.println(check(root) ^ garbage);
+            }
+        }
+        System.out.println(check(root));
+    }
+
+    private static GcStress build(int depth, int value) {
+        GcStress node = new GcStress();
+        node.value = value;
+        if (depth > 0) {
+            node.left = build(depth - 1, value * 2);
+            node.right = build(depth - 1, value * 2 + 1);
+        }
+        return node;
+    }
+
+    private static int check(GcStress node) {
+        if (node == null) {
+            return 0;
+        }
+        return node.value + 3 * check(node.left) - check(node.right);
+    }
+
+    // The subtree it replaces was already promoted once the same path comes around again
+    private static void replace(GcStress root, int round) {
+        GcStress node = root;
+        for (int level = 0; level < 6; level++) {
+            if ((round >> level & 1) == 0) {
+                node = node.left;
+            } else {
+                node = node.right;
+            }
+        }
+        node.left = build(8, round);
+    }
+}
@@ -0,0 +1,17 @@
+public class NarrowingPressure {
+    // Enough live values to hand the narrowed ones registers past rbx once mix is optimized
+    public static void main(String[] args) {
+        int sum = 0;
+        for (int i = 1; i < 20000; i++) {
+            sum += mix(i * 7919, i % 13 + 1);
+        }
+        System.out.println(sum);
+    }
+
+    private static int mix(int a, int b) {
+        int c = (a / b) + (byte) a | (a * b);
+        int d = (byte) (c >> 3) + (char) (a ^ c) - (short) (b * c);
+        int e = (byte) (d + a) ^ (byte) (c - b) ^ (byte) (a * d);
+        return c + d * 3 + e * 5 + (byte) (c ^ d ^ e);
+    }
+}
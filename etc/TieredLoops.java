@@ -0,0 +1,68 @@
+public class TieredLoops {
+    private int value;
+    private TieredLoops next;
+
+    // main only runs once, its loops are compiled on stack
+    public static void main(String[] args) {
+        int sum = 0;
+        for (int i = 0; i < 300000; i++) {
+            sum += clamp(i) ^ mix(i, sum);
+        }
+        System.out.println(sum);
+
+        int nested = 0;
+        for (int i = 0; i < 300; i++) {
+            for (int j = 0; j < i; j++) {
+                nested += i * j % 11;
+            }
+        }
+        System.out.println(nested);
+
+        System.out.println(fib(22));
+
+        TieredLoops list = null;
+        for (int i = 0; i < 2000; i++) {
+            TieredLoops node = new TieredLoops();
+            node.value = i;
+            node.next = list;
+            list = node;
+        }
+        int total = 0;
+        for (int i = 0; i < 200; i++) {
+            total += sumList(list, i);
+        }
+        System.out.println(total);
+    }
+
+    // Only takes its first branch long after the optimized code inlining it assumed it never does
+    private static int clamp(int x) {
+        if (x >= 250000) {
+            return x * 3 - 7;
+        }
+        return x + 1;
+    }
+
+    private static int mix(int a, int b) {
+        return (a << 3) - (b >>> 5) + a % 7;
+    }
+
+    private static int fib(int n) {
+        if (n < 2) {
+            return n;
+        }
+        return fib(n - 1) + fib(n - 2);
+    }
+
+    private static int sumList(TieredLoops node, int limit) {
+        int sum = 0;
+        while (node != null) {
+            if (node.value < limit * 10) {
+                sum += node.value;
+            } else {
+                sum -= 1;
+            }
+            node = node.next;
+        }
+        return sum;
+    }
+}
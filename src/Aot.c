@@ -0,0 +1,520 @@
+#include "Aot.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Translator.h"
+#include "Utils.h"
+#include "Verifier.h"
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+// Exported by every library, checks the ABI key and returns the methods it has code for
+typedef const AotMethod* (*AotLinkFunction)(const AotRuntime* runtime, uint32_t* count);
+#define AOT_LINK_SYMBOL "AotLink"
+
+typedef struct
+{
+    void* Handle;
+    uint32_t MethodCount;
+    const AotMethod* Methods;
+} AotLibrary;
+
+static AotLibrary LIBRARY = { 0 };
+
+// Code compiled against a different frame layout would read the wrong fields
+static uint32_t GetAbiKey(void)
+{
+    const uint32_t layout[] = {
+        AOT_ABI_VERSION,
+        (uint32_t)sizeof(Frame),
+        (uint32_t)sizeof(Slot),
+        (uint32_t)offsetof(Frame, Stack),
+        (uint32_t)offsetof(Frame, StackStart),
+        (uint32_t)offsetof(Frame, Locals),
+    };
+    return HashBytes(layout, sizeof(layout), HASH_SEED);
+}
+
+static const Symbol* GetClassName(const ClassFile* cf)
+{
+    const Constant* class = &cf->ConstantPool[cf->ThisClass - 1];
+    assert(class->Type == CONST_CLASS);
+    const Constant* className = &cf->ConstantPool[class->As.Class.NameIndex - 1];
+    assert(className->Type == CONST_UTF8);
+    return className->As.Utf8;
+}
+
+static uint32_t GetCodeHash(const CodeAttribute* ca)
+{
+    return HashBytes(ca->Code, ca->CodeLength, HASH_SEED);
+}
+
+// Declarations the emitted code needs, the structs have the same layout as AotRuntime and AotMethod. Slots are
+// accessed as their int bits
+static const char PRELUDE[] =
+    "#include <stdbool.h>\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "typedef struct\n"
+    "{\n"
+    "    uint32_t AbiKey;\n"
+    "    bool (*ExecuteInstruction)(void* frame, uint32_t index, int32_t* stackTop);\n"
+    "    void (*ThrowDivideByZero)(void);\n"
+    "} AotRuntime;\n"
+    "\n"
+    "typedef struct\n"
+    "{\n"
+    "    const char* ClassName;\n"
+    "    const char* Name;\n"
+    "    const char* Descriptor;\n"
+    "    uint32_t CodeHash;\n"
+    "    bool (*Code)(void* frame);\n"
+    "} AotMethod;\n"
+    "\n"
+    "static const AotRuntime* RT;\n"
+    "\n";
+
+// Names can hold any character but a few, everything unusual is escaped
+static void EmitString(FILE* out, const Symbol* symbol)
+{
+    fputc('"', out);
+    for (uint16_t i = 0; i < symbol->Length; i++) {
+        const uint8_t c = (uint8_t)symbol->Bytes[i];
+        if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\' && c != '?')
+            fputc(c, out);
+        else
+            fprintf(out, "\\%03o", c);
+    }
+    fputc('"', out);
+}
+
+static const char* GetConditionOperator(const InstructionOp op)
+{
+    switch (op) {
+        case INST_IF_EQ:
+        case INST_IF_ICMP_EQ:
+        case INST_IF_NULL:
+            return "==";
+        case INST_IF_NE:
+        case INST_IF_ICMP_NE:
+        case INST_IF_NON_NULL:
+            return "!=";
+        case INST_IF_LT:
+        case INST_IF_ICMP_LT:
+            return "<";
+        case INST_IF_GE:
+        case INST_IF_ICMP_GE:
+            return ">=";
+        case INST_IF_GT:
+        case INST_IF_ICMP_GT:
+            return ">";
+        case INST_IF_LE:
+        case INST_IF_ICMP_LE:
+            return "<=";
+        default:
+            assert(false && "Not a conditional branch");
+            return NULL;
+    }
+}
+
+// Duplicates the count slots on top of the stack below the skip slots under them, see StackDuplicate
+static void EmitDuplicate(FILE* out, const uint16_t depth, const uint8_t count, const uint8_t skip)
+{
+    const uint16_t base = depth - count - skip;
+    fprintf(out, "    {");
+    for (uint16_t i = 0; i < count + skip; i++)
+        fprintf(out, " const int32_t t%u = s%u;", i, base + i);
+    for (uint16_t i = 0; i < count; i++)
+        fprintf(out, " s%u = t%u;", base + i, skip + i);
+    for (uint16_t i = 0; i < count + skip; i++)
+        fprintf(out, " s%u = t%u;", base + count + i, i);
+    fprintf(out, " }\n");
+}
+
+// The runtime works on the frame, so the operand stack is written out before the instruction and read back after it.
+// So are the locals holding references, which the collector finds in the frame and may move
+static void EmitRuntimeInstruction(FILE* out, const TranslatedCode* tc, const uint16_t maxLocals, const uint32_t index)
+{
+    const uint16_t depth = tc->StackDepths[index];
+    assert(index + 1 < tc->Count && tc->StackDepths[index + 1] != VERIFIER_UNREACHABLE);
+    const uint16_t depthAfter = tc->StackDepths[index + 1];
+    const uint8_t* types = VerifierGetFrameTypes(tc, index);
+    const uint8_t* typesAfter = VerifierGetFrameTypes(tc, index + 1);
+
+    for (uint16_t i = 0; i < maxLocals; i++) {
+        if (types[i] == VTYPE_REFERENCE)
+            fprintf(out, "    L[%u] = l%u;\n", i, i);
+    }
+    for (uint16_t i = 0; i < depth; i++)
+        fprintf(out, "    S[%u] = s%u;\n", i, i);
+    fprintf(out, "    if (!RT->ExecuteInstruction(frame, %u, S + %u))\n        return false;\n", index, depth);
+    for (uint16_t i = 0; i < depthAfter; i++)
+        fprintf(out, "    s%u = S[%u];\n", i, i);
+    for (uint16_t i = 0; i < maxLocals; i++) {
+        if (typesAfter[i] == VTYPE_REFERENCE)
+            fprintf(out, "    l%u = L[%u];\n", i, i);
+    }
+}
+
+// Java int arithmetic wraps around on overflow, so it is done on unsigned values, see INT_BINARY_OPS
+static const char* GetBinaryExpression(const InstructionOp op)
+{
+    switch (op) {
+        case INST_ADD_INT:  return "(int32_t)((uint32_t)s%u + (uint32_t)s%u)";
+        case INST_SUB_INT:  return "(int32_t)((uint32_t)s%u - (uint32_t)s%u)";
+        case INST_MUL_INT:  return "(int32_t)((uint32_t)s%u * (uint32_t)s%u)";
+        case INST_SHL_INT:  return "(int32_t)((uint32_t)s%u << (s%u & 0x1F))";
+        case INST_SHR_INT:  return "s%u >> (s%u & 0x1F)";
+        case INST_USHR_INT: return "(int32_t)((uint32_t)s%u >> (s%u & 0x1F))";
+        case INST_AND_INT:  return "s%u & s%u";
+        case INST_OR_INT:   return "s%u | s%u";
+        case INST_XOR_INT:  return "s%u ^ s%u";
+        default:            return NULL;
+    }
+}
+
+static const char* GetUnaryExpression(const InstructionOp op)
+{
+    switch (op) {
+        case INST_NEG_INT:      return "(int32_t)(0u - (uint32_t)s%u)";
+        case INST_INT_TO_BYTE:  return "(int8_t)s%u";
+        case INST_INT_TO_CHAR:  return "(uint16_t)s%u";
+        case INST_INT_TO_SHORT: return "(int16_t)s%u";
+        default:                return NULL;
+    }
+}
+
+// Superinstructions are emitted as the instructions they replaced, which are still in place after them
+static void EmitInstruction(FILE* out, const TranslatedCode* tc, const uint16_t maxLocals, const uint32_t index)
+{
+    const Instruction* inst = &tc->Instructions[index];
+    const InstructionOp op = GetUnfusedOp((InstructionOp)inst->Op);
+    const uint16_t depth = tc->StackDepths[index];
+    // Top of the stack and the slot below it
+    const uint16_t top = depth - 1;
+    const uint16_t below = depth - 2;
+
+    const char* binary = GetBinaryExpression(op);
+    if (binary) {
+        fprintf(out, "    s%u = ", below);
+        fprintf(out, binary, below, top);
+        fprintf(out, ";\n");
+        return;
+    }
+    const char* unary = GetUnaryExpression(op);
+    if (unary) {
+        fprintf(out, "    s%u = ", top);
+        fprintf(out, unary, top);
+        fprintf(out, ";\n");
+        return;
+    }
+
+    switch (op) {
+        case INST_PUSH_INT:
+        case INST_PUSH_FLOAT:
+            fprintf(out, "    s%u = %d;\n", depth, inst->B);
+            break;
+        case INST_PUSH_NULL:
+            fprintf(out, "    s%u = 0;\n", depth);
+            break;
+        case INST_LOAD_INT:
+        case INST_LOAD_REFERENCE:
+            fprintf(out, "    s%u = l%u;\n", depth, inst->A);
+            break;
+        case INST_STORE_INT:
+        case INST_STORE_REFERENCE:
+            fprintf(out, "    l%u = s%u;\n", inst->A, top);
+            break;
+        case INST_POP:
+        case INST_POP2:
+            break;
+        case INST_DUP:
+            EmitDuplicate(out, depth, 1, 0);
+            break;
+        case INST_DUP_X1:
+            EmitDuplicate(out, depth, 1, 1);
+            break;
+        case INST_DUP_X2:
+            EmitDuplicate(out, depth, 1, 2);
+            break;
+        case INST_DUP2:
+            EmitDuplicate(out, depth, 2, 0);
+            break;
+        case INST_DUP2_X1:
+            EmitDuplicate(out, depth, 2, 1);
+            break;
+        case INST_DUP2_X2:
+            EmitDuplicate(out, depth, 2, 2);
+            break;
+        case INST_SWAP:
+            fprintf(out, "    { const int32_t t = s%u; s%u = s%u; s%u = t; }\n", top, top, below, below);
+            break;
+        case INST_DIV_INT:
+        case INST_REM_INT:
+        {
+            fprintf(out, "    if (s%u == 0) {\n        RT->ThrowDivideByZero();\n        return false;\n    }\n", top);
+            // The overflowing division of the most negative int by -1 would trap in C
+            if (op == INST_DIV_INT)
+                fprintf(out, "    s%u = s%u == -1 ? (int32_t)(0u - (uint32_t)s%u) : s%u / s%u;\n", below, top, below, below, top);
+            else
+                fprintf(out, "    s%u = s%u == -1 ? 0 : s%u %% s%u;\n", below, top, below, top);
+            break;
+        }
+        case INST_INC_INT:
+            fprintf(out, "    l%u = (int32_t)((uint32_t)l%u + (uint32_t)%d);\n", inst->A, inst->A, (int8_t)inst->B);
+            break;
+        case INST_IF_EQ:
+        case INST_IF_NE:
+        case INST_IF_LT:
+        case INST_IF_GE:
+        case INST_IF_GT:
+        case INST_IF_LE:
+        case INST_IF_NULL:
+        case INST_IF_NON_NULL:
+            fprintf(out, "    if (s%u %s 0)\n        goto I%d;\n", top, GetConditionOperator(op), inst->B);
+            break;
+        case INST_IF_ICMP_EQ:
+        case INST_IF_ICMP_NE:
+        case INST_IF_ICMP_LT:
+        case INST_IF_ICMP_GE:
+        case INST_IF_ICMP_GT:
+        case INST_IF_ICMP_LE:
+            fprintf(out, "    if (s%u %s s%u)\n        goto I%d;\n", below, GetConditionOperator(op), top, inst->B);
+            break;
+        case INST_GOTO:
+            fprintf(out, "    goto I%d;\n", inst->B);
+            break;
+        case INST_RETURN_INT:
+        case INST_RETURN_REFERENCE:
+            // The VM takes the return value from the top of the frame's stack
+            fprintf(out, "    S[0] = s%u;\n    FRAME_STACK(frame) = S + 1;\n    return true;\n", top);
+            break;
+        case INST_RETURN:
+            fprintf(out, "    FRAME_STACK(frame) = S;\n    return true;\n");
+            break;
+        default:
+            // Resolution, calls and printing
+            EmitRuntimeInstruction(out, tc, maxLocals, index);
+            break;
+    }
+}
+
+static bool IsBranch(const InstructionOp op)
+{
+    return (op >= INST_IF_EQ && op <= INST_IF_NON_NULL) || op == INST_GOTO;
+}
+
+// Locals and operand stack slots become C variables, which the C compiler keeps in registers
+static void EmitMethod(FILE* out, const ClassFile* cf, const MethodInfo* method, const TranslatedCode* tc, const uint32_t id)
+{
+    const CodeAttribute* ca = method->Code;
+    fprintf(out, "// %s.%s%s\n", GetClassName(cf)->Bytes, method->Name->Bytes, method->Descriptor->Bytes);
+    fprintf(out, "static bool M%u(void* frame)\n{\n", id);
+    fprintf(out, "    int32_t* const L = FRAME_LOCALS(frame);\n");
+    fprintf(out, "    int32_t* const S = FRAME_STACK_START(frame);\n");
+    fprintf(out, "    (void)L;\n");
+
+    // Only the arguments hold a value on entry
+    const uint8_t* entryTypes = VerifierGetFrameTypes(tc, 0);
+    for (uint16_t i = 0; i < ca->MaxLocals; i++) {
+        if (entryTypes[i] != VTYPE_TOP)
+            fprintf(out, "    int32_t l%u = L[%u];\n", i, i);
+        else
+            fprintf(out, "    int32_t l%u = 0;\n", i);
+    }
+    for (uint16_t i = 0; i < ca->MaxStack; i++)
+        fprintf(out, "    int32_t s%u = 0;\n", i);
+
+    bool* targets = calloc(tc->Count, sizeof(bool));
+    assert(targets);
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        const Instruction* inst = &tc->Instructions[i];
+        if (tc->StackDepths[i] != VERIFIER_UNREACHABLE && IsBranch(GetUnfusedOp((InstructionOp)inst->Op)))
+            targets[inst->B] = true;
+    }
+
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        // Code no path reaches has no stack depth to emit it with
+        if (tc->StackDepths[i] == VERIFIER_UNREACHABLE)
+            continue;
+        if (targets[i])
+            fprintf(out, "I%u:\n", i);
+        EmitInstruction(out, tc, ca->MaxLocals, i);
+    }
+    fprintf(out, "}\n\n");
+    free(targets);
+}
+
+static bool EmitClass(FILE* out, const ClassFile* cf)
+{
+    fputs(PRELUDE, out);
+    fprintf(out, "#define FRAME_STACK(f) (*(int32_t**)((char*)(f) + %zu))\n", offsetof(Frame, Stack));
+    fprintf(out, "#define FRAME_STACK_START(f) (*(int32_t**)((char*)(f) + %zu))\n", offsetof(Frame, StackStart));
+    fprintf(out, "#define FRAME_LOCALS(f) (*(int32_t**)((char*)(f) + %zu))\n\n", offsetof(Frame, Locals));
+
+    bool* compiled = calloc(cf->MethodsCount ? cf->MethodsCount : 1, sizeof(bool));
+    assert(compiled);
+    for (uint16_t i = 0; i < cf->MethodsCount; i++) {
+        const MethodInfo* method = &cf->Methods[i];
+        // Abstract and native methods have no code
+        if (!method->CodeInfo || !MethodGetCode(cf, method))
+            continue;
+        const TranslatedCode* tc = TranslateCode(cf, method);
+        if (!tc) {
+            fprintf(stderr, "Method '%s%s' can't be compiled ahead of time, it will be interpreted\n",
+                method->Name->Bytes, method->Descriptor->Bytes);
+            continue;
+        }
+        EmitMethod(out, cf, method, tc, i);
+        compiled[i] = true;
+    }
+
+    // Ends with an empty entry so the table is never empty
+    uint32_t count = 0;
+    fprintf(out, "static const AotMethod METHODS[] = {\n");
+    for (uint16_t i = 0; i < cf->MethodsCount; i++) {
+        if (!compiled[i])
+            continue;
+        const MethodInfo* method = &cf->Methods[i];
+        fprintf(out, "    { ");
+        EmitString(out, GetClassName(cf));
+        fprintf(out, ", ");
+        EmitString(out, method->Name);
+        fprintf(out, ", ");
+        EmitString(out, method->Descriptor);
+        fprintf(out, ", %uu, M%u },\n", GetCodeHash(method->Code), i);
+        count++;
+    }
+    fprintf(out, "    { 0 },\n};\n\n");
+    free(compiled);
+
+    fprintf(out,
+        "#if defined(_WIN32)\n"
+        "__declspec(dllexport)\n"
+        "#endif\n"
+        "const AotMethod* " AOT_LINK_SYMBOL "(const AotRuntime* runtime, uint32_t* count)\n"
+        "{\n"
+        "    if (runtime->AbiKey != %uu)\n"
+        "        return 0;\n"
+        "    RT = runtime;\n"
+        "    *count = %u;\n"
+        "    return METHODS;\n"
+        "}\n", GetAbiKey(), count);
+    return !ferror(out);
+}
+
+bool AotCompileClass(const ClassFile* cf, const char* libraryPath)
+{
+    const size_t pathLength = strlen(libraryPath);
+    char* sourcePath = malloc(pathLength + 3);
+    assert(sourcePath);
+    memcpy(sourcePath, libraryPath, pathLength);
+    memcpy(sourcePath + pathLength, ".c", 3);
+
+    FILE* out = fopen(sourcePath, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to create '%s'\n", sourcePath);
+        free(sourcePath);
+        return false;
+    }
+    const bool emitted = EmitClass(out, cf);
+    if (fclose(out) != 0 || !emitted) {
+        fprintf(stderr, "Failed to write '%s'\n", sourcePath);
+        free(sourcePath);
+        return false;
+    }
+
+    const char* compiler = getenv("CC");
+    if (!compiler || !*compiler)
+        compiler = AOT_DEFAULT_COMPILER;
+    const char* format = "%s -O2 -shared -fPIC -o \"%s\" \"%s\"";
+    const size_t commandSize = strlen(format) + strlen(compiler) + pathLength + strlen(sourcePath) + 1;
+    char* command = malloc(commandSize);
+    assert(command);
+    snprintf(command, commandSize, format, compiler, libraryPath, sourcePath);
+
+    // The source is kept when it fails to compile, so the error can be looked into
+    const bool result = system(command) == 0;
+    if (result)
+        remove(sourcePath);
+    else
+        fprintf(stderr, "Failed to compile '%s' with '%s'\n", sourcePath, compiler);
+    free(command);
+    free(sourcePath);
+    return result;
+}
+
+static bool ExecuteInstruction(Frame* frame, const uint32_t index, Slot* stackTop)
+{
+    return RuntimeExecuteInstruction(frame, &frame->Code->Instructions[index], stackTop);
+}
+
+bool AotLoad(const char* libraryPath)
+{
+    assert(!LIBRARY.Handle && "AOT library already loaded");
+#if defined(_WIN32)
+    void* handle = LoadLibraryA(libraryPath);
+    AotLinkFunction link = handle ? (AotLinkFunction)GetProcAddress(handle, AOT_LINK_SYMBOL) : NULL;
+#else
+    void* handle = dlopen(libraryPath, RTLD_NOW | RTLD_LOCAL);
+    AotLinkFunction link = handle ? (AotLinkFunction)dlsym(handle, AOT_LINK_SYMBOL) : NULL;
+#endif
+    if (!link) {
+        fprintf(stderr, "Failed to load the AOT library '%s'\n", libraryPath);
+        LIBRARY.Handle = handle;
+        AotUnload();
+        return false;
+    }
+
+    // Lives as long as the library, which keeps a pointer to it
+    static AotRuntime runtime;
+    runtime = (AotRuntime){
+        .AbiKey = GetAbiKey(),
+        .ExecuteInstruction = ExecuteInstruction,
+        .ThrowDivideByZero = RuntimeThrowDivideByZero,
+    };
+    LIBRARY.Handle = handle;
+    LIBRARY.Methods = link(&runtime, &LIBRARY.MethodCount);
+    if (!LIBRARY.Methods) {
+        fprintf(stderr, "The AOT library '%s' was compiled by a different version of the VM\n", libraryPath);
+        AotUnload();
+        return false;
+    }
+    return true;
+}
+
+void AotUnload(void)
+{
+    if (LIBRARY.Handle) {
+#if defined(_WIN32)
+        FreeLibrary(LIBRARY.Handle);
+#else
+        dlclose(LIBRARY.Handle);
+#endif
+    }
+    LIBRARY = (AotLibrary){ 0 };
+}
+
+CompiledMethod AotFindMethod(const ClassFile* cf, const MethodInfo* method)
+{
+    if (!LIBRARY.Methods)
+        return NULL;
+
+    const Symbol* className = GetClassName(cf);
+    for (uint32_t i = 0; i < LIBRARY.MethodCount; i++) {
+        const AotMethod* entry = &LIBRARY.Methods[i];
+        if (strcmp(entry->Name, method->Name->Bytes) == 0 &&
+            strcmp(entry->Descriptor, method->Descriptor->Bytes) == 0 &&
+            strcmp(entry->ClassName, className->Bytes) == 0)
+            // Code compiled from different bytecode would disagree with the translated code it indexes into
+            return entry->CodeHash == GetCodeHash(method->Code) ? entry->Code : NULL;
+    }
+    return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ClassFile.h"
+#include "Jit.h"
+#include "Runtime.h"
+
+// Ahead-of-time compilation. Every method of a class is translated into a C function that keeps locals and the
+// operand stack in C variables and calls back into the runtime for resolution, calls and printing. The C is compiled
+// by the system compiler into a shared library, which the VM loads and runs instead of interpreting the methods
+
+// Bumped whenever the code emitted or the runtime it calls changes meaning
+#define AOT_ABI_VERSION 3
+
+// Compiler used to build the library when the CC environment variable isn't set
+#define AOT_DEFAULT_COMPILER "gcc"
+
+// Runtime entry points handed to the library when it is loaded, the emitted code declares the same layout
+typedef struct
+{
+    // Hash of the ABI version and the frame layout the code was compiled against
+    uint32_t AbiKey;
+    // RuntimeExecuteInstruction for the instruction at the index of the frame's translated code
+    bool (*ExecuteInstruction)(Frame* frame, uint32_t index, Slot* stackTop);
+    void (*ThrowDivideByZero)(void);
+} AotRuntime;
+
+// One compiled method in the library, looked up by the names and the hash of the bytecode it was compiled from
+typedef struct
+{
+    const char* ClassName;
+    const char* Name;
+    const char* Descriptor;
+    uint32_t CodeHash;
+    CompiledMethod Code;
+} AotMethod;
+
+// Compiles every method of the class that translates into a shared library at libraryPath, false if emitting or
+// compiling it failed. The symbol table must have been initialized
+bool AotCompileClass(const ClassFile* cf, const char* libraryPath);
+
+// Loads the library methods are looked up in, false if it can't be loaded or was built for another ABI
+bool AotLoad(const char* libraryPath);
+void AotUnload(void);
+// Code of the method in the loaded library, NULL if there is none or the method changed since it was compiled. The
+// method code must have been decoded by MethodGetCode
+CompiledMethod AotFindMethod(const ClassFile* cf, const MethodInfo* method);
+
+#endif //AOT_H
@@ -0,0 +1,75 @@
+#include "Arena.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGN_UP(value, alignment) (((value) + ((alignment) - 1)) & ~((size_t)(alignment) - 1))
+#define ARENA_MIN_BLOCK_SIZE 4096
+
+struct ArenaBlock
+{
+    ArenaBlock* Next;
+    size_t Size;
+    size_t Used;
+};
+
+// Data starts right after the header, rounded up so the first allocation is already aligned
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(ArenaBlock), ARENA_ALIGNMENT)
+
+static ArenaBlock* ArenaBlockCreate(const size_t size)
+{
+    ArenaBlock* block = malloc(BLOCK_HEADER_SIZE + size);
+    assert(block && "Out of RAM");
+    block->Next = NULL;
+    block->Size = size;
+    block->Used = 0;
+    return block;
+}
+
+Arena ArenaCreate(const size_t blockSize)
+{
+    return (Arena) {
+        .Head = NULL,
+        .BlockSize = ALIGN_UP(blockSize < ARENA_MIN_BLOCK_SIZE ? ARENA_MIN_BLOCK_SIZE : blockSize, ARENA_ALIGNMENT),
+    };
+}
+
+void* ArenaAlloc(Arena* arena, const size_t size)
+{
+    const size_t alignedSize = ALIGN_UP(size == 0 ? 1 : size, ARENA_ALIGNMENT);
+
+    ArenaBlock* block = arena->Head;
+    if (!block || block->Used + alignedSize > block->Size) {
+        // Oversized requests get a block of their own so the current one can keep being bumped
+        if (alignedSize > arena->BlockSize / 2 && block) {
+            ArenaBlock* big = ArenaBlockCreate(alignedSize);
+            big->Next = block->Next;
+            block->Next = big;
+            big->Used = alignedSize;
+            uint8_t* data = (uint8_t*)big + BLOCK_HEADER_SIZE;
+            memset(data, 0, alignedSize);
+            return data;
+        }
+
+        block = ArenaBlockCreate(alignedSize > arena->BlockSize ? alignedSize : arena->BlockSize);
+        block->Next = arena->Head;
+        arena->Head = block;
+    }
+
+    uint8_t* data = (uint8_t*)block + BLOCK_HEADER_SIZE + block->Used;
+    block->Used += alignedSize;
+    memset(data, 0, alignedSize);
+    return data;
+}
+
+void ArenaDestroy(Arena* arena)
+{
+    ArenaBlock* block = arena->Head;
+    while (block) {
+        ArenaBlock* next = block->Next;
+        free(block);
+        block = next;
+    }
+    arena->Head = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator, everything allocated from it is released at once by ArenaDestroy
+typedef struct
+{
+    ArenaBlock* Head;
+    size_t BlockSize;
+} Arena;
+
+Arena ArenaCreate(const size_t blockSize);
+// Returns zeroed memory aligned to ARENA_ALIGNMENT
+void* ArenaAlloc(Arena* arena, const size_t size);
+void ArenaDestroy(Arena* arena);
+
+#endif //ARENA_H
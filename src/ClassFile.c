@@ -6,6 +6,8 @@
 #include <string.h>
 
 #include "Cursor.h"
+#include "Symbol.h"
+#include "Utils.h"
 
 #define ENSURE_READ(result) \
     do {                    \
@@ -17,11 +19,20 @@
     } while(0)
 
 
+// Points straight into the class data instead of copying the bytes out of it
+static bool ReadBytes(Cursor* c, const uint8_t** bytes, const size_t count)
+{
+    if (c->ReadPosition + count > c->Size)
+        return false;
+    *bytes = &c->Data[c->ReadPosition];
+    c->ReadPosition += count;
+    return true;
+}
+
 static bool ReadConstantPool(ClassFile* cf, Cursor* c)
 {
     ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&cf->ConstantPoolCount));
-    cf->ConstantPool = calloc(cf->ConstantPoolCount, sizeof(Constant));
-    assert(cf->ConstantPool);
+    cf->ConstantPool = ArenaAlloc(&cf->Arena, cf->ConstantPoolCount * sizeof(Constant));
 
     for (int i = 0; i < cf->ConstantPoolCount - 1; i++) {
         Constant* cnst = (Constant*)&cf->ConstantPool[i];
@@ -32,10 +43,10 @@ static bool ReadConstantPool(ClassFile* cf, Cursor* c)
             {
                 uint16_t length;
                 ENSURE_READ(CursorReadUInt16(c, &length));
-                // Uft8 strings apparently are written in little endian
-                c->LittleEndian = true;
-                ENSURE_READ(CursorReadBytesAlloc(c, (uint8_t**)&cnst->As.Utf8, length + 1, length));
-                c->LittleEndian = false;
+                ENSURE_READ(c->ReadPosition + length <= c->Size);
+                // Interned straight from the class data, the symbol table keeps the only copy
+                cnst->As.Utf8 = SymbolIntern((const char*)&c->Data[c->ReadPosition], length);
+                c->ReadPosition += length;
                 break;
             }
             case CONST_INT:
@@ -109,40 +120,155 @@ static bool ReadConstantPool(ClassFile* cf, Cursor* c)
     return true;
 }
 
-bool ReadAttributes(AttributeInfo* attributes, const uint16_t count, Cursor* c, const bool copyData)
+static const Symbol* GetUtf8(const ClassFile* cf, const uint16_t index)
+{
+    if (index == 0 || index >= cf->ConstantPoolCount || cf->ConstantPool[index - 1].Type != CONST_UTF8)
+        return NULL;
+    return cf->ConstantPool[index - 1].As.Utf8;
+}
+
+static AttributeKind GetAttributeKind(const ClassFile* cf, const uint16_t nameIndex)
+{
+    const Symbol* name = GetUtf8(cf, nameIndex);
+    if (name == SYM_CODE)
+        return ATTRIBUTE_CODE;
+    if (name == SYM_CONSTANT_VALUE)
+        return ATTRIBUTE_CONSTANT_VALUE;
+    if (name == SYM_STACK_MAP_TABLE)
+        return ATTRIBUTE_STACK_MAP_TABLE;
+    if (name == SYM_EXCEPTIONS)
+        return ATTRIBUTE_EXCEPTIONS;
+    if (name == SYM_SOURCE_FILE)
+        return ATTRIBUTE_SOURCE_FILE;
+    if (name == SYM_LINE_NUMBER_TABLE)
+        return ATTRIBUTE_LINE_NUMBER_TABLE;
+    if (name == SYM_LOCAL_VARIABLE_TABLE)
+        return ATTRIBUTE_LOCAL_VARIABLE_TABLE;
+    return ATTRIBUTE_UNKNOWN;
+}
+
+static uint32_t HashMethod(const Symbol* name, const Symbol* descriptor)
+{
+    return name->Hash * 31u ^ descriptor->Hash;
+}
+
+bool ReadAttributes(const ClassFile* cf, AttributeInfo* attributes, const uint16_t count, Cursor* c)
 {
     assert(attributes && "Attributes was null");
     for (int i = 0; i < count; i++) {
         AttributeInfo* att = &attributes[i];
         if (!CursorReadUInt16(c, (uint16_t*)&att->NameIndex))
             return false;
+        *(AttributeKind*)&att->Kind = GetAttributeKind(cf, att->NameIndex);
         if (!CursorReadUInt32(c, (uint32_t*)&att->Length))
             return false;
 
-        att->Data = NULL;
-        if (!copyData) {
-            att->Data = &c->Data[c->ReadPosition];
-            c->ReadPosition += att->Length;
-            return true;
+        if (!ReadBytes(c, &att->Data, att->Length))
+            return false;
+    }
+    return true;
+}
+
+static bool ReadFields(ClassFile* cf, Cursor* c)
+{
+    ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&cf->FieldsCount));
+    cf->Fields = ArenaAlloc(&cf->Arena, cf->FieldsCount * sizeof(FieldInfo));
+
+    for (int i = 0; i < cf->FieldsCount; i++) {
+        FieldInfo* info = (FieldInfo*)&cf->Fields[i];
+        ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&info->AccessFlags));
+        ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&info->NameIndex));
+        ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&info->DescriptorIndex));
+        ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&info->AttributesCount));
+
+        if (info->AttributesCount <= 0)
+            continue;
+
+        info->Attributes = ArenaAlloc(&cf->Arena, info->AttributesCount * sizeof(AttributeInfo));
+        if (!ReadAttributes(cf, (AttributeInfo*)info->Attributes, info->AttributesCount, c)) {
+            ClassFileDestroy(cf);
+            return false;
         }
+    }
 
-        if (att->Length > 0) {
-            c->LittleEndian = true;
-            if (!CursorReadBytesAlloc(c, (uint8_t**)&att->Data, att->Length, att->Length)) {
-                c->LittleEndian = false;
-                return false;
-            }
-            c->LittleEndian = false;
+    return true;
+}
+
+// Bytes a field of the type takes inside an object, references are 32 bit like in a Slot
+static uint32_t GetFieldSize(const ArgumentType type)
+{
+    switch (type) {
+        case TYPE_BYTE:
+        case TYPE_BOOL:
+            return 1;
+        case TYPE_CHAR:
+        case TYPE_SHORT:
+            return 2;
+        case TYPE_LONG:
+        case TYPE_DOUBLE:
+            return 8;
+        default:
+            return 4;
+    }
+}
+
+static bool IsReferenceType(const ArgumentType type)
+{
+    return type == TYPE_CLASS_TYPE || type == TYPE_STRING;
+}
+
+// Lays out the instance fields after the header from the largest to the smallest, so every field is aligned to its
+// size without any padding between them
+static bool BuildInstanceLayout(ClassFile* cf)
+{
+    uint16_t referenceCount = 0;
+    for (int i = 0; i < cf->FieldsCount; i++) {
+        FieldInfo* f = (FieldInfo*)&cf->Fields[i];
+        f->Name = GetUtf8(cf, f->NameIndex);
+        f->Descriptor = GetUtf8(cf, f->DescriptorIndex);
+        if (!f->Name || !f->Descriptor) {
+            fprintf(stderr, "Field %d has an invalid name or descriptor index\n", i);
+            return false;
+        }
+        if (!ParseFieldDescriptor(f->Descriptor->Bytes, (ArgumentType*)&f->Type)) {
+            fprintf(stderr, "Field '%s' has an invalid descriptor '%s'\n", f->Name->Bytes, f->Descriptor->Bytes);
+            return false;
         }
+        if ((f->AccessFlags & FAF_STATIC) == 0 && IsReferenceType(f->Type))
+            referenceCount++;
     }
+
+    ObjectLayout* layout = (ObjectLayout*)&cf->InstanceLayout;
+    uint32_t* referenceOffsets = ArenaAlloc(&cf->Arena, referenceCount * sizeof(uint32_t));
+    uint32_t offset = sizeof(ObjectHeader);
+    for (uint32_t size = 8; size > 0; size /= 2) {
+        for (int i = 0; i < cf->FieldsCount; i++) {
+            FieldInfo* f = (FieldInfo*)&cf->Fields[i];
+            if ((f->AccessFlags & FAF_STATIC) != 0 || GetFieldSize(f->Type) != size)
+                continue;
+            *(uint32_t*)&f->Offset = offset;
+            if (IsReferenceType(f->Type))
+                referenceOffsets[layout->ReferenceFieldCount++] = offset;
+            offset += size;
+        }
+    }
+
+    const bool validClass = cf->ThisClass > 0 && cf->ThisClass < cf->ConstantPoolCount
+        && cf->ConstantPool[cf->ThisClass - 1].Type == CONST_CLASS;
+    layout->Name = validClass ? GetUtf8(cf, cf->ConstantPool[cf->ThisClass - 1].As.Class.NameIndex) : NULL;
+    if (!layout->Name) {
+        fprintf(stderr, "Class has an invalid name\n");
+        return false;
+    }
+    layout->InstanceSize = HeapAlignSize(offset);
+    layout->ReferenceFieldOffsets = referenceOffsets;
     return true;
 }
 
 static bool ReadMethods(ClassFile* cf, Cursor* c)
 {
     ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&cf->MethodsCount));
-    cf->Methods = calloc(cf->MethodsCount, sizeof(MethodInfo));
-    assert(cf->Methods);
+    cf->Methods = ArenaAlloc(&cf->Arena, cf->MethodsCount * sizeof(MethodInfo));
 
     for (int i = 0; i < cf->MethodsCount; i++) {
         MethodInfo* info = (MethodInfo*)&cf->Methods[i];
@@ -154,21 +280,51 @@ static bool ReadMethods(ClassFile* cf, Cursor* c)
         if (info->AttributesCount <= 0)
             continue;
 
-        info->Attributes = calloc(info->AttributesCount, sizeof(AttributeInfo));
-        assert(info->Attributes);
-        if (!ReadAttributes((AttributeInfo*)info->Attributes, info->AttributesCount, c, true)) {
+        info->Attributes = ArenaAlloc(&cf->Arena, info->AttributesCount * sizeof(AttributeInfo));
+        if (!ReadAttributes(cf, (AttributeInfo*)info->Attributes, info->AttributesCount, c)) {
             ClassFileDestroy(cf);
             return false;
         }
+        info->CodeInfo = FindAttribute(info->Attributes, info->AttributesCount, ATTRIBUTE_CODE);
     }
     
     return true;
 }
 
+static bool BuildMethodTable(ClassFile* cf)
+{
+    MethodTable* table = (MethodTable*)&cf->MethodTable;
+    // Keep the load factor at or below 0.5 so probe sequences stay short
+    table->Capacity = 4;
+    while (table->Capacity < (uint32_t)cf->MethodsCount * 2)
+        table->Capacity *= 2;
+    table->Slots = ArenaAlloc(&cf->Arena, table->Capacity * sizeof(*table->Slots));
+
+    for (int i = 0; i < cf->MethodsCount; i++) {
+        MethodInfo* m = (MethodInfo*)&cf->Methods[i];
+        m->Name = GetUtf8(cf, m->NameIndex);
+        m->Descriptor = GetUtf8(cf, m->DescriptorIndex);
+        if (!m->Name || !m->Descriptor) {
+            fprintf(stderr, "Method %d has an invalid name or descriptor index\n", i);
+            return false;
+        }
+
+        *(uint32_t*)&m->Hash = HashMethod(m->Name, m->Descriptor);
+        uint32_t slot = m->Hash & (table->Capacity - 1);
+        while (table->Slots[slot])
+            slot = (slot + 1) & (table->Capacity - 1);
+        table->Slots[slot] = m;
+    }
+
+    return true;
+}
+
 ClassFile* ClassFileCreate(const uint8_t* classData, const size_t size)
 {
-    ClassFile* cf = calloc(1, sizeof(ClassFile));
-    assert(cf);
+    // Attributes point into the class data, the arena only needs room for the tables
+    Arena arena = ArenaCreate(size);
+    ClassFile* cf = ArenaAlloc(&arena, sizeof(ClassFile));
+    cf->Arena = arena;
 
     Cursor cursor = CursorCreate(classData, size, false);
 
@@ -188,19 +344,28 @@ ClassFile* ClassFileCreate(const uint8_t* classData, const size_t size)
     ENSURE_READ(CursorReadUInt16(&cursor, &interfacesCount));
     assert(interfacesCount == 0 && "Interfaces are not supported!");
 
-    uint16_t fieldsCount;
-    ENSURE_READ(CursorReadUInt16(&cursor, &fieldsCount));
-    assert(fieldsCount == 0 && "Fields are not supported!");
+    if (!ReadFields(cf, &cursor)) {
+        return NULL;
+    }
 
     if (!ReadMethods(cf, &cursor)) {
         return NULL;
     }
 
+    if (!BuildInstanceLayout(cf)) {
+        ClassFileDestroy(cf);
+        return NULL;
+    }
+
+    if (!BuildMethodTable(cf)) {
+        ClassFileDestroy(cf);
+        return NULL;
+    }
+
     ENSURE_READ(CursorReadUInt16(&cursor, (uint16_t*)&cf->AttributesCount));
     if (cf->AttributesCount > 0) {
-        cf->Attributes = calloc(cf->AttributesCount, sizeof(AttributeInfo));
-        assert(cf->Attributes);
-        if (!ReadAttributes((AttributeInfo*)cf->Attributes, cf->AttributesCount, &cursor, true)) {
+        cf->Attributes = ArenaAlloc(&cf->Arena, cf->AttributesCount * sizeof(AttributeInfo));
+        if (!ReadAttributes(cf, (AttributeInfo*)cf->Attributes, cf->AttributesCount, &cursor)) {
             ClassFileDestroy(cf);
             return false;
         }
@@ -209,69 +374,138 @@ ClassFile* ClassFileCreate(const uint8_t* classData, const size_t size)
     return cf;
 }
 
-void ClassFileDestroy(const ClassFile* cf)
+ClassFile* ClassFileLoad(const char* filePath)
 {
-    if (!cf)
-        return;
+    size_t size;
+    const uint8_t* data = MapFileToMemory(filePath, &size);
+    if (!data)
+        return NULL;
 
-    if (cf->ConstantPool) {
-        for (int i = 0; i < cf->ConstantPoolCount - 1; i++) {
-            const Constant* c = &cf->ConstantPool[i];
-            if (c && c->Type == CONST_UTF8) {
-                free((void*)c->As.Utf8);
-            }
-        }
-        free((void*)cf->ConstantPool);
+    ClassFile* cf = ClassFileCreate(data, size);
+    if (!cf) {
+        UnmapFile(data, size);
+        return NULL;
     }
 
-    if (cf->Methods) {
-        for (int i = 0; i < cf->MethodsCount; i++) {
-            const MethodInfo* m = &cf->Methods[i];
-            if (m) {
-                for (int j = 0; j < m->AttributesCount; j++) {
-                    const AttributeInfo* a = &m->Attributes[i];
-                    if (a) {
-                        free((void*)m->Attributes->Data);
-                    }
-                }
-            }
-        }
-        free((void*)cf->Methods);
-    }
+    cf->MappedData = data;
+    cf->MappedSize = size;
+    return cf;
+}
 
-    if (cf->Attributes) {
-        for (int i = 0; i < cf->AttributesCount; i++) {
-            const AttributeInfo* a = &cf->Attributes[i];
-            if (a) {
-                free((void*)a->Data);
-            }
-        }
-        free((void*)cf->Attributes);
-    }
+void ClassFileDestroy(const ClassFile* cf)
+{
+    if (!cf)
+        return;
 
-    free((void*)cf);
+    UnmapFile(cf->MappedData, cf->MappedSize);
+
+    // The ClassFile lives inside its own arena, so it has to be copied out before being released
+    Arena arena = cf->Arena;
+    ArenaDestroy(&arena);
 }
 
 const MethodInfo* FindMethodByName(const ClassFile* cf, const char* name)
 {
+    // A name that was never interned can't possibly be the name of a method
+    const Symbol* symbol = SymbolLookup(name);
+    if (!symbol)
+        return NULL;
+
     for (int i = 0; i < cf->MethodsCount; i++) {
-        const MethodInfo* m = &cf->Methods[i];
-        const Constant* c = &cf->ConstantPool[m->NameIndex - 1];
-        assert(c->Type == CONST_UTF8);
-        if (strcmp(c->As.Utf8, name) == 0)
+        if (cf->Methods[i].Name == symbol)
+            return &cf->Methods[i];
+    }
+    return NULL;
+}
+
+const MethodInfo* FindMethod(const ClassFile* cf, const Symbol* name, const Symbol* descriptor)
+{
+    const MethodTable* table = &cf->MethodTable;
+    const uint32_t hash = HashMethod(name, descriptor);
+
+    for (uint32_t slot = hash & (table->Capacity - 1); table->Slots[slot]; slot = (slot + 1) & (table->Capacity - 1)) {
+        const MethodInfo* m = table->Slots[slot];
+        if (m->Name == name && m->Descriptor == descriptor)
             return m;
     }
     return NULL;
 }
 
-const AttributeInfo* FindAttributeByName(const ClassFile* cf, const AttributeInfo* attributes, const uint16_t count, const char* name)
+const FieldInfo* FindField(const ClassFile* cf, const Symbol* name, const Symbol* descriptor)
+{
+    for (int i = 0; i < cf->FieldsCount; i++) {
+        if (cf->Fields[i].Name == name && cf->Fields[i].Descriptor == descriptor)
+            return &cf->Fields[i];
+    }
+    return NULL;
+}
+
+const AttributeInfo* FindAttribute(const AttributeInfo* attributes, const uint16_t count, const AttributeKind kind)
 {
     for (uint16_t i = 0; i < count; i++) {
-        const AttributeInfo* a = &attributes[i];
-        const Constant* c = &cf->ConstantPool[a->NameIndex - 1];
-        assert(c->Type == CONST_UTF8);
-        if (strcmp(c->As.Utf8, name) == 0)
-            return a;
+        if (attributes[i].Kind == kind)
+            return &attributes[i];
     }
     return NULL;
 }
+
+static bool DecodeCodeAttribute(ClassFile* cf, CodeAttribute* ca, Cursor* c)
+{
+    if (!CursorReadUInt16(c, (uint16_t*)&ca->MaxStack)
+        || !CursorReadUInt16(c, (uint16_t*)&ca->MaxLocals)
+        || !CursorReadUInt32(c, (uint32_t*)&ca->CodeLength))
+        return false;
+
+    if (ca->CodeLength == 0 || c->ReadPosition + ca->CodeLength > c->Size)
+        return false;
+    // The attribute data lives as long as the class, so the code can be used in place
+    ca->Code = &c->Data[c->ReadPosition];
+    c->ReadPosition += ca->CodeLength;
+
+    if (!CursorReadUInt16(c, (uint16_t*)&ca->ExceptionTableLength))
+        return false;
+    if (ca->ExceptionTableLength > 0) {
+        ExceptionTableEntry* table = ArenaAlloc(&cf->Arena, ca->ExceptionTableLength * sizeof(ExceptionTableEntry));
+        for (uint16_t i = 0; i < ca->ExceptionTableLength; i++) {
+            ExceptionTableEntry* e = &table[i];
+            if (!CursorReadUInt16(c, (uint16_t*)&e->StartPc)
+                || !CursorReadUInt16(c, (uint16_t*)&e->EndPc)
+                || !CursorReadUInt16(c, (uint16_t*)&e->HandlerPc)
+                || !CursorReadUInt16(c, (uint16_t*)&e->CatchType))
+                return false;
+        }
+        ca->ExceptionTable = table;
+    }
+
+    if (!CursorReadUInt16(c, (uint16_t*)&ca->AttributesCount))
+        return false;
+    if (ca->AttributesCount > 0) {
+        ca->Attributes = ArenaAlloc(&cf->Arena, ca->AttributesCount * sizeof(AttributeInfo));
+        if (!ReadAttributes(cf, (AttributeInfo*)ca->Attributes, ca->AttributesCount, c))
+            return false;
+    }
+
+    return true;
+}
+
+const CodeAttribute* MethodGetCode(const ClassFile* cf, const MethodInfo* method)
+{
+    if (method->Code)
+        return method->Code;
+
+    if (!method->CodeInfo) {
+        fprintf(stderr, "Failed to find attribute 'Code' inside method '%s'\n", method->Name->Bytes);
+        return NULL;
+    }
+
+    Cursor c = CursorCreate(method->CodeInfo->Data, method->CodeInfo->Length, false);
+    // Decoded once and kept for the lifetime of the class, a failed decode only wastes a bit of arena
+    CodeAttribute* ca = ArenaAlloc((Arena*)&cf->Arena, sizeof(CodeAttribute));
+    if (!DecodeCodeAttribute((ClassFile*)cf, ca, &c)) {
+        fprintf(stderr, "Invalid attribute 'Code' inside method '%s'\n", method->Name->Bytes);
+        return NULL;
+    }
+
+    ((MethodInfo*)method)->Code = ca;
+    return ca;
+}
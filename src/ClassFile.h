@@ -4,7 +4,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "Arena.h"
 #include "Cursor.h"
+#include "Descriptor.h"
+#include "Heap.h"
+#include "Symbol.h"
 
 typedef enum
 {
@@ -60,7 +64,7 @@ typedef struct
 
 typedef union
 {
-    const char* Utf8;
+    const Symbol* Utf8;
     const int32_t Int;
     const float Float;
     const int64_t Long;
@@ -120,13 +124,70 @@ typedef enum
     MAF_SYNTHETIC    = 0x1000,
 } MethodsAccessFlags;
 
+// Attributes the VM looks for, resolved from the attribute name once when the class is parsed
+typedef enum
+{
+    ATTRIBUTE_UNKNOWN,
+    ATTRIBUTE_CONSTANT_VALUE,
+    ATTRIBUTE_CODE,
+    ATTRIBUTE_STACK_MAP_TABLE,
+    ATTRIBUTE_EXCEPTIONS,
+    ATTRIBUTE_SOURCE_FILE,
+    ATTRIBUTE_LINE_NUMBER_TABLE,
+    ATTRIBUTE_LOCAL_VARIABLE_TABLE,
+} AttributeKind;
+
 typedef struct
 {
     const uint16_t NameIndex;
+    const AttributeKind Kind;
     const uint32_t Length;
     const uint8_t* Data;
 } AttributeInfo;
 
+// Defined by the VM, one per constant pool entry
+typedef struct ResolvedRef ResolvedRef;
+// Defined by the translator
+typedef struct TranslatedCode TranslatedCode;
+// Defined by the profiler
+typedef struct MethodProfile MethodProfile;
+
+typedef struct
+{
+    const uint16_t StartPc;
+    const uint16_t EndPc;
+    const uint16_t HandlerPc;
+    const uint16_t CatchType;
+} ExceptionTableEntry;
+
+typedef struct
+{
+    const FieldsAccessFlags AccessFlags;
+    const uint16_t NameIndex;
+    const uint16_t DescriptorIndex;
+    const uint16_t AttributesCount;
+    const AttributeInfo* Attributes;
+    const Symbol* Name;
+    const Symbol* Descriptor;
+    const ArgumentType Type;
+    // Byte offset of an instance field from the start of the object, static fields have none
+    const uint32_t Offset;
+} FieldInfo;
+
+typedef struct
+{
+    const uint16_t MaxStack;
+    const uint16_t MaxLocals;
+    const uint32_t CodeLength;
+    const uint8_t* Code;
+    const uint16_t ExceptionTableLength;
+    const ExceptionTableEntry* ExceptionTable;
+    const uint16_t AttributesCount;
+    const AttributeInfo* Attributes;
+    // Translated into the internal instruction format the first time the method is invoked
+    const TranslatedCode* Translated;
+} CodeAttribute;
+
 typedef struct
 {
     const MethodsAccessFlags AccessFlags;
@@ -134,8 +195,24 @@ typedef struct
     const uint16_t DescriptorIndex;
     const uint16_t AttributesCount;
     const AttributeInfo* Attributes;
+    const AttributeInfo* CodeInfo;
+    // Decoded from CodeInfo by MethodGetCode the first time the method is invoked
+    const CodeAttribute* Code;
+    const Symbol* Name;
+    const Symbol* Descriptor;
+    // Hash of name and descriptor, used by the class method table
+    const uint32_t Hash;
+    // Runtime profile, attached the first time the method is invoked
+    MethodProfile* Profile;
 } MethodInfo;
 
+// Open addressing table of the class methods keyed on (name, descriptor)
+typedef struct
+{
+    uint32_t Capacity;
+    const MethodInfo** Slots;
+} MethodTable;
+
 typedef struct
 {
     const uint32_t Magic;
@@ -147,18 +224,40 @@ typedef struct
     const uint16_t ThisClass;
     const uint16_t SuperClass;
     // Interfaces NYI
-    // Fields NYI
+    const uint16_t FieldsCount;
+    const FieldInfo* Fields;
     const uint16_t MethodsCount;
     const MethodInfo* Methods;
+    const MethodTable MethodTable;
     const uint16_t AttributesCount;
     const AttributeInfo* Attributes;
+    // Instance fields only, superclasses other than Object aren't supported so none are inherited
+    const ObjectLayout InstanceLayout;
+
+    // Resolution cache indexed like the constant pool, allocated the first time an entry is resolved
+    ResolvedRef* ResolvedRefs;
+
+    // Everything parsed from the class, including the ClassFile itself, is allocated from here
+    Arena Arena;
+    // Set when the ClassFile was created by ClassFileLoad, unmapped on ClassFileDestroy
+    const uint8_t* MappedData;
+    size_t MappedSize;
 } ClassFile;
 
-bool ReadAttributes(AttributeInfo* attributes, const uint16_t count, Cursor* c, const bool copyData);
+// Attributes point into the data the cursor reads, which must outlive the ClassFile
+bool ReadAttributes(const ClassFile* cf, AttributeInfo* attributes, const uint16_t count, Cursor* c);
 
+// The class data must outlive the ClassFile, nothing is copied out of it
 ClassFile* ClassFileCreate(const uint8_t* classData, const size_t size);
+// Maps the class file to memory and creates the ClassFile without copying its attributes
+ClassFile* ClassFileLoad(const char* filePath);
 void ClassFileDestroy(const ClassFile* cf);
+// Linear scan that ignores the descriptor, meant for looking up entry points by name only
 const MethodInfo* FindMethodByName(const ClassFile* cf, const char* name);
-const AttributeInfo* FindAttributeByName(const ClassFile* cf, const AttributeInfo* attributes, const uint16_t count, const char* name);
+const MethodInfo* FindMethod(const ClassFile* cf, const Symbol* name, const Symbol* descriptor);
+const FieldInfo* FindField(const ClassFile* cf, const Symbol* name, const Symbol* descriptor);
+const AttributeInfo* FindAttribute(const AttributeInfo* attributes, const uint16_t count, const AttributeKind kind);
+// Returns NULL if the method has no valid Code attribute
+const CodeAttribute* MethodGetCode(const ClassFile* cf, const MethodInfo* method);
 
 #endif //CLASSFILE_H
@@ -1,7 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 
-#include "cursor.h"
+#include "Cursor.h"
 
 #include <string.h>
 
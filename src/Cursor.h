@@ -1,6 +1,7 @@
 #ifndef CURSOR_H
 #define CURSOR_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
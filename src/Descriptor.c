@@ -0,0 +1,113 @@
+#include "Descriptor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Advances str past the type
+static bool ParseType(const char** str, ArgumentType* type)
+{
+    const char c = *(*str)++;
+    switch (c) {
+        case 'B':
+            *type = TYPE_BYTE;
+            return true;
+        case 'C':
+            *type = TYPE_CHAR;
+            return true;
+        case 'F':
+            *type = TYPE_FLOAT;
+            return true;
+        case 'I':
+            *type = TYPE_INT;
+            return true;
+        case 'S':
+            *type = TYPE_SHORT;
+            return true;
+        case 'Z':
+            *type = TYPE_BOOL;
+            return true;
+        case 'J':
+            *type = TYPE_LONG;
+            return true;
+        case 'D':
+            *type = TYPE_DOUBLE;
+            return true;
+        case 'V':
+            *type = TYPE_VOID;
+            return true;
+        case 'L':
+        {
+            const char* className = *str;
+            while (**str && **str != ';')
+                (*str)++;
+            if (**str != ';') {
+                fprintf(stderr, "Unterminated class name in descriptor\n");
+                return false;
+            }
+            const bool isString = *str - className == 16 && strncmp(className, "java/lang/String", 16) == 0;
+            (*str)++;
+            *type = isString ? TYPE_STRING : TYPE_CLASS_TYPE;
+            return true;
+        }
+        case '[':
+        {
+            // Arrays are references like any other object
+            ArgumentType elementType;
+            if (!ParseType(str, &elementType) || elementType == TYPE_VOID)
+                return false;
+            *type = TYPE_CLASS_TYPE;
+            return true;
+        }
+        default:
+            fprintf(stderr, "Unsupported argument type %c\n", c);
+            return false;
+    }
+}
+
+bool ParseMethodDescriptor(const char* descStr, Descriptor* desc)
+{
+    if (*descStr != '(') {
+        fprintf(stderr, "Descriptor '%s' should start with '('\n", descStr);
+        return false;
+    }
+
+    const char* str = descStr + 1;
+    desc->ParametersCount = 0;
+    while (*str && *str != ')') {
+        if (desc->ParametersCount == METHOD_MAX_PARAMS) {
+            fprintf(stderr, "Descriptor '%s' has more than %d parameters\n", descStr, METHOD_MAX_PARAMS);
+            return false;
+        }
+        ArgumentType* type = &desc->ParameterTypes[desc->ParametersCount++];
+        if (!ParseType(&str, type))
+            return false;
+        if (*type == TYPE_VOID) {
+            fprintf(stderr, "Method parameter can't possibly be of type void!\n");
+            return false;
+        }
+    }
+
+    if (*str++ != ')')
+        return false;
+    return ParseType(&str, &desc->MethodReturnType) && *str == '\0';
+}
+
+bool ParseFieldDescriptor(const char* descStr, ArgumentType* type)
+{
+    return ParseType(&descStr, type) && *type != TYPE_VOID && *descStr == '\0';
+}
+
+uint8_t GetTypeSlots(const ArgumentType type)
+{
+    if (type == TYPE_VOID)
+        return 0;
+    return type == TYPE_LONG || type == TYPE_DOUBLE ? 2 : 1;
+}
+
+uint8_t GetArgumentSlots(const Descriptor* desc)
+{
+    uint8_t slots = 0;
+    for (uint8_t i = 0; i < desc->ParametersCount; i++)
+        slots += GetTypeSlots(desc->ParameterTypes[i]);
+    return slots;
+}
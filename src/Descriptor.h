@@ -0,0 +1,41 @@
+#ifndef DESCRIPTOR_H
+#define DESCRIPTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Types from field and method descriptors
+typedef enum
+{
+    TYPE_VOID,
+    TYPE_CLASS_TYPE,
+    TYPE_STRING,
+    TYPE_BYTE,
+    TYPE_CHAR,
+    TYPE_BOOL,
+    TYPE_SHORT,
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_LONG,
+    TYPE_DOUBLE,
+} ArgumentType;
+
+// If a method has more than 10 you deserve the crash lol
+#define METHOD_MAX_PARAMS 10
+
+typedef struct
+{
+    uint8_t ParametersCount;
+    ArgumentType ParameterTypes[METHOD_MAX_PARAMS];
+    ArgumentType MethodReturnType;
+} Descriptor;
+
+// Return false if the descriptor is malformed or uses something the VM doesn't support
+bool ParseMethodDescriptor(const char* descStr, Descriptor* desc);
+bool ParseFieldDescriptor(const char* descStr, ArgumentType* type);
+
+// Number of 32 bit slots a value takes on the operand stack and in the locals
+uint8_t GetTypeSlots(const ArgumentType type);
+uint8_t GetArgumentSlots(const Descriptor* desc);
+
+#endif //DESCRIPTOR_H
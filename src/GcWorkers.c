@@ -0,0 +1,222 @@
+#include "GcWorkers.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+// Items a deque starts with room for, it doubles whenever it is full
+#define GC_DEQUE_INITIAL_SIZE 1024
+
+typedef struct
+{
+    uint32_t Count;
+    thrd_t Threads[GC_MAX_WORKERS];
+    mtx_t Lock;
+    // Signaled when a task is handed out and when the workers have to exit
+    cnd_t Started;
+    cnd_t Finished;
+    GcTask Task;
+    // Bumped for every task so a worker never runs the same one twice
+    uint64_t Generation;
+    // Workers still running the current task, not counting the thread that handed it out
+    uint32_t Running;
+    bool Exiting;
+    // The locks only exist with more than one worker
+    bool Initialized;
+} GcWorkers;
+
+static GcWorkers WORKERS = { .Count = 1 };
+
+static int WorkerMain(void* argument)
+{
+    const uint32_t worker = (uint32_t)(uintptr_t)argument;
+    uint64_t generation = 0;
+    mtx_lock(&WORKERS.Lock);
+    for (;;) {
+        while (WORKERS.Generation == generation && !WORKERS.Exiting)
+            cnd_wait(&WORKERS.Started, &WORKERS.Lock);
+        if (WORKERS.Exiting)
+            break;
+
+        generation = WORKERS.Generation;
+        const GcTask task = WORKERS.Task;
+        mtx_unlock(&WORKERS.Lock);
+        task(worker);
+        mtx_lock(&WORKERS.Lock);
+        if (--WORKERS.Running == 0)
+            cnd_signal(&WORKERS.Finished);
+    }
+    mtx_unlock(&WORKERS.Lock);
+    return 0;
+}
+
+bool GcWorkersInit(const uint32_t workerCount)
+{
+    assert(workerCount >= 1 && workerCount <= GC_MAX_WORKERS);
+    WORKERS.Count = 1;
+    if (workerCount == 1)
+        return true;
+
+    if (mtx_init(&WORKERS.Lock, mtx_plain) != thrd_success || cnd_init(&WORKERS.Started) != thrd_success ||
+        cnd_init(&WORKERS.Finished) != thrd_success) {
+        fprintf(stderr, "Failed to create the GC worker locks\n");
+        return false;
+    }
+    WORKERS.Initialized = true;
+    for (uint32_t i = 1; i < workerCount; i++) {
+        if (thrd_create(&WORKERS.Threads[i], WorkerMain, (void*)(uintptr_t)i) != thrd_success) {
+            fprintf(stderr, "Failed to start GC worker %u\n", i);
+            GcWorkersDestroy();
+            return false;
+        }
+        WORKERS.Count++;
+    }
+    return true;
+}
+
+void GcWorkersDestroy(void)
+{
+    if (WORKERS.Initialized) {
+        mtx_lock(&WORKERS.Lock);
+        WORKERS.Exiting = true;
+        cnd_broadcast(&WORKERS.Started);
+        mtx_unlock(&WORKERS.Lock);
+        for (uint32_t i = 1; i < WORKERS.Count; i++)
+            thrd_join(WORKERS.Threads[i], NULL);
+        cnd_destroy(&WORKERS.Started);
+        cnd_destroy(&WORKERS.Finished);
+        mtx_destroy(&WORKERS.Lock);
+    }
+    WORKERS = (GcWorkers){ .Count = 1 };
+}
+
+uint32_t GcWorkersGetCount(void)
+{
+    return WORKERS.Count;
+}
+
+void GcWorkersRun(const GcTask task)
+{
+    if (WORKERS.Count == 1) {
+        task(0);
+        return;
+    }
+
+    mtx_lock(&WORKERS.Lock);
+    WORKERS.Task = task;
+    WORKERS.Generation++;
+    WORKERS.Running = WORKERS.Count - 1;
+    cnd_broadcast(&WORKERS.Started);
+    mtx_unlock(&WORKERS.Lock);
+
+    task(0);
+
+    mtx_lock(&WORKERS.Lock);
+    while (WORKERS.Running > 0)
+        cnd_wait(&WORKERS.Finished, &WORKERS.Lock);
+    mtx_unlock(&WORKERS.Lock);
+}
+
+static GcDequeArray* NewDequeArray(const int64_t size)
+{
+    GcDequeArray* array = malloc(sizeof(GcDequeArray) + (size_t)size * sizeof(_Atomic uint32_t));
+    assert(array && "Out of RAM");
+    array->Size = size;
+    array->Previous = NULL;
+    return array;
+}
+
+void GcDequeInit(GcDeque* deque)
+{
+    atomic_init(&deque->Top, 0);
+    atomic_init(&deque->Bottom, 0);
+    atomic_init(&deque->Array, NewDequeArray(GC_DEQUE_INITIAL_SIZE));
+}
+
+void GcDequeDestroy(GcDeque* deque)
+{
+    if (!atomic_load_explicit(&deque->Array, memory_order_relaxed))
+        return;
+    GcDequeReset(deque);
+    free(atomic_load_explicit(&deque->Array, memory_order_relaxed));
+    atomic_store_explicit(&deque->Array, NULL, memory_order_relaxed);
+}
+
+void GcDequeReset(GcDeque* deque)
+{
+    GcDequeArray* array = atomic_load_explicit(&deque->Array, memory_order_relaxed);
+    for (GcDequeArray* previous = array->Previous; previous;) {
+        GcDequeArray* next = previous->Previous;
+        free(previous);
+        previous = next;
+    }
+    array->Previous = NULL;
+}
+
+// The orderings follow "Correct and Efficient Work-Stealing for Weak Memory Models" by Lê, Pop, Cohen and Zappa Nardelli
+void GcDequePush(GcDeque* deque, const uint32_t reference)
+{
+    const int64_t bottom = atomic_load_explicit(&deque->Bottom, memory_order_relaxed);
+    const int64_t top = atomic_load_explicit(&deque->Top, memory_order_acquire);
+    GcDequeArray* array = atomic_load_explicit(&deque->Array, memory_order_relaxed);
+    if (bottom - top > array->Size - 1) {
+        GcDequeArray* grown = NewDequeArray(array->Size * 2);
+        for (int64_t i = top; i < bottom; i++) {
+            const uint32_t item = atomic_load_explicit(&array->Items[i % array->Size], memory_order_relaxed);
+            atomic_store_explicit(&grown->Items[i % grown->Size], item, memory_order_relaxed);
+        }
+        grown->Previous = array;
+        atomic_store_explicit(&deque->Array, grown, memory_order_release);
+        array = grown;
+    }
+    atomic_store_explicit(&array->Items[bottom % array->Size], reference, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->Bottom, bottom + 1, memory_order_relaxed);
+}
+
+uint32_t GcDequeTake(GcDeque* deque)
+{
+    const int64_t bottom = atomic_load_explicit(&deque->Bottom, memory_order_relaxed) - 1;
+    GcDequeArray* array = atomic_load_explicit(&deque->Array, memory_order_relaxed);
+    atomic_store_explicit(&deque->Bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->Top, memory_order_relaxed);
+    if (top > bottom) {
+        atomic_store_explicit(&deque->Bottom, bottom + 1, memory_order_relaxed);
+        return GC_DEQUE_EMPTY;
+    }
+
+    uint32_t reference = atomic_load_explicit(&array->Items[bottom % array->Size], memory_order_relaxed);
+    if (top == bottom) {
+        // Last item, a thief may be taking it too
+        if (!atomic_compare_exchange_strong_explicit(&deque->Top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+            reference = GC_DEQUE_EMPTY;
+        atomic_store_explicit(&deque->Bottom, bottom + 1, memory_order_relaxed);
+    }
+    return reference;
+}
+
+bool GcDequeSteal(GcDeque* deque, uint32_t* reference)
+{
+    *reference = GC_DEQUE_EMPTY;
+    int64_t top = atomic_load_explicit(&deque->Top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const int64_t bottom = atomic_load_explicit(&deque->Bottom, memory_order_acquire);
+    if (top >= bottom)
+        return true;
+
+    GcDequeArray* array = atomic_load_explicit(&deque->Array, memory_order_acquire);
+    const uint32_t item = atomic_load_explicit(&array->Items[top % array->Size], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->Top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        return false;
+    *reference = item;
+    return true;
+}
+
+bool GcDequeIsEmpty(GcDeque* deque)
+{
+    const int64_t top = atomic_load_explicit(&deque->Top, memory_order_acquire);
+    const int64_t bottom = atomic_load_explicit(&deque->Bottom, memory_order_acquire);
+    return top >= bottom;
+}
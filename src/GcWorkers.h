@@ -0,0 +1,54 @@
+#ifndef GC_WORKERS_H
+#define GC_WORKERS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Threads the collector splits the work of full collections across, along with the work stealing deques they share
+// objects to scan through. The thread that collects is always worker 0, the pool only holds the others
+
+#define GC_MAX_WORKERS 64
+
+// Returned by GcDequeTake and GcDequeSteal, null is never pushed
+#define GC_DEQUE_EMPTY 0
+
+typedef struct GcDequeArray
+{
+    int64_t Size;
+    // Outgrown arrays are kept until the deque is reset, a thief may still be reading one
+    struct GcDequeArray* Previous;
+    _Atomic uint32_t Items[];
+} GcDequeArray;
+
+// Chase-Lev deque of object references. Its owner pushes and takes at the bottom, any other worker steals from the top
+typedef struct
+{
+    _Atomic int64_t Top;
+    _Atomic int64_t Bottom;
+    _Atomic(GcDequeArray*) Array;
+} GcDeque;
+
+// Runs on every worker, worker being its index
+typedef void (*GcTask)(uint32_t worker);
+
+// Starts workerCount - 1 threads, false if one couldn't be started
+bool GcWorkersInit(uint32_t workerCount);
+void GcWorkersDestroy(void);
+uint32_t GcWorkersGetCount(void);
+// Runs the task on every worker, the calling thread being worker 0, and returns once all of them finished it
+void GcWorkersRun(GcTask task);
+
+void GcDequeInit(GcDeque* deque);
+// Does nothing if the deque was never initialized
+void GcDequeDestroy(GcDeque* deque);
+// Frees the arrays the deque outgrew, only while no other worker can steal from it
+void GcDequeReset(GcDeque* deque);
+// Owner only
+void GcDequePush(GcDeque* deque, uint32_t reference);
+uint32_t GcDequeTake(GcDeque* deque);
+// Any worker. False if it lost a race with another thread, the deque may still have work then
+bool GcDequeSteal(GcDeque* deque, uint32_t* reference);
+bool GcDequeIsEmpty(GcDeque* deque);
+
+#endif //GC_WORKERS_H
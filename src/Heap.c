@@ -0,0 +1,1325 @@
+#include "Heap.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "GcWorkers.h"
+#include "Utils.h"
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+// Bump allocated part of the heap, as offsets from its start
+typedef struct
+{
+    size_t Start;
+    size_t End;
+    size_t Top;
+} Space;
+
+// Full collections split the compacted spaces into chunks the GC workers claim one at a time
+#define HEAP_CHUNK_SIZE (256 * 1024)
+
+typedef struct
+{
+    // Range of blocks of a single space, End being at most the space's top
+    size_t Start;
+    size_t End;
+    // End of the last live object starting in the chunk, which may be past End. Start if there is none
+    size_t LiveEnd;
+    size_t LiveBytes;
+    // Where its first live object moves to
+    size_t Destination;
+    // Highest LiveEnd of this chunk and the ones before it
+    size_t Reach;
+    // Set once its objects moved out of the way
+    _Atomic bool Moved;
+} CompactionChunk;
+
+// Pauses are counted in buckets by how many microseconds they took, bucket i holding those under 2^i
+#define HEAP_PAUSE_BUCKETS 24
+
+typedef enum
+{
+    PAUSE_YOUNG,
+    // Young collection that also took the snapshot a concurrent mark starts from
+    PAUSE_INITIAL_MARK,
+    // Finishes a concurrent mark and compacts
+    PAUSE_REMARK,
+    PAUSE_FULL,
+    PAUSE_KIND_COUNT,
+} PauseKind;
+
+static const char* PAUSE_NAMES[PAUSE_KIND_COUNT] = { "young", "initial-mark", "remark", "full" };
+
+typedef struct
+{
+    uint64_t Count;
+    double TotalMs;
+    double MaxMs;
+    uint64_t Buckets[HEAP_PAUSE_BUCKETS];
+} PauseHistogram;
+
+// Entries the barrier logs on a thread before handing them to the marker
+#define HEAP_SATB_BUFFER_SIZE 256
+// Objects the marker scans between checks for logged entries and aborts
+#define HEAP_MARK_STEP 1024
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Items[HEAP_SATB_BUFFER_SIZE];
+} SatbBuffer;
+
+typedef enum
+{
+    // No concurrent mark running, the barrier is off
+    MARKER_IDLE,
+    MARKER_MARKING,
+    // Out of work, the next allocation slow path finishes the cycle with a remark pause
+    MARKER_DONE,
+    // A full collection is waiting for the marker to give up the cycle
+    MARKER_ABORTING,
+} MarkerState;
+
+// Background thread that marks the old objects reachable from the snapshot taken when a cycle starts. Only old objects
+// below Top are marked, everything allocated or promoted during the cycle ends up above it or in the nursery and is
+// taken as live by the remark
+typedef struct
+{
+    thrd_t Thread;
+    bool Started;
+    bool Exiting;
+    mtx_t Lock;
+    cnd_t Wake;
+    cnd_t Stopped;
+    // Changed under Lock only
+    _Atomic uint32_t State;
+    size_t Top;
+    // Marked objects yet to be scanned. The marker owns it while MARKING, the thread collecting otherwise
+    struct
+    {
+        uint32_t Count;
+        uint32_t Capacity;
+        uint32_t* Items;
+    } Stack;
+    // Entries the barrier logged, handed over in buffers under Lock
+    struct
+    {
+        uint32_t Count;
+        uint32_t Capacity;
+        uint32_t* Items;
+    } Logged;
+} ConcurrentMarker;
+
+typedef struct
+{
+    size_t Size;
+    Space Old;
+    // Permanent objects take the end of the old generation, from here to Old.End
+    size_t PermanentBottom;
+    Space Eden;
+    Space Survivors[2];
+    // Survivor space the survivors of the last young collection are in, the other one is empty
+    uint8_t From;
+    uint32_t TenuringThreshold;
+    bool PrintGC;
+    bool PrintStatistics;
+    HeapRootEnumerator EnumerateRoots;
+    PauseHistogram Pauses[PAUSE_KIND_COUNT];
+
+    bool ConcurrentMark;
+    uint32_t InitiatingOccupancyPercent;
+    ConcurrentMarker Marker;
+
+    // Old object that covers the first byte of every card, dirty cards are walked from it
+    uint32_t* CardObjects;
+    // One bit for every HEAP_OBJECT_ALIGNMENT bytes, full collections set the bit of every live object's start
+    _Atomic uint64_t* MarkBits;
+    // Reference full collections move the first live object that starts in every card sized block to
+    uint32_t* BlockDestinations;
+    // Objects each GC worker marked and has yet to scan
+    GcDeque Deques[GC_MAX_WORKERS];
+    // Workers still marking or looking for objects to steal
+    _Atomic uint32_t ActiveMarkers;
+    CompactionChunk* Chunks;
+    uint32_t ChunkCount;
+    // Next chunk a worker claims during a compaction phase
+    _Atomic uint32_t NextChunk;
+
+    uint32_t LayoutCount;
+
+    // Allocation buffers of every thread that allocated, all of them are retired before collecting
+    Tlab* Tlabs;
+    // Taken by the slow paths, which are the only ones that change the heap's state
+    atomic_flag Lock;
+} Heap;
+
+static Heap HEAP = { .Lock = ATOMIC_FLAG_INIT };
+uint8_t* HEAP_BASE = NULL;
+uint8_t* HEAP_CARDS = NULL;
+const ObjectLayout** HEAP_LAYOUTS = NULL;
+_Thread_local Tlab THREAD_TLAB = { 0 };
+_Atomic bool HEAP_MARKING = false;
+static _Thread_local SatbBuffer THREAD_SATB = { 0 };
+// Xorshift state identity hashes are drawn from
+static _Thread_local uint32_t THREAD_HASH_SEED = 0x2545F491;
+
+static void LockHeap(void)
+{
+    while (atomic_flag_test_and_set_explicit(&HEAP.Lock, memory_order_acquire))
+        ;
+}
+
+static void UnlockHeap(void)
+{
+    atomic_flag_clear_explicit(&HEAP.Lock, memory_order_release);
+}
+
+static size_t AlignDown(const size_t value, const size_t alignment)
+{
+    return value & ~(alignment - 1);
+}
+
+static inline bool IsPermanent(const uint32_t reference)
+{
+    const size_t object = HeapGetOffset(reference);
+    return object >= HEAP.PermanentBottom && object < HEAP.Old.End;
+}
+
+static inline bool IsYoung(const uint32_t reference)
+{
+    return HeapGetOffset(reference) >= HEAP.Eden.Start;
+}
+
+// Bytes an object of the layout takes, length being the number of elements of an array
+static inline uint32_t GetSize(const ObjectLayout* layout, const uint32_t length)
+{
+    return layout->ElementSize ? HeapGetArraySize(layout, length) : layout->InstanceSize;
+}
+
+static inline uint32_t GetObjectSize(const size_t object)
+{
+    const uint32_t reference = HeapGetReference(object);
+    const ObjectLayout* layout = HeapGetLayout(reference);
+    return layout->ElementSize ? HeapGetArraySize(layout, HeapGetArrayLength(reference)) : layout->InstanceSize;
+}
+
+// Elements of the array of references, none for any other object
+static inline uint32_t GetReferenceElementCount(const ObjectLayout* layout, const uint32_t object)
+{
+    return layout->ReferenceElements ? HeapGetArrayLength(object) : 0;
+}
+
+static inline uint32_t GetElementOffset(const uint32_t index)
+{
+    return HEAP_ARRAY_DATA_OFFSET + index * (uint32_t)sizeof(uint32_t);
+}
+
+static inline uint32_t* GetField(const uint32_t object, const uint32_t offset)
+{
+    return (uint32_t*)((uint8_t*)HeapGetObject(object) + offset);
+}
+
+static size_t GetUsed(void)
+{
+    const Space* from = &HEAP.Survivors[HEAP.From];
+    return (HEAP.Old.Top - HEAP.Old.Start) + (HEAP.Old.End - HEAP.PermanentBottom) + (HEAP.Eden.Top - HEAP.Eden.Start)
+        + (from->Top - from->Start);
+}
+
+static double GetTime(void)
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Counts the pause and prints it with PrintGC
+static void FinishPause(const PauseKind kind, const bool failed, const size_t usedBefore, const double start)
+{
+    const double ms = (GetTime() - start) * 1000;
+    PauseHistogram* histogram = &HEAP.Pauses[kind];
+    histogram->Count++;
+    histogram->TotalMs += ms;
+    histogram->MaxMs = ms > histogram->MaxMs ? ms : histogram->MaxMs;
+    uint32_t bucket = 0;
+    for (uint64_t us = (uint64_t)(ms * 1000); us > 0 && bucket < HEAP_PAUSE_BUCKETS - 1; us >>= 1)
+        bucket++;
+    histogram->Buckets[bucket]++;
+
+    if (HEAP.PrintGC) {
+        printf("[GC %s%s %zuK->%zuK(%zuK), %.3f ms]\n", PAUSE_NAMES[kind], failed ? " (failed)" : "", usedBefore / 1024,
+            GetUsed() / 1024, HEAP.Size / 1024, ms);
+    }
+}
+
+// Upper bound of the bucket the fraction of the pauses fall under, in milliseconds
+static double GetPercentile(const PauseHistogram* histogram, const double fraction)
+{
+    const double target = fraction * (double)histogram->Count;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < HEAP_PAUSE_BUCKETS; i++) {
+        count += histogram->Buckets[i];
+        if ((double)count >= target)
+            return (double)((uint64_t)1 << i) / 1000;
+    }
+    return histogram->MaxMs;
+}
+
+static void PrintStatistics(void)
+{
+    printf("GC pauses        count    total ms      max ms   p50 < ms   p99 < ms\n");
+    for (uint32_t kind = 0; kind < PAUSE_KIND_COUNT; kind++) {
+        const PauseHistogram* histogram = &HEAP.Pauses[kind];
+        if (histogram->Count == 0)
+            continue;
+        printf("  %-12s %7llu %11.3f %11.3f %10.3f %10.3f\n", PAUSE_NAMES[kind], (unsigned long long)histogram->Count,
+            histogram->TotalMs, histogram->MaxMs, GetPercentile(histogram, 0.5), GetPercentile(histogram, 0.99));
+    }
+
+    printf("Pause histogram ");
+    for (uint32_t kind = 0; kind < PAUSE_KIND_COUNT; kind++)
+        printf(" %12s", PAUSE_NAMES[kind]);
+    printf("\n");
+    for (uint32_t i = 0; i < HEAP_PAUSE_BUCKETS; i++) {
+        uint64_t total = 0;
+        for (uint32_t kind = 0; kind < PAUSE_KIND_COUNT; kind++)
+            total += HEAP.Pauses[kind].Buckets[i];
+        if (total == 0)
+            continue;
+        printf("  < %9.3f ms ", (double)((uint64_t)1 << i) / 1000);
+        for (uint32_t kind = 0; kind < PAUSE_KIND_COUNT; kind++)
+            printf(" %12llu", (unsigned long long)HEAP.Pauses[kind].Buckets[i]);
+        printf("\n");
+    }
+}
+
+static inline uint32_t CountTrailingZeros(const uint64_t bits)
+{
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_ctzll(bits);
+#else
+    uint32_t count = 0;
+    while (!(bits & ((uint64_t)1 << count)))
+        count++;
+    return count;
+#endif
+}
+
+// Cards whose first byte the object covers start their walk at it
+static void RecordOldObject(const size_t start, const size_t size)
+{
+    for (size_t card = (start + HEAP_CARD_SIZE - 1) >> HEAP_CARD_SHIFT; (card << HEAP_CARD_SHIFT) < start + size; card++)
+        HEAP.CardObjects[card] = HeapGetReference(start);
+}
+
+// Start of size bytes at the top of the old generation, 0 when it is full
+static size_t AllocateOld(const size_t size)
+{
+    if (HEAP.PermanentBottom - HEAP.Old.Top < size)
+        return 0;
+    const size_t start = HEAP.Old.Top;
+    HEAP.Old.Top += size;
+    RecordOldObject(start, size);
+    return start;
+}
+
+static uint32_t InitObject(const size_t start, const ObjectLayout* layout, const uint32_t length)
+{
+    memset(HEAP_BASE + start, 0, GetSize(layout, length));
+    ((ObjectHeader*)(HEAP_BASE + start))->Word = (uint64_t)layout->Index << HEAP_HEADER_LAYOUT_SHIFT;
+    if (layout->ElementSize)
+        *(uint32_t*)(HEAP_BASE + start + HEAP_ARRAY_LENGTH_OFFSET) = length;
+    return HeapGetReference(start);
+}
+
+static void RetireTlabs(void)
+{
+    for (Tlab* tlab = HEAP.Tlabs; tlab; tlab = tlab->Next) {
+        tlab->Top = NULL;
+        tlab->End = NULL;
+    }
+}
+
+// Survivors copied by this collection are in the to space, which is young but not collected
+static inline bool IsInCollectionSet(const uint32_t reference)
+{
+    const Space* to = &HEAP.Survivors[HEAP.From ^ 1];
+    const size_t object = HeapGetOffset(reference);
+    return IsYoung(reference) && (object < to->Start || object >= to->End);
+}
+
+// Copies the young object the reference points to into the to space, or into the old generation once it is old
+// enough or the to space is full. The old copy is left forwarding to the new one
+static void EvacuateReference(uint32_t* reference, void* context)
+{
+    (void)context;
+    if (!IsInCollectionSet(*reference))
+        return;
+
+    ObjectHeader* header = HeapGetObject(*reference);
+    const uint64_t word = header->Word;
+    if (word & HEAP_HEADER_FORWARDED) {
+        *reference = (uint32_t)(word >> HEAP_HEADER_LAYOUT_SHIFT);
+        return;
+    }
+
+    const size_t size = GetObjectSize(HeapGetOffset(*reference));
+    const uint32_t age = (uint32_t)((word & HEAP_HEADER_AGE_MASK) >> HEAP_HEADER_AGE_SHIFT) + 1;
+    Space* to = &HEAP.Survivors[HEAP.From ^ 1];
+    size_t target;
+    // The copy keeps the identity hash
+    uint64_t targetWord = word & ~HEAP_HEADER_AGE_MASK;
+    if (age < HEAP.TenuringThreshold && to->End - to->Top >= size) {
+        target = to->Top;
+        to->Top += size;
+        targetWord |= (uint64_t)age << HEAP_HEADER_AGE_SHIFT;
+    } else {
+        // Young collections only run when the old generation can take the whole nursery
+        target = AllocateOld(size);
+        assert(target && "Old generation full while promoting");
+    }
+
+    memcpy(HEAP_BASE + target, header, size);
+    ((ObjectHeader*)(HEAP_BASE + target))->Word = targetWord;
+    *reference = HeapGetReference(target);
+    header->Word = ((uint64_t)*reference << HEAP_HEADER_LAYOUT_SHIFT) | HEAP_HEADER_FORWARDED;
+}
+
+static inline void ScanYoungField(const uint32_t object, const uint32_t offset, const bool old)
+{
+    uint32_t* field = GetField(object, offset);
+    EvacuateReference(field, NULL);
+    if (old && IsYoung(*field))
+        HeapWriteBarrier(object, offset);
+}
+
+// Evacuates what the reference fields of the object in [from, to) point to. Old objects still pointing to young ones
+// after it get their card dirtied again for the next young collection
+static void ScanYoungReferences(const uint32_t object, const size_t from, const size_t to)
+{
+    const ObjectLayout* layout = HeapGetLayout(object);
+    const bool old = !IsYoung(object);
+    for (uint16_t i = 0; i < layout->ReferenceFieldCount; i++) {
+        const uint32_t offset = layout->ReferenceFieldOffsets[i];
+        if (HeapGetOffset(object) + offset < from || HeapGetOffset(object) + offset >= to)
+            continue;
+        ScanYoungField(object, offset, old);
+    }
+
+    // Only the elements in the range, a large array spans many cards
+    const uint32_t count = GetReferenceElementCount(layout, object);
+    if (count == 0)
+        return;
+    const size_t elements = HeapGetOffset(object) + HEAP_ARRAY_DATA_OFFSET;
+    const size_t first = from > elements ? (from - elements) / sizeof(uint32_t) : 0;
+    const size_t end = to > elements ? (to - elements + sizeof(uint32_t) - 1) / sizeof(uint32_t) : 0;
+    for (size_t i = first; i < end && i < count; i++)
+        ScanYoungField(object, GetElementOffset((uint32_t)i), old);
+}
+
+// Old objects are laid out back to back, so a card's objects are found by walking from the one covering its start
+static void ScanDirtyCards(const size_t oldTop)
+{
+    for (size_t card = HEAP.Old.Start >> HEAP_CARD_SHIFT; (card << HEAP_CARD_SHIFT) < oldTop; card++) {
+        // Most cards are clean, they are skipped eight at a time
+        uint64_t cards;
+        if (card % 8 == 0 && ((card + 8) << HEAP_CARD_SHIFT) <= oldTop) {
+            memcpy(&cards, &HEAP_CARDS[card], sizeof(cards));
+            if (cards == 0) {
+                card += 7;
+                continue;
+            }
+        }
+        if (HEAP_CARDS[card] == HEAP_CARD_CLEAN)
+            continue;
+
+        HEAP_CARDS[card] = HEAP_CARD_CLEAN;
+        const size_t cardStart = card << HEAP_CARD_SHIFT;
+        const size_t cardEnd = cardStart + HEAP_CARD_SIZE;
+        for (size_t object = HeapGetOffset(HEAP.CardObjects[card]); object < cardEnd && object < oldTop;
+             object += GetObjectSize(object))
+            ScanYoungReferences(HeapGetReference(object), cardStart, cardEnd);
+    }
+}
+
+// Copies everything reachable in eden and the from space out of them, breadth first. The objects copied are the queue,
+// both the ones in the to space and the ones promoted to the top of the old generation
+static void CollectYoung(void)
+{
+    Space* from = &HEAP.Survivors[HEAP.From];
+    Space* to = &HEAP.Survivors[HEAP.From ^ 1];
+    assert(to->Top == to->Start && "To space not empty");
+    const size_t oldTop = HEAP.Old.Top;
+
+    HEAP.EnumerateRoots(EvacuateReference, NULL);
+    ScanDirtyCards(oldTop);
+
+    size_t survivor = to->Start;
+    size_t promoted = oldTop;
+    while (survivor < to->Top || promoted < HEAP.Old.Top) {
+        for (; survivor < to->Top; survivor += GetObjectSize(survivor))
+            ScanYoungReferences(HeapGetReference(survivor), 0, SIZE_MAX);
+        for (; promoted < HEAP.Old.Top; promoted += GetObjectSize(promoted))
+            ScanYoungReferences(HeapGetReference(promoted), 0, SIZE_MAX);
+    }
+
+    HEAP.Eden.Top = HEAP.Eden.Start;
+    from->Top = from->Start;
+    HEAP.From ^= 1;
+}
+
+static inline uint64_t LoadMarkBits(const size_t block)
+{
+    return atomic_load_explicit(&HEAP.MarkBits[block], memory_order_relaxed);
+}
+
+// Every block has a word of mark bits, one for each reference in it
+static inline bool IsMarked(const uint32_t reference)
+{
+    return (LoadMarkBits(HeapGetOffset(reference) >> HEAP_CARD_SHIFT) >> (reference % 64)) & 1;
+}
+
+// True if the object wasn't marked yet. Workers race to mark the same object, only one of them wins
+static inline bool TryMark(const uint32_t reference)
+{
+    if (!reference || IsPermanent(reference))
+        return false;
+    _Atomic uint64_t* bits = &HEAP.MarkBits[HeapGetOffset(reference) >> HEAP_CARD_SHIFT];
+    const uint64_t bit = (uint64_t)1 << (reference % 64);
+    if (atomic_load_explicit(bits, memory_order_relaxed) & bit)
+        return false;
+    return !(atomic_fetch_or_explicit(bits, bit, memory_order_relaxed) & bit);
+}
+
+// Hands the roots out to the workers' deques in turn
+static void MarkRoot(uint32_t* reference, void* context)
+{
+    uint32_t* worker = context;
+    if (!TryMark(*reference))
+        return;
+    GcDequePush(&HEAP.Deques[*worker], *reference);
+    *worker = (*worker + 1) % GcWorkersGetCount();
+}
+
+static uint32_t StealMarkWork(const uint32_t worker)
+{
+    const uint32_t count = GcWorkersGetCount();
+    for (uint32_t i = 1; i < count; i++) {
+        GcDeque* victim = &HEAP.Deques[(worker + i) % count];
+        uint32_t object;
+        while (!GcDequeSteal(victim, &object))
+            ;
+        if (object != GC_DEQUE_EMPTY)
+            return object;
+    }
+    return GC_DEQUE_EMPTY;
+}
+
+static bool HasMarkWork(void)
+{
+    for (uint32_t i = 0; i < GcWorkersGetCount(); i++) {
+        if (!GcDequeIsEmpty(&HEAP.Deques[i]))
+            return true;
+    }
+    return false;
+}
+
+// Scans the objects of the worker's own deque and steals from the others once it is empty. Only workers with work
+// push, so marking is over once all of them are out of it at the same time
+static void MarkTask(const uint32_t worker)
+{
+    GcDeque* deque = &HEAP.Deques[worker];
+    for (;;) {
+        uint32_t object;
+        while ((object = GcDequeTake(deque)) != GC_DEQUE_EMPTY || (object = StealMarkWork(worker)) != GC_DEQUE_EMPTY) {
+            const ObjectLayout* layout = HeapGetLayout(object);
+            for (uint16_t i = 0; i < layout->ReferenceFieldCount; i++) {
+                const uint32_t field = *GetField(object, layout->ReferenceFieldOffsets[i]);
+                if (TryMark(field))
+                    GcDequePush(deque, field);
+            }
+            const uint32_t* elements = HeapGetArrayData(object);
+            for (uint32_t i = 0, count = GetReferenceElementCount(layout, object); i < count; i++) {
+                if (TryMark(elements[i]))
+                    GcDequePush(deque, elements[i]);
+            }
+        }
+
+        atomic_fetch_sub(&HEAP.ActiveMarkers, 1);
+        for (;;) {
+            if (atomic_load(&HEAP.ActiveMarkers) == 0)
+                return;
+            if (HasMarkWork()) {
+                atomic_fetch_add(&HEAP.ActiveMarkers, 1);
+                break;
+            }
+            thrd_yield();
+        }
+    }
+}
+
+static void MarkLive(void)
+{
+    uint32_t worker = 0;
+    HEAP.EnumerateRoots(MarkRoot, &worker);
+    atomic_store(&HEAP.ActiveMarkers, GcWorkersGetCount());
+    GcWorkersRun(MarkTask);
+    for (uint32_t i = 0; i < GcWorkersGetCount(); i++)
+        GcDequeReset(&HEAP.Deques[i]);
+}
+
+// Spaces full collections compact, in address order so objects only ever move down
+#define COMPACTED_SPACE_COUNT 3
+
+static void GetCompactedSpaces(Space* spaces[COMPACTED_SPACE_COUNT])
+{
+    spaces[0] = &HEAP.Old;
+    spaces[1] = &HEAP.Eden;
+    spaces[2] = &HEAP.Survivors[HEAP.From];
+}
+
+// Splits the used part of the compacted spaces into chunks, in address order
+static void BuildChunks(void)
+{
+    Space* spaces[COMPACTED_SPACE_COUNT];
+    GetCompactedSpaces(spaces);
+    HEAP.ChunkCount = 0;
+    for (uint32_t s = 0; s < COMPACTED_SPACE_COUNT; s++) {
+        // Chunks start on a block, the old generation starts right after null
+        for (size_t start = AlignDown(spaces[s]->Start, HEAP_CARD_SIZE); start < spaces[s]->Top; start += HEAP_CHUNK_SIZE) {
+            CompactionChunk* chunk = &HEAP.Chunks[HEAP.ChunkCount++];
+            chunk->Start = start;
+            chunk->End = spaces[s]->Top - start < HEAP_CHUNK_SIZE ? spaces[s]->Top : start + HEAP_CHUNK_SIZE;
+            atomic_init(&chunk->Moved, false);
+        }
+    }
+}
+
+static CompactionChunk* ClaimChunk(void)
+{
+    const uint32_t index = atomic_fetch_add_explicit(&HEAP.NextChunk, 1, memory_order_relaxed);
+    return index < HEAP.ChunkCount ? &HEAP.Chunks[index] : NULL;
+}
+
+// Runs the task on every worker, which claim chunks in address order until there are none left
+static void RunChunkTask(const GcTask task)
+{
+    atomic_store(&HEAP.NextChunk, 0);
+    GcWorkersRun(task);
+}
+
+static inline size_t GetMarkedObject(const size_t block, const uint64_t bits)
+{
+    return (block << HEAP_CARD_SHIFT) + CountTrailingZeros(bits) * HEAP_OBJECT_ALIGNMENT;
+}
+
+static void SummarizeTask(const uint32_t worker)
+{
+    (void)worker;
+    for (CompactionChunk* chunk; (chunk = ClaimChunk());) {
+        chunk->LiveBytes = 0;
+        chunk->LiveEnd = chunk->Start;
+        for (size_t block = chunk->Start >> HEAP_CARD_SHIFT; (block << HEAP_CARD_SHIFT) < chunk->End; block++) {
+            for (uint64_t bits = LoadMarkBits(block); bits; bits &= bits - 1) {
+                const size_t object = GetMarkedObject(block, bits);
+                const uint32_t size = GetObjectSize(object);
+                chunk->LiveBytes += size;
+                chunk->LiveEnd = object + size;
+            }
+        }
+    }
+}
+
+// Gives every chunk the address its first live object moves to, returns where the last one ends
+static size_t ComputeDestinations(void)
+{
+    RunChunkTask(SummarizeTask);
+    size_t destination = HEAP.Old.Start;
+    size_t reach = 0;
+    for (uint32_t i = 0; i < HEAP.ChunkCount; i++) {
+        CompactionChunk* chunk = &HEAP.Chunks[i];
+        chunk->Destination = destination;
+        destination += chunk->LiveBytes;
+        reach = chunk->LiveEnd > reach ? chunk->LiveEnd : reach;
+        chunk->Reach = reach;
+    }
+    return destination;
+}
+
+// Gives every block the address its first live object moves to
+static void BlockDestinationTask(const uint32_t worker)
+{
+    (void)worker;
+    for (CompactionChunk* chunk; (chunk = ClaimChunk());) {
+        size_t destination = chunk->Destination;
+        for (size_t block = chunk->Start >> HEAP_CARD_SHIFT; (block << HEAP_CARD_SHIFT) < chunk->End; block++) {
+            HEAP.BlockDestinations[block] = HeapGetReference(destination);
+            for (uint64_t bits = LoadMarkBits(block); bits; bits &= bits - 1)
+                destination += GetObjectSize(GetMarkedObject(block, bits));
+        }
+    }
+}
+
+// Where the live object moves to, its block's destination plus the size of the live objects before it in the block.
+// Only valid until objects start moving, since it reads their headers
+static uint32_t Forward(const uint32_t reference)
+{
+    if (!reference || IsPermanent(reference))
+        return reference;
+    assert(IsMarked(reference) && "Forwarding a dead object");
+
+    const size_t block = HeapGetOffset(reference) >> HEAP_CARD_SHIFT;
+    size_t destination = HeapGetOffset(HEAP.BlockDestinations[block]);
+    const uint64_t below = ((uint64_t)1 << (reference % 64)) - 1;
+    for (uint64_t bits = LoadMarkBits(block) & below; bits; bits &= bits - 1)
+        destination += GetObjectSize(GetMarkedObject(block, bits));
+    return HeapGetReference(destination);
+}
+
+static void UpdateReference(uint32_t* reference, void* context)
+{
+    (void)context;
+    *reference = Forward(*reference);
+}
+
+// Objects a concurrent cycle took as live without tracing them may point to dead ones, but then nothing reaches them
+// either
+static inline void UpdateField(uint32_t* field)
+{
+    *field = *field && !IsPermanent(*field) && !IsMarked(*field) ? 0 : Forward(*field);
+}
+
+static void UpdateTask(const uint32_t worker)
+{
+    (void)worker;
+    for (CompactionChunk* chunk; (chunk = ClaimChunk());) {
+        for (size_t block = chunk->Start >> HEAP_CARD_SHIFT; (block << HEAP_CARD_SHIFT) < chunk->End; block++) {
+            for (uint64_t bits = LoadMarkBits(block); bits; bits &= bits - 1) {
+                const uint32_t object = HeapGetReference(GetMarkedObject(block, bits));
+                const ObjectLayout* layout = HeapGetLayout(object);
+                for (uint16_t i = 0; i < layout->ReferenceFieldCount; i++)
+                    UpdateField(GetField(object, layout->ReferenceFieldOffsets[i]));
+                uint32_t* elements = HeapGetArrayData(object);
+                for (uint32_t i = 0, count = GetReferenceElementCount(layout, object); i < count; i++)
+                    UpdateField(&elements[i]);
+            }
+        }
+    }
+}
+
+// Index of the first chunk whose Reach, or Start, is above the address. Both only grow from one chunk to the next
+static uint32_t FindChunk(const size_t address, const bool byReach)
+{
+    uint32_t low = 0;
+    uint32_t high = HEAP.ChunkCount;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        const CompactionChunk* chunk = &HEAP.Chunks[middle];
+        if ((byReach ? chunk->Reach : chunk->Start) > address)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
+// Slides the live objects of every chunk down to their destination in address order, clearing the mark bits on the
+// way. A chunk first waits for the earlier chunks its objects will overwrite, later ones are all above it
+static void MoveTask(const uint32_t worker)
+{
+    (void)worker;
+    for (CompactionChunk* chunk; (chunk = ClaimChunk());) {
+        if (chunk->LiveBytes > 0) {
+            const uint32_t index = (uint32_t)(chunk - HEAP.Chunks);
+            const size_t end = chunk->Destination + chunk->LiveBytes;
+            const uint32_t last = FindChunk(end - 1, false);
+            for (uint32_t i = FindChunk(chunk->Destination, true); i < index && i < last; i++) {
+                const CompactionChunk* earlier = &HEAP.Chunks[i];
+                if (earlier->LiveEnd <= chunk->Destination)
+                    continue;
+                while (!atomic_load_explicit(&earlier->Moved, memory_order_acquire))
+                    thrd_yield();
+            }
+        }
+
+        size_t destination = chunk->Destination;
+        for (size_t block = chunk->Start >> HEAP_CARD_SHIFT; (block << HEAP_CARD_SHIFT) < chunk->End; block++) {
+            for (uint64_t bits = LoadMarkBits(block); bits; bits &= bits - 1) {
+                const size_t object = GetMarkedObject(block, bits);
+                const uint32_t size = GetObjectSize(object);
+                memmove(HEAP_BASE + destination, HEAP_BASE + object, size);
+                ((ObjectHeader*)(HEAP_BASE + destination))->Word &= ~HEAP_HEADER_AGE_MASK;
+                RecordOldObject(destination, size);
+                destination += size;
+            }
+            atomic_store_explicit(&HEAP.MarkBits[block], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&chunk->Moved, true, memory_order_release);
+    }
+}
+
+static void ClearMarkBits(void)
+{
+    for (uint32_t i = 0; i < HEAP.ChunkCount; i++) {
+        const CompactionChunk* chunk = &HEAP.Chunks[i];
+        for (size_t block = chunk->Start >> HEAP_CARD_SHIFT; (block << HEAP_CARD_SHIFT) < chunk->End; block++)
+            atomic_store_explicit(&HEAP.MarkBits[block], 0, memory_order_relaxed);
+    }
+}
+
+// Compacts every marked object into the old generation, sliding them in address order. The forwarding addresses are
+// computed from the mark bits instead of being stored in the objects. Every phase but updating the roots is split
+// across the GC workers. False when the live objects don't fit in the old generation, then nothing moves
+static bool Compact(void)
+{
+    BuildChunks();
+    const size_t top = ComputeDestinations();
+    if (top > HEAP.PermanentBottom) {
+        ClearMarkBits();
+        return false;
+    }
+    RunChunkTask(BlockDestinationTask);
+    HEAP.EnumerateRoots(UpdateReference, NULL);
+    RunChunkTask(UpdateTask);
+    RunChunkTask(MoveTask);
+
+    HEAP.Old.Top = top;
+    HEAP.Eden.Top = HEAP.Eden.Start;
+    HEAP.Survivors[HEAP.From].Top = HEAP.Survivors[HEAP.From].Start;
+    // No old object points to a young one anymore
+    memset(HEAP_CARDS, HEAP_CARD_CLEAN, HEAP.Size >> HEAP_CARD_SHIFT);
+    return true;
+}
+
+static bool CollectFull(void)
+{
+    MarkLive();
+    return Compact();
+}
+
+static inline uint32_t LoadMarkerState(void)
+{
+    return atomic_load_explicit(&HEAP.Marker.State, memory_order_acquire);
+}
+
+static inline void SetMarkerState(const MarkerState state)
+{
+    atomic_store_explicit(&HEAP.Marker.State, state, memory_order_release);
+}
+
+// Old objects allocated during the cycle are above the marker's top and live anyway, young ones aren't marked
+static inline bool TryMarkSnapshot(const uint32_t reference)
+{
+    return reference && HeapGetOffset(reference) < HEAP.Marker.Top && TryMark(reference);
+}
+
+static void MarkSnapshotRoot(uint32_t* reference, void* context)
+{
+    (void)context;
+    if (TryMarkSnapshot(*reference))
+        ArrayAppend(&HEAP.Marker.Stack, *reference);
+}
+
+// Java code may be storing to the field meanwhile. Either value does, the barrier logs the one overwritten
+static inline void TraceSnapshotField(_Atomic uint32_t* field)
+{
+    const uint32_t reference = atomic_load_explicit(field, memory_order_relaxed);
+    if (TryMarkSnapshot(reference))
+        ArrayAppend(&HEAP.Marker.Stack, reference);
+}
+
+// Scans up to limit objects of the mark stack
+static void TraceSnapshot(uint32_t limit)
+{
+    ConcurrentMarker* marker = &HEAP.Marker;
+    while (marker->Stack.Count > 0 && limit-- > 0) {
+        const uint32_t object = marker->Stack.Items[--marker->Stack.Count];
+        const ObjectLayout* layout = HeapGetLayout(object);
+        for (uint16_t i = 0; i < layout->ReferenceFieldCount; i++)
+            TraceSnapshotField((_Atomic uint32_t*)GetField(object, layout->ReferenceFieldOffsets[i]));
+        _Atomic uint32_t* elements = HeapGetArrayData(object);
+        for (uint32_t i = 0, count = GetReferenceElementCount(layout, object); i < count; i++)
+            TraceSnapshotField(&elements[i]);
+    }
+}
+
+// Moves what the barrier logged onto the mark stack, Lock has to be held
+static void TakeLogged(void)
+{
+    ConcurrentMarker* marker = &HEAP.Marker;
+    for (uint32_t i = 0; i < marker->Logged.Count; i++) {
+        if (TryMarkSnapshot(marker->Logged.Items[i]))
+            ArrayAppend(&marker->Stack, marker->Logged.Items[i]);
+    }
+    marker->Logged.Count = 0;
+}
+
+// Lock has to be held
+static void HandOverSatbBuffer(void)
+{
+    ConcurrentMarker* marker = &HEAP.Marker;
+    for (uint32_t i = 0; i < THREAD_SATB.Count; i++)
+        ArrayAppend(&marker->Logged, THREAD_SATB.Items[i]);
+    THREAD_SATB.Count = 0;
+}
+
+void HeapSatbEnqueue(const uint32_t previous)
+{
+    if (HeapGetOffset(previous) >= HEAP.Marker.Top || IsPermanent(previous) || IsMarked(previous))
+        return;
+    THREAD_SATB.Items[THREAD_SATB.Count++] = previous;
+    if (THREAD_SATB.Count < HEAP_SATB_BUFFER_SIZE)
+        return;
+
+    ConcurrentMarker* marker = &HEAP.Marker;
+    mtx_lock(&marker->Lock);
+    HandOverSatbBuffer();
+    // The marker may have run out of work already
+    if (LoadMarkerState() == MARKER_DONE) {
+        SetMarkerState(MARKER_MARKING);
+        cnd_signal(&marker->Wake);
+    }
+    mtx_unlock(&marker->Lock);
+}
+
+static int MarkerMain(void* argument)
+{
+    (void)argument;
+    ConcurrentMarker* marker = &HEAP.Marker;
+    mtx_lock(&marker->Lock);
+    while (!marker->Exiting) {
+        const uint32_t state = LoadMarkerState();
+        if (state == MARKER_ABORTING) {
+            marker->Stack.Count = 0;
+            SetMarkerState(MARKER_IDLE);
+            cnd_broadcast(&marker->Stopped);
+            continue;
+        }
+        if (state != MARKER_MARKING) {
+            cnd_wait(&marker->Wake, &marker->Lock);
+            continue;
+        }
+
+        TakeLogged();
+        if (marker->Stack.Count == 0) {
+            SetMarkerState(MARKER_DONE);
+            cnd_broadcast(&marker->Stopped);
+            continue;
+        }
+        mtx_unlock(&marker->Lock);
+        TraceSnapshot(HEAP_MARK_STEP);
+        mtx_lock(&marker->Lock);
+    }
+    mtx_unlock(&marker->Lock);
+    return 0;
+}
+
+// Starts a concurrent mark right after a young collection, so eden is empty and the survivors hold every young object.
+// The snapshot is what the roots and the survivors point to in the old generation
+static void StartConcurrentMark(void)
+{
+    ConcurrentMarker* marker = &HEAP.Marker;
+    mtx_lock(&marker->Lock);
+    marker->Top = HEAP.Old.Top;
+    HEAP.EnumerateRoots(MarkSnapshotRoot, NULL);
+    const Space* survivors = &HEAP.Survivors[HEAP.From];
+    for (size_t object = survivors->Start; object < survivors->Top; object += GetObjectSize(object)) {
+        const uint32_t reference = HeapGetReference(object);
+        const ObjectLayout* layout = HeapGetLayout(reference);
+        for (uint16_t i = 0; i < layout->ReferenceFieldCount; i++)
+            MarkSnapshotRoot(GetField(reference, layout->ReferenceFieldOffsets[i]), NULL);
+        uint32_t* elements = HeapGetArrayData(reference);
+        for (uint32_t i = 0, count = GetReferenceElementCount(layout, reference); i < count; i++)
+            MarkSnapshotRoot(&elements[i], NULL);
+    }
+    atomic_store(&HEAP_MARKING, true);
+    SetMarkerState(MARKER_MARKING);
+    cnd_signal(&marker->Wake);
+    mtx_unlock(&marker->Lock);
+}
+
+// Throws away the marking of the cycle, for a full collection to mark everything on its own
+static void AbortConcurrentMark(void)
+{
+    ConcurrentMarker* marker = &HEAP.Marker;
+    mtx_lock(&marker->Lock);
+    if (LoadMarkerState() == MARKER_MARKING) {
+        SetMarkerState(MARKER_ABORTING);
+        cnd_signal(&marker->Wake);
+        while (LoadMarkerState() != MARKER_IDLE)
+            cnd_wait(&marker->Stopped, &marker->Lock);
+    }
+    SetMarkerState(MARKER_IDLE);
+    marker->Stack.Count = 0;
+    marker->Logged.Count = 0;
+    THREAD_SATB.Count = 0;
+    mtx_unlock(&marker->Lock);
+
+    atomic_store(&HEAP_MARKING, false);
+    for (size_t block = 0; (block << HEAP_CARD_SHIFT) < marker->Top; block++)
+        atomic_store_explicit(&HEAP.MarkBits[block], 0, memory_order_relaxed);
+}
+
+static void MarkAll(const size_t start, const size_t end)
+{
+    for (size_t object = start; object < end; object += GetObjectSize(object))
+        TryMark(HeapGetReference(object));
+}
+
+// Ends a cycle whose marker ran out of work. What the barrier logged since is marked here, then the nursery is
+// collected so every young object left is a survivor. Those and the objects promoted during the cycle are taken as
+// live, which leaves the compaction as the only part of the pause that grows with the heap
+static bool Remark(void)
+{
+    ConcurrentMarker* marker = &HEAP.Marker;
+    mtx_lock(&marker->Lock);
+    assert(LoadMarkerState() == MARKER_DONE);
+    HandOverSatbBuffer();
+    TakeLogged();
+    SetMarkerState(MARKER_IDLE);
+    mtx_unlock(&marker->Lock);
+    TraceSnapshot(UINT32_MAX);
+    atomic_store(&HEAP_MARKING, false);
+
+    const Space* from = &HEAP.Survivors[HEAP.From];
+    const size_t young = (HEAP.Eden.Top - HEAP.Eden.Start) + (from->Top - from->Start);
+    if (HEAP.PermanentBottom - HEAP.Old.Top < young) {
+        // The old generation can't take the nursery, the young objects have to be marked the usual way
+        AbortConcurrentMark();
+        return CollectFull();
+    }
+    CollectYoung();
+    MarkAll(marker->Top, HEAP.Old.Top);
+    MarkAll(HEAP.Survivors[HEAP.From].Start, HEAP.Survivors[HEAP.From].Top);
+    return Compact();
+}
+
+// Collects the whole heap when the old generation can't take everything the nursery holds, otherwise the nursery only.
+// Young collections start a concurrent mark once the old generation fills up past the initiating occupancy
+static void Collect(const bool full)
+{
+    RetireTlabs();
+    const double start = GetTime();
+    const size_t usedBefore = GetUsed();
+
+    const Space* from = &HEAP.Survivors[HEAP.From];
+    const size_t young = (HEAP.Eden.Top - HEAP.Eden.Start) + (from->Top - from->Start);
+    if (!full && HEAP.PermanentBottom - HEAP.Old.Top >= young) {
+        CollectYoung();
+        const size_t oldCapacity = HEAP.Old.End - HEAP.Old.Start;
+        const size_t oldUsed = (HEAP.Old.Top - HEAP.Old.Start) + (HEAP.Old.End - HEAP.PermanentBottom);
+        if (HEAP.ConcurrentMark && LoadMarkerState() == MARKER_IDLE &&
+            oldUsed * 100 >= oldCapacity * HEAP.InitiatingOccupancyPercent) {
+            StartConcurrentMark();
+            FinishPause(PAUSE_INITIAL_MARK, false, usedBefore, start);
+            return;
+        }
+        FinishPause(PAUSE_YOUNG, false, usedBefore, start);
+        return;
+    }
+
+    // The cycle couldn't keep up with the allocations
+    if (HEAP.ConcurrentMark && LoadMarkerState() != MARKER_IDLE)
+        AbortConcurrentMark();
+    const bool compacted = CollectFull();
+    FinishPause(PAUSE_FULL, !compacted, usedBefore, start);
+}
+
+// Finishes the concurrent mark once the marker is done with it
+static void CheckConcurrentMark(void)
+{
+    if (!HEAP.ConcurrentMark || LoadMarkerState() != MARKER_DONE)
+        return;
+    RetireTlabs();
+    const double start = GetTime();
+    const size_t usedBefore = GetUsed();
+    const bool compacted = Remark();
+    FinishPause(PAUSE_REMARK, !compacted, usedBefore, start);
+}
+
+bool HeapInit(const HeapOptions* options, const HeapRootEnumerator enumerateRoots)
+{
+    assert(!HEAP_BASE && "Heap already initialized");
+    const size_t size = options->Size;
+    if (size < HEAP_MIN_SIZE || (uint64_t)size > HEAP_MAX_SIZE) {
+        fprintf(stderr, "The heap size has to be between %dm and %llum\n", HEAP_MIN_SIZE / (1024 * 1024),
+            (unsigned long long)(HEAP_MAX_SIZE / (1024 * 1024)));
+        return false;
+    }
+    const size_t nursery = options->NurserySize ? options->NurserySize : size / HEAP_DEFAULT_NURSERY_RATIO;
+    if (nursery < HEAP_MIN_NURSERY_SIZE || nursery > size / 2) {
+        fprintf(stderr, "The nursery size has to be between %dk and half the heap\n", HEAP_MIN_NURSERY_SIZE / 1024);
+        return false;
+    }
+    if (options->TenuringThreshold > HEAP_MAX_TENURING_THRESHOLD) {
+        fprintf(stderr, "The tenuring threshold can be at most %d\n", HEAP_MAX_TENURING_THRESHOLD);
+        return false;
+    }
+    if (options->InitiatingOccupancyPercent > 100) {
+        fprintf(stderr, "The initiating occupancy has to be a percentage\n");
+        return false;
+    }
+    if (options->ParallelGCThreads < 1 || options->ParallelGCThreads > GC_MAX_WORKERS) {
+        fprintf(stderr, "The number of parallel GC threads has to be between 1 and %d\n", GC_MAX_WORKERS);
+        return false;
+    }
+
+    // Pages are only backed by memory once something is allocated in them
+#if defined(_WIN32)
+    HEAP_BASE = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    HEAP_BASE = base == MAP_FAILED ? NULL : base;
+#endif
+    if (!HEAP_BASE) {
+        fprintf(stderr, "Failed to reserve a heap of %zu bytes\n", size);
+        return false;
+    }
+    HEAP.Size = size;
+
+    const size_t blocks = (size + HEAP_CARD_SIZE - 1) >> HEAP_CARD_SHIFT;
+    HEAP_CARDS = calloc(blocks, 1);
+    HEAP.CardObjects = calloc(blocks, sizeof(uint32_t));
+    HEAP.MarkBits = calloc(blocks, sizeof(uint64_t));
+    HEAP.BlockDestinations = calloc(blocks, sizeof(uint32_t));
+    // Each space can end in a partial chunk
+    HEAP.Chunks = calloc(size / HEAP_CHUNK_SIZE + COMPACTED_SPACE_COUNT, sizeof(CompactionChunk));
+    HEAP_LAYOUTS = calloc(HEAP_MAX_LAYOUTS, sizeof(ObjectLayout*));
+    HEAP.LayoutCount = 1;
+    assert(HEAP_CARDS && HEAP.CardObjects && HEAP.MarkBits && HEAP.BlockDestinations && HEAP.Chunks && HEAP_LAYOUTS);
+    for (uint32_t i = 0; i < options->ParallelGCThreads; i++)
+        GcDequeInit(&HEAP.Deques[i]);
+    if (!GcWorkersInit(options->ParallelGCThreads)) {
+        HeapDestroy();
+        return false;
+    }
+
+    // Spaces start on a card so no card is shared between generations
+    const size_t end = AlignDown(size, HEAP_CARD_SIZE);
+    const size_t survivor = AlignDown(nursery / HEAP_SURVIVOR_RATIO, HEAP_CARD_SIZE);
+    const size_t nurseryStart = AlignDown(size - nursery, HEAP_CARD_SIZE);
+    // Offset 0 is null, so nothing is allocated there
+    HEAP.Old = (Space){ .Start = HEAP_OBJECT_ALIGNMENT, .End = nurseryStart, .Top = HEAP_OBJECT_ALIGNMENT };
+    HEAP.PermanentBottom = nurseryStart;
+    HEAP.Eden = (Space){ .Start = nurseryStart, .End = end - 2 * survivor, .Top = nurseryStart };
+    HEAP.Survivors[0] = (Space){ .Start = end - 2 * survivor, .End = end - survivor, .Top = end - 2 * survivor };
+    HEAP.Survivors[1] = (Space){ .Start = end - survivor, .End = end, .Top = end - survivor };
+    HEAP.From = 0;
+    HEAP.TenuringThreshold = options->TenuringThreshold;
+    HEAP.PrintGC = options->PrintGC;
+    HEAP.PrintStatistics = options->PrintGCStatistics;
+    HEAP.EnumerateRoots = enumerateRoots;
+    HEAP.CardObjects[HEAP.Old.Start >> HEAP_CARD_SHIFT] = HeapGetReference(HEAP.Old.Start);
+
+    HEAP.ConcurrentMark = options->ConcurrentMark;
+    HEAP.InitiatingOccupancyPercent = options->InitiatingOccupancyPercent;
+    if (HEAP.ConcurrentMark) {
+        ConcurrentMarker* marker = &HEAP.Marker;
+        if (mtx_init(&marker->Lock, mtx_plain) != thrd_success || cnd_init(&marker->Wake) != thrd_success ||
+            cnd_init(&marker->Stopped) != thrd_success || thrd_create(&marker->Thread, MarkerMain, NULL) != thrd_success) {
+            fprintf(stderr, "Failed to start the concurrent marker\n");
+            HEAP.ConcurrentMark = false;
+            HeapDestroy();
+            return false;
+        }
+        marker->Started = true;
+    }
+    return true;
+}
+
+void HeapDestroy(void)
+{
+    if (!HEAP_BASE)
+        return;
+    ConcurrentMarker* marker = &HEAP.Marker;
+    if (marker->Started) {
+        mtx_lock(&marker->Lock);
+        marker->Exiting = true;
+        cnd_signal(&marker->Wake);
+        mtx_unlock(&marker->Lock);
+        thrd_join(marker->Thread, NULL);
+        cnd_destroy(&marker->Wake);
+        cnd_destroy(&marker->Stopped);
+        mtx_destroy(&marker->Lock);
+    }
+    free(marker->Stack.Items);
+    free(marker->Logged.Items);
+    atomic_store(&HEAP_MARKING, false);
+    THREAD_SATB.Count = 0;
+    if (HEAP.PrintStatistics)
+        PrintStatistics();
+
+#if defined(_WIN32)
+    VirtualFree(HEAP_BASE, 0, MEM_RELEASE);
+#else
+    munmap(HEAP_BASE, HEAP.Size);
+#endif
+    free(HEAP_CARDS);
+    free(HEAP.CardObjects);
+    free(HEAP.MarkBits);
+    free(HEAP.BlockDestinations);
+    free(HEAP.Chunks);
+    free(HEAP_LAYOUTS);
+    GcWorkersDestroy();
+    for (uint32_t i = 0; i < GC_MAX_WORKERS; i++)
+        GcDequeDestroy(&HEAP.Deques[i]);
+    HEAP_BASE = NULL;
+    HEAP_CARDS = NULL;
+    HEAP_LAYOUTS = NULL;
+    HEAP = (Heap){ .Lock = ATOMIC_FLAG_INIT };
+    THREAD_TLAB = (Tlab){ 0 };
+}
+
+void HeapDetachThread(void)
+{
+    LockHeap();
+    for (Tlab** tlab = &HEAP.Tlabs; *tlab; tlab = &(*tlab)->Next) {
+        if (*tlab == &THREAD_TLAB) {
+            *tlab = THREAD_TLAB.Next;
+            break;
+        }
+    }
+    UnlockHeap();
+    THREAD_TLAB = (Tlab){ 0 };
+}
+
+bool HeapRegisterLayout(ObjectLayout* layout)
+{
+    assert(HEAP_BASE && "Heap not initialized");
+    // Layouts outlive the heap, the index may be from a previous one
+    if (layout->Index != 0 && HEAP_LAYOUTS[layout->Index] == layout)
+        return true;
+    LockHeap();
+    const bool registered = HEAP.LayoutCount < HEAP_MAX_LAYOUTS;
+    if (registered) {
+        layout->Index = HEAP.LayoutCount++;
+        HEAP_LAYOUTS[layout->Index] = layout;
+    }
+    UnlockHeap();
+    if (!registered)
+        fprintf(stderr, "More than %d classes were instantiated\n", HEAP_MAX_LAYOUTS - 1);
+    return registered;
+}
+
+uint32_t HeapGetIdentityHash(const uint32_t reference)
+{
+    assert(reference != 0 && "Null has no identity hash");
+    // Other threads may be reading the header meanwhile, only one of them gets to set the hash
+    _Atomic uint64_t* word = (_Atomic uint64_t*)&((ObjectHeader*)HeapGetObject(reference))->Word;
+    uint64_t current = atomic_load_explicit(word, memory_order_relaxed);
+    while (!(current & HEAP_HEADER_HASH_MASK)) {
+        uint32_t hash;
+        do {
+            THREAD_HASH_SEED ^= THREAD_HASH_SEED << 13;
+            THREAD_HASH_SEED ^= THREAD_HASH_SEED >> 17;
+            THREAD_HASH_SEED ^= THREAD_HASH_SEED << 5;
+            hash = (uint32_t)(THREAD_HASH_SEED & (HEAP_HEADER_HASH_MASK >> HEAP_HEADER_HASH_SHIFT));
+        } while (hash == 0);
+        const uint64_t hashed = current | ((uint64_t)hash << HEAP_HEADER_HASH_SHIFT);
+        if (atomic_compare_exchange_weak_explicit(word, &current, hashed, memory_order_relaxed, memory_order_relaxed))
+            return hash;
+    }
+    return (uint32_t)((current & HEAP_HEADER_HASH_MASK) >> HEAP_HEADER_HASH_SHIFT);
+}
+
+// Small objects take a new buffer with what is left in eden, larger ones are allocated on their own. 0 when eden is
+// full
+static uint32_t AllocateYoung(const ObjectLayout* layout, const uint32_t length)
+{
+    Space* eden = &HEAP.Eden;
+    const size_t size = GetSize(layout, length);
+    if (eden->End - eden->Top < size)
+        return 0;
+    if (size > HEAP_TLAB_SIZE / 4) {
+        const size_t start = eden->Top;
+        eden->Top += size;
+        return InitObject(start, layout, length);
+    }
+
+    // Zeroed once here so the fast path only has to write the header. The rest of the previous buffer is left unused
+    const size_t available = eden->End - eden->Top;
+    const size_t bufferSize = available < HEAP_TLAB_SIZE ? available : HEAP_TLAB_SIZE;
+    uint8_t* buffer = HEAP_BASE + eden->Top;
+    eden->Top += bufferSize;
+    memset(buffer, 0, bufferSize);
+    THREAD_TLAB.Top = buffer + size;
+    THREAD_TLAB.End = buffer + bufferSize;
+    return InitObject((size_t)(buffer - HEAP_BASE), layout, length);
+}
+
+static uint32_t Allocate(const ObjectLayout* layout, const uint32_t length)
+{
+    assert(HEAP_BASE && "Heap not initialized");
+    assert(HEAP_LAYOUTS[layout->Index] == layout && "Layout not registered");
+    const uint32_t size = GetSize(layout, length);
+    if (size == 0)
+        return 0;
+    LockHeap();
+    if (!THREAD_TLAB.Registered) {
+        THREAD_TLAB.Registered = true;
+        THREAD_TLAB.Next = HEAP.Tlabs;
+        HEAP.Tlabs = &THREAD_TLAB;
+    }
+
+    CheckConcurrentMark();
+    uint32_t reference = 0;
+    // Objects that take a good part of eden would get it collected over and over, they start out old instead
+    if (size > (HEAP.Eden.End - HEAP.Eden.Start) / 2) {
+        for (int attempt = 0; attempt < 2 && !reference; attempt++) {
+            if (attempt > 0)
+                Collect(true);
+            const size_t start = AllocateOld(size);
+            if (start)
+                reference = InitObject(start, layout, length);
+        }
+    } else {
+        reference = AllocateYoung(layout, length);
+        if (!reference) {
+            Collect(false);
+            reference = AllocateYoung(layout, length);
+        }
+    }
+    UnlockHeap();
+    return reference;
+}
+
+uint32_t HeapAllocateSlow(const ObjectLayout* layout)
+{
+    assert(!layout->ElementSize && "Arrays need a length");
+    return Allocate(layout, 0);
+}
+
+uint32_t HeapAllocateArraySlow(const ObjectLayout* layout, const uint32_t length)
+{
+    assert(layout->ElementSize && "Not an array");
+    return Allocate(layout, length);
+}
+
+uint32_t HeapAllocatePermanent(const ObjectLayout* layout)
+{
+    assert(HEAP_BASE && "Heap not initialized");
+    assert(layout->ReferenceFieldCount == 0 && !layout->ElementSize && "Permanent objects are not scanned");
+    assert(HEAP_LAYOUTS[layout->Index] == layout && "Layout not registered");
+    LockHeap();
+    uint32_t reference = 0;
+    for (int attempt = 0; attempt < 2 && !reference; attempt++) {
+        if (attempt > 0)
+            Collect(true);
+        if (HEAP.PermanentBottom - HEAP.Old.Top >= layout->InstanceSize) {
+            HEAP.PermanentBottom -= layout->InstanceSize;
+            reference = InitObject(HEAP.PermanentBottom, layout, 0);
+        }
+    }
+    UnlockHeap();
+    return reference;
+}
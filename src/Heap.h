@@ -0,0 +1,269 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Symbol.h"
+
+// Objects live in a single reserved range and are referred to by 32 bit compressed references, their offset from its
+// start in units of HEAP_OBJECT_ALIGNMENT, 0 being null. Heaps of up to 32GB are addressed that way.
+// The range is split in two generations. The old generation grows up from the start, with objects that never move
+// growing down from its end. The nursery after it is eden followed by two survivor spaces. Every thread bump allocates
+// from its own buffer in eden and only goes to the shared heap to take a new one, or to collect once eden is full
+
+#define HEAP_DEFAULT_SIZE (256 * 1024 * 1024)
+#define HEAP_MIN_SIZE (1024 * 1024)
+// Objects are aligned to 1 << HEAP_REFERENCE_SHIFT bytes, which references leave out
+#define HEAP_REFERENCE_SHIFT 3
+#define HEAP_OBJECT_ALIGNMENT (1 << HEAP_REFERENCE_SHIFT)
+// Every offset has to fit in a reference
+#define HEAP_MAX_SIZE (((uint64_t)UINT32_MAX + 1) << HEAP_REFERENCE_SHIFT)
+// The nursery takes a third of the heap unless its size is given, it can take at most half
+#define HEAP_DEFAULT_NURSERY_RATIO 3
+#define HEAP_MIN_NURSERY_SIZE (256 * 1024)
+// Each survivor space takes this fraction of the nursery, eden the rest
+#define HEAP_SURVIVOR_RATIO 10
+// Young collections an object survives before it is promoted to the old generation
+#define HEAP_DEFAULT_TENURING_THRESHOLD 7
+#define HEAP_MAX_TENURING_THRESHOLD 7
+#define HEAP_DEFAULT_PARALLEL_GC_THREADS 1
+// Percentage of the old generation in use after a young collection that starts a concurrent mark
+#define HEAP_DEFAULT_INITIATING_OCCUPANCY 45
+// Size of the allocation buffers threads take from eden, objects over a quarter of it are allocated on their own
+#define HEAP_TLAB_SIZE (64 * 1024)
+
+// Stores of references into objects dirty the card the field is in, young collections only look for old to young
+// references in dirty cards
+#define HEAP_CARD_SHIFT 9
+#define HEAP_CARD_SIZE (1 << HEAP_CARD_SHIFT)
+#define HEAP_CARD_CLEAN 0
+#define HEAP_CARD_DIRTY 1
+
+// The header is a single word. Its upper half is the index of the object's layout in the layout table, the lower half
+// holds the identity hash, the lock bits and what the collector keeps
+#define HEAP_HEADER_LAYOUT_SHIFT 32
+// Set once the object was copied, the upper half is then the reference of the copy
+#define HEAP_HEADER_FORWARDED 1
+// Young collections the object survived
+#define HEAP_HEADER_AGE_SHIFT 1
+#define HEAP_HEADER_AGE_MASK ((uint64_t)HEAP_MAX_TENURING_THRESHOLD << HEAP_HEADER_AGE_SHIFT)
+// Left unlocked for now, there are no monitors yet
+#define HEAP_HEADER_LOCK_SHIFT 4
+#define HEAP_HEADER_LOCK_MASK ((uint64_t)3 << HEAP_HEADER_LOCK_SHIFT)
+// 0 until the identity hash is first asked for
+#define HEAP_HEADER_HASH_SHIFT 6
+#define HEAP_HEADER_HASH_MASK ((uint64_t)0x3FFFFFF << HEAP_HEADER_HASH_SHIFT)
+
+// Layouts a heap can tell apart, index 0 is never used
+#define HEAP_MAX_LAYOUTS (64 * 1024)
+// Sizes are kept in 32 bits, arrays that would take more can't be allocated
+#define HEAP_MAX_OBJECT_SIZE (UINT32_MAX - HEAP_OBJECT_ALIGNMENT + 1)
+
+// Arrays are the header followed by their length and then their elements, back to back. The elements start 16 bytes
+// in, so every element is aligned to its own size and none of them straddles a cache line
+#define HEAP_ARRAY_LENGTH_OFFSET 8
+#define HEAP_ARRAY_DATA_OFFSET 16
+
+// Shared by every object of a class
+typedef struct
+{
+    const Symbol* Name;
+    // Index of the layout in the table headers refer to it through, 0 until it is registered with the heap
+    uint32_t Index;
+    // Bytes each object takes including its header, a multiple of HEAP_OBJECT_ALIGNMENT. Arrays take this plus their
+    // elements
+    uint32_t InstanceSize;
+    // Offsets of the fields that hold references
+    uint16_t ReferenceFieldCount;
+    const uint32_t* ReferenceFieldOffsets;
+    // Bytes each element of an array takes, 0 for every other class
+    uint8_t ElementSize;
+    // Set for arrays of references, whose elements are scanned like fields
+    bool ReferenceElements;
+    // Class of the elements of an array of references
+    const Symbol* ElementClass;
+} ObjectLayout;
+
+// Fields follow the header, at the offsets the layout of the class gave them
+typedef struct
+{
+    uint64_t Word;
+} ObjectHeader;
+
+// Thread local allocation buffer, already zeroed
+typedef struct Tlab
+{
+    uint8_t* Top;
+    uint8_t* End;
+    // Every thread's buffer is retired when collecting
+    struct Tlab* Next;
+    bool Registered;
+} Tlab;
+
+typedef struct
+{
+    // Bytes reserved for the heap, between HEAP_MIN_SIZE and HEAP_MAX_SIZE
+    size_t Size;
+    // 0 for the default
+    size_t NurserySize;
+    uint32_t TenuringThreshold;
+    // Threads full collections are split across, 1 collects on the allocating thread only
+    uint32_t ParallelGCThreads;
+    // Marks the old generation on a background thread while Java code runs, so the full collection that follows only
+    // has to finish the marking and compact
+    bool ConcurrentMark;
+    uint32_t InitiatingOccupancyPercent;
+    // Prints a line for every collection
+    bool PrintGC;
+    // Prints how long collections paused Java code when the heap is destroyed
+    bool PrintGCStatistics;
+} HeapOptions;
+
+// Called with the address of every reference that is a root, the collector may update it
+typedef void (*HeapReferenceVisitor)(uint32_t* reference, void* context);
+// Visits every root outside of the heap
+typedef void (*HeapRootEnumerator)(HeapReferenceVisitor visit, void* context);
+
+extern uint8_t* HEAP_BASE;
+extern uint8_t* HEAP_CARDS;
+extern const ObjectLayout** HEAP_LAYOUTS;
+extern _Thread_local Tlab THREAD_TLAB;
+// Set while a concurrent mark runs, see HeapPreWriteBarrier
+extern _Atomic bool HEAP_MARKING;
+
+// Reserves the heap. Collections find the roots through enumerateRoots, which only sees the thread that collects, so
+// no other thread may run Java code meanwhile
+bool HeapInit(const HeapOptions* options, HeapRootEnumerator enumerateRoots);
+void HeapDestroy(void);
+// Drops the thread's allocation buffer, the rest of it is never used
+void HeapDetachThread(void);
+
+// Gives the layout its index in the layout table unless it already has one, every layout has to be registered before
+// objects are allocated with it. False once the table is full
+bool HeapRegisterLayout(ObjectLayout* layout);
+// Takes a new allocation buffer for the thread, collecting when eden is full. Large objects are allocated on their
+// own. 0 once the heap is full
+uint32_t HeapAllocateSlow(const ObjectLayout* layout);
+// Same as HeapAllocateSlow for an array of length elements
+uint32_t HeapAllocateArraySlow(const ObjectLayout* layout, uint32_t length);
+// Allocates an object that is never moved or freed, for objects compiled code embeds the reference of. Their layout
+// can't have reference fields. 0 once the heap is full
+uint32_t HeapAllocatePermanent(const ObjectLayout* layout);
+// Logs a reference a store overwrote during a concurrent mark, see HeapPreWriteBarrier
+void HeapSatbEnqueue(uint32_t previous);
+// Hash Object.hashCode would return, made up the first time and kept in the header so it survives the object moving
+uint32_t HeapGetIdentityHash(uint32_t reference);
+
+// Offset of the object from the start of the heap
+static inline size_t HeapGetOffset(const uint32_t reference)
+{
+    return (size_t)reference << HEAP_REFERENCE_SHIFT;
+}
+
+static inline uint32_t HeapGetReference(const size_t offset)
+{
+    return (uint32_t)(offset >> HEAP_REFERENCE_SHIFT);
+}
+
+static inline void* HeapGetObject(const uint32_t reference)
+{
+    return HEAP_BASE + HeapGetOffset(reference);
+}
+
+static inline const ObjectLayout* HeapGetLayout(const uint32_t reference)
+{
+    return HEAP_LAYOUTS[((const ObjectHeader*)HeapGetObject(reference))->Word >> HEAP_HEADER_LAYOUT_SHIFT];
+}
+
+// Rounds an instance size up to what objects are aligned to
+static inline uint32_t HeapAlignSize(const uint32_t size)
+{
+    return (size + HEAP_OBJECT_ALIGNMENT - 1) & ~(uint32_t)(HEAP_OBJECT_ALIGNMENT - 1);
+}
+
+static inline uint32_t HeapGetArrayLength(const uint32_t reference)
+{
+    return *(const uint32_t*)((const uint8_t*)HeapGetObject(reference) + HEAP_ARRAY_LENGTH_OFFSET);
+}
+
+static inline void* HeapGetArrayData(const uint32_t reference)
+{
+    return (uint8_t*)HeapGetObject(reference) + HEAP_ARRAY_DATA_OFFSET;
+}
+
+// Bytes an array of the layout with length elements takes, 0 if that's more than HEAP_MAX_OBJECT_SIZE
+static inline uint32_t HeapGetArraySize(const ObjectLayout* layout, const uint32_t length)
+{
+    const uint64_t size = HEAP_ARRAY_DATA_OFFSET + (uint64_t)length * layout->ElementSize;
+    return size > HEAP_MAX_OBJECT_SIZE ? 0 : HeapAlignSize((uint32_t)size);
+}
+
+// Allocates an object with every field zeroed, 0 when the heap is full. Collects when eden is full, which moves
+// objects, so only references the roots hold stay valid across it
+static inline uint32_t HeapAllocate(const ObjectLayout* layout)
+{
+    Tlab* tlab = &THREAD_TLAB;
+    uint8_t* object = tlab->Top;
+    if ((size_t)(tlab->End - object) < layout->InstanceSize)
+        return HeapAllocateSlow(layout);
+    tlab->Top = object + layout->InstanceSize;
+    ((ObjectHeader*)object)->Word = (uint64_t)layout->Index << HEAP_HEADER_LAYOUT_SHIFT;
+    return HeapGetReference((size_t)(object - HEAP_BASE));
+}
+
+// Same as HeapAllocate for an array of length elements, every one of them zeroed. 0 as well when the array would take
+// more than HEAP_MAX_OBJECT_SIZE
+static inline uint32_t HeapAllocateArray(const ObjectLayout* layout, const uint32_t length)
+{
+    const uint32_t size = HeapGetArraySize(layout, length);
+    Tlab* tlab = &THREAD_TLAB;
+    uint8_t* object = tlab->Top;
+    if (size == 0 || (size_t)(tlab->End - object) < size)
+        return HeapAllocateArraySlow(layout, length);
+    tlab->Top = object + size;
+    ((ObjectHeader*)object)->Word = (uint64_t)layout->Index << HEAP_HEADER_LAYOUT_SHIFT;
+    *(uint32_t*)(object + HEAP_ARRAY_LENGTH_OFFSET) = length;
+    return HeapGetReference((size_t)(object - HEAP_BASE));
+}
+
+// Has to come before every store of a reference into a field of an object, with the reference the field holds. The
+// concurrent mark works on a snapshot of the heap taken when it started, every reference the store removes from the
+// snapshot is handed to the marker
+static inline void HeapPreWriteBarrier(const uint32_t previous)
+{
+    if (previous && atomic_load_explicit(&HEAP_MARKING, memory_order_relaxed))
+        HeapSatbEnqueue(previous);
+}
+
+// Has to follow every store of a reference into a field of an object
+static inline void HeapWriteBarrier(const uint32_t object, const uint32_t fieldOffset)
+{
+    HEAP_CARDS[(HeapGetOffset(object) + fieldOffset) >> HEAP_CARD_SHIFT] = HEAP_CARD_DIRTY;
+}
+
+// HeapPreWriteBarrier for stores that overwrite count references at once
+static inline void HeapPreWriteBarrierRange(const uint32_t* fields, const uint32_t count)
+{
+    if (!atomic_load_explicit(&HEAP_MARKING, memory_order_relaxed))
+        return;
+    for (uint32_t i = 0; i < count; i++) {
+        if (fields[i])
+            HeapSatbEnqueue(fields[i]);
+    }
+}
+
+// HeapWriteBarrier for stores to every field in [fromOffset, toOffset)
+static inline void HeapWriteBarrierRange(const uint32_t object, const uint32_t fromOffset, const uint32_t toOffset)
+{
+    if (fromOffset >= toOffset)
+        return;
+    const size_t first = (HeapGetOffset(object) + fromOffset) >> HEAP_CARD_SHIFT;
+    const size_t last = (HeapGetOffset(object) + toOffset - 1) >> HEAP_CARD_SHIFT;
+    memset(&HEAP_CARDS[first], HEAP_CARD_DIRTY, last - first + 1);
+}
+
+#endif //HEAP_H
@@ -0,0 +1,1632 @@
+#include "Jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Optimizer.h"
+#include "Utils.h"
+#include "Verifier.h"
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+// Executable memory compiled methods are bump allocated from, it is only ever writable while code is being copied in
+typedef struct
+{
+    uint8_t* Base;
+    size_t Size;
+    size_t Used;
+    size_t PageSize;
+    bool Full;
+} CodeCache;
+
+static CodeCache CODE_CACHE = { 0 };
+
+bool JitInit(const size_t codeCacheSize)
+{
+    assert(!CODE_CACHE.Base && "JIT already initialized");
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    CODE_CACHE.PageSize = info.dwPageSize;
+    CODE_CACHE.Base = VirtualAlloc(NULL, codeCacheSize, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READ);
+#else
+    CODE_CACHE.PageSize = (size_t)sysconf(_SC_PAGESIZE);
+    void* base = mmap(NULL, codeCacheSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CODE_CACHE.Base = base == MAP_FAILED ? NULL : base;
+#endif
+    if (!CODE_CACHE.Base) {
+        fprintf(stderr, "Failed to reserve a code cache of %zu bytes\n", codeCacheSize);
+        return false;
+    }
+    CODE_CACHE.Size = codeCacheSize;
+    CODE_CACHE.Used = 0;
+    CODE_CACHE.Full = false;
+    return true;
+}
+
+void JitDestroy(void)
+{
+    if (!CODE_CACHE.Base)
+        return;
+#if defined(_WIN32)
+    VirtualFree(CODE_CACHE.Base, 0, MEM_RELEASE);
+#else
+    munmap(CODE_CACHE.Base, CODE_CACHE.Size);
+#endif
+    CODE_CACHE = (CodeCache){ 0 };
+}
+
+#if defined(JIT_X86_64)
+
+// Toggles the pages covering the range between writable and executable
+static bool CodeCacheProtect(uint8_t* start, const size_t size, const bool writable)
+{
+    const uintptr_t first = (uintptr_t)start & ~(uintptr_t)(CODE_CACHE.PageSize - 1);
+    const size_t length = (uintptr_t)start + size - first;
+#if defined(_WIN32)
+    DWORD previous;
+    return VirtualProtect((void*)first, length, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &previous) != 0;
+#else
+    return mprotect((void*)first, length, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+// Copies the code into the cache and returns where it was placed, NULL when the cache is full
+static void* CodeCacheInstall(const uint8_t* code, const size_t size)
+{
+    // Entry points are aligned for the decoder's sake
+    const size_t offset = (CODE_CACHE.Used + 15) & ~(size_t)15;
+    if (!CODE_CACHE.Base || offset + size > CODE_CACHE.Size) {
+        if (CODE_CACHE.Base && !CODE_CACHE.Full)
+            fprintf(stderr, "Code cache is full, methods will no longer be compiled\n");
+        CODE_CACHE.Full = true;
+        return NULL;
+    }
+
+    uint8_t* entry = CODE_CACHE.Base + offset;
+    if (!CodeCacheProtect(entry, size, true)) {
+        fprintf(stderr, "Failed to make the code cache writable\n");
+        return NULL;
+    }
+    memcpy(entry, code, size);
+    const bool executable = CodeCacheProtect(entry, size, false);
+    assert(executable && "Failed to make the code cache executable");
+    (void)executable;
+
+    CODE_CACHE.Used = offset + size;
+    return entry;
+}
+
+typedef enum
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+// Condition codes in the low nibble of the jcc opcode
+typedef enum
+{
+    CC_E  = 0x4,
+    CC_NE = 0x5,
+    CC_NS = 0x9,
+    CC_L  = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G  = 0xF,
+} ConditionCode;
+
+// Compiled code keeps the locals base in rbx, the operand stack base in r12 and the frame in r13, all callee saved in
+// both calling conventions. The verifier knows the stack depth at every instruction, so stack slots are addressed at
+// fixed offsets and no stack pointer is kept. eax, ecx and edx are scratch, r8d to r11d hold operand stack values
+#define LOCALS_REGISTER RBX
+#define STACK_REGISTER R12
+#define FRAME_REGISTER R13
+#define FIRST_VALUE_REGISTER R8
+#define VALUE_REGISTER_COUNT 4
+
+#if defined(_WIN32)
+    #define ARGUMENT_0 RCX
+    #define ARGUMENT_1 RDX
+    #define ARGUMENT_2 R8
+    // Space the callee may spill its register arguments to
+    #define SHADOW_SPACE 32
+#else
+    #define ARGUMENT_0 RDI
+    #define ARGUMENT_1 RSI
+    #define ARGUMENT_2 RDX
+    #define SHADOW_SPACE 0
+#endif
+
+#define SLOT_OFFSET(index) ((int32_t)((index) * sizeof(Slot)))
+// Spill slots sit above the shadow space
+#define SPILL_OFFSET(slot) ((int32_t)(SHADOW_SPACE + (slot) * 8))
+
+// Where an operand stack value is while compiling. Pushes only record the value, it is written to its stack slot
+// when the basic block ends, before the runtime is called or when registers run out
+typedef enum
+{
+    // In its own stack slot
+    VALUE_MEMORY,
+    VALUE_CONSTANT,
+    // Still in the local it was loaded from
+    VALUE_LOCAL,
+    VALUE_REGISTER,
+    // In a spill slot of the optimizing tier's native frame
+    VALUE_SPILL,
+} ValueKind;
+
+typedef struct
+{
+    ValueKind Kind;
+    // Constant, local index or register depending on the kind
+    int32_t As;
+} Value;
+
+// Int operation with both a reg, r/m and an immediate form
+typedef struct
+{
+    uint32_t Opcode;
+    uint8_t ImmediateExtension;
+} AluOp;
+
+static const AluOp ALU_ADD = { 0x03, 0 };
+static const AluOp ALU_OR  = { 0x0B, 1 };
+static const AluOp ALU_AND = { 0x23, 4 };
+static const AluOp ALU_SUB = { 0x2B, 5 };
+static const AluOp ALU_XOR = { 0x33, 6 };
+static const AluOp ALU_CMP = { 0x3B, 7 };
+// imul has its own immediate form
+static const AluOp ALU_MUL = { 0x0FAF, 0 };
+
+// rel32 field of a jump to patch once the offset of its target is known
+typedef struct
+{
+    size_t Position;
+    uint32_t Target;
+} Fixup;
+
+typedef struct
+{
+    size_t Count;
+    size_t Capacity;
+    uint8_t* Items;
+} CodeBuffer;
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Capacity;
+    Fixup* Items;
+} FixupArray;
+
+typedef struct
+{
+    TranslatedCode* Translated;
+    MethodProfile* Profile;
+    // Backedge count the baseline code asks for optimized code at, 0 never does
+    uint32_t OptimizeThreshold;
+    CodeBuffer Code;
+    FixupArray Fixups;
+    // Code offset of every instruction, followed by the shared exit paths
+    size_t* Labels;
+    uint32_t FailLabel;
+    uint32_t ExitLabel;
+
+    // Operand stack at the current instruction. Not live after an unconditional jump until the next branch target
+    Value* Stack;
+    uint16_t Depth;
+    bool Live;
+} Emitter;
+
+static void Emit8(Emitter* e, const uint8_t value)
+{
+    ArrayAppend(&e->Code, value);
+}
+
+static void Emit32(Emitter* e, const uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        Emit8(e, (uint8_t)(value >> (i * 8)));
+}
+
+static void Emit64(Emitter* e, const uint64_t value)
+{
+    Emit32(e, (uint32_t)value);
+    Emit32(e, (uint32_t)(value >> 32));
+}
+
+// Without a REX prefix byte operands 4 to 7 encode ah, ch, dh and bh instead of spl, bpl, sil and dil, so an empty one
+// is still emitted when rm is a byte register past rbx
+static void EmitPrefix(Emitter* e, const bool wide, const Register reg, const Register rm, const uint32_t opcode, const bool byteRm)
+{
+    const uint8_t rex = (uint8_t)(0x40 | (wide ? 0x8 : 0) | (reg >= R8 ? 0x4 : 0) | (rm >= R8 ? 0x1 : 0));
+    if (rex != 0x40 || (byteRm && rm >= RSP))
+        Emit8(e, rex);
+    if (opcode > 0xFF)
+        Emit8(e, (uint8_t)(opcode >> 8));
+    Emit8(e, (uint8_t)opcode);
+}
+
+// opcode reg, [base + disp32]. Opcodes taking an extension instead of a register pass it as reg
+static void EmitMemory(Emitter* e, const bool wide, const uint32_t opcode, const Register reg, const Register base, const int32_t disp)
+{
+    EmitPrefix(e, wide, reg, base, opcode, false);
+    Emit8(e, (uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+    // rsp and r12 as a base need a SIB byte
+    if ((base & 7) == RSP)
+        Emit8(e, 0x24);
+    Emit32(e, (uint32_t)disp);
+}
+
+// opcode reg, rm with both operands in registers
+static void EmitRegister(Emitter* e, const bool wide, const uint32_t opcode, const Register reg, const Register rm)
+{
+    EmitPrefix(e, wide, reg, rm, opcode, false);
+    Emit8(e, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// opcode reg, rm reading the low byte of rm, like movsx and movzx
+static void EmitByteRegister(Emitter* e, const uint32_t opcode, const Register reg, const Register rm)
+{
+    EmitPrefix(e, false, reg, rm, opcode, true);
+    Emit8(e, (uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+static void EmitMoveImmediate64(Emitter* e, const Register reg, const uint64_t value)
+{
+    Emit8(e, (uint8_t)(0x48 | (reg >= R8 ? 0x1 : 0)));
+    Emit8(e, (uint8_t)(0xB8 | (reg & 7)));
+    Emit64(e, value);
+}
+
+static void EmitPush(Emitter* e, const Register reg)
+{
+    if (reg >= R8)
+        Emit8(e, 0x41);
+    Emit8(e, (uint8_t)(0x50 | (reg & 7)));
+}
+
+static void EmitPop(Emitter* e, const Register reg)
+{
+    if (reg >= R8)
+        Emit8(e, 0x41);
+    Emit8(e, (uint8_t)(0x58 | (reg & 7)));
+}
+
+// Jumps to a label, patched once every label is placed
+static void EmitJump(Emitter* e, const uint32_t label)
+{
+    Emit8(e, 0xE9);
+    ArrayAppend(&e->Fixups, ((Fixup){ .Position = e->Code.Count, .Target = label }));
+    Emit32(e, 0);
+}
+
+static void EmitJumpIf(Emitter* e, const ConditionCode cc, const uint32_t label)
+{
+    Emit8(e, 0x0F);
+    Emit8(e, (uint8_t)(0x80 | cc));
+    ArrayAppend(&e->Fixups, ((Fixup){ .Position = e->Code.Count, .Target = label }));
+    Emit32(e, 0);
+}
+
+// Forward jump within the code of a single instruction, returns the position to pass to PatchForwardJump
+static size_t EmitForwardJumpIf(Emitter* e, const ConditionCode cc)
+{
+    Emit8(e, 0x0F);
+    Emit8(e, (uint8_t)(0x80 | cc));
+    Emit32(e, 0);
+    return e->Code.Count - 4;
+}
+
+static size_t EmitForwardJump(Emitter* e)
+{
+    Emit8(e, 0xE9);
+    Emit32(e, 0);
+    return e->Code.Count - 4;
+}
+
+static void PatchForwardJump(Emitter* e, const size_t position)
+{
+    const uint32_t distance = (uint32_t)(e->Code.Count - (position + 4));
+    memcpy(&e->Code.Items[position], &distance, sizeof(distance));
+}
+
+// Jumps to the target of the branch at index, counting the jump in the profile when it closes a loop. Clobbers eax
+static void EmitBranch(Emitter* e, const bool conditional, const ConditionCode cc, const uint32_t target, const uint32_t index)
+{
+    if (target > index) {
+        if (conditional)
+            EmitJumpIf(e, cc, target);
+        else
+            EmitJump(e, target);
+        return;
+    }
+
+    // Condition codes come in pairs that differ in the lowest bit only
+    size_t notTaken = 0;
+    if (conditional)
+        notTaken = EmitForwardJumpIf(e, (ConditionCode)(cc ^ 1));
+    // add dword [BackedgeCount], 1
+    EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)&e->Profile->BackedgeCount);
+    EmitMemory(e, false, 0x83, 0, RAX, 0);
+    Emit8(e, 1);
+    if (e->OptimizeThreshold > 0) {
+        // cmp dword [BackedgeCount], threshold. The stack is in memory at branches, so the frame is as the
+        // interpreter has it at the loop header
+        EmitMemory(e, false, 0x81, 7, RAX, 0);
+        Emit32(e, e->OptimizeThreshold);
+        const size_t below = EmitForwardJumpIf(e, CC_NE);
+        EmitRegister(e, true, 0x89, FRAME_REGISTER, ARGUMENT_0);
+        EmitRegister(e, false, 0xC7, 0, ARGUMENT_1);
+        Emit32(e, target);
+        EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)&RuntimeOptimizeLoop);
+        EmitRegister(e, false, 0xFF, 2, RAX);
+        // test eax, eax. Leaves with the result unless it is OSR_CONTINUE
+        EmitRegister(e, false, 0x85, RAX, RAX);
+        EmitJumpIf(e, CC_NS, e->ExitLabel);
+        PatchForwardJump(e, below);
+    }
+    EmitJump(e, target);
+    if (conditional)
+        PatchForwardJump(e, notTaken);
+}
+
+// Emits mov reg, value
+static void EmitLoadValue(Emitter* e, const Register reg, const Value value)
+{
+    switch (value.Kind) {
+        case VALUE_CONSTANT:
+        {
+            EmitRegister(e, false, 0xC7, 0, reg);
+            Emit32(e, (uint32_t)value.As);
+            break;
+        }
+        case VALUE_LOCAL:
+        {
+            EmitMemory(e, false, 0x8B, reg, LOCALS_REGISTER, SLOT_OFFSET(value.As));
+            break;
+        }
+        case VALUE_REGISTER:
+        {
+            if ((Register)value.As != reg)
+                EmitRegister(e, false, 0x89, (Register)value.As, reg);
+            break;
+        }
+        case VALUE_MEMORY:
+        {
+            // Only ever in its own slot
+            EmitMemory(e, false, 0x8B, reg, STACK_REGISTER, SLOT_OFFSET(value.As));
+            break;
+        }
+        case VALUE_SPILL:
+        {
+            EmitMemory(e, false, 0x8B, reg, RSP, SPILL_OFFSET(value.As));
+            break;
+        }
+    }
+}
+
+// Emits op reg, value
+static void EmitAluOp(Emitter* e, const AluOp op, const Register reg, const Value value)
+{
+    switch (value.Kind) {
+        case VALUE_CONSTANT:
+        {
+            if (op.Opcode == ALU_MUL.Opcode)
+                EmitRegister(e, false, 0x69, reg, reg);
+            else
+                EmitRegister(e, false, 0x81, op.ImmediateExtension, reg);
+            Emit32(e, (uint32_t)value.As);
+            break;
+        }
+        case VALUE_LOCAL:
+            EmitMemory(e, false, op.Opcode, reg, LOCALS_REGISTER, SLOT_OFFSET(value.As));
+            break;
+        case VALUE_REGISTER:
+            EmitRegister(e, false, op.Opcode, reg, (Register)value.As);
+            break;
+        case VALUE_MEMORY:
+            EmitMemory(e, false, op.Opcode, reg, STACK_REGISTER, SLOT_OFFSET(value.As));
+            break;
+        case VALUE_SPILL:
+            EmitMemory(e, false, op.Opcode, reg, RSP, SPILL_OFFSET(value.As));
+            break;
+    }
+}
+
+// Writes the value into stack slot index, which must be the slot it belongs to or a free one
+static void EmitStoreValue(Emitter* e, const uint32_t index, const Value value)
+{
+    switch (value.Kind) {
+        case VALUE_CONSTANT:
+        {
+            EmitMemory(e, false, 0xC7, 0, STACK_REGISTER, SLOT_OFFSET(index));
+            Emit32(e, (uint32_t)value.As);
+            break;
+        }
+        case VALUE_LOCAL:
+        {
+            EmitLoadValue(e, RAX, value);
+            EmitMemory(e, false, 0x89, RAX, STACK_REGISTER, SLOT_OFFSET(index));
+            break;
+        }
+        case VALUE_REGISTER:
+        {
+            EmitMemory(e, false, 0x89, (Register)value.As, STACK_REGISTER, SLOT_OFFSET(index));
+            break;
+        }
+        case VALUE_MEMORY:
+            assert((uint32_t)value.As == index && "Stack values only live in their own slot");
+            break;
+        case VALUE_SPILL:
+            assert(false && "Spill slots belong to the optimizing tier");
+            break;
+    }
+}
+
+// Writes the values that aren't in their stack slot yet. When commit is false the values are written for a side exit
+// and the compiler keeps tracking them where they were
+static void EmitFlush(Emitter* e, const bool commit)
+{
+    for (uint16_t i = 0; i < e->Depth; i++) {
+        EmitStoreValue(e, i, e->Stack[i]);
+        if (commit)
+            e->Stack[i] = (Value){ .Kind = VALUE_MEMORY, .As = i };
+    }
+}
+
+// Starts tracking a stack that is entirely in memory
+static void ResetStack(Emitter* e, const uint16_t depth)
+{
+    e->Depth = depth;
+    for (uint16_t i = 0; i < depth; i++)
+        e->Stack[i] = (Value){ .Kind = VALUE_MEMORY, .As = i };
+    e->Live = true;
+}
+
+static void PushValue(Emitter* e, const ValueKind kind, const int32_t as)
+{
+    e->Stack[e->Depth++] = (Value){ .Kind = kind, .As = as };
+}
+
+static Value PopValue(Emitter* e)
+{
+    assert(e->Depth > 0);
+    return e->Stack[--e->Depth];
+}
+
+static bool IsRegisterUsed(const Emitter* e, const Register reg)
+{
+    for (uint16_t i = 0; i < e->Depth; i++) {
+        if (e->Stack[i].Kind == VALUE_REGISTER && (Register)e->Stack[i].As == reg)
+            return true;
+    }
+    return false;
+}
+
+// Spills the values held in the register to their stack slots
+static void SpillRegister(Emitter* e, const Register reg)
+{
+    for (uint16_t i = 0; i < e->Depth; i++) {
+        if (e->Stack[i].Kind == VALUE_REGISTER && (Register)e->Stack[i].As == reg) {
+            EmitStoreValue(e, i, e->Stack[i]);
+            e->Stack[i] = (Value){ .Kind = VALUE_MEMORY, .As = i };
+        }
+    }
+}
+
+// Value register not used by the stack nor the avoided one, spilling the deepest value when they are all taken
+static Register AllocateRegister(Emitter* e, const Register avoid)
+{
+    for (Register reg = FIRST_VALUE_REGISTER; reg < FIRST_VALUE_REGISTER + VALUE_REGISTER_COUNT; reg++) {
+        if (reg != avoid && !IsRegisterUsed(e, reg))
+            return reg;
+    }
+    for (uint16_t i = 0; i < e->Depth; i++) {
+        if (e->Stack[i].Kind == VALUE_REGISTER && (Register)e->Stack[i].As != avoid) {
+            const Register reg = (Register)e->Stack[i].As;
+            SpillRegister(e, reg);
+            return reg;
+        }
+    }
+    assert(false && "No value register left");
+    return RAX;
+}
+
+// Register to compute a result from lhs into, reusing lhs when nothing else refers to it
+static Register AllocateResultRegister(Emitter* e, const Value lhs, const Value rhs)
+{
+    if (lhs.Kind == VALUE_REGISTER && !IsRegisterUsed(e, (Register)lhs.As) && !(rhs.Kind == VALUE_REGISTER && rhs.As == lhs.As))
+        return (Register)lhs.As;
+    return AllocateRegister(e, rhs.Kind == VALUE_REGISTER ? (Register)rhs.As : RAX);
+}
+
+// Loads values still in a local before the local gets written
+static void DetachLocal(Emitter* e, const uint16_t index)
+{
+    for (uint16_t i = 0; i < e->Depth; i++) {
+        if (e->Stack[i].Kind == VALUE_LOCAL && e->Stack[i].As == index) {
+            EmitStoreValue(e, i, e->Stack[i]);
+            e->Stack[i] = (Value){ .Kind = VALUE_MEMORY, .As = i };
+        }
+    }
+}
+
+// Hands the instruction to the runtime with the operand stack written out as it is on entry to it, leaving when it
+// fails
+static void EmitRuntimeCall(Emitter* e, Instruction* inst)
+{
+    EmitRegister(e, true, 0x89, FRAME_REGISTER, ARGUMENT_0);
+    EmitMoveImmediate64(e, ARGUMENT_1, (uint64_t)(uintptr_t)inst);
+    EmitMemory(e, true, 0x8D, ARGUMENT_2, STACK_REGISTER, SLOT_OFFSET(e->Depth));
+    EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)&RuntimeExecuteInstruction);
+    // call rax
+    EmitRegister(e, false, 0xFF, 2, RAX);
+    // test al, al
+    EmitRegister(e, false, 0x84, RAX, RAX);
+    EmitJumpIf(e, CC_E, e->FailLabel);
+}
+
+static void EmitBinary(Emitter* e, const AluOp op)
+{
+    const Value rhs = PopValue(e);
+    const Value lhs = PopValue(e);
+    const Register reg = AllocateResultRegister(e, lhs, rhs);
+    EmitLoadValue(e, reg, lhs);
+    EmitAluOp(e, op, reg, rhs);
+    PushValue(e, VALUE_REGISTER, reg);
+}
+
+// extension is that of the shift by cl or imm8, both of which mask the distance to 5 bits like Java does
+static void EmitShift(Emitter* e, const uint8_t extension)
+{
+    const Value rhs = PopValue(e);
+    const Value lhs = PopValue(e);
+    const Register reg = AllocateResultRegister(e, lhs, rhs);
+    if (rhs.Kind == VALUE_CONSTANT) {
+        EmitLoadValue(e, reg, lhs);
+        EmitRegister(e, false, 0xC1, extension, reg);
+        Emit8(e, (uint8_t)(rhs.As & 0x1F));
+    } else {
+        EmitLoadValue(e, RCX, rhs);
+        EmitLoadValue(e, reg, lhs);
+        EmitRegister(e, false, 0xD3, extension, reg);
+    }
+    PushValue(e, VALUE_REGISTER, reg);
+}
+
+static void EmitDivide(Emitter* e, Instruction* inst, const bool remainder)
+{
+    const Value rhs = e->Stack[e->Depth - 1];
+    const Value lhs = e->Stack[e->Depth - 2];
+    EmitLoadValue(e, RCX, rhs);
+    EmitLoadValue(e, RAX, lhs);
+
+    // test ecx, ecx. The runtime throws the ArithmeticException from a stack written out as the interpreter has it
+    EmitRegister(e, false, 0x85, RCX, RCX);
+    const size_t notZero = EmitForwardJumpIf(e, CC_NE);
+    EmitFlush(e, false);
+    EmitRuntimeCall(e, inst);
+    EmitJump(e, e->FailLabel);
+    PatchForwardJump(e, notZero);
+
+    e->Depth -= 2;
+    const Register reg = AllocateRegister(e, RAX);
+    // idiv traps on INT_MIN / -1 where Java gives back the dividend, so -1 negates instead. cmp ecx, -1
+    EmitRegister(e, false, 0x83, 7, RCX);
+    Emit8(e, 0xFF);
+    const size_t notMinusOne = EmitForwardJumpIf(e, CC_NE);
+    if (remainder)
+        EmitRegister(e, false, 0x31, RAX, RAX);
+    else
+        EmitRegister(e, false, 0xF7, 3, RAX);
+    const size_t done = EmitForwardJump(e);
+    PatchForwardJump(e, notMinusOne);
+    // cdq, idiv ecx
+    Emit8(e, 0x99);
+    EmitRegister(e, false, 0xF7, 7, RCX);
+    if (remainder)
+        EmitRegister(e, false, 0x89, RDX, RAX);
+    PatchForwardJump(e, done);
+    EmitRegister(e, false, 0x89, RAX, reg);
+    PushValue(e, VALUE_REGISTER, reg);
+}
+
+// Duplicates the count values on top of the stack and inserts the copy below the skip values under them
+static void EmitDuplicate(Emitter* e, const uint8_t count, const uint8_t skip)
+{
+    if (count == 1 && skip == 0) {
+        Value value = e->Stack[e->Depth - 1];
+        // A memory value has to be copied, it can't live in two slots
+        if (value.Kind == VALUE_MEMORY) {
+            const Register reg = AllocateRegister(e, RAX);
+            EmitLoadValue(e, reg, value);
+            value = (Value){ .Kind = VALUE_REGISTER, .As = reg };
+            e->Stack[e->Depth - 1] = value;
+        }
+        e->Stack[e->Depth++] = value;
+        return;
+    }
+
+    // The rest shuffle the stack in memory like the interpreter does
+    EmitFlush(e, true);
+    const uint32_t depth = e->Depth;
+    const uint32_t base = depth - count - skip;
+    // Moves the skipped and duplicated slots up by count, starting from the top since the ranges overlap
+    for (uint32_t i = depth + count; i-- > base + count;) {
+        EmitMemory(e, false, 0x8B, RAX, STACK_REGISTER, SLOT_OFFSET(i - count));
+        EmitMemory(e, false, 0x89, RAX, STACK_REGISTER, SLOT_OFFSET(i));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        EmitMemory(e, false, 0x8B, RAX, STACK_REGISTER, SLOT_OFFSET(depth + i));
+        EmitMemory(e, false, 0x89, RAX, STACK_REGISTER, SLOT_OFFSET(base + i));
+    }
+    ResetStack(e, (uint16_t)(depth + count));
+}
+
+static void EmitSwap(Emitter* e)
+{
+    Value* top = &e->Stack[e->Depth - 1];
+    if (top[0].Kind != VALUE_MEMORY && top[-1].Kind != VALUE_MEMORY) {
+        const Value value = top[0];
+        top[0] = top[-1];
+        top[-1] = value;
+        return;
+    }
+
+    EmitFlush(e, true);
+    EmitMemory(e, false, 0x8B, RAX, STACK_REGISTER, SLOT_OFFSET(e->Depth - 1u));
+    EmitMemory(e, false, 0x8B, RCX, STACK_REGISTER, SLOT_OFFSET(e->Depth - 2u));
+    EmitMemory(e, false, 0x89, RCX, STACK_REGISTER, SLOT_OFFSET(e->Depth - 1u));
+    EmitMemory(e, false, 0x89, RAX, STACK_REGISTER, SLOT_OFFSET(e->Depth - 2u));
+}
+
+static void EmitStoreLocal(Emitter* e, const uint16_t index)
+{
+    const Value value = PopValue(e);
+    DetachLocal(e, index);
+    if (value.Kind == VALUE_LOCAL && value.As == index)
+        return;
+
+    if (value.Kind == VALUE_CONSTANT) {
+        EmitMemory(e, false, 0xC7, 0, LOCALS_REGISTER, SLOT_OFFSET(index));
+        Emit32(e, (uint32_t)value.As);
+        return;
+    }
+
+    Register reg = RAX;
+    if (value.Kind == VALUE_REGISTER)
+        reg = (Register)value.As;
+    else
+        EmitLoadValue(e, RAX, value);
+    EmitMemory(e, false, 0x89, reg, LOCALS_REGISTER, SLOT_OFFSET(index));
+}
+
+// Compares the value against 0, flags are set for the jcc that follows
+static void EmitTest(Emitter* e, const Value value)
+{
+    if (value.Kind == VALUE_REGISTER) {
+        EmitRegister(e, false, 0x85, (Register)value.As, (Register)value.As);
+        return;
+    }
+    EmitLoadValue(e, RAX, value);
+    EmitRegister(e, false, 0x85, RAX, RAX);
+}
+
+static void EmitReturn(Emitter* e)
+{
+    // The VM takes the return value from the top of the frame's stack
+    EmitFlush(e, true);
+    EmitMemory(e, true, 0x8D, RAX, STACK_REGISTER, SLOT_OFFSET(e->Depth));
+    EmitMemory(e, true, 0x89, RAX, FRAME_REGISTER, (int32_t)offsetof(Frame, Stack));
+    // mov eax, 1
+    Emit8(e, 0xB8);
+    Emit32(e, 1);
+    EmitJump(e, e->ExitLabel);
+    e->Live = false;
+}
+
+static ConditionCode GetConditionCode(const InstructionOp op)
+{
+    switch (op) {
+        case INST_IF_EQ:
+        case INST_IF_ICMP_EQ:
+        case INST_IF_NULL:
+            return CC_E;
+        case INST_IF_NE:
+        case INST_IF_ICMP_NE:
+        case INST_IF_NON_NULL:
+            return CC_NE;
+        case INST_IF_LT:
+        case INST_IF_ICMP_LT:
+            return CC_L;
+        case INST_IF_GE:
+        case INST_IF_ICMP_GE:
+            return CC_GE;
+        case INST_IF_GT:
+        case INST_IF_ICMP_GT:
+            return CC_G;
+        case INST_IF_LE:
+        case INST_IF_ICMP_LE:
+            return CC_LE;
+        default:
+            assert(false && "Not a conditional branch");
+            return CC_E;
+    }
+}
+
+static bool IsBranch(const InstructionOp op)
+{
+    return op >= INST_IF_EQ && op <= INST_GOTO;
+}
+
+// Superinstructions are compiled as the instructions they cover, which are still in the stream
+static void EmitInstruction(Emitter* e, Instruction* inst, const uint32_t index)
+{
+    const InstructionOp op = GetUnfusedOp((InstructionOp)inst->Op);
+    switch (op) {
+        case INST_PUSH_INT:
+        case INST_PUSH_FLOAT:
+        case INST_PUSH_STRING_QUICK:
+            PushValue(e, VALUE_CONSTANT, inst->B);
+            break;
+        case INST_PUSH_NULL:
+            PushValue(e, VALUE_CONSTANT, 0);
+            break;
+        case INST_LOAD_INT:
+        case INST_LOAD_REFERENCE:
+            PushValue(e, VALUE_LOCAL, inst->A);
+            break;
+        case INST_STORE_INT:
+        case INST_STORE_REFERENCE:
+            EmitStoreLocal(e, inst->A);
+            break;
+        case INST_POP:
+            e->Depth -= 1;
+            break;
+        case INST_POP2:
+            e->Depth -= 2;
+            break;
+        case INST_DUP:     EmitDuplicate(e, 1, 0); break;
+        case INST_DUP_X1:  EmitDuplicate(e, 1, 1); break;
+        case INST_DUP_X2:  EmitDuplicate(e, 1, 2); break;
+        case INST_DUP2:    EmitDuplicate(e, 2, 0); break;
+        case INST_DUP2_X1: EmitDuplicate(e, 2, 1); break;
+        case INST_DUP2_X2: EmitDuplicate(e, 2, 2); break;
+        case INST_SWAP:    EmitSwap(e); break;
+        case INST_ADD_INT: EmitBinary(e, ALU_ADD); break;
+        case INST_SUB_INT: EmitBinary(e, ALU_SUB); break;
+        case INST_MUL_INT: EmitBinary(e, ALU_MUL); break;
+        case INST_AND_INT: EmitBinary(e, ALU_AND); break;
+        case INST_OR_INT:  EmitBinary(e, ALU_OR); break;
+        case INST_XOR_INT: EmitBinary(e, ALU_XOR); break;
+        case INST_SHL_INT:  EmitShift(e, 4); break;
+        case INST_SHR_INT:  EmitShift(e, 7); break;
+        case INST_USHR_INT: EmitShift(e, 5); break;
+        case INST_DIV_INT: EmitDivide(e, inst, false); break;
+        case INST_REM_INT: EmitDivide(e, inst, true); break;
+        case INST_NEG_INT:
+        case INST_INT_TO_BYTE:
+        case INST_INT_TO_CHAR:
+        case INST_INT_TO_SHORT:
+        {
+            const Value value = PopValue(e);
+            const Register reg = AllocateResultRegister(e, value, (Value){ .Kind = VALUE_CONSTANT });
+            EmitLoadValue(e, reg, value);
+            if (op == INST_NEG_INT)
+                EmitRegister(e, false, 0xF7, 3, reg);
+            else if (op == INST_INT_TO_BYTE)
+                EmitByteRegister(e, 0x0FBE, reg, reg);
+            else if (op == INST_INT_TO_CHAR)
+                EmitRegister(e, false, 0x0FB7, reg, reg);
+            else
+                EmitRegister(e, false, 0x0FBF, reg, reg);
+            PushValue(e, VALUE_REGISTER, reg);
+            break;
+        }
+        case INST_INC_INT:
+        {
+            DetachLocal(e, inst->A);
+            // add dword [local], imm32
+            EmitMemory(e, false, 0x81, 0, LOCALS_REGISTER, SLOT_OFFSET(inst->A));
+            Emit32(e, (uint32_t)(int32_t)(int8_t)inst->B);
+            break;
+        }
+        case INST_IF_EQ:
+        case INST_IF_NE:
+        case INST_IF_LT:
+        case INST_IF_GE:
+        case INST_IF_GT:
+        case INST_IF_LE:
+        case INST_IF_NULL:
+        case INST_IF_NON_NULL:
+        {
+            // Both paths start from a stack in memory, the flush only moves data and leaves the flags alone
+            const Value value = PopValue(e);
+            EmitFlush(e, true);
+            EmitTest(e, value);
+            EmitBranch(e, true, GetConditionCode(op), (uint32_t)inst->B, index);
+            break;
+        }
+        case INST_IF_ICMP_EQ:
+        case INST_IF_ICMP_NE:
+        case INST_IF_ICMP_LT:
+        case INST_IF_ICMP_GE:
+        case INST_IF_ICMP_GT:
+        case INST_IF_ICMP_LE:
+        {
+            const Value rhs = PopValue(e);
+            const Value lhs = PopValue(e);
+            EmitFlush(e, true);
+            Register reg = RAX;
+            if (lhs.Kind == VALUE_REGISTER)
+                reg = (Register)lhs.As;
+            else
+                EmitLoadValue(e, RAX, lhs);
+            EmitAluOp(e, ALU_CMP, reg, rhs);
+            EmitBranch(e, true, GetConditionCode(op), (uint32_t)inst->B, index);
+            break;
+        }
+        case INST_GOTO:
+        {
+            EmitFlush(e, true);
+            EmitBranch(e, false, CC_E, (uint32_t)inst->B, index);
+            e->Live = false;
+            break;
+        }
+        case INST_RETURN_INT:
+        case INST_RETURN_REFERENCE:
+        case INST_RETURN:
+            EmitReturn(e);
+            break;
+        default:
+        {
+            // Resolution, calls and printing are left to the runtime, which leaves its results in memory
+            EmitFlush(e, true);
+            EmitRuntimeCall(e, inst);
+            assert(index + 1 < e->Translated->Count);
+            ResetStack(e, e->Translated->StackDepths[index + 1]);
+            break;
+        }
+    }
+}
+
+static void EmitPrologue(Emitter* e)
+{
+    EmitPush(e, LOCALS_REGISTER);
+    EmitPush(e, STACK_REGISTER);
+    EmitPush(e, FRAME_REGISTER);
+    // Three pushes after the return address leave the stack 16 byte aligned for calls
+#if SHADOW_SPACE > 0
+    // sub rsp, imm8
+    EmitRegister(e, true, 0x83, 5, RSP);
+    Emit8(e, SHADOW_SPACE);
+#endif
+    EmitRegister(e, true, 0x89, ARGUMENT_0, FRAME_REGISTER);
+    EmitMemory(e, true, 0x8B, LOCALS_REGISTER, FRAME_REGISTER, (int32_t)offsetof(Frame, Locals));
+    EmitMemory(e, true, 0x8B, STACK_REGISTER, FRAME_REGISTER, (int32_t)offsetof(Frame, StackStart));
+}
+
+static void EmitEpilogue(Emitter* e)
+{
+    e->Labels[e->FailLabel] = e->Code.Count;
+    // xor eax, eax
+    EmitRegister(e, false, 0x31, RAX, RAX);
+    e->Labels[e->ExitLabel] = e->Code.Count;
+#if SHADOW_SPACE > 0
+    // add rsp, imm8
+    EmitRegister(e, true, 0x83, 0, RSP);
+    Emit8(e, SHADOW_SPACE);
+#endif
+    EmitPop(e, FRAME_REGISTER);
+    EmitPop(e, STACK_REGISTER);
+    EmitPop(e, LOCALS_REGISTER);
+    Emit8(e, 0xC3);
+}
+
+// Points every jump at its label now that they are all placed
+static void PatchFixups(Emitter* e)
+{
+    for (uint32_t i = 0; i < e->Fixups.Count; i++) {
+        const Fixup* fixup = &e->Fixups.Items[i];
+        const int32_t distance = (int32_t)((int64_t)e->Labels[fixup->Target] - (int64_t)(fixup->Position + 4));
+        memcpy(&e->Code.Items[fixup->Position], &distance, sizeof(distance));
+    }
+}
+
+// Loop headers are the targets of backward branches
+static bool IsLoopHeader(const TranslatedCode* tc, const uint32_t index, const bool* loopHeaders)
+{
+    return loopHeaders[index] && tc->StackDepths[index] != VERIFIER_UNREACHABLE;
+}
+
+bool JitCompile(TranslatedCode* tc, MethodProfile* profile, const uint32_t optimizeThreshold)
+{
+    assert(!tc->Compiled && "Method already compiled");
+    if (CODE_CACHE.Full)
+        return false;
+
+    Emitter e = { .Translated = tc, .Profile = profile, .OptimizeThreshold = optimizeThreshold };
+    // Most instructions compile to less than 16 bytes, the buffer grows for the rest
+    e.Code.Capacity = tc->Count * 16 + 64;
+    e.Code.Items = malloc(e.Code.Capacity);
+    e.Labels = malloc((tc->Count + 2) * sizeof(size_t));
+    e.FailLabel = tc->Count;
+    e.ExitLabel = tc->Count + 1;
+    // The frame size bounds the operand stack
+    e.Stack = malloc((tc->FrameSize + 1) * sizeof(Value));
+    bool* branchTargets = calloc(tc->Count, sizeof(bool));
+    bool* loopHeaders = calloc(tc->Count, sizeof(bool));
+    size_t* osrOffsets = malloc(tc->Count * sizeof(size_t));
+    assert(e.Code.Items && e.Labels && e.Stack && branchTargets && loopHeaders && osrOffsets);
+
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        const Instruction* inst = &tc->Instructions[i];
+        if (IsBranch(GetUnfusedOp((InstructionOp)inst->Op))) {
+            branchTargets[inst->B] = true;
+            if ((uint32_t)inst->B <= i)
+                loopHeaders[inst->B] = true;
+        }
+    }
+
+    EmitPrologue(&e);
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        // Every path into a branch target agrees on a stack that is entirely in memory
+        if (branchTargets[i] && e.Live)
+            EmitFlush(&e, true);
+        e.Labels[i] = e.Code.Count;
+
+        // Never reached, so there is no stack depth to compile it with
+        if (tc->StackDepths[i] == VERIFIER_UNREACHABLE) {
+            e.Live = false;
+            continue;
+        }
+        if (!e.Live || branchTargets[i])
+            ResetStack(&e, tc->StackDepths[i]);
+        assert(e.Depth == tc->StackDepths[i]);
+        EmitInstruction(&e, &tc->Instructions[i], i);
+    }
+    EmitEpilogue(&e);
+
+    // OSR entries set up the same registers and jump into the loop, where the stack is all in memory
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        if (!IsLoopHeader(tc, i, loopHeaders))
+            continue;
+        osrOffsets[i] = e.Code.Count;
+        EmitPrologue(&e);
+        EmitJump(&e, i);
+    }
+
+    PatchFixups(&e);
+    uint8_t* code = CodeCacheInstall(e.Code.Items, e.Code.Count);
+    if (code) {
+        tc->OsrEntries = ArenaAlloc((Arena*)&profile->Class->Arena, tc->Count * sizeof(void*));
+        for (uint32_t i = 0; i < tc->Count; i++) {
+            if (IsLoopHeader(tc, i, loopHeaders))
+                tc->OsrEntries[i] = code + osrOffsets[i];
+        }
+        tc->Compiled = code;
+        tc->BaselineCompiled = code;
+    }
+
+    ArrayFree(&e.Code);
+    ArrayFree(&e.Fixups);
+    free(e.Labels);
+    free(e.Stack);
+    free(branchTargets);
+    free(loopHeaders);
+    free(osrOffsets);
+    return tc->Compiled != NULL;
+}
+
+// The optimizing tier allocates values to these, callee saved ones first so values that live across runtime calls
+// mostly don't need saving. rbp holds the locals base instead of rbx, r12 and r13 are the same as in baseline code
+static const Register OPTIMIZED_REGISTERS[] = { RBX, R14, R15, RSI, RDI, R8, R9, R10, R11 };
+#define OPTIMIZED_REGISTER_COUNT ((uint32_t)(sizeof(OPTIMIZED_REGISTERS) / sizeof(OPTIMIZED_REGISTERS[0])))
+// The rest are caller saved in the System V convention and get saved around runtime calls. Every register has a save
+// slot after the spill slots, deoptimizing saves all of them
+#define OPTIMIZED_CALLEE_SAVED 3
+#define SAVE_SLOT(g, index) ((g)->SpillSlots + (index))
+#define OPTIMIZED_LOCALS_REGISTER RBP
+// rsi and rdi are callee saved on Windows
+static const Register OPTIMIZED_PUSHED_REGISTERS[] = { RBX, RBP, R12, R13, R14, R15, RSI, RDI };
+#define OPTIMIZED_PUSHED_COUNT ((uint32_t)(sizeof(OPTIMIZED_PUSHED_REGISTERS) / sizeof(OPTIMIZED_PUSHED_REGISTERS[0])))
+
+// A move between registers and spill slots, done at the same time as the others of a phi move
+typedef struct
+{
+    Value Destination;
+    Value Source;
+} Move;
+
+static Value GetNodeValue(const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    if (node->Op == IR_CONSTANT)
+        return (Value){ .Kind = VALUE_CONSTANT, .As = node->Constant };
+    assert(node->Location != IR_LOCATION_NONE && "Value without a location");
+    if (node->Location >= 0)
+        return (Value){ .Kind = VALUE_REGISTER, .As = (int32_t)OPTIMIZED_REGISTERS[node->Location] };
+    return (Value){ .Kind = VALUE_SPILL, .As = IR_SPILL_SLOT(node->Location) };
+}
+
+static bool IsSameValue(const Value a, const Value b)
+{
+    return a.Kind == b.Kind && a.As == b.As;
+}
+
+// Register the node's result is computed in, its own unless it was spilled
+static Register GetResultRegister(const Value destination)
+{
+    return destination.Kind == VALUE_REGISTER ? (Register)destination.As : RAX;
+}
+
+// mov dword [base + disp], value
+static void EmitStoreMemory(Emitter* e, const Register base, const int32_t disp, const Value value)
+{
+    if (value.Kind == VALUE_CONSTANT) {
+        EmitMemory(e, false, 0xC7, 0, base, disp);
+        Emit32(e, (uint32_t)value.As);
+        return;
+    }
+    Register reg = RAX;
+    if (value.Kind == VALUE_REGISTER)
+        reg = (Register)value.As;
+    else
+        EmitLoadValue(e, RAX, value);
+    EmitMemory(e, false, 0x89, reg, base, disp);
+}
+
+// Moves the value into a register or spill slot
+static void EmitMove(Emitter* e, const Value destination, const Value value)
+{
+    if (IsSameValue(destination, value))
+        return;
+    if (destination.Kind == VALUE_REGISTER) {
+        EmitLoadValue(e, (Register)destination.As, value);
+        return;
+    }
+    assert(destination.Kind == VALUE_SPILL);
+    EmitStoreMemory(e, RSP, SPILL_OFFSET(destination.As), value);
+}
+
+static void EmitLoadFrame(Emitter* e, const IrGraph* g, const uint32_t id, const Register base)
+{
+    const Value destination = GetNodeValue(g, id);
+    const Register reg = GetResultRegister(destination);
+    EmitMemory(e, false, 0x8B, reg, base, SLOT_OFFSET(IrGetNode(g, id)->Constant));
+    EmitMove(e, destination, (Value){ .Kind = VALUE_REGISTER, .As = reg });
+}
+
+static AluOp GetAluOp(const IrOp op)
+{
+    switch (op) {
+        case IR_ADD: return ALU_ADD;
+        case IR_SUB: return ALU_SUB;
+        case IR_MUL: return ALU_MUL;
+        case IR_AND: return ALU_AND;
+        case IR_OR:  return ALU_OR;
+        case IR_XOR: return ALU_XOR;
+        default:
+            assert(false && "Not an ALU op");
+            return ALU_ADD;
+    }
+}
+
+static void EmitIrBinary(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const Value destination = GetNodeValue(g, id);
+    Value lhs = GetNodeValue(g, node->Inputs[0]);
+    Value rhs = GetNodeValue(g, node->Inputs[1]);
+    Register reg = GetResultRegister(destination);
+    // Loading lhs would overwrite rhs, all of these but sub can take their operands the other way around
+    if (rhs.Kind == VALUE_REGISTER && (Register)rhs.As == reg && !IsSameValue(lhs, rhs)) {
+        if (node->Op != IR_SUB) {
+            rhs = lhs;
+            lhs = GetNodeValue(g, node->Inputs[1]);
+        } else {
+            reg = RAX;
+        }
+    }
+    EmitLoadValue(e, reg, lhs);
+    EmitAluOp(e, GetAluOp((IrOp)node->Op), reg, rhs);
+    EmitMove(e, destination, (Value){ .Kind = VALUE_REGISTER, .As = reg });
+}
+
+// extension is that of the shift by cl or imm8, both of which mask the distance to 5 bits like Java does
+static void EmitIrShift(Emitter* e, const IrGraph* g, const uint32_t id, const uint8_t extension)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const Value destination = GetNodeValue(g, id);
+    const Value lhs = GetNodeValue(g, node->Inputs[0]);
+    const Value rhs = GetNodeValue(g, node->Inputs[1]);
+    const Register reg = GetResultRegister(destination);
+    if (rhs.Kind == VALUE_CONSTANT) {
+        EmitLoadValue(e, reg, lhs);
+        EmitRegister(e, false, 0xC1, extension, reg);
+        Emit8(e, (uint8_t)(rhs.As & 0x1F));
+    } else {
+        EmitLoadValue(e, RCX, rhs);
+        EmitLoadValue(e, reg, lhs);
+        EmitRegister(e, false, 0xD3, extension, reg);
+    }
+    EmitMove(e, destination, (Value){ .Kind = VALUE_REGISTER, .As = reg });
+}
+
+static void EmitIrUnary(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const Value destination = GetNodeValue(g, id);
+    const Register reg = GetResultRegister(destination);
+    EmitLoadValue(e, reg, GetNodeValue(g, node->Inputs[0]));
+    if (node->Op == IR_NEG)
+        EmitRegister(e, false, 0xF7, 3, reg);
+    else if (node->Op == IR_TO_BYTE)
+        EmitByteRegister(e, 0x0FBE, reg, reg);
+    else if (node->Op == IR_TO_CHAR)
+        EmitRegister(e, false, 0x0FB7, reg, reg);
+    else
+        EmitRegister(e, false, 0x0FBF, reg, reg);
+    EmitMove(e, destination, (Value){ .Kind = VALUE_REGISTER, .As = reg });
+}
+
+static void EmitIrDivide(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const bool remainder = node->Op == IR_REM;
+    const Value rhs = GetNodeValue(g, node->Inputs[1]);
+    EmitLoadValue(e, RCX, rhs);
+    EmitLoadValue(e, RAX, GetNodeValue(g, node->Inputs[0]));
+
+    if (rhs.Kind != VALUE_CONSTANT || rhs.As == 0) {
+        // test ecx, ecx. Nothing catches the exception, so the frame doesn't have to be written out for it
+        EmitRegister(e, false, 0x85, RCX, RCX);
+        const size_t notZero = EmitForwardJumpIf(e, CC_NE);
+        EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)&RuntimeThrowDivideByZero);
+        EmitRegister(e, false, 0xFF, 2, RAX);
+        EmitJump(e, e->FailLabel);
+        PatchForwardJump(e, notZero);
+    }
+
+    // Same as baseline code, -1 negates instead of trapping in idiv. cmp ecx, -1
+    EmitRegister(e, false, 0x83, 7, RCX);
+    Emit8(e, 0xFF);
+    const size_t notMinusOne = EmitForwardJumpIf(e, CC_NE);
+    if (remainder)
+        EmitRegister(e, false, 0x31, RAX, RAX);
+    else
+        EmitRegister(e, false, 0xF7, 3, RAX);
+    const size_t done = EmitForwardJump(e);
+    PatchForwardJump(e, notMinusOne);
+    // cdq, idiv ecx
+    Emit8(e, 0x99);
+    EmitRegister(e, false, 0xF7, 7, RCX);
+    if (remainder)
+        EmitRegister(e, false, 0x89, RDX, RAX);
+    PatchForwardJump(e, done);
+    EmitMove(e, GetNodeValue(g, id), (Value){ .Kind = VALUE_REGISTER, .As = RAX });
+}
+
+// Caller saved registers holding values that are live across the call at the position
+static void GetSavedRegisters(const IrGraph* g, const uint32_t position, bool* saved)
+{
+    memset(saved, 0, OPTIMIZED_REGISTER_COUNT * sizeof(bool));
+    for (uint32_t v = 0; v < g->Nodes.Count; v++) {
+        const IrNode* value = IrGetNode(g, v);
+        if (value->Location >= OPTIMIZED_CALLEE_SAVED && IrIsLiveAcross(value, position))
+            saved[value->Location] = true;
+    }
+}
+
+// Stores the registers to their save slots with 0x89, loads them back with 0x8B
+static void EmitSaveSlots(Emitter* e, const IrGraph* g, const bool* saved, const uint32_t opcode)
+{
+    for (uint32_t r = 0; r < OPTIMIZED_REGISTER_COUNT; r++) {
+        if (saved[r])
+            EmitMemory(e, false, opcode, OPTIMIZED_REGISTERS[r], RSP, SPILL_OFFSET(SAVE_SLOT(g, r)));
+    }
+}
+
+// Writes the locals and operand stack out, hands the instruction to the runtime and reloads the caller saved registers
+// holding values used after it. Leaves when the runtime fails
+static void EmitIrRuntimeCall(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const uint32_t localCount = node->InputCount - node->StackDepth;
+    for (uint32_t i = 0; i < node->InputCount; i++) {
+        if (node->Inputs[i] == IR_NONE)
+            continue;
+        const Value value = GetNodeValue(g, node->Inputs[i]);
+        if (i < localCount)
+            EmitStoreMemory(e, OPTIMIZED_LOCALS_REGISTER, SLOT_OFFSET(i), value);
+        else
+            EmitStoreMemory(e, STACK_REGISTER, SLOT_OFFSET(i - localCount), value);
+    }
+
+    bool saved[OPTIMIZED_REGISTER_COUNT];
+    GetSavedRegisters(g, node->Position, saved);
+    EmitSaveSlots(e, g, saved, 0x89);
+
+    const void* function = node->Op == IR_DIRECT_CALL ? (const void*)&RuntimeInvokeDirect : (const void*)&RuntimeExecuteInstruction;
+    EmitRegister(e, true, 0x89, FRAME_REGISTER, ARGUMENT_0);
+    EmitMoveImmediate64(e, ARGUMENT_1, (uint64_t)(uintptr_t)node->Instruction);
+    EmitMemory(e, true, 0x8D, ARGUMENT_2, STACK_REGISTER, SLOT_OFFSET(node->StackDepth));
+    EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)function);
+    EmitRegister(e, false, 0xFF, 2, RAX);
+    // test al, al
+    EmitRegister(e, false, 0x84, RAX, RAX);
+    EmitJumpIf(e, CC_E, e->FailLabel);
+
+    EmitSaveSlots(e, g, saved, 0x8B);
+}
+
+// The class of a reference is the runtime's business, so the check is a call too
+static void EmitIrHasClass(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    bool saved[OPTIMIZED_REGISTER_COUNT];
+    GetSavedRegisters(g, node->Position, saved);
+    EmitSaveSlots(e, g, saved, 0x89);
+
+    // The reference may be in the register of the second argument, but not the other way around
+    EmitLoadValue(e, ARGUMENT_0, GetNodeValue(g, node->Inputs[0]));
+    EmitMoveImmediate64(e, ARGUMENT_1, (uint64_t)(uintptr_t)node->Class);
+    EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)&RuntimeHasClass);
+    EmitRegister(e, false, 0xFF, 2, RAX);
+    // movzx eax, al
+    EmitByteRegister(e, 0x0FB6, RAX, RAX);
+
+    EmitSaveSlots(e, g, saved, 0x8B);
+    EmitMove(e, GetNodeValue(g, id), (Value){ .Kind = VALUE_REGISTER, .As = RAX });
+}
+
+// Where RuntimeDeoptimize finds the value, registers are read from their save slots
+static DeoptValue GetDeoptValue(const IrGraph* g, const uint32_t id)
+{
+    if (id == IR_NONE)
+        return (DeoptValue){ .Kind = DEOPT_EMPTY };
+    const IrNode* node = IrGetNode(g, id);
+    if (node->Op == IR_CONSTANT)
+        return (DeoptValue){ .Kind = DEOPT_CONSTANT, .As = node->Constant };
+    assert(node->Location != IR_LOCATION_NONE && "Value without a location");
+    const uint32_t slot = node->Location >= 0 ? SAVE_SLOT(g, (uint32_t)node->Location) : (uint32_t)IR_SPILL_SLOT(node->Location);
+    return (DeoptValue){ .Kind = DEOPT_SAVED, .As = (int32_t)slot };
+}
+
+// Saves every register next to the spill slots and hands both to the runtime along with where each value of the
+// interpreter frames is. The frame runs to its end interpreted
+static void EmitIrDeoptimize(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const DeoptInfo* frames = &g->Deoptimizations.Items[node->Constant];
+    // Lives as long as the code, which is as long as the class
+    Arena* arena = (Arena*)&e->Profile->Class->Arena;
+    DeoptInfo* info = ArenaAlloc(arena, sizeof(DeoptInfo));
+    info->FrameCount = frames->FrameCount;
+    info->Frames = ArenaAlloc(arena, frames->FrameCount * sizeof(DeoptFrame));
+    uint32_t input = 0;
+    for (uint32_t f = 0; f < frames->FrameCount; f++) {
+        DeoptFrame* frame = &info->Frames[f];
+        *frame = frames->Frames[f];
+        const uint32_t count = (uint32_t)frame->LocalCount + frame->StackDepth;
+        frame->Values = ArenaAlloc(arena, count * sizeof(DeoptValue));
+        for (uint32_t i = 0; i < count; i++)
+            frame->Values[i] = GetDeoptValue(g, node->Inputs[input++]);
+    }
+    assert(input == node->InputCount);
+
+    bool saved[OPTIMIZED_REGISTER_COUNT];
+    memset(saved, 1, sizeof(saved));
+    EmitSaveSlots(e, g, saved, 0x89);
+    EmitRegister(e, true, 0x89, FRAME_REGISTER, ARGUMENT_0);
+    EmitMoveImmediate64(e, ARGUMENT_1, (uint64_t)(uintptr_t)info);
+    EmitMemory(e, true, 0x8D, ARGUMENT_2, RSP, SPILL_OFFSET(0));
+    EmitMoveImmediate64(e, RAX, (uint64_t)(uintptr_t)&RuntimeDeoptimize);
+    EmitRegister(e, false, 0xFF, 2, RAX);
+    EmitJump(e, e->ExitLabel);
+}
+
+static ConditionCode GetIrConditionCode(const IrCondition condition)
+{
+    switch (condition) {
+        case IR_EQ: return CC_E;
+        case IR_NE: return CC_NE;
+        case IR_LT: return CC_L;
+        case IR_GE: return CC_GE;
+        case IR_GT: return CC_G;
+        case IR_LE: return CC_LE;
+    }
+    return CC_E;
+}
+
+// Condition that holds for the operands the other way around
+static IrCondition SwapCondition(const IrCondition condition)
+{
+    switch (condition) {
+        case IR_LT: return IR_GT;
+        case IR_GE: return IR_LE;
+        case IR_GT: return IR_LT;
+        case IR_LE: return IR_GE;
+        default:    return condition;
+    }
+}
+
+// Successors of a branch have no phis once critical edges are split, so it only jumps
+static void EmitIrBranch(Emitter* e, const IrGraph* g, const uint32_t block, const uint32_t id, const uint32_t next)
+{
+    const IrNode* node = IrGetNode(g, id);
+    const IrBlock* b = IrGetBlock(g, block);
+    IrCondition condition = (IrCondition)node->Condition;
+    Value lhs = GetNodeValue(g, node->Inputs[0]);
+    Value rhs = GetNodeValue(g, node->Inputs[1]);
+    if (lhs.Kind == VALUE_CONSTANT && rhs.Kind != VALUE_CONSTANT) {
+        const Value value = lhs;
+        lhs = rhs;
+        rhs = value;
+        condition = SwapCondition(condition);
+    }
+
+    Register reg = RAX;
+    if (lhs.Kind == VALUE_REGISTER)
+        reg = (Register)lhs.As;
+    else
+        EmitLoadValue(e, RAX, lhs);
+    EmitAluOp(e, ALU_CMP, reg, rhs);
+
+    // Condition codes come in pairs that differ in the lowest bit only
+    const ConditionCode cc = GetIrConditionCode(condition);
+    if (b->Successors[0] == next) {
+        EmitJumpIf(e, (ConditionCode)(cc ^ 1), b->Successors[1]);
+        return;
+    }
+    EmitJumpIf(e, cc, b->Successors[0]);
+    if (b->Successors[1] != next)
+        EmitJump(e, b->Successors[1]);
+}
+
+static bool IsMoveSource(const Move* moves, const uint32_t count, const Value value)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (IsSameValue(moves[i].Source, value))
+            return true;
+    }
+    return false;
+}
+
+// Moves the values the block passes to the phis of its successor, all at once since a phi may take the value of
+// another. Cycles are broken through rcx
+static void EmitPhiMoves(Emitter* e, const IrGraph* g, const uint32_t block, const uint32_t successor)
+{
+    const IrBlock* target = IrGetBlock(g, successor);
+    uint32_t index = 0;
+    while (target->Predecessors.Items[index] != block)
+        index++;
+
+    Move* moves = malloc(target->Nodes.Count * sizeof(Move));
+    assert(moves);
+    uint32_t count = 0;
+    for (uint32_t n = 0; n < target->Nodes.Count; n++) {
+        const IrNode* phi = IrGetNode(g, target->Nodes.Items[n]);
+        if (phi->Op != IR_PHI)
+            break;
+        const Move move = { GetNodeValue(g, target->Nodes.Items[n]), GetNodeValue(g, phi->Inputs[index]) };
+        if (!IsSameValue(move.Destination, move.Source))
+            moves[count++] = move;
+    }
+
+    while (count > 0) {
+        // A move whose destination no other move still reads can go first
+        uint32_t m = 0;
+        while (m < count && IsMoveSource(moves, count, moves[m].Destination))
+            m++;
+        if (m == count) {
+            const Value destination = moves[0].Destination;
+            EmitLoadValue(e, RCX, destination);
+            for (uint32_t i = 0; i < count; i++) {
+                if (IsSameValue(moves[i].Source, destination))
+                    moves[i].Source = (Value){ .Kind = VALUE_REGISTER, .As = RCX };
+            }
+            m = 0;
+        }
+        EmitMove(e, moves[m].Destination, moves[m].Source);
+        moves[m] = moves[--count];
+    }
+    free(moves);
+}
+
+static void EmitIrReturn(Emitter* e, const IrGraph* g, const uint32_t id)
+{
+    // The VM takes the return value from the top of the frame's stack
+    const IrNode* node = IrGetNode(g, id);
+    if (node->InputCount > 0)
+        EmitStoreMemory(e, STACK_REGISTER, 0, GetNodeValue(g, node->Inputs[0]));
+    EmitMemory(e, true, 0x8D, RAX, STACK_REGISTER, SLOT_OFFSET(node->InputCount));
+    EmitMemory(e, true, 0x89, RAX, FRAME_REGISTER, (int32_t)offsetof(Frame, Stack));
+    // mov eax, 1
+    Emit8(e, 0xB8);
+    Emit32(e, 1);
+    EmitJump(e, e->ExitLabel);
+}
+
+// next is the block laid out after this one, jumps to it fall through
+static void EmitIrBlock(Emitter* e, const IrGraph* g, const uint32_t block, const uint32_t next)
+{
+    const IrList* nodes = &IrGetBlock(g, block)->Nodes;
+    for (uint32_t n = 0; n < nodes->Count; n++) {
+        const uint32_t id = nodes->Items[n];
+        switch ((IrOp)IrGetNode(g, id)->Op) {
+            case IR_PHI:
+                break;
+            case IR_LOAD_LOCAL:
+                EmitLoadFrame(e, g, id, OPTIMIZED_LOCALS_REGISTER);
+                break;
+            case IR_LOAD_STACK:
+                EmitLoadFrame(e, g, id, STACK_REGISTER);
+                break;
+            case IR_ADD:
+            case IR_SUB:
+            case IR_MUL:
+            case IR_AND:
+            case IR_OR:
+            case IR_XOR:
+                EmitIrBinary(e, g, id);
+                break;
+            case IR_SHL:  EmitIrShift(e, g, id, 4); break;
+            case IR_SHR:  EmitIrShift(e, g, id, 7); break;
+            case IR_USHR: EmitIrShift(e, g, id, 5); break;
+            case IR_DIV:
+            case IR_REM:
+                EmitIrDivide(e, g, id);
+                break;
+            case IR_NEG:
+            case IR_TO_BYTE:
+            case IR_TO_CHAR:
+            case IR_TO_SHORT:
+                EmitIrUnary(e, g, id);
+                break;
+            case IR_HAS_CLASS:
+                EmitIrHasClass(e, g, id);
+                break;
+            case IR_RUNTIME_CALL:
+            case IR_DIRECT_CALL:
+                EmitIrRuntimeCall(e, g, id);
+                break;
+            case IR_JUMP:
+            {
+                const uint32_t successor = IrGetBlock(g, block)->Successors[0];
+                EmitPhiMoves(e, g, block, successor);
+                if (successor != next)
+                    EmitJump(e, successor);
+                break;
+            }
+            case IR_BRANCH:
+                EmitIrBranch(e, g, block, id, next);
+                break;
+            case IR_RETURN:
+                EmitIrReturn(e, g, id);
+                break;
+            case IR_DEOPTIMIZE:
+                EmitIrDeoptimize(e, g, id);
+                break;
+            case IR_CONSTANT:
+                assert(false && "Constants aren't placed in blocks");
+                break;
+        }
+    }
+}
+
+// Saves every register the code may use, rsp is left 16 byte aligned for calls
+static void EmitOptimizedPrologue(Emitter* e, const uint32_t frameSize)
+{
+    for (uint32_t i = 0; i < OPTIMIZED_PUSHED_COUNT; i++)
+        EmitPush(e, OPTIMIZED_PUSHED_REGISTERS[i]);
+    // sub rsp, imm32
+    EmitRegister(e, true, 0x81, 5, RSP);
+    Emit32(e, frameSize);
+    EmitRegister(e, true, 0x89, ARGUMENT_0, FRAME_REGISTER);
+    EmitMemory(e, true, 0x8B, OPTIMIZED_LOCALS_REGISTER, FRAME_REGISTER, (int32_t)offsetof(Frame, Locals));
+    EmitMemory(e, true, 0x8B, STACK_REGISTER, FRAME_REGISTER, (int32_t)offsetof(Frame, StackStart));
+}
+
+static void EmitOptimizedEpilogue(Emitter* e, const uint32_t frameSize)
+{
+    e->Labels[e->FailLabel] = e->Code.Count;
+    // xor eax, eax
+    EmitRegister(e, false, 0x31, RAX, RAX);
+    e->Labels[e->ExitLabel] = e->Code.Count;
+    // add rsp, imm32
+    EmitRegister(e, true, 0x81, 0, RSP);
+    Emit32(e, frameSize);
+    for (uint32_t i = OPTIMIZED_PUSHED_COUNT; i-- > 0;)
+        EmitPop(e, OPTIMIZED_PUSHED_REGISTERS[i]);
+    Emit8(e, 0xC3);
+}
+
+// Deoptimizing is rare, so those blocks are laid out after the rest
+static bool IsDeoptimizeBlock(const IrGraph* g, const uint32_t block)
+{
+    const IrList* nodes = &IrGetBlock(g, block)->Nodes;
+    return IrGetNode(g, nodes->Items[nodes->Count - 1])->Op == IR_DEOPTIMIZE;
+}
+
+CompiledMethod JitCompileOptimized(TranslatedCode* tc, MethodProfile* profile, const uint32_t osrIndex, const bool speculate)
+{
+    if (CODE_CACHE.Full)
+        return NULL;
+
+    IrGraph g;
+    if (!IrBuild(&g, profile->Class, profile->Method, osrIndex == JIT_NO_OSR ? IR_NONE : osrIndex, speculate)) {
+        IrDestroy(&g);
+        return NULL;
+    }
+    IrOptimize(&g);
+    IrAllocateRegisters(&g, OPTIMIZED_REGISTER_COUNT);
+
+    Emitter e = { .Translated = tc, .Profile = profile };
+    e.Code.Capacity = g.Nodes.Count * 16 + 128;
+    e.Code.Items = malloc(e.Code.Capacity);
+    e.Labels = malloc((g.Blocks.Count + 2) * sizeof(size_t));
+    e.FailLabel = g.Blocks.Count;
+    e.ExitLabel = g.Blocks.Count + 1;
+    uint32_t* layout = malloc(g.Order.Count * sizeof(uint32_t));
+    assert(e.Code.Items && e.Labels && layout);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < g.Order.Count; i++) {
+        if (!IsDeoptimizeBlock(&g, g.Order.Items[i]))
+            layout[count++] = g.Order.Items[i];
+    }
+    for (uint32_t i = 0; i < g.Order.Count; i++) {
+        if (IsDeoptimizeBlock(&g, g.Order.Items[i]))
+            layout[count++] = g.Order.Items[i];
+    }
+
+    // Spill slots and the save slots, the pushes leave rsp 8 off the alignment calls need
+    uint32_t frameSize = SHADOW_SPACE + SAVE_SLOT(&g, OPTIMIZED_REGISTER_COUNT) * 8;
+    if (frameSize % 16 == 0)
+        frameSize += 8;
+
+    EmitOptimizedPrologue(&e, frameSize);
+    for (uint32_t i = 0; i < count; i++) {
+        e.Labels[layout[i]] = e.Code.Count;
+        EmitIrBlock(&e, &g, layout[i], i + 1 < count ? layout[i + 1] : IR_NONE);
+    }
+    EmitOptimizedEpilogue(&e, frameSize);
+    PatchFixups(&e);
+    const CompiledMethod code = (CompiledMethod)CodeCacheInstall(e.Code.Items, e.Code.Count);
+
+    ArrayFree(&e.Code);
+    ArrayFree(&e.Fixups);
+    free(e.Labels);
+    free(layout);
+    IrDestroy(&g);
+    return code;
+}
+
+#else
+
+bool JitCompile(TranslatedCode* tc, MethodProfile* profile, const uint32_t optimizeThreshold)
+{
+    (void)tc;
+    (void)profile;
+    (void)optimizeThreshold;
+    return false;
+}
+
+CompiledMethod JitCompileOptimized(TranslatedCode* tc, MethodProfile* profile, const uint32_t osrIndex, const bool speculate)
+{
+    (void)tc;
+    (void)profile;
+    (void)osrIndex;
+    (void)speculate;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Profile.h"
+#include "Runtime.h"
+#include "Translator.h"
+
+// Only x86-64 has a code generator, elsewhere every method stays interpreted
+#if defined(__x86_64__) || defined(_M_X64)
+    #define JIT_X86_64
+#endif
+
+#define JIT_DEFAULT_CODE_CACHE_SIZE (16 * 1024 * 1024)
+
+// Runs the frame the VM pushed for the method until it returns, leaving the return value on top of the frame's
+// operand stack. False when an exception is pending or the runtime failed
+typedef bool (*CompiledMethod)(Frame* frame);
+
+// Reserves the executable code cache compiled methods are placed in
+bool JitInit(const size_t codeCacheSize);
+void JitDestroy(void);
+
+// Compiles the verified code and sets its Compiled and OsrEntries entry points, false if it can't be compiled. The
+// compiled code keeps counting loop backedges in the profile and calls RuntimeOptimizeLoop at the backedge the count
+// reaches optimizeThreshold at, 0 never does
+bool JitCompile(TranslatedCode* tc, MethodProfile* profile, const uint32_t optimizeThreshold);
+
+// osrIndex of an optimized compile for calls to the method
+#define JIT_NO_OSR UINT32_MAX
+
+// Compiles the method with the optimizing tier, which inlines small static callees and keeps values in registers.
+// The code is entered on calls, or at the loop header osrIndex by a frame the interpreter ran up to it, and is left
+// for the caller to install. When speculating, branches the profile never saw go one way and virtual calls that
+// always saw one receiver class are left to deoptimization, see RuntimeDeoptimize. NULL if the method can't be compiled
+CompiledMethod JitCompileOptimized(TranslatedCode* tc, MethodProfile* profile, const uint32_t osrIndex, const bool speculate);
+
+// Entry into the compiled code at the loop header for a frame the interpreter ran up to it, NULL if there is none.
+// Compiled code keeps locals and the operand stack in the frame at loop headers, so the frame is taken over as is
+static inline CompiledMethod JitGetOsrEntry(const TranslatedCode* tc, const uint32_t index)
+{
+    return tc->OsrEntries ? (CompiledMethod)tc->OsrEntries[index] : NULL;
+}
+
+#endif //JIT_H
@@ -1,27 +1,102 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "Aot.h"
 #include "ClassFile.h"
+#include "Heap.h"
+#include "Symbol.h"
 #include "Utils.h"
 #include "VM.h"
 
-int Run(const char* filePath, const char* methodName)
+// Parses sizes like the java launcher does, a number in bytes optionally followed by k, m or g
+static bool ParseSize(const char* str, size_t* size)
 {
-    size_t size;
-    uint8_t* fileData = ReadFileToBuffer(filePath, &size);
+    char* end;
+    const unsigned long long value = strtoull(str, &end, 10);
+    if (end == str)
+        return false;
 
-    if (!fileData) {
-        return 1;
+    switch (*end) {
+        case '\0':
+            *size = (size_t)value;
+            return true;
+        case 'k':
+        case 'K':
+            *size = (size_t)value * 1024;
+            break;
+        case 'm':
+        case 'M':
+            *size = (size_t)value * 1024 * 1024;
+            break;
+        case 'g':
+        case 'G':
+            *size = (size_t)value * 1024 * 1024 * 1024;
+            break;
+        default:
+            return false;
     }
+    return end[1] == '\0';
+}
+
+// Parses the value of a -XX:<name>=<value> option into a count
+static bool ParseCountOption(const char* arg, const char* name, uint32_t* value)
+{
+    const size_t length = strlen(name);
+    if (strncmp(arg, "-XX:", 4) != 0 || strncmp(arg + 4, name, length) != 0 || arg[4 + length] != '=')
+        return false;
 
-    const ClassFile* classFile = ClassFileCreate(fileData, size);
+    const char* str = arg + 4 + length + 1;
+    char* end;
+    const unsigned long long parsed = strtoull(str, &end, 10);
+    if (end == str || *end != '\0' || parsed > UINT32_MAX)
+        return false;
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+// Parses the value of a -XX:<name>=<value> option, which must not be empty
+static bool ParseStringOption(const char* arg, const char* name, const char** value)
+{
+    const size_t length = strlen(name);
+    if (strncmp(arg, "-XX:", 4) != 0 || strncmp(arg + 4, name, length) != 0 || arg[4 + length] != '=' ||
+        arg[4 + length + 1] == '\0')
+        return false;
+    *value = arg + 4 + length + 1;
+    return true;
+}
+
+int CompileAot(const char* filePath, const char* libraryPath)
+{
+    SymbolTableInit();
+    const ClassFile* classFile = ClassFileLoad(filePath);
     if (classFile == NULL) {
         fprintf(stderr, "Failed to create ClassFile.\n");
-        free(fileData);
+        SymbolTableDestroy();
+        return 1;
+    }
+
+    const bool result = AotCompileClass(classFile, libraryPath);
+    ClassFileDestroy(classFile);
+    SymbolTableDestroy();
+    return result ? 0 : 1;
+}
+
+int Run(const char* filePath, const char* methodName, const VMOptions* options)
+{
+    SymbolTableInit();
+    if (!VMInit(options)) {
+        SymbolTableDestroy();
         return 1;
     }
 
-    free(fileData);
+    const ClassFile* classFile = ClassFileLoad(filePath);
+    if (classFile == NULL) {
+        fprintf(stderr, "Failed to create ClassFile.\n");
+        VMDestroy();
+        SymbolTableDestroy();
+        return 1;
+    }
 
 #if defined(APP_DEBUG)
     printf("Magic: %x\n", classFile->Magic);
@@ -34,21 +109,109 @@ int Run(const char* filePath, const char* methodName)
         assert(class->Type == CONST_CLASS);
         const Constant* className = &classFile->ConstantPool[class->As.Class.NameIndex - 1];
         assert(className->Type == CONST_UTF8);
-        fprintf(stderr, "Method '%s' does not exist in class '%s'\n", methodName, className->As.Utf8);
+        fprintf(stderr, "Method '%s' does not exist in class '%s'\n", methodName, className->As.Utf8->Bytes);
     } else {
         ExecuteMethod(classFile, methodToRun);
     }
 
     ClassFileDestroy(classFile);
+    VMDestroy();
+    SymbolTableDestroy();
     return 0;
 }
 
 int main(const int argc, const char** argv)
 {
-    if (argc < 3) {
-        printf("Usage: %s <file_path> <method_name>\n", argv[0]);
+    VMOptions options = {
+        .StackSize = VM_DEFAULT_STACK_SIZE,
+        .Heap = { .Size = HEAP_DEFAULT_SIZE, .TenuringThreshold = HEAP_DEFAULT_TENURING_THRESHOLD,
+            .ParallelGCThreads = HEAP_DEFAULT_PARALLEL_GC_THREADS,
+            .InitiatingOccupancyPercent = HEAP_DEFAULT_INITIATING_OCCUPANCY },
+        .UseJit = true,
+        .BaselineInvocationThreshold = VM_DEFAULT_BASELINE_INVOCATION_THRESHOLD,
+        .BaselineBackedgeThreshold = VM_DEFAULT_BASELINE_BACKEDGE_THRESHOLD,
+        .OptimizedInvocationThreshold = VM_DEFAULT_OPTIMIZED_INVOCATION_THRESHOLD,
+        .OptimizedBackedgeThreshold = VM_DEFAULT_OPTIMIZED_BACKEDGE_THRESHOLD,
+    };
+
+    // Library to compile the class into instead of running it
+    const char* aotCompile = NULL;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strncmp(argv[arg], "-Xss", 4) == 0 && ParseSize(argv[arg] + 4, &options.StackSize))
+            continue;
+        if (strncmp(argv[arg], "-Xmx", 4) == 0 && ParseSize(argv[arg] + 4, &options.Heap.Size))
+            continue;
+        if (strncmp(argv[arg], "-Xmn", 4) == 0 && ParseSize(argv[arg] + 4, &options.Heap.NurserySize))
+            continue;
+        if (strcmp(argv[arg], "-Xint") == 0) {
+            options.UseJit = false;
+            continue;
+        }
+        if (strcmp(argv[arg], "-XX:+PrintCompilation") == 0) {
+            options.PrintCompilation = true;
+            continue;
+        }
+        if (strcmp(argv[arg], "-XX:+PrintGC") == 0) {
+            options.Heap.PrintGC = true;
+            continue;
+        }
+        if (strcmp(argv[arg], "-XX:+PrintGCStatistics") == 0) {
+            options.Heap.PrintGCStatistics = true;
+            continue;
+        }
+        if (strcmp(argv[arg], "-XX:+UseConcurrentMark") == 0) {
+            options.Heap.ConcurrentMark = true;
+            continue;
+        }
+        if (ParseCountOption(argv[arg], "InitiatingOccupancyPercent", &options.Heap.InitiatingOccupancyPercent))
+            continue;
+        if (ParseCountOption(argv[arg], "MaxTenuringThreshold", &options.Heap.TenuringThreshold))
+            continue;
+        if (ParseCountOption(argv[arg], "ParallelGCThreads", &options.Heap.ParallelGCThreads))
+            continue;
+        if (ParseCountOption(argv[arg], "BaselineInvocationThreshold", &options.BaselineInvocationThreshold))
+            continue;
+        if (ParseCountOption(argv[arg], "BaselineBackedgeThreshold", &options.BaselineBackedgeThreshold))
+            continue;
+        if (ParseCountOption(argv[arg], "OptimizedInvocationThreshold", &options.OptimizedInvocationThreshold))
+            continue;
+        if (ParseCountOption(argv[arg], "OptimizedBackedgeThreshold", &options.OptimizedBackedgeThreshold))
+            continue;
+        if (ParseStringOption(argv[arg], "AotLibrary", &options.AotLibrary))
+            continue;
+        if (ParseStringOption(argv[arg], "AotCompile", &aotCompile))
+            continue;
+        fprintf(stderr, "Invalid option '%s'\n", argv[arg]);
+        return 1;
+    }
+
+    if (aotCompile && argc - arg == 1)
+        return CompileAot(argv[arg], aotCompile);
+
+    if (argc - arg < 2) {
+        printf("Usage: %s [options] <file_path> <method_name>\n", argv[0]);
+        printf("       %s -XX:AotCompile=<library> <file_path>\n", argv[0]);
+        printf("Options:\n");
+        printf("  -Xss<size>[k|m|g]                     VM stack size of each thread\n");
+        printf("  -Xmx<size>[k|m|g]                     Size of the heap objects are allocated in\n");
+        printf("  -Xmn<size>[k|m|g]                     Size of the nursery new objects are allocated in\n");
+        printf("  -Xint                                 Interpret only, never compile\n");
+        printf("  -XX:BaselineInvocationThreshold=<n>   Invocations before a method is compiled\n");
+        printf("  -XX:BaselineBackedgeThreshold=<n>     Loop backedges before a method is compiled\n");
+        printf("  -XX:OptimizedInvocationThreshold=<n>  Invocations before a method is optimized\n");
+        printf("  -XX:OptimizedBackedgeThreshold=<n>    Loop backedges before a method is optimized\n");
+        printf("  -XX:+PrintCompilation                 Print methods as they move up a tier\n");
+        printf("  -XX:MaxTenuringThreshold=<n>          Young collections objects survive before they are promoted\n");
+        printf("  -XX:ParallelGCThreads=<n>             Threads full garbage collections are split across\n");
+        printf("  -XX:+UseConcurrentMark                Mark the old generation while Java code runs\n");
+        printf("  -XX:InitiatingOccupancyPercent=<n>    Old generation use that starts a concurrent mark\n");
+        printf("  -XX:+PrintGC                          Print every garbage collection\n");
+        printf("  -XX:+PrintGCStatistics                Print a histogram of the pause times at exit\n");
+        printf("  -XX:AotCompile=<library>              Compile every method of the class into a shared library\n");
+        printf("  -XX:AotLibrary=<library>              Run the methods a compiled library has code for from it\n");
         return 0;
     }
 
-    return Run(argv[1], argv[2]);
+    return Run(argv[arg], argv[arg + 1], &options);
 }
\ No newline at end of file
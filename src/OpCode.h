@@ -0,0 +1,108 @@
+#ifndef OPCODE_H
+#define OPCODE_H
+
+typedef enum
+{
+    OP_CODE_A_CONST_NULL   = 0x01,
+    OP_CODE_I_CONST_M1     = 0x02,
+    OP_CODE_I_CONST_0      = 0x03,
+    OP_CODE_I_CONST_1      = 0x04,
+    OP_CODE_I_CONST_2      = 0x05,
+    OP_CODE_I_CONST_3      = 0x06,
+    OP_CODE_I_CONST_4      = 0x07,
+    OP_CODE_I_CONST_5      = 0x08,
+    OP_CODE_BI_PUSH        = 0x10,
+    OP_CODE_SI_PUSH        = 0x11,
+    OP_CODE_LDC            = 0x12,
+    OP_CODE_I_LOAD         = 0x15,
+    OP_CODE_I_LOAD_0       = 0x1A,
+    OP_CODE_I_LOAD_1       = 0x1B,
+    OP_CODE_I_LOAD_2       = 0x1C,
+    OP_CODE_I_LOAD_3       = 0x1D,
+    OP_CODE_A_LOAD         = 0x19,
+    OP_CODE_A_LOAD_0       = 0x2A,
+    OP_CODE_A_LOAD_1       = 0x2B,
+    OP_CODE_A_LOAD_2       = 0x2C,
+    OP_CODE_A_LOAD_3       = 0x2D,
+    OP_CODE_I_A_LOAD       = 0x2E,
+    OP_CODE_L_A_LOAD       = 0x2F,
+    OP_CODE_F_A_LOAD       = 0x30,
+    OP_CODE_D_A_LOAD       = 0x31,
+    OP_CODE_A_A_LOAD       = 0x32,
+    OP_CODE_B_A_LOAD       = 0x33,
+    OP_CODE_C_A_LOAD       = 0x34,
+    OP_CODE_S_A_LOAD       = 0x35,
+    OP_CODE_I_STORE        = 0x36,
+    OP_CODE_I_STORE_0      = 0x3B,
+    OP_CODE_I_STORE_1      = 0x3C,
+    OP_CODE_I_STORE_2      = 0x3D,
+    OP_CODE_I_STORE_3      = 0x3E,
+    OP_CODE_A_STORE        = 0x3A,
+    OP_CODE_A_STORE_0      = 0x4B,
+    OP_CODE_A_STORE_1      = 0x4C,
+    OP_CODE_A_STORE_2      = 0x4D,
+    OP_CODE_A_STORE_3      = 0x4E,
+    OP_CODE_I_A_STORE      = 0x4F,
+    OP_CODE_L_A_STORE      = 0x50,
+    OP_CODE_F_A_STORE      = 0x51,
+    OP_CODE_D_A_STORE      = 0x52,
+    OP_CODE_A_A_STORE      = 0x53,
+    OP_CODE_B_A_STORE      = 0x54,
+    OP_CODE_C_A_STORE      = 0x55,
+    OP_CODE_S_A_STORE      = 0x56,
+    OP_CODE_POP            = 0x57,
+    OP_CODE_POP2           = 0x58,
+    OP_CODE_DUP            = 0x59,
+    OP_CODE_DUP_X1         = 0x5A,
+    OP_CODE_DUP_X2         = 0x5B,
+    OP_CODE_DUP2           = 0x5C,
+    OP_CODE_DUP2_X1        = 0x5D,
+    OP_CODE_DUP2_X2        = 0x5E,
+    OP_CODE_SWAP           = 0x5F,
+    OP_CODE_I_ADD          = 0x60,
+    OP_CODE_I_SUB          = 0x64,
+    OP_CODE_I_MUL          = 0x68,
+    OP_CODE_I_DIV          = 0x6C,
+    OP_CODE_I_REM          = 0x70,
+    OP_CODE_I_NEG          = 0x74,
+    OP_CODE_I_SHL          = 0x78,
+    OP_CODE_I_SHR          = 0x7A,
+    OP_CODE_I_USHR         = 0x7C,
+    OP_CODE_I_AND          = 0x7E,
+    OP_CODE_I_OR           = 0x80,
+    OP_CODE_I_XOR          = 0x82,
+    OP_CODE_I_INC          = 0x84,
+    OP_CODE_I_TO_B         = 0x91,
+    OP_CODE_I_TO_C         = 0x92,
+    OP_CODE_I_TO_S         = 0x93,
+    OP_CODE_IF_EQ          = 0x99,
+    OP_CODE_IF_NE          = 0x9A,
+    OP_CODE_IF_LT          = 0x9B,
+    OP_CODE_IF_GE          = 0x9C,
+    OP_CODE_IF_GT          = 0x9D,
+    OP_CODE_IF_LE          = 0x9E,
+    OP_CODE_I_CMP_EQ       = 0x9F,
+    OP_CODE_I_CMP_NE       = 0xA0,
+    OP_CODE_I_CMP_LT       = 0xA1,
+    OP_CODE_I_CMP_GE       = 0xA2,
+    OP_CODE_I_CMP_GT       = 0xA3,
+    OP_CODE_I_CMP_LE       = 0xA4,
+    OP_CODE_GOTO           = 0xA7,
+    OP_CODE_I_RETURN       = 0xAC,
+    OP_CODE_A_RETURN       = 0xB0,
+    OP_CODE_RETURN         = 0xB1,
+    OP_CODE_GET_STATIC     = 0xB2,
+    OP_CODE_GET_FIELD      = 0xB4,
+    OP_CODE_PUT_FIELD      = 0xB5,
+    OP_CODE_INVOKE_VIRTUAL = 0xB6,
+    OP_CODE_INVOKE_SPECIAL = 0xB7,
+    OP_CODE_INVOKE_STATIC  = 0xB8,
+    OP_CODE_NEW            = 0xBB,
+    OP_CODE_NEW_ARRAY      = 0xBC,
+    OP_CODE_A_NEW_ARRAY    = 0xBD,
+    OP_CODE_ARRAY_LENGTH   = 0xBE,
+    OP_CODE_IF_NULL        = 0xC6,
+    OP_CODE_IF_NON_NULL    = 0xC7,
+} OpCode;
+
+#endif //OPCODE_H
@@ -0,0 +1,1735 @@
+#include "Optimizer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Runtime.h"
+#include "Utils.h"
+#include "Verifier.h"
+
+// Callees are inlined when they are at most this many instructions long and the call isn't nested any deeper
+#define MAX_INLINE_SIZE 35
+#define MAX_INLINE_DEPTH 4
+// Bounds the code the graph is built from once callees are inlined
+#define MAX_GRAPH_INSTRUCTIONS 2000
+// Times a branch or call has to have been profiled for what it never did to be speculated on
+#define MIN_SPECULATION_SAMPLES 100
+
+// A method whose code is being added to the graph, either the one compiled or a callee inlined into it
+typedef struct Scope
+{
+    const struct Scope* Caller;
+    const ClassFile* Class;
+    const MethodInfo* Method;
+    const TranslatedCode* Code;
+    const MethodProfile* Profile;
+    uint16_t MaxLocals;
+    uint16_t MaxStack;
+    uint32_t Depth;
+    // Variables of the scope start here, its locals followed by its operand stack
+    uint32_t Base;
+    // Block starting at every instruction, IR_NONE for the rest. Loop headers also get a preheader every edge that
+    // enters the loop goes to
+    uint32_t* Blocks;
+    uint32_t* Preheaders;
+    // Scope inlined at every call instruction that gets inlined
+    struct Scope** Callees;
+    // Caller block returns continue in and the caller variable the result goes to, IR_NONE at the top level
+    uint32_t Continuation;
+    uint32_t ResultVariable;
+    // Call instruction in the caller and the slots the arguments take on its operand stack
+    uint32_t CallIndex;
+    uint8_t ArgumentSlots;
+} Scope;
+
+typedef enum
+{
+    // Start == End for blocks that only jump
+    BLOCK_CODE,
+    // Checks the receiver of the virtual call at Start before the block with the call
+    BLOCK_GUARD,
+    // Rebuilds the interpreter frames to resume at Start
+    BLOCK_DEOPTIMIZE,
+} BlockKind;
+
+// Code each block is built from
+typedef struct
+{
+    Scope* Scope;
+    uint32_t Start;
+    uint32_t End;
+    BlockKind Kind;
+} BlockRange;
+
+typedef struct
+{
+    IrGraph* Graph;
+    Scope* Top;
+    uint32_t OsrIndex;
+    bool Speculate;
+    struct
+    {
+        uint32_t Count;
+        uint32_t Capacity;
+        BlockRange* Items;
+    } Ranges;
+    uint32_t VariableCount;
+    uint32_t InstructionCount;
+
+    // Value of every variable while building a block, IR_NONE when it holds nothing, and at the end of every block
+    uint32_t* Variables;
+    uint32_t** States;
+} Builder;
+
+static uint32_t NewNode(IrGraph* g, const IrOp op, const uint32_t block, const uint32_t inputCount)
+{
+    IrNode* node;
+    ArrayPushBack(&g->Nodes, &node);
+    *node = (IrNode){
+        .Op = (uint8_t)op,
+        .Block = block,
+        .InputCount = inputCount,
+        .Replacement = IR_NONE,
+        .Location = IR_LOCATION_NONE,
+    };
+    if (inputCount > 0)
+        node->Inputs = ArenaAlloc(&g->Arena, inputCount * sizeof(uint32_t));
+    return g->Nodes.Count - 1;
+}
+
+// Constants aren't placed in any block, code generation encodes them where they are used
+static uint32_t NewConstant(IrGraph* g, const int32_t value)
+{
+    const uint32_t id = NewNode(g, IR_CONSTANT, g->Entry, 0);
+    IrGetNode(g, id)->Constant = value;
+    return id;
+}
+
+static bool IsConstant(const IrGraph* g, const uint32_t id)
+{
+    return IrGetNode(g, id)->Op == IR_CONSTANT;
+}
+
+static bool SameValue(const IrGraph* g, const uint32_t a, const uint32_t b)
+{
+    return a == b || (IsConstant(g, a) && IsConstant(g, b) && IrGetNode(g, a)->Constant == IrGetNode(g, b)->Constant);
+}
+
+static uint32_t Resolve(const IrGraph* g, uint32_t id)
+{
+    while (id != IR_NONE && IrGetNode(g, id)->Replacement != IR_NONE)
+        id = IrGetNode(g, id)->Replacement;
+    return id;
+}
+
+static bool IsTerminator(const IrOp op)
+{
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN || op == IR_DEOPTIMIZE;
+}
+
+static bool IsCall(const IrOp op)
+{
+    return op == IR_RUNTIME_CALL || op == IR_DIRECT_CALL;
+}
+
+static bool IsCommutative(const IrOp op)
+{
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR;
+}
+
+// Ops without side effects whose result only depends on their inputs
+static bool IsPure(const IrGraph* g, const IrNode* node)
+{
+    switch ((IrOp)node->Op) {
+        case IR_CONSTANT:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_SHL:
+        case IR_SHR:
+        case IR_USHR:
+        case IR_AND:
+        case IR_OR:
+        case IR_XOR:
+        case IR_NEG:
+        case IR_TO_BYTE:
+        case IR_TO_CHAR:
+        case IR_TO_SHORT:
+            return true;
+        case IR_DIV:
+        case IR_REM:
+        {
+            // Can't throw
+            const IrNode* divisor = IrGetNode(g, node->Inputs[1]);
+            return divisor->Op == IR_CONSTANT && divisor->Constant != 0;
+        }
+        default:
+            return false;
+    }
+}
+
+// Java int arithmetic, false for a division by zero which has to throw at runtime
+static bool FoldArithmetic(const IrOp op, const int32_t a, const int32_t b, int32_t* result)
+{
+    switch (op) {
+        case IR_ADD:  *result = (int32_t)((uint32_t)a + (uint32_t)b); return true;
+        case IR_SUB:  *result = (int32_t)((uint32_t)a - (uint32_t)b); return true;
+        case IR_MUL:  *result = (int32_t)((uint32_t)a * (uint32_t)b); return true;
+        case IR_SHL:  *result = (int32_t)((uint32_t)a << (b & 0x1F)); return true;
+        case IR_SHR:  *result = a >> (b & 0x1F); return true;
+        case IR_USHR: *result = (int32_t)((uint32_t)a >> (b & 0x1F)); return true;
+        case IR_AND:  *result = a & b; return true;
+        case IR_OR:   *result = a | b; return true;
+        case IR_XOR:  *result = a ^ b; return true;
+        case IR_NEG:      *result = (int32_t)(0u - (uint32_t)a); return true;
+        case IR_TO_BYTE:  *result = (int8_t)a; return true;
+        case IR_TO_CHAR:  *result = (uint16_t)a; return true;
+        case IR_TO_SHORT: *result = (int16_t)a; return true;
+        case IR_DIV:
+        case IR_REM:
+        {
+            if (b == 0)
+                return false;
+            if (b == -1)
+                *result = op == IR_REM ? 0 : (int32_t)(0u - (uint32_t)a);
+            else
+                *result = op == IR_REM ? a % b : a / b;
+            return true;
+        }
+        default:
+            assert(false && "Not an arithmetic op");
+            return false;
+    }
+}
+
+static bool FoldCondition(const IrCondition condition, const int32_t a, const int32_t b)
+{
+    switch (condition) {
+        case IR_EQ: return a == b;
+        case IR_NE: return a != b;
+        case IR_LT: return a < b;
+        case IR_GE: return a >= b;
+        case IR_GT: return a > b;
+        case IR_LE: return a <= b;
+    }
+    return false;
+}
+
+static IrCondition GetCondition(const InstructionOp op)
+{
+    switch (op) {
+        case INST_IF_EQ:
+        case INST_IF_ICMP_EQ:
+        case INST_IF_NULL:
+            return IR_EQ;
+        case INST_IF_NE:
+        case INST_IF_ICMP_NE:
+        case INST_IF_NON_NULL:
+            return IR_NE;
+        case INST_IF_LT:
+        case INST_IF_ICMP_LT:
+            return IR_LT;
+        case INST_IF_GE:
+        case INST_IF_ICMP_GE:
+            return IR_GE;
+        case INST_IF_GT:
+        case INST_IF_ICMP_GT:
+            return IR_GT;
+        case INST_IF_LE:
+        case INST_IF_ICMP_LE:
+            return IR_LE;
+        default:
+            assert(false && "Not a conditional branch");
+            return IR_EQ;
+    }
+}
+
+static IrOp GetArithmeticOp(const InstructionOp op)
+{
+    switch (op) {
+        case INST_ADD_INT:  return IR_ADD;
+        case INST_SUB_INT:  return IR_SUB;
+        case INST_MUL_INT:  return IR_MUL;
+        case INST_DIV_INT:  return IR_DIV;
+        case INST_REM_INT:  return IR_REM;
+        case INST_SHL_INT:  return IR_SHL;
+        case INST_SHR_INT:  return IR_SHR;
+        case INST_USHR_INT: return IR_USHR;
+        case INST_AND_INT:  return IR_AND;
+        case INST_OR_INT:   return IR_OR;
+        case INST_XOR_INT:  return IR_XOR;
+        case INST_NEG_INT:      return IR_NEG;
+        case INST_INT_TO_BYTE:  return IR_TO_BYTE;
+        case INST_INT_TO_CHAR:  return IR_TO_CHAR;
+        case INST_INT_TO_SHORT: return IR_TO_SHORT;
+        default:
+            assert(false && "Not an arithmetic instruction");
+            return IR_ADD;
+    }
+}
+
+static bool IsBranch(const InstructionOp op)
+{
+    return op >= INST_IF_EQ && op <= INST_GOTO;
+}
+
+static bool IsReturn(const InstructionOp op)
+{
+    return op == INST_RETURN_INT || op == INST_RETURN_REFERENCE || op == INST_RETURN;
+}
+
+// Instructions compiled code leaves to the runtime
+static bool IsRuntimeInstruction(const InstructionOp op)
+{
+    switch (op) {
+        case INST_PUSH_STRING:
+        case INST_GET_STATIC:
+        case INST_INVOKE_VIRTUAL:
+        case INST_INVOKE_STATIC:
+        case INST_INVOKE_SPECIAL:
+        case INST_NEW:
+        case INST_GET_FIELD:
+        case INST_PUT_FIELD:
+        case INST_NEW_ARRAY:
+        case INST_NEW_REFERENCE_ARRAY:
+        case INST_ARRAY_LENGTH:
+        case INST_LOAD_ELEMENT:
+        case INST_STORE_ELEMENT:
+        case INST_GET_STATIC_QUICK:
+        case INST_INVOKE_VIRTUAL_QUICK:
+        case INST_INVOKE_STATIC_QUICK:
+        case INST_INVOKE_SPECIAL_QUICK:
+        case INST_NEW_QUICK:
+        case INST_GET_FIELD_QUICK:
+        case INST_PUT_FIELD_QUICK:
+        case INST_NEW_REFERENCE_ARRAY_QUICK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool IsReachable(const TranslatedCode* tc, const uint32_t index)
+{
+    return tc->StackDepths[index] != VERIFIER_UNREACHABLE;
+}
+
+static bool CanInline(const Scope* caller, const MethodInfo* callee);
+
+// Method the static call at the instruction gets inlined from, NULL when it stays a call. Only calls already resolved
+// by the interpreter are considered
+static const MethodInfo* FindInlineCallee(const Scope* s, const Instruction* inst)
+{
+    if (s->Depth >= MAX_INLINE_DEPTH || inst->Op != INST_INVOKE_STATIC_QUICK)
+        return NULL;
+    const MethodInfo* callee = RuntimeGetStaticCallee(s->Class, inst);
+    if (!callee || !callee->Code || !callee->Code->Translated)
+        return NULL;
+    return CanInline(s, callee) ? callee : NULL;
+}
+
+// Small, not recursive and every call it makes can be inlined too, since inlined code can't call the runtime
+static bool CanInline(const Scope* caller, const MethodInfo* callee)
+{
+    const TranslatedCode* tc = callee->Code->Translated;
+    if (tc->Count > MAX_INLINE_SIZE)
+        return false;
+    for (const Scope* s = caller; s; s = s->Caller) {
+        if (s->Code == tc)
+            return false;
+    }
+
+    const Scope scope = { .Caller = caller, .Class = caller->Class, .Code = tc, .Depth = caller->Depth + 1 };
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        const InstructionOp op = GetUnfusedOp((InstructionOp)tc->Instructions[i].Op);
+        if (IsReachable(tc, i) && IsRuntimeInstruction(op) && !FindInlineCallee(&scope, &tc->Instructions[i]))
+            return false;
+    }
+    return true;
+}
+
+static uint32_t NewBlock(Builder* b, Scope* s, const uint32_t start, const BlockKind kind)
+{
+    IrBlock* block;
+    ArrayPushBack(&b->Graph->Blocks, &block);
+    *block = (IrBlock){ .Dominator = IR_NONE, .Order = IR_NONE };
+    ArrayAppend(&b->Ranges, ((BlockRange){ .Scope = s, .Start = start, .End = start, .Kind = kind }));
+    return b->Graph->Blocks.Count - 1;
+}
+
+static void AddSuccessor(IrGraph* g, const uint32_t from, const uint32_t to)
+{
+    IrBlock* block = IrGetBlock(g, from);
+    assert(block->SuccessorCount < 2);
+    block->Successors[block->SuccessorCount++] = to;
+}
+
+// Block an edge from the instruction to the target goes to, edges into a loop go to its preheader
+static uint32_t GetEdgeTarget(const Scope* s, const uint32_t from, const uint32_t to)
+{
+    if (to > from && s->Preheaders[to] != IR_NONE)
+        return s->Preheaders[to];
+    return s->Blocks[to];
+}
+
+static uint32_t GetScopeEntry(const Scope* s)
+{
+    return s->Preheaders[0] != IR_NONE ? s->Preheaders[0] : s->Blocks[0];
+}
+
+// Successor of the branch at the instruction its profile never saw it go to, 0 being the taken one like in
+// IrBlock.Successors. IR_NONE when it went both ways or didn't run often enough to tell
+static uint32_t GetUnusedSuccessor(const Builder* b, const Scope* s, const uint32_t index)
+{
+    if (!b->Speculate)
+        return IR_NONE;
+    const BranchProfile* profile = &s->Profile->Branches[index];
+    if (profile->Taken == 0 && profile->NotTaken >= MIN_SPECULATION_SAMPLES)
+        return 0;
+    if (profile->NotTaken == 0 && profile->Taken >= MIN_SPECULATION_SAMPLES)
+        return 1;
+    return IR_NONE;
+}
+
+// Class of every receiver the virtual call at the instruction saw, NULL when it saw several or too few calls
+static const Symbol* GetMonomorphicClass(const Builder* b, const Scope* s, const uint32_t index)
+{
+    if (!b->Speculate || s->Code->Instructions[index].Op != INST_INVOKE_VIRTUAL_QUICK)
+        return NULL;
+    const ReceiverProfile* profile = &s->Profile->Receivers[index];
+    if (profile->Classes[1] || profile->Polymorphic > 0 || profile->Counts[0] < MIN_SPECULATION_SAMPLES)
+        return NULL;
+    return profile->Classes[0];
+}
+
+static Scope* NewScope(Builder* b, const Scope* caller, const ClassFile* cf, const MethodInfo* method)
+{
+    Scope* s = ArenaAlloc(&b->Graph->Arena, sizeof(Scope));
+    s->Caller = caller;
+    s->Class = cf;
+    s->Method = method;
+    s->Code = method->Code->Translated;
+    s->Profile = GetMethodProfile(cf, method);
+    s->MaxLocals = method->Code->MaxLocals;
+    s->MaxStack = method->Code->MaxStack;
+    s->Depth = caller ? caller->Depth + 1 : 0;
+    s->Base = caller ? caller->Base + caller->MaxLocals + caller->MaxStack : 0;
+    s->Continuation = IR_NONE;
+    s->ResultVariable = IR_NONE;
+    if (s->Base + s->MaxLocals + s->MaxStack > b->VariableCount)
+        b->VariableCount = s->Base + s->MaxLocals + s->MaxStack;
+    return s;
+}
+
+// Splits the code of the scope into blocks and adds the edges between them, inlining callees along the way
+static bool AddScopeBlocks(Builder* b, Scope* s)
+{
+    IrGraph* g = b->Graph;
+    const TranslatedCode* tc = s->Code;
+    b->InstructionCount += tc->Count;
+    if (b->InstructionCount > MAX_GRAPH_INSTRUCTIONS)
+        return false;
+
+    s->Blocks = ArenaAlloc(&g->Arena, tc->Count * sizeof(uint32_t));
+    s->Preheaders = ArenaAlloc(&g->Arena, tc->Count * sizeof(uint32_t));
+    s->Callees = ArenaAlloc(&g->Arena, tc->Count * sizeof(Scope*));
+    const MethodInfo** callees = ArenaAlloc(&g->Arena, tc->Count * sizeof(MethodInfo*));
+    bool* leaders = ArenaAlloc(&g->Arena, (tc->Count + 1) * sizeof(bool));
+    bool* headers = ArenaAlloc(&g->Arena, tc->Count * sizeof(bool));
+    bool* guarded = ArenaAlloc(&g->Arena, tc->Count * sizeof(bool));
+
+    leaders[0] = true;
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        s->Blocks[i] = IR_NONE;
+        s->Preheaders[i] = IR_NONE;
+        if (!IsReachable(tc, i))
+            continue;
+
+        const Instruction* inst = &tc->Instructions[i];
+        const InstructionOp op = GetUnfusedOp((InstructionOp)inst->Op);
+        if (IsBranch(op)) {
+            leaders[inst->B] = true;
+            if ((uint32_t)inst->B <= i)
+                headers[inst->B] = true;
+        }
+        if (IsRuntimeInstruction(op)) {
+            callees[i] = FindInlineCallee(s, inst);
+            // Only the compiled method itself calls the runtime
+            if (!callees[i] && s->Caller)
+                return false;
+            // The receiver check goes in a block of its own ahead of the call
+            guarded[i] = GetMonomorphicClass(b, s, i) != NULL;
+            leaders[i] |= guarded[i];
+        }
+        if (IsBranch(op) || IsReturn(op) || callees[i])
+            leaders[i + 1] = true;
+    }
+
+    // Every block of the scope is a code block or a guard, the ones after it are callees' or deoptimize
+    const uint32_t first = g->Blocks.Count;
+    uint32_t current = IR_NONE;
+    for (uint32_t i = 0; i < tc->Count; i++) {
+        if (leaders[i] && IsReachable(tc, i)) {
+            if (headers[i])
+                s->Preheaders[i] = NewBlock(b, s, i, BLOCK_CODE);
+            if (guarded[i])
+                s->Blocks[i] = NewBlock(b, s, i, BLOCK_GUARD);
+            current = NewBlock(b, s, i, BLOCK_CODE);
+            if (!guarded[i])
+                s->Blocks[i] = current;
+        }
+        if (current != IR_NONE)
+            b->Ranges.Items[current].End = i + 1;
+        if (leaders[i + 1])
+            current = IR_NONE;
+    }
+    const uint32_t end = g->Blocks.Count;
+
+    for (uint32_t block = first; block < end; block++) {
+        const BlockRange range = b->Ranges.Items[block];
+        if (range.Kind == BLOCK_GUARD) {
+            // Goes on to the call's block, which comes right after, while the receiver has the class
+            AddSuccessor(g, block, block + 1);
+            AddSuccessor(g, block, NewBlock(b, s, range.Start, BLOCK_DEOPTIMIZE));
+            continue;
+        }
+        if (range.Start == range.End) {
+            AddSuccessor(g, block, s->Blocks[range.Start]);
+            continue;
+        }
+
+        const uint32_t last = range.End - 1;
+        const Instruction* inst = &tc->Instructions[last];
+        const InstructionOp op = GetUnfusedOp((InstructionOp)inst->Op);
+        if (op == INST_GOTO) {
+            AddSuccessor(g, block, GetEdgeTarget(s, last, (uint32_t)inst->B));
+        } else if (IsBranch(op)) {
+            uint32_t successors[2] = { GetEdgeTarget(s, last, (uint32_t)inst->B), GetEdgeTarget(s, last, last + 1) };
+            // A branch to the next instruction goes there either way
+            if (successors[0] == successors[1]) {
+                AddSuccessor(g, block, successors[0]);
+                continue;
+            }
+            // Going the way the profile never saw resumes the interpreter at the branch, which then takes it
+            const uint32_t unused = GetUnusedSuccessor(b, s, last);
+            if (unused != IR_NONE)
+                successors[unused] = NewBlock(b, s, last, BLOCK_DEOPTIMIZE);
+            AddSuccessor(g, block, successors[0]);
+            AddSuccessor(g, block, successors[1]);
+        } else if (IsReturn(op)) {
+            if (s->Caller)
+                AddSuccessor(g, block, s->Continuation);
+        } else if (IsRuntimeInstruction(op) && callees[last]) {
+            Scope* callee = NewScope(b, s, s->Class, callees[last]);
+            s->Callees[last] = callee;
+            callee->Continuation = GetEdgeTarget(s, last, last + 1);
+            callee->CallIndex = last;
+            callee->ArgumentSlots = (uint8_t)(tc->StackDepths[last] - tc->StackDepths[last + 1] + callee->Code->ReturnSlots);
+            if (tc->StackDepths[last + 1] > 0 && callee->Code->ReturnSlots > 0)
+                callee->ResultVariable = s->Base + s->MaxLocals + tc->StackDepths[last + 1] - 1u;
+            if (!AddScopeBlocks(b, callee))
+                return false;
+            AddSuccessor(g, block, GetScopeEntry(callee));
+        } else {
+            AddSuccessor(g, block, GetEdgeTarget(s, last, last + 1));
+        }
+    }
+    return true;
+}
+
+// Lays the reachable blocks out in reverse postorder, blocks no longer reachable get IR_NONE as their order
+static void ComputeOrder(IrGraph* g)
+{
+    const uint32_t count = g->Blocks.Count;
+    uint8_t* visited = calloc(count, 1);
+    uint32_t* postorder = malloc(count * sizeof(uint32_t));
+    // Blocks being visited along with the next successor to visit
+    uint32_t* stack = malloc(count * 2 * sizeof(uint32_t));
+    assert(visited && postorder && stack);
+
+    uint32_t postorderCount = 0;
+    stack[0] = g->Entry;
+    stack[1] = 0;
+    visited[g->Entry] = 1;
+    uint32_t depth = 1;
+    while (depth > 0) {
+        uint32_t* top = &stack[(depth - 1) * 2];
+        const IrBlock* block = IrGetBlock(g, top[0]);
+        if (top[1] < block->SuccessorCount) {
+            const uint32_t successor = block->Successors[top[1]++];
+            if (!visited[successor]) {
+                visited[successor] = 1;
+                stack[depth * 2] = successor;
+                stack[depth * 2 + 1] = 0;
+                depth++;
+            }
+            continue;
+        }
+        postorder[postorderCount++] = top[0];
+        depth--;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        IrGetBlock(g, i)->Order = IR_NONE;
+    g->Order.Count = 0;
+    for (uint32_t i = postorderCount; i-- > 0;) {
+        IrGetBlock(g, postorder[i])->Order = g->Order.Count;
+        ArrayAppend(&g->Order, postorder[i]);
+    }
+
+    free(visited);
+    free(postorder);
+    free(stack);
+}
+
+static void AppendNode(IrGraph* g, const uint32_t block, const uint32_t id)
+{
+    ArrayAppend(&IrGetBlock(g, block)->Nodes, id);
+}
+
+static uint32_t AddNode(IrGraph* g, const uint32_t block, const IrOp op, const uint32_t lhs, const uint32_t rhs)
+{
+    const uint32_t id = NewNode(g, op, block, rhs == IR_NONE ? 1 : 2);
+    IrNode* node = IrGetNode(g, id);
+    node->Inputs[0] = lhs;
+    if (rhs != IR_NONE)
+        node->Inputs[1] = rhs;
+    AppendNode(g, block, id);
+    return id;
+}
+
+// Arithmetic on constants is folded right away
+static uint32_t AddArithmetic(IrGraph* g, const uint32_t block, const IrOp op, const uint32_t lhs, const uint32_t rhs)
+{
+    int32_t result;
+    if (IsConstant(g, lhs) && (rhs == IR_NONE || IsConstant(g, rhs))) {
+        const int32_t b = rhs == IR_NONE ? 0 : IrGetNode(g, rhs)->Constant;
+        if (FoldArithmetic(op, IrGetNode(g, lhs)->Constant, b, &result))
+            return NewConstant(g, result);
+    }
+    return AddNode(g, block, op, lhs, rhs);
+}
+
+static uint32_t AddLoad(IrGraph* g, const uint32_t block, const IrOp op, const uint32_t slot)
+{
+    const uint32_t id = NewNode(g, op, block, 0);
+    IrGetNode(g, id)->Constant = (int32_t)slot;
+    AppendNode(g, block, id);
+    return id;
+}
+
+// Sets up the variables on entry to the block from its predecessors, with a phi for every variable of the block's
+// scope that may differ between them. Phi inputs are filled in once every block is built
+static void EnterBlock(Builder* b, const uint32_t id)
+{
+    IrGraph* g = b->Graph;
+    const IrBlock* block = IrGetBlock(g, id);
+    const BlockRange* range = &b->Ranges.Items[id];
+    const Scope* s = range->Scope;
+
+    if (id == g->Entry) {
+        // Arguments, or everything the loop uses when entering it from the interpreter
+        const uint32_t start = b->OsrIndex == IR_NONE ? 0 : b->OsrIndex;
+        const uint8_t* types = VerifierGetFrameTypes(s->Code, start);
+        for (uint32_t i = 0; i < b->VariableCount; i++)
+            b->Variables[i] = IR_NONE;
+        for (uint32_t i = 0; i < s->MaxLocals; i++) {
+            if (types[i] != VTYPE_TOP)
+                b->Variables[s->Base + i] = AddLoad(g, id, IR_LOAD_LOCAL, i);
+        }
+        for (uint32_t i = 0; b->OsrIndex != IR_NONE && i < s->Code->StackDepths[start]; i++)
+            b->Variables[s->Base + s->MaxLocals + i] = AddLoad(g, id, IR_LOAD_STACK, i);
+        return;
+    }
+
+    // Predecessors that come first in the order are built already
+    uint32_t first = IR_NONE;
+    for (uint32_t i = 0; i < block->Predecessors.Count; i++) {
+        const uint32_t predecessor = block->Predecessors.Items[i];
+        if (IrGetBlock(g, predecessor)->Order < block->Order && (first == IR_NONE || IrGetBlock(g, predecessor)->Order < IrGetBlock(g, first)->Order))
+            first = predecessor;
+    }
+    assert(first != IR_NONE && "Block reached before its predecessors");
+    memcpy(b->Variables, b->States[first], b->VariableCount * sizeof(uint32_t));
+    if (block->Predecessors.Count == 1)
+        return;
+
+    // Callers of the scope can't change while it runs and callees haven't started yet
+    const uint8_t* types = VerifierGetFrameTypes(s->Code, range->Start);
+    const uint32_t depth = s->Code->StackDepths[range->Start];
+    for (uint32_t i = s->Base + s->MaxLocals + s->MaxStack; i < b->VariableCount; i++)
+        b->Variables[i] = IR_NONE;
+    for (uint32_t i = 0; i < (uint32_t)s->MaxLocals + depth; i++) {
+        const uint32_t variable = s->Base + i;
+        if (i < s->MaxLocals && types[i] == VTYPE_TOP) {
+            b->Variables[variable] = IR_NONE;
+            continue;
+        }
+        const uint32_t phi = NewNode(g, IR_PHI, id, block->Predecessors.Count);
+        IrGetNode(g, phi)->Constant = (int32_t)variable;
+        AppendNode(g, id, phi);
+        b->Variables[variable] = phi;
+    }
+    for (uint32_t i = s->Base + s->MaxLocals + depth; i < s->Base + s->MaxLocals + s->MaxStack; i++)
+        b->Variables[i] = IR_NONE;
+}
+
+// Writes the frame back and hands the instruction to the runtime. The operand stack is read back after it since
+// the instruction changes it, the locals stay as they are
+static void AddRuntimeCall(Builder* b, const uint32_t block, const Scope* s, Instruction* inst, const uint32_t index, const IrOp op)
+{
+    IrGraph* g = b->Graph;
+    const uint8_t* types = VerifierGetFrameTypes(s->Code, index);
+    const uint32_t depth = s->Code->StackDepths[index];
+    uint32_t* locals = &b->Variables[s->Base];
+
+    const uint32_t id = NewNode(g, op, block, s->MaxLocals + depth);
+    IrNode* node = IrGetNode(g, id);
+    node->Instruction = inst;
+    node->StackDepth = (uint16_t)depth;
+    for (uint32_t i = 0; i < (uint32_t)s->MaxLocals + depth; i++)
+        node->Inputs[i] = i < s->MaxLocals && types[i] == VTYPE_TOP ? IR_NONE : locals[i];
+    AppendNode(g, block, id);
+
+    const uint32_t newDepth = s->Code->StackDepths[index + 1];
+    for (uint32_t i = 0; i < newDepth; i++)
+        locals[s->MaxLocals + i] = AddLoad(g, block, IR_LOAD_STACK, i);
+    // Collections during the call may have moved the objects the references in locals point to
+    const uint8_t* nextTypes = VerifierGetFrameTypes(s->Code, index + 1);
+    for (uint32_t i = 0; i < s->MaxLocals; i++) {
+        if (nextTypes[i] == VTYPE_REFERENCE)
+            locals[i] = AddLoad(g, block, IR_LOAD_LOCAL, i);
+    }
+}
+
+static void AddBranch(IrGraph* g, const uint32_t block, const IrCondition condition, const uint32_t lhs, const uint32_t rhs)
+{
+    if (IrGetBlock(g, block)->SuccessorCount == 1) {
+        AddNode(g, block, IR_JUMP, IR_NONE, IR_NONE);
+        return;
+    }
+    const uint32_t id = AddNode(g, block, IR_BRANCH, lhs, rhs);
+    IrGetNode(g, id)->Condition = (uint8_t)condition;
+}
+
+// Checks the receiver of the virtual call at the instruction has the class the call always saw, the guard block's
+// first successor makes the call and the other deoptimizes
+static void AddReceiverCheck(Builder* b, const uint32_t block, const Scope* s, const uint32_t index)
+{
+    IrGraph* g = b->Graph;
+    const uint32_t depth = s->Code->StackDepths[index];
+    const uint32_t receiver = b->Variables[s->Base + s->MaxLocals + depth - RuntimeGetArgumentSlots(s->Class, &s->Code->Instructions[index]) - 1];
+    const uint32_t check = AddNode(g, block, IR_HAS_CLASS, receiver, IR_NONE);
+    IrGetNode(g, check)->Class = GetMonomorphicClass(b, s, index);
+    AddBranch(g, block, IR_NE, check, NewConstant(g, 0));
+}
+
+// Leaves to the interpreter at the instruction. The frames of the scope and its callers are rebuilt from the
+// variables, callers resume after the call into the next scope
+static void AddDeoptimize(Builder* b, const uint32_t block, const Scope* s, const uint32_t index)
+{
+    IrGraph* g = b->Graph;
+    const Scope* scopes[MAX_INLINE_DEPTH + 1];
+    uint32_t frameCount = 0;
+    for (const Scope* scope = s; scope; scope = scope->Caller)
+        frameCount++;
+
+    DeoptInfo* info;
+    ArrayPushBack(&g->Deoptimizations, &info);
+    info->FrameCount = frameCount;
+    info->Frames = ArenaAlloc(&g->Arena, frameCount * sizeof(DeoptFrame));
+    uint32_t inputCount = 0;
+    uint32_t resume = index;
+    const Scope* scope = s;
+    for (uint32_t f = frameCount; f-- > 0;) {
+        scopes[f] = scope;
+        info->Frames[f] = (DeoptFrame){
+            .Class = scope->Class,
+            .Method = scope->Method,
+            .Index = resume,
+            .ArgumentSlots = scope->ArgumentSlots,
+            .LocalCount = scope->MaxLocals,
+            .StackDepth = scope->Code->StackDepths[resume],
+        };
+        inputCount += (uint32_t)scope->MaxLocals + info->Frames[f].StackDepth;
+        resume = scope->CallIndex;
+        scope = scope->Caller;
+    }
+
+    const uint32_t id = NewNode(g, IR_DEOPTIMIZE, block, inputCount);
+    IrNode* node = IrGetNode(g, id);
+    node->Constant = (int32_t)(g->Deoptimizations.Count - 1);
+    uint32_t input = 0;
+    for (uint32_t f = 0; f < frameCount; f++) {
+        const DeoptFrame* frame = &g->Deoptimizations.Items[node->Constant].Frames[f];
+        const uint8_t* types = VerifierGetFrameTypes(scopes[f]->Code, frame->Index);
+        const uint32_t* variables = &b->Variables[scopes[f]->Base];
+        for (uint32_t i = 0; i < (uint32_t)frame->LocalCount + frame->StackDepth; i++)
+            node->Inputs[input++] = i < frame->LocalCount && types[i] == VTYPE_TOP ? IR_NONE : variables[i];
+    }
+    AppendNode(g, block, id);
+}
+
+// Interprets the instructions of the block on the variables, adding nodes for everything they compute
+static void BuildBlock(Builder* b, const uint32_t id)
+{
+    IrGraph* g = b->Graph;
+    const BlockRange* range = &b->Ranges.Items[id];
+    const Scope* s = range->Scope;
+    uint32_t* locals = &b->Variables[s->Base];
+    uint32_t* stack = locals + s->MaxLocals;
+    uint32_t depth = range->Start < range->End ? s->Code->StackDepths[range->Start] : 0;
+    bool terminated = false;
+
+    if (range->Kind == BLOCK_GUARD) {
+        AddReceiverCheck(b, id, s, range->Start);
+        return;
+    }
+    if (range->Kind == BLOCK_DEOPTIMIZE) {
+        AddDeoptimize(b, id, s, range->Start);
+        return;
+    }
+
+    for (uint32_t i = range->Start; i < range->End; i++) {
+        Instruction* inst = &s->Code->Instructions[i];
+        const InstructionOp op = GetUnfusedOp((InstructionOp)inst->Op);
+        switch (op) {
+            case INST_PUSH_INT:
+            case INST_PUSH_FLOAT:
+            case INST_PUSH_STRING_QUICK:
+                stack[depth++] = NewConstant(g, inst->B);
+                break;
+            case INST_PUSH_NULL:
+                stack[depth++] = NewConstant(g, 0);
+                break;
+            case INST_LOAD_INT:
+            case INST_LOAD_REFERENCE:
+                stack[depth++] = locals[inst->A];
+                break;
+            case INST_STORE_INT:
+            case INST_STORE_REFERENCE:
+                locals[inst->A] = stack[--depth];
+                break;
+            case INST_INC_INT:
+                locals[inst->A] = AddArithmetic(g, id, IR_ADD, locals[inst->A], NewConstant(g, (int32_t)(int8_t)inst->B));
+                break;
+            case INST_POP:
+                depth -= 1;
+                break;
+            case INST_POP2:
+                depth -= 2;
+                break;
+            case INST_DUP:
+            case INST_DUP_X1:
+            case INST_DUP_X2:
+            case INST_DUP2:
+            case INST_DUP2_X1:
+            case INST_DUP2_X2:
+            {
+                // Same shuffle as the interpreter's, on values instead of slots
+                const uint32_t count = op >= INST_DUP2 ? 2 : 1;
+                const uint32_t skip = (uint32_t)(op - (count == 2 ? INST_DUP2 : INST_DUP));
+                uint32_t values[2];
+                memcpy(values, &stack[depth - count], count * sizeof(uint32_t));
+                uint32_t* insertAt = &stack[depth - count - skip];
+                memmove(insertAt + count, insertAt, (count + skip) * sizeof(uint32_t));
+                memcpy(insertAt, values, count * sizeof(uint32_t));
+                depth += count;
+                break;
+            }
+            case INST_SWAP:
+            {
+                const uint32_t value = stack[depth - 1];
+                stack[depth - 1] = stack[depth - 2];
+                stack[depth - 2] = value;
+                break;
+            }
+            case INST_ADD_INT:
+            case INST_SUB_INT:
+            case INST_MUL_INT:
+            case INST_DIV_INT:
+            case INST_REM_INT:
+            case INST_SHL_INT:
+            case INST_SHR_INT:
+            case INST_USHR_INT:
+            case INST_AND_INT:
+            case INST_OR_INT:
+            case INST_XOR_INT:
+            {
+                const uint32_t rhs = stack[--depth];
+                const uint32_t lhs = stack[--depth];
+                stack[depth++] = AddArithmetic(g, id, GetArithmeticOp(op), lhs, rhs);
+                break;
+            }
+            case INST_NEG_INT:
+            case INST_INT_TO_BYTE:
+            case INST_INT_TO_CHAR:
+            case INST_INT_TO_SHORT:
+            {
+                const uint32_t value = stack[--depth];
+                stack[depth++] = AddArithmetic(g, id, GetArithmeticOp(op), value, IR_NONE);
+                break;
+            }
+            case INST_IF_EQ:
+            case INST_IF_NE:
+            case INST_IF_LT:
+            case INST_IF_GE:
+            case INST_IF_GT:
+            case INST_IF_LE:
+            case INST_IF_NULL:
+            case INST_IF_NON_NULL:
+            {
+                const uint32_t value = stack[--depth];
+                AddBranch(g, id, GetCondition(op), value, NewConstant(g, 0));
+                terminated = true;
+                break;
+            }
+            case INST_IF_ICMP_EQ:
+            case INST_IF_ICMP_NE:
+            case INST_IF_ICMP_LT:
+            case INST_IF_ICMP_GE:
+            case INST_IF_ICMP_GT:
+            case INST_IF_ICMP_LE:
+            {
+                const uint32_t rhs = stack[--depth];
+                const uint32_t lhs = stack[--depth];
+                AddBranch(g, id, GetCondition(op), lhs, rhs);
+                terminated = true;
+                break;
+            }
+            case INST_GOTO:
+            {
+                AddNode(g, id, IR_JUMP, IR_NONE, IR_NONE);
+                terminated = true;
+                break;
+            }
+            case INST_RETURN_INT:
+            case INST_RETURN_REFERENCE:
+            case INST_RETURN:
+            {
+                const uint32_t value = op != INST_RETURN ? stack[--depth] : IR_NONE;
+                if (s->Caller) {
+                    // Continues in the caller with the result on its operand stack
+                    if (s->ResultVariable != IR_NONE)
+                        b->Variables[s->ResultVariable] = value;
+                    AddNode(g, id, IR_JUMP, IR_NONE, IR_NONE);
+                } else {
+                    const uint32_t ret = NewNode(g, IR_RETURN, id, value == IR_NONE ? 0 : 1);
+                    if (value != IR_NONE)
+                        IrGetNode(g, ret)->Inputs[0] = value;
+                    AppendNode(g, id, ret);
+                }
+                terminated = true;
+                break;
+            }
+            default:
+            {
+                assert(IsRuntimeInstruction(op));
+                const Scope* callee = s->Callees[i];
+                if (callee) {
+                    // Inlined, the arguments on top of the stack become the first locals of the callee
+                    const uint32_t arguments = callee->ArgumentSlots;
+                    for (uint32_t v = callee->Base; v < b->VariableCount; v++)
+                        b->Variables[v] = IR_NONE;
+                    for (uint32_t a = 0; a < arguments; a++)
+                        b->Variables[callee->Base + a] = stack[depth - arguments + a];
+                    depth -= arguments;
+                    AddNode(g, id, IR_JUMP, IR_NONE, IR_NONE);
+                    terminated = true;
+                    break;
+                }
+                AddRuntimeCall(b, id, s, inst, i, GetMonomorphicClass(b, s, i) ? IR_DIRECT_CALL : IR_RUNTIME_CALL);
+                depth = s->Code->StackDepths[i + 1];
+                break;
+            }
+        }
+    }
+
+    if (!terminated)
+        AddNode(g, id, IR_JUMP, IR_NONE, IR_NONE);
+}
+
+static void ComputePredecessors(IrGraph* g)
+{
+    for (uint32_t i = 0; i < g->Blocks.Count; i++)
+        IrGetBlock(g, i)->Predecessors.Count = 0;
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const uint32_t id = g->Order.Items[i];
+        const IrBlock* block = IrGetBlock(g, id);
+        for (uint32_t s = 0; s < block->SuccessorCount; s++)
+            ArrayAppend(&IrGetBlock(g, block->Successors[s])->Predecessors, id);
+    }
+}
+
+bool IrBuild(IrGraph* g, const ClassFile* cf, const MethodInfo* method, const uint32_t osrIndex, const bool speculate)
+{
+    *g = (IrGraph){ .Arena = ArenaCreate(64 * 1024) };
+    Builder b = { .Graph = g, .OsrIndex = osrIndex, .Speculate = speculate };
+
+    b.Top = NewScope(&b, NULL, cf, method);
+    g->Entry = NewBlock(&b, b.Top, 0, BLOCK_CODE);
+    if (!AddScopeBlocks(&b, b.Top)) {
+        ArrayFree(&b.Ranges);
+        return false;
+    }
+    if (osrIndex == IR_NONE) {
+        AddSuccessor(g, g->Entry, GetScopeEntry(b.Top));
+    } else {
+        assert(b.Top->Preheaders[osrIndex] != IR_NONE && "OSR entry is not a loop header");
+        AddSuccessor(g, g->Entry, b.Top->Preheaders[osrIndex]);
+    }
+
+    ComputeOrder(g);
+    ComputePredecessors(g);
+
+    b.Variables = ArenaAlloc(&g->Arena, b.VariableCount * sizeof(uint32_t));
+    b.States = ArenaAlloc(&g->Arena, g->Blocks.Count * sizeof(uint32_t*));
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const uint32_t id = g->Order.Items[i];
+        EnterBlock(&b, id);
+        BuildBlock(&b, id);
+        b.States[id] = ArenaAlloc(&g->Arena, b.VariableCount * sizeof(uint32_t));
+        memcpy(b.States[id], b.Variables, b.VariableCount * sizeof(uint32_t));
+    }
+
+    // Every predecessor is built now
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const IrBlock* block = IrGetBlock(g, g->Order.Items[i]);
+        for (uint32_t n = 0; n < block->Nodes.Count; n++) {
+            IrNode* phi = IrGetNode(g, block->Nodes.Items[n]);
+            if (phi->Op != IR_PHI)
+                break;
+            for (uint32_t p = 0; p < block->Predecessors.Count; p++) {
+                phi->Inputs[p] = b.States[block->Predecessors.Items[p]][phi->Constant];
+                assert(phi->Inputs[p] != IR_NONE && "Variable undefined on a path into the block");
+            }
+        }
+    }
+
+    ArrayFree(&b.Ranges);
+    return true;
+}
+
+// Points inputs past the nodes that were replaced and drops those from their blocks
+static void ForwardReplacements(IrGraph* g)
+{
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        IrList* nodes = &IrGetBlock(g, g->Order.Items[i])->Nodes;
+        uint32_t kept = 0;
+        for (uint32_t n = 0; n < nodes->Count; n++) {
+            IrNode* node = IrGetNode(g, nodes->Items[n]);
+            if (node->Replacement != IR_NONE)
+                continue;
+            for (uint32_t k = 0; k < node->InputCount; k++)
+                node->Inputs[k] = Resolve(g, node->Inputs[k]);
+            nodes->Items[kept++] = nodes->Items[n];
+        }
+        nodes->Count = kept;
+    }
+}
+
+// Phis whose inputs are all the same value, or the phi itself around a loop, are that value
+static bool RemoveTrivialPhis(IrGraph* g)
+{
+    bool changed = false;
+    bool progress;
+    do {
+        progress = false;
+        for (uint32_t i = 0; i < g->Order.Count; i++) {
+            const IrList* nodes = &IrGetBlock(g, g->Order.Items[i])->Nodes;
+            for (uint32_t n = 0; n < nodes->Count; n++) {
+                const uint32_t id = nodes->Items[n];
+                IrNode* phi = IrGetNode(g, id);
+                if (phi->Op != IR_PHI)
+                    break;
+                if (phi->Replacement != IR_NONE)
+                    continue;
+
+                uint32_t same = IR_NONE;
+                bool trivial = true;
+                for (uint32_t k = 0; k < phi->InputCount && trivial; k++) {
+                    const uint32_t input = Resolve(g, phi->Inputs[k]);
+                    if (input == id || (same != IR_NONE && SameValue(g, input, same)))
+                        continue;
+                    if (same != IR_NONE)
+                        trivial = false;
+                    same = input;
+                }
+                if (trivial) {
+                    assert(same != IR_NONE && "Phi only refers to itself");
+                    phi->Replacement = same;
+                    progress = changed = true;
+                }
+            }
+        }
+    } while (progress);
+
+    if (changed)
+        ForwardReplacements(g);
+    return changed;
+}
+
+// Removes the edge along with the phi inputs that came in through it
+static void RemoveEdge(IrGraph* g, const uint32_t from, const uint32_t to)
+{
+    IrBlock* block = IrGetBlock(g, to);
+    uint32_t index = 0;
+    while (index < block->Predecessors.Count && block->Predecessors.Items[index] != from)
+        index++;
+    if (index == block->Predecessors.Count)
+        return;
+
+    block->Predecessors.Count--;
+    memmove(&block->Predecessors.Items[index], &block->Predecessors.Items[index + 1], (block->Predecessors.Count - index) * sizeof(uint32_t));
+    for (uint32_t n = 0; n < block->Nodes.Count; n++) {
+        IrNode* phi = IrGetNode(g, block->Nodes.Items[n]);
+        if (phi->Op != IR_PHI)
+            break;
+        phi->InputCount--;
+        memmove(&phi->Inputs[index], &phi->Inputs[index + 1], (phi->InputCount - index) * sizeof(uint32_t));
+    }
+}
+
+static void MakeConstant(IrNode* node, const int32_t value)
+{
+    node->Op = IR_CONSTANT;
+    node->Constant = value;
+    node->InputCount = 0;
+}
+
+// Folds arithmetic on constants and algebraic identities, true when the node no longer computes anything
+static bool SimplifyArithmetic(IrGraph* g, IrNode* node)
+{
+    const IrOp op = (IrOp)node->Op;
+    // Constants go on the right, where they can be encoded as immediates
+    if (IsCommutative(op) && IsConstant(g, node->Inputs[0]) && !IsConstant(g, node->Inputs[1])) {
+        const uint32_t input = node->Inputs[0];
+        node->Inputs[0] = node->Inputs[1];
+        node->Inputs[1] = input;
+    }
+
+    const uint32_t lhs = node->Inputs[0];
+    const uint32_t rhs = node->InputCount > 1 ? node->Inputs[1] : IR_NONE;
+    int32_t result;
+    if (IsConstant(g, lhs) && (rhs == IR_NONE || IsConstant(g, rhs))) {
+        if (FoldArithmetic(op, IrGetNode(g, lhs)->Constant, rhs == IR_NONE ? 0 : IrGetNode(g, rhs)->Constant, &result)) {
+            MakeConstant(node, result);
+            return true;
+        }
+        return false;
+    }
+    if (rhs == IR_NONE)
+        return false;
+    if ((op == IR_SUB || op == IR_XOR) && lhs == rhs) {
+        MakeConstant(node, 0);
+        return true;
+    }
+    if (!IsConstant(g, rhs))
+        return false;
+
+    const int32_t value = IrGetNode(g, rhs)->Constant;
+    bool identity = false;
+    switch (op) {
+        case IR_ADD:
+        case IR_SUB:
+        case IR_OR:
+        case IR_XOR:
+            identity = value == 0;
+            break;
+        case IR_SHL:
+        case IR_SHR:
+        case IR_USHR:
+            identity = (value & 0x1F) == 0;
+            break;
+        case IR_MUL:
+        case IR_DIV:
+            identity = value == 1;
+            break;
+        case IR_AND:
+            identity = value == -1;
+            break;
+        default:
+            break;
+    }
+    if (identity) {
+        node->Replacement = lhs;
+        return true;
+    }
+    if (((op == IR_MUL || op == IR_AND) && value == 0) || (op == IR_REM && (value == 1 || value == -1))) {
+        MakeConstant(node, 0);
+        return true;
+    }
+    return false;
+}
+
+// A branch whose outcome is known becomes a jump, the edge it no longer takes is removed
+static bool SimplifyBranch(IrGraph* g, const uint32_t id, IrNode* node)
+{
+    const uint32_t lhs = node->Inputs[0];
+    const uint32_t rhs = node->Inputs[1];
+    bool taken;
+    if (IsConstant(g, lhs) && IsConstant(g, rhs))
+        taken = FoldCondition((IrCondition)node->Condition, IrGetNode(g, lhs)->Constant, IrGetNode(g, rhs)->Constant);
+    else if (lhs == rhs)
+        taken = FoldCondition((IrCondition)node->Condition, 0, 0);
+    else
+        return false;
+
+    IrBlock* block = IrGetBlock(g, id);
+    const uint32_t target = block->Successors[taken ? 0 : 1];
+    RemoveEdge(g, id, block->Successors[taken ? 1 : 0]);
+    block->Successors[0] = target;
+    block->SuccessorCount = 1;
+    node->Op = IR_JUMP;
+    node->InputCount = 0;
+    return true;
+}
+
+static bool FoldConstants(IrGraph* g)
+{
+    bool changed = false;
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const uint32_t id = g->Order.Items[i];
+        IrList* nodes = &IrGetBlock(g, id)->Nodes;
+        uint32_t kept = 0;
+        for (uint32_t n = 0; n < nodes->Count; n++) {
+            IrNode* node = IrGetNode(g, nodes->Items[n]);
+            if (node->Op >= IR_ADD && node->Op <= IR_TO_SHORT && SimplifyArithmetic(g, node)) {
+                changed = true;
+                continue;
+            }
+            if (node->Op == IR_BRANCH && SimplifyBranch(g, id, node))
+                changed = true;
+            nodes->Items[kept++] = nodes->Items[n];
+        }
+        nodes->Count = kept;
+    }
+
+    if (changed)
+        ForwardReplacements(g);
+    return changed;
+}
+
+// Drops the edges out of blocks that can no longer be reached
+static bool RemoveUnreachableBlocks(IrGraph* g)
+{
+    const uint32_t reachable = g->Order.Count;
+    ComputeOrder(g);
+    if (g->Order.Count == reachable)
+        return false;
+
+    for (uint32_t i = 0; i < g->Blocks.Count; i++) {
+        IrBlock* block = IrGetBlock(g, i);
+        if (block->Order != IR_NONE)
+            continue;
+        for (uint32_t s = 0; s < block->SuccessorCount; s++)
+            RemoveEdge(g, i, block->Successors[s]);
+        block->SuccessorCount = 0;
+        block->Nodes.Count = 0;
+    }
+    return true;
+}
+
+static uint32_t Intersect(const IrGraph* g, uint32_t a, uint32_t b)
+{
+    while (a != b) {
+        while (IrGetBlock(g, a)->Order > IrGetBlock(g, b)->Order)
+            a = IrGetBlock(g, a)->Dominator;
+        while (IrGetBlock(g, b)->Order > IrGetBlock(g, a)->Order)
+            b = IrGetBlock(g, b)->Dominator;
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm over the reverse postorder
+static void ComputeDominators(IrGraph* g)
+{
+    for (uint32_t i = 0; i < g->Blocks.Count; i++)
+        IrGetBlock(g, i)->Dominator = IR_NONE;
+    IrGetBlock(g, g->Entry)->Dominator = g->Entry;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = 1; i < g->Order.Count; i++) {
+            IrBlock* block = IrGetBlock(g, g->Order.Items[i]);
+            uint32_t dominator = IR_NONE;
+            for (uint32_t p = 0; p < block->Predecessors.Count; p++) {
+                const uint32_t predecessor = block->Predecessors.Items[p];
+                if (IrGetBlock(g, predecessor)->Dominator == IR_NONE)
+                    continue;
+                dominator = dominator == IR_NONE ? predecessor : Intersect(g, predecessor, dominator);
+            }
+            if (block->Dominator != dominator) {
+                block->Dominator = dominator;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool Dominates(const IrGraph* g, const uint32_t a, uint32_t b)
+{
+    for (;;) {
+        if (a == b)
+            return true;
+        if (b == g->Entry)
+            return false;
+        b = IrGetBlock(g, b)->Dominator;
+    }
+}
+
+static uint32_t HashExpression(const IrNode* node)
+{
+    uint32_t hash = HashBytes(&node->Op, sizeof(node->Op), HASH_SEED);
+    hash = HashBytes(&node->Constant, sizeof(node->Constant), hash);
+    return node->InputCount > 0 ? HashBytes(node->Inputs, node->InputCount * sizeof(uint32_t), hash) : hash;
+}
+
+static bool SameExpression(const IrNode* a, const IrNode* b)
+{
+    if (a->Op != b->Op || a->Constant != b->Constant || a->InputCount != b->InputCount)
+        return false;
+    return a->InputCount == 0 || memcmp(a->Inputs, b->Inputs, a->InputCount * sizeof(uint32_t)) == 0;
+}
+
+// Global value numbering. A pure node computing the same as one in a dominating block is replaced by it, blocks are
+// visited in reverse postorder so dominating blocks come first
+static void NumberValues(IrGraph* g)
+{
+    uint32_t capacity = 16;
+    while (capacity < g->Nodes.Count * 2)
+        capacity *= 2;
+    uint32_t* buckets = malloc(capacity * sizeof(uint32_t));
+    uint32_t* next = malloc(g->Nodes.Count * sizeof(uint32_t));
+    assert(buckets && next);
+    for (uint32_t i = 0; i < capacity; i++)
+        buckets[i] = IR_NONE;
+
+    // Constants aren't in any block, they are numbered first so the nodes using them compare equal
+    for (uint32_t id = 0; id < g->Nodes.Count; id++) {
+        IrNode* node = IrGetNode(g, id);
+        if (node->Op != IR_CONSTANT || node->Replacement != IR_NONE)
+            continue;
+        const uint32_t bucket = HashExpression(node) & (capacity - 1);
+        uint32_t other = buckets[bucket];
+        while (other != IR_NONE && !SameExpression(IrGetNode(g, other), node))
+            other = next[other];
+        if (other != IR_NONE) {
+            node->Replacement = other;
+            continue;
+        }
+        next[id] = buckets[bucket];
+        buckets[bucket] = id;
+    }
+
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const uint32_t block = g->Order.Items[i];
+        const IrList* nodes = &IrGetBlock(g, block)->Nodes;
+        for (uint32_t n = 0; n < nodes->Count; n++) {
+            const uint32_t id = nodes->Items[n];
+            IrNode* node = IrGetNode(g, id);
+            for (uint32_t k = 0; k < node->InputCount; k++)
+                node->Inputs[k] = Resolve(g, node->Inputs[k]);
+            if (!IsPure(g, node))
+                continue;
+            if (IsCommutative((IrOp)node->Op) && !IsConstant(g, node->Inputs[1]) && node->Inputs[0] > node->Inputs[1]) {
+                const uint32_t input = node->Inputs[0];
+                node->Inputs[0] = node->Inputs[1];
+                node->Inputs[1] = input;
+            }
+
+            const uint32_t bucket = HashExpression(node) & (capacity - 1);
+            uint32_t other = buckets[bucket];
+            while (other != IR_NONE && !(SameExpression(IrGetNode(g, other), node) && Dominates(g, IrGetNode(g, other)->Block, block)))
+                other = next[other];
+            if (other != IR_NONE) {
+                node->Replacement = other;
+                continue;
+            }
+            next[id] = buckets[bucket];
+            buckets[bucket] = id;
+        }
+    }
+
+    free(buckets);
+    free(next);
+    ForwardReplacements(g);
+}
+
+// Keeps what has side effects or decides control flow and everything they use
+static void EliminateDeadCode(IrGraph* g)
+{
+    bool* live = calloc(g->Nodes.Count, sizeof(bool));
+    uint32_t* worklist = malloc(g->Nodes.Count * sizeof(uint32_t));
+    assert(live && worklist);
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const IrList* nodes = &IrGetBlock(g, g->Order.Items[i])->Nodes;
+        for (uint32_t n = 0; n < nodes->Count; n++) {
+            const IrNode* node = IrGetNode(g, nodes->Items[n]);
+            const bool throws = (node->Op == IR_DIV || node->Op == IR_REM) && !IsPure(g, node);
+            if (IsTerminator((IrOp)node->Op) || IsCall((IrOp)node->Op) || throws) {
+                live[nodes->Items[n]] = true;
+                worklist[count++] = nodes->Items[n];
+            }
+        }
+    }
+    while (count > 0) {
+        const IrNode* node = IrGetNode(g, worklist[--count]);
+        for (uint32_t k = 0; k < node->InputCount; k++) {
+            const uint32_t input = node->Inputs[k];
+            if (input != IR_NONE && !live[input]) {
+                live[input] = true;
+                worklist[count++] = input;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        IrList* nodes = &IrGetBlock(g, g->Order.Items[i])->Nodes;
+        uint32_t kept = 0;
+        for (uint32_t n = 0; n < nodes->Count; n++) {
+            if (live[nodes->Items[n]])
+                nodes->Items[kept++] = nodes->Items[n];
+        }
+        nodes->Count = kept;
+    }
+
+    free(live);
+    free(worklist);
+}
+
+static bool IsDefinedOutside(const IrGraph* g, const IrNode* node, const uint8_t* inLoop)
+{
+    for (uint32_t k = 0; k < node->InputCount; k++) {
+        if (inLoop[IrGetNode(g, node->Inputs[k])->Block])
+            return false;
+    }
+    return true;
+}
+
+// Moves pure nodes whose inputs are all computed outside a loop to its preheader. Inner loops have their headers
+// later in the order and are visited first, so what they hoist can move further out of the loops around them
+static void HoistLoopInvariants(IrGraph* g)
+{
+    uint8_t* inLoop = malloc(g->Blocks.Count);
+    uint32_t* worklist = malloc(g->Blocks.Count * sizeof(uint32_t));
+    assert(inLoop && worklist);
+
+    for (uint32_t i = g->Order.Count; i-- > 0;) {
+        const uint32_t header = g->Order.Items[i];
+        const IrBlock* block = IrGetBlock(g, header);
+
+        // Backedges come from blocks the header dominates, every other edge has to come from the one preheader
+        uint32_t preheader = IR_NONE;
+        uint32_t entries = 0;
+        bool loop = false;
+        for (uint32_t p = 0; p < block->Predecessors.Count; p++) {
+            const uint32_t predecessor = block->Predecessors.Items[p];
+            if (Dominates(g, header, predecessor)) {
+                loop = true;
+            } else {
+                preheader = predecessor;
+                entries++;
+            }
+        }
+        if (!loop || entries != 1 || IrGetBlock(g, preheader)->SuccessorCount != 1)
+            continue;
+
+        // The blocks that reach a backedge without going through the header
+        memset(inLoop, 0, g->Blocks.Count);
+        inLoop[header] = 1;
+        uint32_t count = 0;
+        for (uint32_t p = 0; p < block->Predecessors.Count; p++) {
+            const uint32_t predecessor = block->Predecessors.Items[p];
+            if (Dominates(g, header, predecessor) && !inLoop[predecessor]) {
+                inLoop[predecessor] = 1;
+                worklist[count++] = predecessor;
+            }
+        }
+        while (count > 0) {
+            const IrBlock* body = IrGetBlock(g, worklist[--count]);
+            for (uint32_t p = 0; p < body->Predecessors.Count; p++) {
+                const uint32_t predecessor = body->Predecessors.Items[p];
+                if (!inLoop[predecessor]) {
+                    inLoop[predecessor] = 1;
+                    worklist[count++] = predecessor;
+                }
+            }
+        }
+
+        IrList* target = &IrGetBlock(g, preheader)->Nodes;
+        for (uint32_t j = i; j < g->Order.Count; j++) {
+            const uint32_t id = g->Order.Items[j];
+            if (!inLoop[id])
+                continue;
+            IrList* nodes = &IrGetBlock(g, id)->Nodes;
+            uint32_t kept = 0;
+            for (uint32_t n = 0; n < nodes->Count; n++) {
+                IrNode* node = IrGetNode(g, nodes->Items[n]);
+                if (!IsPure(g, node) || !IsDefinedOutside(g, node, inLoop)) {
+                    nodes->Items[kept++] = nodes->Items[n];
+                    continue;
+                }
+                // Ahead of the preheader's jump
+                ArrayAppend(target, nodes->Items[n]);
+                target->Items[target->Count - 1] = target->Items[target->Count - 2];
+                target->Items[target->Count - 2] = nodes->Items[n];
+                node->Block = preheader;
+            }
+            nodes->Count = kept;
+        }
+    }
+
+    free(inLoop);
+    free(worklist);
+}
+
+void IrOptimize(IrGraph* g)
+{
+    // Each of these can make more of the others possible
+    bool changed;
+    do {
+        changed = RemoveTrivialPhis(g);
+        changed |= FoldConstants(g);
+        changed |= RemoveUnreachableBlocks(g);
+    } while (changed);
+
+    ComputeDominators(g);
+    NumberValues(g);
+    EliminateDeadCode(g);
+    HoistLoopInvariants(g);
+}
+
+// Values that need a register or a spill slot
+static bool IsValue(const IrNode* node)
+{
+    return node->Op != IR_CONSTANT && !IsCall((IrOp)node->Op) && !IsTerminator((IrOp)node->Op);
+}
+
+// Moves into phis happen at the end of the predecessors. An edge from a block that branches to a block with several
+// predecessors gets a block of its own for them
+static void SplitCriticalEdges(IrGraph* g)
+{
+    const uint32_t count = g->Order.Count;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t id = g->Order.Items[i];
+        for (uint32_t s = 0; s < IrGetBlock(g, id)->SuccessorCount; s++) {
+            const uint32_t successor = IrGetBlock(g, id)->Successors[s];
+            if (IrGetBlock(g, id)->SuccessorCount < 2 || IrGetBlock(g, successor)->Predecessors.Count < 2)
+                continue;
+
+            IrBlock* split;
+            ArrayPushBack(&g->Blocks, &split);
+            *split = (IrBlock){ .Dominator = IR_NONE, .Order = IR_NONE, .SuccessorCount = 1, .Successors = { successor } };
+            const uint32_t splitId = g->Blocks.Count - 1;
+            ArrayAppend(&split->Predecessors, id);
+            AppendNode(g, splitId, NewNode(g, IR_JUMP, splitId, 0));
+
+            IrBlock* target = IrGetBlock(g, successor);
+            for (uint32_t p = 0; p < target->Predecessors.Count; p++) {
+                if (target->Predecessors.Items[p] == id)
+                    target->Predecessors.Items[p] = splitId;
+            }
+            IrGetBlock(g, id)->Successors[s] = splitId;
+        }
+    }
+    ComputeOrder(g);
+}
+
+// Index of the block among the predecessors of its successor, which is the phi input it provides
+static uint32_t GetPredecessorIndex(const IrGraph* g, const uint32_t block, const uint32_t successor)
+{
+    const IrList* predecessors = &IrGetBlock(g, successor)->Predecessors;
+    for (uint32_t p = 0; p < predecessors->Count; p++) {
+        if (predecessors->Items[p] == block)
+            return p;
+    }
+    assert(false && "Not a predecessor");
+    return 0;
+}
+
+#define BIT_SET(bits, index) ((bits)[(index) / 64] |= (uint64_t)1 << ((index) % 64))
+#define BIT_CLEAR(bits, index) ((bits)[(index) / 64] &= ~((uint64_t)1 << ((index) % 64)))
+#define BIT_TEST(bits, index) (((bits)[(index) / 64] >> ((index) % 64)) & 1)
+
+// Values live at the end of the block, phi inputs are used at the end of the predecessor they come from
+static void GetLiveOut(const IrGraph* g, const uint32_t id, uint64_t* const* liveIn, const uint32_t words, uint64_t* live)
+{
+    memset(live, 0, words * sizeof(uint64_t));
+    const IrBlock* block = IrGetBlock(g, id);
+    for (uint32_t s = 0; s < block->SuccessorCount; s++) {
+        const uint32_t successor = block->Successors[s];
+        for (uint32_t w = 0; w < words; w++)
+            live[w] |= liveIn[successor][w];
+
+        const uint32_t index = GetPredecessorIndex(g, id, successor);
+        const IrList* nodes = &IrGetBlock(g, successor)->Nodes;
+        for (uint32_t n = 0; n < nodes->Count && IrGetNode(g, nodes->Items[n])->Op == IR_PHI; n++) {
+            const uint32_t input = IrGetNode(g, nodes->Items[n])->Inputs[index];
+            if (IsValue(IrGetNode(g, input)))
+                BIT_SET(live, input);
+        }
+    }
+}
+
+// Each value gets a single interval from its definition to the last position it is live at. Holes in it are
+// ignored, which keeps the allocator a single linear pass
+static void ComputeLiveIntervals(IrGraph* g)
+{
+    uint32_t position = 0;
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        IrBlock* block = IrGetBlock(g, g->Order.Items[i]);
+        block->From = position;
+        position += 2;
+        for (uint32_t n = 0; n < block->Nodes.Count; n++) {
+            IrNode* node = IrGetNode(g, block->Nodes.Items[n]);
+            if (node->Op == IR_PHI) {
+                node->Position = block->From;
+            } else {
+                node->Position = position;
+                position += 2;
+            }
+            node->End = node->Position;
+        }
+        block->To = position;
+    }
+
+    const uint32_t words = (g->Nodes.Count + 63) / 64;
+    uint64_t** liveIn = malloc(g->Blocks.Count * sizeof(uint64_t*));
+    uint64_t* live = malloc(words * sizeof(uint64_t));
+    assert(liveIn && live);
+    for (uint32_t i = 0; i < g->Blocks.Count; i++) {
+        liveIn[i] = calloc(words, sizeof(uint64_t));
+        assert(liveIn[i]);
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = g->Order.Count; i-- > 0;) {
+            const uint32_t id = g->Order.Items[i];
+            const IrList* nodes = &IrGetBlock(g, id)->Nodes;
+            GetLiveOut(g, id, liveIn, words, live);
+            for (uint32_t n = nodes->Count; n-- > 0;) {
+                const uint32_t node = nodes->Items[n];
+                BIT_CLEAR(live, node);
+                if (IrGetNode(g, node)->Op == IR_PHI)
+                    continue;
+                for (uint32_t k = 0; k < IrGetNode(g, node)->InputCount; k++) {
+                    const uint32_t input = IrGetNode(g, node)->Inputs[k];
+                    if (input != IR_NONE && IsValue(IrGetNode(g, input)))
+                        BIT_SET(live, input);
+                }
+            }
+            if (memcmp(live, liveIn[id], words * sizeof(uint64_t)) != 0) {
+                memcpy(liveIn[id], live, words * sizeof(uint64_t));
+                changed = true;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const uint32_t id = g->Order.Items[i];
+        const IrBlock* block = IrGetBlock(g, id);
+        GetLiveOut(g, id, liveIn, words, live);
+        for (uint32_t w = 0; w < words; w++) {
+            for (uint64_t bits = live[w]; bits; bits &= bits - 1) {
+                IrNode* value = IrGetNode(g, w * 64 + (uint32_t)__builtin_ctzll(bits));
+                if (value->End < block->To)
+                    value->End = block->To;
+            }
+        }
+        for (uint32_t n = 0; n < block->Nodes.Count; n++) {
+            const IrNode* node = IrGetNode(g, block->Nodes.Items[n]);
+            if (node->Op == IR_PHI)
+                continue;
+            for (uint32_t k = 0; k < node->InputCount; k++) {
+                if (node->Inputs[k] == IR_NONE)
+                    continue;
+                IrNode* input = IrGetNode(g, node->Inputs[k]);
+                if (IsValue(input) && input->End < node->Position)
+                    input->End = node->Position;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < g->Blocks.Count; i++)
+        free(liveIn[i]);
+    free(liveIn);
+    free(live);
+}
+
+// Poletto and Sarkar's linear scan. When registers run out the interval that ends last is spilled for all of its
+// lifetime
+void IrAllocateRegisters(IrGraph* g, const uint32_t registerCount)
+{
+    SplitCriticalEdges(g);
+    ComputeLiveIntervals(g);
+
+    // Active intervals ordered by their end
+    uint32_t* active = malloc(registerCount * sizeof(uint32_t));
+    bool* used = calloc(registerCount, sizeof(bool));
+    assert(active && used);
+    uint32_t activeCount = 0;
+    g->SpillSlots = 0;
+
+    for (uint32_t i = 0; i < g->Order.Count; i++) {
+        const IrList* nodes = &IrGetBlock(g, g->Order.Items[i])->Nodes;
+        for (uint32_t n = 0; n < nodes->Count; n++) {
+            const uint32_t id = nodes->Items[n];
+            IrNode* node = IrGetNode(g, id);
+            if (!IsValue(node))
+                continue;
+
+            uint32_t expired = 0;
+            while (expired < activeCount && IrGetNode(g, active[expired])->End <= node->Position)
+                used[IrGetNode(g, active[expired++])->Location] = false;
+            activeCount -= expired;
+            memmove(active, active + expired, activeCount * sizeof(uint32_t));
+
+            if (activeCount == registerCount) {
+                IrNode* last = IrGetNode(g, active[activeCount - 1]);
+                if (last->End <= node->End) {
+                    node->Location = IR_SPILL_SLOT((int32_t)g->SpillSlots++);
+                    continue;
+                }
+                node->Location = last->Location;
+                last->Location = IR_SPILL_SLOT((int32_t)g->SpillSlots++);
+                activeCount--;
+            } else {
+                int32_t reg = 0;
+                while (used[reg])
+                    reg++;
+                node->Location = reg;
+                used[reg] = true;
+            }
+
+            uint32_t at = activeCount++;
+            while (at > 0 && IrGetNode(g, active[at - 1])->End > node->End) {
+                active[at] = active[at - 1];
+                at--;
+            }
+            active[at] = id;
+        }
+    }
+
+    free(active);
+    free(used);
+}
+
+void IrDestroy(IrGraph* g)
+{
+    for (uint32_t i = 0; i < g->Blocks.Count; i++) {
+        ArrayFree(&IrGetBlock(g, i)->Nodes);
+        ArrayFree(&IrGetBlock(g, i)->Predecessors);
+    }
+    ArrayFree(&g->Blocks);
+    ArrayFree(&g->Nodes);
+    ArrayFree(&g->Order);
+    ArrayFree(&g->Deoptimizations);
+    ArenaDestroy(&g->Arena);
+}
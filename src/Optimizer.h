@@ -0,0 +1,175 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "Arena.h"
+#include "ClassFile.h"
+#include "Runtime.h"
+#include "Translator.h"
+
+// Front end of the optimizing tier. Verified code is turned into an SSA graph with small static callees inlined, the
+// graph is optimized and every value gets a register or a spill slot. The JIT lowers the result to machine code
+
+// Missing node or block
+#define IR_NONE UINT32_MAX
+
+typedef enum
+{
+    IR_CONSTANT,
+    // Frame local or operand stack slot Constant, loaded on entry and after runtime calls
+    IR_LOAD_LOCAL,
+    IR_LOAD_STACK,
+    // One input per predecessor of its block, in the same order
+    IR_PHI,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    // Throw an ArithmeticException when dividing by zero
+    IR_DIV,
+    IR_REM,
+    IR_SHL,
+    IR_SHR,
+    IR_USHR,
+    IR_AND,
+    IR_OR,
+    IR_XOR,
+    IR_NEG,
+    IR_TO_BYTE,
+    IR_TO_CHAR,
+    IR_TO_SHORT,
+    // 1 when the reference input is of Class exactly, 0 otherwise
+    IR_HAS_CLASS,
+    // Hands Instruction to the runtime. Its inputs are the top level frame's locals followed by its operand stack,
+    // written back to the frame before the call. IR_NONE inputs hold nothing
+    IR_RUNTIME_CALL,
+    // Same as a runtime call, for a virtual call whose receiver IR_HAS_CLASS checked. See RuntimeInvokeDirect
+    IR_DIRECT_CALL,
+
+    // Block terminators
+    IR_JUMP,
+    // Compares its two inputs and goes to the first successor when Condition holds
+    IR_BRANCH,
+    // Returns the input if there is one
+    IR_RETURN,
+    // Leaves to the interpreter with the frames of IrGraph.Deoptimizations entry Constant. The inputs are the values
+    // of those frames in the same order, IR_NONE inputs hold nothing
+    IR_DEOPTIMIZE,
+} IrOp;
+
+typedef enum
+{
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_GE,
+    IR_GT,
+    IR_LE,
+} IrCondition;
+
+// Register or spill slot of a value, constants have none since they are encoded as immediates
+#define IR_LOCATION_NONE INT32_MIN
+#define IR_SPILL_SLOT(location) (-1 - (location))
+
+typedef struct
+{
+    uint8_t Op;
+    uint8_t Condition;
+    // Locals and operand stack slots in the inputs of a runtime call
+    uint16_t StackDepth;
+    uint32_t Block;
+    int32_t Constant;
+    uint32_t InputCount;
+    uint32_t* Inputs;
+    Instruction* Instruction;
+    const Symbol* Class;
+
+    // Set when the node was found equivalent to another one
+    uint32_t Replacement;
+    // Linear position and last position the value is used at, after register allocation
+    uint32_t Position;
+    uint32_t End;
+    // Register index when non-negative, otherwise see IR_SPILL_SLOT
+    int32_t Location;
+} IrNode;
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Capacity;
+    uint32_t* Items;
+} IrList;
+
+typedef struct
+{
+    // Phis first and the terminator last
+    IrList Nodes;
+    IrList Predecessors;
+    uint32_t SuccessorCount;
+    uint32_t Successors[2];
+    uint32_t Dominator;
+    // Index in IrGraph.Order, IR_NONE once unreachable
+    uint32_t Order;
+    // Linear positions the block spans
+    uint32_t From;
+    uint32_t To;
+} IrBlock;
+
+typedef struct
+{
+    Arena Arena;
+    struct
+    {
+        uint32_t Count;
+        uint32_t Capacity;
+        IrNode* Items;
+    } Nodes;
+    struct
+    {
+        uint32_t Count;
+        uint32_t Capacity;
+        IrBlock* Items;
+    } Blocks;
+    uint32_t Entry;
+    // Reachable blocks in reverse postorder, which is also the order code is laid out in
+    IrList Order;
+    uint32_t SpillSlots;
+    // Frames every deoptimization rebuilds, the values they hold are left out
+    struct
+    {
+        uint32_t Count;
+        uint32_t Capacity;
+        DeoptInfo* Items;
+    } Deoptimizations;
+} IrGraph;
+
+// Builds the graph of the method, which has to have been verified. Entry is at the loop header osrIndex with the
+// locals and operand stack taken from the frame when it isn't IR_NONE. When speculating, branch directions and
+// receiver classes the profiles never saw deoptimize instead of being compiled. False when the method can't be compiled
+bool IrBuild(IrGraph* g, const ClassFile* cf, const MethodInfo* method, const uint32_t osrIndex, const bool speculate);
+// Constant folding, global value numbering, dead code elimination and loop invariant code motion
+void IrOptimize(IrGraph* g);
+// Linear scan over the blocks in order. Values live across a runtime call stay in registers, the code generator
+// saves the caller saved ones
+void IrAllocateRegisters(IrGraph* g, const uint32_t registerCount);
+void IrDestroy(IrGraph* g);
+
+// Values are referred to by the node that defines them
+static inline IrNode* IrGetNode(const IrGraph* g, const uint32_t id)
+{
+    return &g->Nodes.Items[id];
+}
+
+static inline IrBlock* IrGetBlock(const IrGraph* g, const uint32_t id)
+{
+    return &g->Blocks.Items[id];
+}
+
+// Values live across the position, which the code generator saves around calls
+static inline bool IrIsLiveAcross(const IrNode* node, const uint32_t position)
+{
+    return node->Position < position && node->End > position;
+}
+
+#endif //OPTIMIZER_H
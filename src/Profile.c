@@ -0,0 +1,40 @@
+#include "Profile.h"
+
+#include <assert.h>
+
+MethodProfile* GetMethodProfile(const ClassFile* cf, const MethodInfo* method)
+{
+    if (method->Profile)
+        return method->Profile;
+
+    const TranslatedCode* tc = method->Code->Translated;
+    assert(tc && "Method not translated");
+
+    // Lives as long as the method, which is as long as its class
+    Arena* arena = (Arena*)&cf->Arena;
+    MethodProfile* profile = ArenaAlloc(arena, sizeof(MethodProfile));
+    profile->Class = cf;
+    profile->Method = method;
+    profile->Tier = TIER_INTERPRETER;
+    profile->Branches = ArenaAlloc(arena, tc->Count * sizeof(BranchProfile));
+    profile->Receivers = ArenaAlloc(arena, tc->Count * sizeof(ReceiverProfile));
+
+    ((MethodInfo*)method)->Profile = profile;
+    return profile;
+}
+
+void ProfileReceiver(ReceiverProfile* profile, const Symbol* receiverClass)
+{
+    for (uint32_t i = 0; i < PROFILE_RECEIVER_ROWS; i++) {
+        if (profile->Classes[i] == receiverClass) {
+            profile->Counts[i]++;
+            return;
+        }
+        if (!profile->Classes[i]) {
+            profile->Classes[i] = receiverClass;
+            profile->Counts[i] = 1;
+            return;
+        }
+    }
+    profile->Polymorphic++;
+}
@@ -0,0 +1,70 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ClassFile.h"
+#include "Symbol.h"
+#include "Translator.h"
+
+// How the method currently runs. Methods move up, except that deoptimizing sends optimized ones back to baseline code
+typedef enum
+{
+    TIER_INTERPRETER,
+    // Compiled by the baseline JIT
+    TIER_BASELINE,
+    // Compiled by the optimizing JIT
+    TIER_OPTIMIZED,
+    // Runs code from the ahead-of-time compiled library from its first call on, never compiled again
+    TIER_AOT,
+} ExecutionTier;
+
+typedef struct
+{
+    uint32_t Taken;
+    uint32_t NotTaken;
+} BranchProfile;
+
+// Receiver classes a virtual call site has seen, in the order they were first seen
+#define PROFILE_RECEIVER_ROWS 2
+
+typedef struct
+{
+    const Symbol* Classes[PROFILE_RECEIVER_ROWS];
+    uint32_t Counts[PROFILE_RECEIVER_ROWS];
+    // Calls with a receiver of a class that no longer fit in the rows
+    uint32_t Polymorphic;
+} ReceiverProfile;
+
+struct MethodProfile
+{
+    const ClassFile* Class;
+    const MethodInfo* Method;
+    ExecutionTier Tier;
+    // Set when compiling for the next tier failed, so it isn't tried again
+    bool CompileFailed;
+
+    uint32_t InvocationCount;
+    uint32_t BackedgeCount;
+    // Times optimized code of the method gave up on what it speculated and went back to the interpreter
+    uint32_t Deoptimizations;
+    // Indexed by instruction like the translated code, only conditional branches and virtual calls fill theirs in
+    BranchProfile* Branches;
+    ReceiverProfile* Receivers;
+};
+
+// The profile attached to the method, created the first time. The method must have been translated
+MethodProfile* GetMethodProfile(const ClassFile* cf, const MethodInfo* method);
+
+static inline void ProfileBranch(BranchProfile* profile, const bool taken)
+{
+    if (taken)
+        profile->Taken++;
+    else
+        profile->NotTaken++;
+}
+
+void ProfileReceiver(ReceiverProfile* profile, const Symbol* receiverClass);
+
+#endif //PROFILE_H
@@ -0,0 +1,117 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ClassFile.h"
+#include "Profile.h"
+#include "Translator.h"
+
+// A single untagged operand stack or local variable entry, long and double take two consecutive slots. The verifier
+// guarantees every instruction finds the types it expects so nothing is checked at runtime
+typedef union
+{
+    int32_t Int;
+    float Float;
+    // Offset of the object in the heap, 0 is null
+    uint32_t Reference;
+} Slot;
+
+// Frames live inside the thread's VM stack laid out as [locals][frame][operand stack]. The callee's locals start at
+// the arguments on top of the caller's operand stack, so passing arguments and returning moves pointers only
+typedef struct Frame
+{
+    struct Frame* Previous;
+    const ClassFile* Class;
+    const TranslatedCode* Code;
+    MethodProfile* Profile;
+    // Instruction to resume at, saved when the frame calls into another one
+    Instruction* Ip;
+    uint16_t StackSize;
+    Slot* Stack;
+    Slot* StackStart;
+
+    // (DOCS:) A single local variable can hold a value of type boolean, byte, char, short, int, float, reference, or returnAddress.
+    // A pair of local variables can hold a value of type long or double.
+    uint16_t LocalsSize;
+    Slot* Locals;
+} Frame;
+
+// Number of stack slots taken by the frame record that sits between the locals and the operand stack
+#define FRAME_SLOTS ((sizeof(Frame) + sizeof(Slot) - 1) / sizeof(Slot))
+
+// Runs a single instruction for compiled code, stackTop being the frame's operand stack before it. Calls run the
+// callee to its return. False when an exception is pending or the instruction failed
+bool RuntimeExecuteInstruction(Frame* frame, Instruction* inst, Slot* stackTop);
+
+// Throws the ArithmeticException of an int division by zero
+void RuntimeThrowDivideByZero(void);
+
+// Method a quickened static call resolved to, NULL for any other instruction
+const MethodInfo* RuntimeGetStaticCallee(const ClassFile* cf, const Instruction* inst);
+// Slots the arguments of a quickened virtual call take, the receiver is right below them
+uint8_t RuntimeGetArgumentSlots(const ClassFile* cf, const Instruction* inst);
+
+// True when the reference isn't null and its class is exactly cls
+bool RuntimeHasClass(const uint32_t reference, const Symbol* cls);
+// Same as RuntimeExecuteInstruction for a quickened virtual call whose receiver compiled code already checked to be of
+// the class the call site always saw, the method it resolved to is called without dispatching on the receiver
+bool RuntimeInvokeDirect(Frame* frame, Instruction* inst, Slot* stackTop);
+
+typedef enum
+{
+    // The frame carries on in the code that asked
+    OSR_CONTINUE = -1,
+    // Same as what the compiled code returns once the frame ran to its end
+    OSR_FAILED = 0,
+    OSR_RETURNED = 1,
+} OsrResult;
+
+// Called by baseline code at the loop backedge that reaches the optimizing tier's threshold, with the frame written
+// out as the interpreter has it at the loop header. Runs the frame to its end in optimized code when it compiles
+OsrResult RuntimeOptimizeLoop(Frame* frame, const uint32_t loopHeader);
+
+typedef enum
+{
+    // Holds nothing the code after it reads
+    DEOPT_EMPTY,
+    DEOPT_CONSTANT,
+    // Saved by compiled code in the buffer it passes to RuntimeDeoptimize, As is the index
+    DEOPT_SAVED,
+} DeoptValueKind;
+
+typedef struct
+{
+    uint8_t Kind;
+    int32_t As;
+} DeoptValue;
+
+// Interpreter frame compiled code stands for, either the method compiled or one inlined into it
+typedef struct
+{
+    const ClassFile* Class;
+    const MethodInfo* Method;
+    // Instruction the interpreter resumes at for the innermost frame, the call into the next frame for the others
+    uint32_t Index;
+    // Slots the frame's arguments take on its caller's operand stack
+    uint8_t ArgumentSlots;
+    uint16_t LocalCount;
+    uint16_t StackDepth;
+    // The locals followed by the operand stack
+    DeoptValue* Values;
+} DeoptFrame;
+
+// What compiled code has to rebuild at a point it deoptimizes at, outermost frame first
+typedef struct
+{
+    uint32_t FrameCount;
+    DeoptFrame* Frames;
+} DeoptInfo;
+
+// Called by optimized code when something it speculated on turned out wrong. Invalidates the code, rebuilds the
+// interpreter frames it stands for on top of the compiled frame and runs them to the compiled frame's end. Returns the
+// same as the compiled code does
+bool RuntimeDeoptimize(Frame* frame, const DeoptInfo* info, const uint64_t* saved);
+
+#endif //RUNTIME_H
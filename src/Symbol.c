@@ -0,0 +1,102 @@
+#include "Symbol.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arena.h"
+#include "Utils.h"
+
+#define SYMBOL_TABLE_INIT_CAP 1024
+#define SYMBOL_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Capacity;
+    const Symbol** Slots;
+    Arena Arena;
+} SymbolTable;
+
+static SymbolTable SYMBOL_TABLE = {0};
+
+#define X(name, str) const Symbol* name = NULL;
+WELL_KNOWN_SYMBOLS(X)
+#undef X
+
+static const Symbol** FindSlot(const Symbol** slots, const uint32_t capacity, const uint32_t hash, const char* bytes, const uint16_t length)
+{
+    uint32_t slot = hash & (capacity - 1);
+    while (slots[slot]) {
+        const Symbol* s = slots[slot];
+        if (s->Hash == hash && s->Length == length && memcmp(s->Bytes, bytes, length) == 0)
+            break;
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return &slots[slot];
+}
+
+static void Grow(void)
+{
+    const uint32_t newCapacity = SYMBOL_TABLE.Capacity * 2;
+    const Symbol** newSlots = calloc(newCapacity, sizeof(*newSlots));
+    assert(newSlots && "Out of RAM");
+
+    for (uint32_t i = 0; i < SYMBOL_TABLE.Capacity; i++) {
+        const Symbol* s = SYMBOL_TABLE.Slots[i];
+        if (s)
+            *FindSlot(newSlots, newCapacity, s->Hash, s->Bytes, s->Length) = s;
+    }
+
+    free((void*)SYMBOL_TABLE.Slots);
+    SYMBOL_TABLE.Slots = newSlots;
+    SYMBOL_TABLE.Capacity = newCapacity;
+}
+
+void SymbolTableInit(void)
+{
+    assert(!SYMBOL_TABLE.Slots && "Symbol table was already initialized");
+    SYMBOL_TABLE.Capacity = SYMBOL_TABLE_INIT_CAP;
+    SYMBOL_TABLE.Slots = calloc(SYMBOL_TABLE.Capacity, sizeof(*SYMBOL_TABLE.Slots));
+    assert(SYMBOL_TABLE.Slots && "Out of RAM");
+    SYMBOL_TABLE.Arena = ArenaCreate(SYMBOL_ARENA_BLOCK_SIZE);
+
+#define X(name, str) name = SymbolIntern(str, sizeof(str) - 1);
+    WELL_KNOWN_SYMBOLS(X)
+#undef X
+}
+
+void SymbolTableDestroy(void)
+{
+    free((void*)SYMBOL_TABLE.Slots);
+    ArenaDestroy(&SYMBOL_TABLE.Arena);
+    SYMBOL_TABLE = (SymbolTable){0};
+}
+
+const Symbol* SymbolIntern(const char* bytes, const uint16_t length)
+{
+    assert(SYMBOL_TABLE.Slots && "Symbol table was not initialized");
+    const uint32_t hash = HashBytes(bytes, length, HASH_SEED);
+    const Symbol** slot = FindSlot(SYMBOL_TABLE.Slots, SYMBOL_TABLE.Capacity, hash, bytes, length);
+    if (*slot)
+        return *slot;
+
+    Symbol* s = ArenaAlloc(&SYMBOL_TABLE.Arena, sizeof(Symbol) + length + 1);
+    *(uint32_t*)&s->Hash = hash;
+    *(uint16_t*)&s->Length = length;
+    memcpy((char*)s->Bytes, bytes, length);
+    *slot = s;
+
+    // Keep the load factor at or below 0.5 so probe sequences stay short
+    if (++SYMBOL_TABLE.Count * 2 > SYMBOL_TABLE.Capacity)
+        Grow();
+    return s;
+}
+
+const Symbol* SymbolLookup(const char* str)
+{
+    const size_t length = strlen(str);
+    if (length > UINT16_MAX)
+        return NULL;
+    return *FindSlot(SYMBOL_TABLE.Slots, SYMBOL_TABLE.Capacity, HashBytes(str, length, HASH_SEED), str, (uint16_t)length);
+}
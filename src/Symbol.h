@@ -0,0 +1,54 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Interned, immutable string. Two symbols with the same contents are always the same pointer
+typedef struct
+{
+    const uint32_t Hash;
+    const uint16_t Length;
+    const char Bytes[]; // Null terminated
+} Symbol;
+
+#define WELL_KNOWN_SYMBOLS(X) \
+    X(SYM_CONSTANT_VALUE,         "ConstantValue") \
+    X(SYM_CODE,                   "Code") \
+    X(SYM_STACK_MAP_TABLE,        "StackMapTable") \
+    X(SYM_EXCEPTIONS,             "Exceptions") \
+    X(SYM_SOURCE_FILE,            "SourceFile") \
+    X(SYM_LINE_NUMBER_TABLE,      "LineNumberTable") \
+    X(SYM_LOCAL_VARIABLE_TABLE,   "LocalVariableTable") \
+    X(SYM_JAVA_LANG_SYSTEM,       "java/lang/System") \
+    X(SYM_JAVA_IO_PRINT_STREAM,   "java/io/PrintStream") \
+    X(SYM_JAVA_LANG_STRING,       "java/lang/String") \
+    X(SYM_OUT,                    "out") \
+    X(SYM_PRINTLN,                "println") \
+    X(SYM_JAVA_LANG_OBJECT,       "java/lang/Object") \
+    X(SYM_INIT,                   "<init>") \
+    X(SYM_STACK_OVERFLOW_ERROR,   "java/lang/StackOverflowError") \
+    X(SYM_ARITHMETIC_EXCEPTION,   "java/lang/ArithmeticException") \
+    X(SYM_OUT_OF_MEMORY_ERROR,    "java/lang/OutOfMemoryError") \
+    X(SYM_NULL_POINTER_EXCEPTION, "java/lang/NullPointerException") \
+    X(SYM_ARRAY_INDEX_OUT_OF_BOUNDS_EXCEPTION, "java/lang/ArrayIndexOutOfBoundsException") \
+    X(SYM_NEGATIVE_ARRAY_SIZE_EXCEPTION, "java/lang/NegativeArraySizeException") \
+    X(SYM_ARRAY_STORE_EXCEPTION,  "java/lang/ArrayStoreException") \
+    X(SYM_ILLEGAL_ARGUMENT_EXCEPTION, "java/lang/IllegalArgumentException") \
+    X(SYM_VERIFY_ERROR,           "java/lang/VerifyError") \
+    X(SYM_NO_CLASS_DEF_FOUND_ERROR, "java/lang/NoClassDefFoundError") \
+    X(SYM_JAVA_UTIL_ARRAYS,       "java/util/Arrays") \
+    X(SYM_ARRAYCOPY,              "arraycopy") \
+    X(SYM_FILL,                   "fill")
+
+#define X(name, str) extern const Symbol* name;
+WELL_KNOWN_SYMBOLS(X)
+#undef X
+
+void SymbolTableInit(void);
+void SymbolTableDestroy(void);
+const Symbol* SymbolIntern(const char* bytes, const uint16_t length);
+// Returns NULL instead of interning when the string is not a symbol yet
+const Symbol* SymbolLookup(const char* str);
+
+#endif //SYMBOL_H
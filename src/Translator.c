@@ -0,0 +1,518 @@
+#include "Translator.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "OpCode.h"
+#include "Verifier.h"
+
+// Operands are big endian, the first pass guarantees they are in bounds
+#define READ_U8(pc, offset) ((uint8_t)(pc)[offset])
+#define READ_S8(pc, offset) ((int8_t)(pc)[offset])
+#define READ_U16(pc, offset) ((uint16_t)(((pc)[offset] << 8) | (pc)[(offset) + 1]))
+#define READ_S16(pc, offset) ((int16_t)READ_U16(pc, offset))
+
+// Instruction for opcodes that have no operands and translate one to one
+static bool GetSimpleOp(const uint8_t opCode, InstructionOp* op)
+{
+    switch (opCode) {
+        case OP_CODE_A_CONST_NULL: *op = INST_PUSH_NULL;     return true;
+        case OP_CODE_POP:          *op = INST_POP;           return true;
+        case OP_CODE_POP2:         *op = INST_POP2;          return true;
+        case OP_CODE_DUP:          *op = INST_DUP;           return true;
+        case OP_CODE_DUP_X1:       *op = INST_DUP_X1;        return true;
+        case OP_CODE_DUP_X2:       *op = INST_DUP_X2;        return true;
+        case OP_CODE_DUP2:         *op = INST_DUP2;          return true;
+        case OP_CODE_DUP2_X1:      *op = INST_DUP2_X1;       return true;
+        case OP_CODE_DUP2_X2:      *op = INST_DUP2_X2;       return true;
+        case OP_CODE_SWAP:         *op = INST_SWAP;          return true;
+        case OP_CODE_I_ADD:        *op = INST_ADD_INT;       return true;
+        case OP_CODE_I_SUB:        *op = INST_SUB_INT;       return true;
+        case OP_CODE_I_MUL:        *op = INST_MUL_INT;       return true;
+        case OP_CODE_I_DIV:        *op = INST_DIV_INT;       return true;
+        case OP_CODE_I_REM:        *op = INST_REM_INT;       return true;
+        case OP_CODE_I_NEG:        *op = INST_NEG_INT;       return true;
+        case OP_CODE_I_SHL:        *op = INST_SHL_INT;       return true;
+        case OP_CODE_I_SHR:        *op = INST_SHR_INT;       return true;
+        case OP_CODE_I_USHR:       *op = INST_USHR_INT;      return true;
+        case OP_CODE_I_AND:        *op = INST_AND_INT;       return true;
+        case OP_CODE_I_OR:         *op = INST_OR_INT;        return true;
+        case OP_CODE_I_XOR:        *op = INST_XOR_INT;       return true;
+        case OP_CODE_I_TO_B:       *op = INST_INT_TO_BYTE;   return true;
+        case OP_CODE_I_TO_C:       *op = INST_INT_TO_CHAR;   return true;
+        case OP_CODE_I_TO_S:       *op = INST_INT_TO_SHORT;  return true;
+        case OP_CODE_I_RETURN:     *op = INST_RETURN_INT;    return true;
+        case OP_CODE_A_RETURN:     *op = INST_RETURN_REFERENCE; return true;
+        case OP_CODE_RETURN:       *op = INST_RETURN;        return true;
+        default:                                             return false;
+    }
+}
+
+static bool GetBranchOp(const uint8_t opCode, InstructionOp* op)
+{
+    switch (opCode) {
+        case OP_CODE_IF_EQ:       *op = INST_IF_EQ;       return true;
+        case OP_CODE_IF_NE:       *op = INST_IF_NE;       return true;
+        case OP_CODE_IF_LT:       *op = INST_IF_LT;       return true;
+        case OP_CODE_IF_GE:       *op = INST_IF_GE;       return true;
+        case OP_CODE_IF_GT:       *op = INST_IF_GT;       return true;
+        case OP_CODE_IF_LE:       *op = INST_IF_LE;       return true;
+        case OP_CODE_I_CMP_EQ:    *op = INST_IF_ICMP_EQ;  return true;
+        case OP_CODE_I_CMP_NE:    *op = INST_IF_ICMP_NE;  return true;
+        case OP_CODE_I_CMP_LT:    *op = INST_IF_ICMP_LT;  return true;
+        case OP_CODE_I_CMP_GE:    *op = INST_IF_ICMP_GE;  return true;
+        case OP_CODE_I_CMP_GT:    *op = INST_IF_ICMP_GT;  return true;
+        case OP_CODE_I_CMP_LE:    *op = INST_IF_ICMP_LE;  return true;
+        case OP_CODE_IF_NULL:     *op = INST_IF_NULL;     return true;
+        case OP_CODE_IF_NON_NULL: *op = INST_IF_NON_NULL; return true;
+        case OP_CODE_GOTO:        *op = INST_GOTO;        return true;
+        default:                                          return false;
+    }
+}
+
+// Array loads and stores, which leave the type of the element in A
+static bool GetElementOp(const uint8_t opCode, InstructionOp* op, ArgumentType* type)
+{
+    switch (opCode) {
+        case OP_CODE_I_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_INT;        return true;
+        case OP_CODE_L_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_LONG;       return true;
+        case OP_CODE_F_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_FLOAT;      return true;
+        case OP_CODE_D_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_DOUBLE;     return true;
+        case OP_CODE_A_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_CLASS_TYPE; return true;
+        case OP_CODE_B_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_BYTE;       return true;
+        case OP_CODE_C_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_CHAR;       return true;
+        case OP_CODE_S_A_LOAD:  *op = INST_LOAD_ELEMENT;  *type = TYPE_SHORT;      return true;
+        case OP_CODE_I_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_INT;        return true;
+        case OP_CODE_L_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_LONG;       return true;
+        case OP_CODE_F_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_FLOAT;      return true;
+        case OP_CODE_D_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_DOUBLE;     return true;
+        case OP_CODE_A_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_CLASS_TYPE; return true;
+        case OP_CODE_B_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_BYTE;       return true;
+        case OP_CODE_C_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_CHAR;       return true;
+        case OP_CODE_S_A_STORE: *op = INST_STORE_ELEMENT; *type = TYPE_SHORT;      return true;
+        default:                                                                   return false;
+    }
+}
+
+// (DOCS:) The atype operand of newarray is a code that indicates the type of array to create
+static bool GetNewArrayType(const uint8_t arrayType, ArgumentType* type)
+{
+    switch (arrayType) {
+        case 4:  *type = TYPE_BOOL;   return true;
+        case 5:  *type = TYPE_CHAR;   return true;
+        case 6:  *type = TYPE_FLOAT;  return true;
+        case 7:  *type = TYPE_DOUBLE; return true;
+        case 8:  *type = TYPE_BYTE;   return true;
+        case 9:  *type = TYPE_SHORT;  return true;
+        case 10: *type = TYPE_INT;    return true;
+        case 11: *type = TYPE_LONG;   return true;
+        default:                      return false;
+    }
+}
+
+// Length in bytes of an instruction including its opcode, 0 for opcodes the VM doesn't support
+static uint8_t GetInstructionLength(const uint8_t opCode)
+{
+    InstructionOp op;
+    ArgumentType type;
+    if (GetSimpleOp(opCode, &op) || GetElementOp(opCode, &op, &type))
+        return 1;
+    if (GetBranchOp(opCode, &op))
+        return 3;
+
+    switch (opCode) {
+        case OP_CODE_I_CONST_M1:
+        case OP_CODE_I_CONST_0:
+        case OP_CODE_I_CONST_1:
+        case OP_CODE_I_CONST_2:
+        case OP_CODE_I_CONST_3:
+        case OP_CODE_I_CONST_4:
+        case OP_CODE_I_CONST_5:
+        case OP_CODE_I_LOAD_0:
+        case OP_CODE_I_LOAD_1:
+        case OP_CODE_I_LOAD_2:
+        case OP_CODE_I_LOAD_3:
+        case OP_CODE_I_STORE_0:
+        case OP_CODE_I_STORE_1:
+        case OP_CODE_I_STORE_2:
+        case OP_CODE_I_STORE_3:
+        case OP_CODE_A_LOAD_0:
+        case OP_CODE_A_LOAD_1:
+        case OP_CODE_A_LOAD_2:
+        case OP_CODE_A_LOAD_3:
+        case OP_CODE_A_STORE_0:
+        case OP_CODE_A_STORE_1:
+        case OP_CODE_A_STORE_2:
+        case OP_CODE_A_STORE_3:
+        case OP_CODE_ARRAY_LENGTH:
+            return 1;
+        case OP_CODE_BI_PUSH:
+        case OP_CODE_LDC:
+        case OP_CODE_I_LOAD:
+        case OP_CODE_I_STORE:
+        case OP_CODE_A_LOAD:
+        case OP_CODE_A_STORE:
+        case OP_CODE_NEW_ARRAY:
+            return 2;
+        case OP_CODE_SI_PUSH:
+        case OP_CODE_I_INC:
+        case OP_CODE_GET_STATIC:
+        case OP_CODE_GET_FIELD:
+        case OP_CODE_PUT_FIELD:
+        case OP_CODE_INVOKE_VIRTUAL:
+        case OP_CODE_INVOKE_SPECIAL:
+        case OP_CODE_INVOKE_STATIC:
+        case OP_CODE_NEW:
+        case OP_CODE_A_NEW_ARRAY:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static bool CheckConstantIndex(const ClassFile* cf, const uint16_t index, const uint32_t pc)
+{
+    if (index == 0 || index >= cf->ConstantPoolCount) {
+        fprintf(stderr, "Instruction at %u uses an invalid constant pool index %u\n", pc, index);
+        return false;
+    }
+    return true;
+}
+
+static bool CheckLocalIndex(const CodeAttribute* ca, const uint16_t index, const uint32_t pc)
+{
+    if (index >= ca->MaxLocals) {
+        fprintf(stderr, "Instruction at %u uses local %u but the method only has %u\n", pc, index, ca->MaxLocals);
+        return false;
+    }
+    return true;
+}
+
+static bool TranslateLDC(const ClassFile* cf, Instruction* inst, const uint8_t index, const uint32_t pc)
+{
+    if (!CheckConstantIndex(cf, index, pc))
+        return false;
+
+    const Constant* constant = &cf->ConstantPool[index - 1];
+    switch (constant->Type) {
+        case CONST_INT:
+        {
+            inst->Op = INST_PUSH_INT;
+            inst->B = constant->As.Int;
+            return true;
+        }
+        case CONST_FLOAT:
+        {
+            inst->Op = INST_PUSH_FLOAT;
+            const float value = constant->As.Float;
+            memcpy(&inst->B, &value, sizeof(value));
+            return true;
+        }
+        case CONST_STRING:
+        {
+            if (!CheckConstantIndex(cf, constant->As.String.Index, pc))
+                return false;
+            assert(cf->ConstantPool[constant->As.String.Index - 1].Type == CONST_UTF8);
+            inst->Op = INST_PUSH_STRING;
+            inst->B = constant->As.String.Index;
+            return true;
+        }
+        default:
+        {
+            fprintf(stderr, "LDC - Unsupported constant type %d\n", constant->Type);
+            return false;
+        }
+    }
+}
+
+static bool TranslateInstruction(const ClassFile* cf, const CodeAttribute* ca, const int32_t* instructionIndices, Instruction* inst, const uint32_t pc)
+{
+    const uint8_t* code = &ca->Code[pc];
+    const OpCode opCode = code[0];
+
+    InstructionOp op;
+    if (GetSimpleOp(opCode, &op)) {
+        inst->Op = (uint16_t)op;
+        return true;
+    }
+
+    ArgumentType type;
+    if (GetElementOp(opCode, &op, &type)) {
+        inst->Op = (uint16_t)op;
+        inst->A = (uint16_t)type;
+        return true;
+    }
+
+    if (GetBranchOp(opCode, &op)) {
+        // (DOCS:) Execution proceeds at that offset from the address of the opcode of this instruction
+        const int64_t target = (int64_t)pc + READ_S16(code, 1);
+        if (target < 0 || target >= ca->CodeLength || instructionIndices[target] < 0) {
+            fprintf(stderr, "Branch at %u has an invalid target %lld\n", pc, (long long)target);
+            return false;
+        }
+        inst->Op = (uint16_t)op;
+        inst->B = instructionIndices[target];
+        return true;
+    }
+
+    switch (opCode) {
+        case OP_CODE_I_CONST_M1:
+        case OP_CODE_I_CONST_0:
+        case OP_CODE_I_CONST_1:
+        case OP_CODE_I_CONST_2:
+        case OP_CODE_I_CONST_3:
+        case OP_CODE_I_CONST_4:
+        case OP_CODE_I_CONST_5:
+        {
+            inst->Op = INST_PUSH_INT;
+            inst->B = (int)opCode - 3;
+            return true;
+        }
+        case OP_CODE_BI_PUSH:
+        {
+            // (DOCS:) The immediate byte is sign-extended to an int value
+            inst->Op = INST_PUSH_INT;
+            inst->B = READ_S8(code, 1);
+            return true;
+        }
+        case OP_CODE_SI_PUSH:
+        {
+            inst->Op = INST_PUSH_INT;
+            inst->B = READ_S16(code, 1);
+            return true;
+        }
+        case OP_CODE_LDC:
+        {
+            return TranslateLDC(cf, inst, READ_U8(code, 1), pc);
+        }
+        case OP_CODE_I_LOAD:
+        case OP_CODE_I_LOAD_0:
+        case OP_CODE_I_LOAD_1:
+        case OP_CODE_I_LOAD_2:
+        case OP_CODE_I_LOAD_3:
+        {
+            inst->Op = INST_LOAD_INT;
+            inst->A = opCode == OP_CODE_I_LOAD ? READ_U8(code, 1) : (int)opCode - OP_CODE_I_LOAD_0;
+            return CheckLocalIndex(ca, inst->A, pc);
+        }
+        case OP_CODE_I_STORE:
+        case OP_CODE_I_STORE_0:
+        case OP_CODE_I_STORE_1:
+        case OP_CODE_I_STORE_2:
+        case OP_CODE_I_STORE_3:
+        {
+            inst->Op = INST_STORE_INT;
+            inst->A = opCode == OP_CODE_I_STORE ? READ_U8(code, 1) : (int)opCode - OP_CODE_I_STORE_0;
+            return CheckLocalIndex(ca, inst->A, pc);
+        }
+        case OP_CODE_A_LOAD:
+        case OP_CODE_A_LOAD_0:
+        case OP_CODE_A_LOAD_1:
+        case OP_CODE_A_LOAD_2:
+        case OP_CODE_A_LOAD_3:
+        {
+            inst->Op = INST_LOAD_REFERENCE;
+            inst->A = opCode == OP_CODE_A_LOAD ? READ_U8(code, 1) : (int)opCode - OP_CODE_A_LOAD_0;
+            return CheckLocalIndex(ca, inst->A, pc);
+        }
+        case OP_CODE_A_STORE:
+        case OP_CODE_A_STORE_0:
+        case OP_CODE_A_STORE_1:
+        case OP_CODE_A_STORE_2:
+        case OP_CODE_A_STORE_3:
+        {
+            inst->Op = INST_STORE_REFERENCE;
+            inst->A = opCode == OP_CODE_A_STORE ? READ_U8(code, 1) : (int)opCode - OP_CODE_A_STORE_0;
+            return CheckLocalIndex(ca, inst->A, pc);
+        }
+        case OP_CODE_I_INC:
+        {
+            inst->Op = INST_INC_INT;
+            inst->A = READ_U8(code, 1);
+            inst->B = READ_S8(code, 2);
+            return CheckLocalIndex(ca, inst->A, pc);
+        }
+        case OP_CODE_GET_STATIC:
+        case OP_CODE_GET_FIELD:
+        case OP_CODE_PUT_FIELD:
+        case OP_CODE_INVOKE_VIRTUAL:
+        case OP_CODE_INVOKE_SPECIAL:
+        case OP_CODE_INVOKE_STATIC:
+        case OP_CODE_NEW:
+        {
+            // Resolved the first time the instruction runs, which then rewrites it into its quick form
+            inst->Op = opCode == OP_CODE_GET_STATIC ? INST_GET_STATIC
+                : opCode == OP_CODE_GET_FIELD ? INST_GET_FIELD
+                : opCode == OP_CODE_PUT_FIELD ? INST_PUT_FIELD
+                : opCode == OP_CODE_INVOKE_VIRTUAL ? INST_INVOKE_VIRTUAL
+                : opCode == OP_CODE_INVOKE_SPECIAL ? INST_INVOKE_SPECIAL
+                : opCode == OP_CODE_INVOKE_STATIC ? INST_INVOKE_STATIC
+                : INST_NEW;
+            inst->B = READ_U16(code, 1);
+            return CheckConstantIndex(cf, (uint16_t)inst->B, pc);
+        }
+        case OP_CODE_NEW_ARRAY:
+        {
+            if (!GetNewArrayType(READ_U8(code, 1), &type)) {
+                fprintf(stderr, "newarray at %u has an invalid type %u\n", pc, READ_U8(code, 1));
+                return false;
+            }
+            inst->Op = INST_NEW_ARRAY;
+            inst->A = (uint16_t)type;
+            return true;
+        }
+        case OP_CODE_A_NEW_ARRAY:
+        {
+            // Resolved the first time the instruction runs, the same as new
+            inst->Op = INST_NEW_REFERENCE_ARRAY;
+            inst->B = READ_U16(code, 1);
+            return CheckConstantIndex(cf, (uint16_t)inst->B, pc);
+        }
+        case OP_CODE_ARRAY_LENGTH:
+        {
+            inst->Op = INST_ARRAY_LENGTH;
+            return true;
+        }
+        default:
+        {
+            fprintf(stderr, "Unsupported OpCode 0x%02x (%d) at %u\n", opCode, opCode, pc);
+            return false;
+        }
+    }
+}
+
+InstructionOp GetUnfusedOp(const InstructionOp op)
+{
+    switch (op) {
+        case INST_LOAD_LOAD_ADD_INT:
+        case INST_LOAD_LOAD_IF_ICMP_EQ:
+        case INST_LOAD_LOAD_IF_ICMP_NE:
+        case INST_LOAD_LOAD_IF_ICMP_LT:
+        case INST_LOAD_LOAD_IF_ICMP_GE:
+        case INST_LOAD_LOAD_IF_ICMP_GT:
+        case INST_LOAD_LOAD_IF_ICMP_LE:
+            return INST_LOAD_INT;
+        case INST_INC_GOTO:
+            return INST_INC_INT;
+        default:
+            return op;
+    }
+}
+
+uint32_t GetFusedLength(const InstructionOp op)
+{
+    switch (op) {
+        case INST_LOAD_LOAD_ADD_INT:
+        case INST_LOAD_LOAD_IF_ICMP_EQ:
+        case INST_LOAD_LOAD_IF_ICMP_NE:
+        case INST_LOAD_LOAD_IF_ICMP_LT:
+        case INST_LOAD_LOAD_IF_ICMP_GE:
+        case INST_LOAD_LOAD_IF_ICMP_GT:
+        case INST_LOAD_LOAD_IF_ICMP_LE:
+            return 3;
+        case INST_INC_GOTO:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+// Superinstruction for the sequence starting at index, INST_COUNT if there is none
+static InstructionOp GetSuperinstruction(const TranslatedCode* tc, const uint32_t index)
+{
+    const Instruction* inst = &tc->Instructions[index];
+    const uint32_t remaining = tc->Count - index;
+
+    if (inst->Op == INST_INC_INT && remaining >= 2 && inst[1].Op == INST_GOTO)
+        return INST_INC_GOTO;
+
+    if (inst->Op != INST_LOAD_INT || remaining < 3 || inst[1].Op != INST_LOAD_INT)
+        return INST_COUNT;
+
+    switch (inst[2].Op) {
+        case INST_ADD_INT:    return INST_LOAD_LOAD_ADD_INT;
+        case INST_IF_ICMP_EQ: return INST_LOAD_LOAD_IF_ICMP_EQ;
+        case INST_IF_ICMP_NE: return INST_LOAD_LOAD_IF_ICMP_NE;
+        case INST_IF_ICMP_LT: return INST_LOAD_LOAD_IF_ICMP_LT;
+        case INST_IF_ICMP_GE: return INST_LOAD_LOAD_IF_ICMP_GE;
+        case INST_IF_ICMP_GT: return INST_LOAD_LOAD_IF_ICMP_GT;
+        case INST_IF_ICMP_LE: return INST_LOAD_LOAD_IF_ICMP_LE;
+        default:              return INST_COUNT;
+    }
+}
+
+// Rewrites the sequences that show up the most in int loops into superinstructions, which then run in one dispatch.
+// Runs after verification, which only knows about plain instructions
+static void FuseSuperinstructions(TranslatedCode* tc)
+{
+    for (uint32_t i = 0; i < tc->Count;) {
+        const InstructionOp fused = GetSuperinstruction(tc, i);
+        if (fused == INST_COUNT) {
+            i++;
+            continue;
+        }
+        tc->Instructions[i].Op = (uint16_t)fused;
+        i += GetFusedLength(fused);
+    }
+}
+
+static TranslatedCode* Translate(const ClassFile* cf, const CodeAttribute* ca)
+{
+    // First pass finds where every instruction starts so branches can be turned into instruction indices
+    int32_t* instructionIndices = malloc(ca->CodeLength * sizeof(int32_t));
+    assert(instructionIndices);
+    for (uint32_t pc = 0; pc < ca->CodeLength; pc++)
+        instructionIndices[pc] = -1;
+
+    uint32_t count = 0;
+    uint8_t lastOpCode = 0;
+    for (uint32_t pc = 0; pc < ca->CodeLength; pc += GetInstructionLength(lastOpCode)) {
+        lastOpCode = ca->Code[pc];
+        const uint8_t length = GetInstructionLength(lastOpCode);
+        if (length == 0) {
+            fprintf(stderr, "Unsupported OpCode 0x%02x (%d) at %u\n", lastOpCode, lastOpCode, pc);
+            free(instructionIndices);
+            return NULL;
+        }
+        if (pc + length > ca->CodeLength) {
+            fprintf(stderr, "Instruction at %u runs past the end of the code\n", pc);
+            free(instructionIndices);
+            return NULL;
+        }
+        instructionIndices[pc] = (int32_t)count++;
+    }
+
+    Arena* arena = (Arena*)&cf->Arena;
+    TranslatedCode* tc = ArenaAlloc(arena, sizeof(TranslatedCode));
+    tc->Count = count;
+    tc->Instructions = ArenaAlloc(arena, count * sizeof(Instruction));
+    tc->BytecodePcs = ArenaAlloc(arena, count * sizeof(uint32_t));
+
+    bool result = true;
+    uint32_t i = 0;
+    for (uint32_t pc = 0; pc < ca->CodeLength && result; pc += GetInstructionLength(ca->Code[pc]), i++) {
+        tc->BytecodePcs[i] = pc;
+        result = TranslateInstruction(cf, ca, instructionIndices, &tc->Instructions[i], pc);
+    }
+
+    free(instructionIndices);
+    return result ? tc : NULL;
+}
+
+const TranslatedCode* TranslateCode(const ClassFile* cf, const MethodInfo* method)
+{
+    const CodeAttribute* ca = method->Code;
+    assert(ca && "Method code not decoded");
+    if (ca->Translated)
+        return ca->Translated;
+
+    TranslatedCode* tc = Translate(cf, ca);
+    if (!tc || !VerifyCode(cf, method, tc))
+        return NULL;
+    FuseSuperinstructions(tc);
+
+    ((CodeAttribute*)ca)->Translated = tc;
+    return tc;
+}
@@ -0,0 +1,148 @@
+#ifndef TRANSLATOR_H
+#define TRANSLATOR_H
+
+#include <stdint.h>
+
+#include "ClassFile.h"
+
+// Internal instruction set the interpreter runs, bytecode is translated into it the first time a method is invoked
+typedef enum
+{
+    INST_PUSH_INT,
+    INST_PUSH_FLOAT,
+    INST_PUSH_STRING,
+    INST_PUSH_NULL,
+    INST_LOAD_INT,
+    INST_STORE_INT,
+    INST_LOAD_REFERENCE,
+    INST_STORE_REFERENCE,
+    INST_POP,
+    INST_POP2,
+    INST_DUP,
+    INST_DUP_X1,
+    INST_DUP_X2,
+    INST_DUP2,
+    INST_DUP2_X1,
+    INST_DUP2_X2,
+    INST_SWAP,
+    INST_ADD_INT,
+    INST_SUB_INT,
+    INST_MUL_INT,
+    INST_DIV_INT,
+    INST_REM_INT,
+    INST_NEG_INT,
+    INST_SHL_INT,
+    INST_SHR_INT,
+    INST_USHR_INT,
+    INST_AND_INT,
+    INST_OR_INT,
+    INST_XOR_INT,
+    INST_INC_INT,
+    INST_INT_TO_BYTE,
+    INST_INT_TO_CHAR,
+    INST_INT_TO_SHORT,
+    // Branches hold the index of the target instruction in B
+    INST_IF_EQ,
+    INST_IF_NE,
+    INST_IF_LT,
+    INST_IF_GE,
+    INST_IF_GT,
+    INST_IF_LE,
+    INST_IF_ICMP_EQ,
+    INST_IF_ICMP_NE,
+    INST_IF_ICMP_LT,
+    INST_IF_ICMP_GE,
+    INST_IF_ICMP_GT,
+    INST_IF_ICMP_LE,
+    INST_IF_NULL,
+    INST_IF_NON_NULL,
+    INST_GOTO,
+    INST_RETURN_INT,
+    INST_RETURN_REFERENCE,
+    INST_RETURN,
+    INST_GET_STATIC,
+    INST_INVOKE_VIRTUAL,
+    INST_INVOKE_STATIC,
+    INST_INVOKE_SPECIAL,
+    INST_NEW,
+    INST_GET_FIELD,
+    INST_PUT_FIELD,
+    // Array of the primitive type in A
+    INST_NEW_ARRAY,
+    // Array of the class at constant pool index B
+    INST_NEW_REFERENCE_ARRAY,
+    INST_ARRAY_LENGTH,
+    // Element of an array of type A, bytes and booleans share their instructions
+    INST_LOAD_ELEMENT,
+    INST_STORE_ELEMENT,
+
+    // An instruction is rewritten into its quick form once its constant pool entry is resolved
+    INST_GET_STATIC_QUICK,
+    INST_INVOKE_VIRTUAL_QUICK,
+    INST_INVOKE_STATIC_QUICK,
+    // Pushes the string reference in B
+    INST_PUSH_STRING_QUICK,
+    INST_INVOKE_SPECIAL_QUICK,
+    INST_NEW_QUICK,
+    // Field of type A at offset B of the object
+    INST_GET_FIELD_QUICK,
+    INST_PUT_FIELD_QUICK,
+    INST_NEW_REFERENCE_ARRAY_QUICK,
+
+    // Superinstructions replace the first instruction of a common sequence. The rest of the sequence is left in place
+    // for operands and for branches that land in the middle of it
+    INST_LOAD_LOAD_ADD_INT,
+    INST_LOAD_LOAD_IF_ICMP_EQ,
+    INST_LOAD_LOAD_IF_ICMP_NE,
+    INST_LOAD_LOAD_IF_ICMP_LT,
+    INST_LOAD_LOAD_IF_ICMP_GE,
+    INST_LOAD_LOAD_IF_ICMP_GT,
+    INST_LOAD_LOAD_IF_ICMP_LE,
+    INST_INC_GOTO,
+
+    INST_COUNT,
+} InstructionOp;
+
+// Fixed width instruction with its operands already decoded
+typedef struct
+{
+    uint16_t Op;
+    // Local variable index
+    uint16_t A;
+    // Immediate value, instruction index of a branch target or constant pool index
+    int32_t B;
+} Instruction;
+
+struct TranslatedCode
+{
+    uint32_t Count;
+    Instruction* Instructions;
+    // Bytecode pc each instruction was translated from
+    uint32_t* BytecodePcs;
+
+    // Filled in by the verifier, indexed by instruction
+    uint16_t* StackDepths;
+    // MaxLocals + MaxStack types per instruction
+    uint16_t FrameSize;
+    uint8_t* FrameTypes;
+    // Slots taken by the return value, 0 for void
+    uint8_t ReturnSlots;
+
+    // Entry point in the code cache once compiled, see CompiledMethod
+    void* Compiled;
+    // Entry point of the baseline compile, Compiled goes back to it when optimized code deoptimizes
+    void* BaselineCompiled;
+    // On-stack replacement entry points into the compiled code, indexed by instruction and set for loop headers only
+    void** OsrEntries;
+};
+
+// Instruction a superinstruction replaced, the instruction itself if it isn't one
+InstructionOp GetUnfusedOp(const InstructionOp op);
+// Number of instructions the superinstruction covers, 1 for any other instruction
+uint32_t GetFusedLength(const InstructionOp op);
+
+// Translates and verifies the method code once and caches it on its CodeAttribute, NULL if the code is invalid or
+// unsupported. The method code must have been decoded by MethodGetCode
+const TranslatedCode* TranslateCode(const ClassFile* cf, const MethodInfo* method);
+
+#endif //TRANSLATOR_H
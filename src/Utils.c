@@ -1,31 +1,103 @@
 #include "Utils.h"
 
-#include <assert.h>
 #include <stdio.h>
-#include <stdlib.h>
 
-uint8_t* ReadFileToBuffer(const char* filePath, size_t* size)
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+uint32_t HashBytes(const void* data, const size_t length, const uint32_t seed)
 {
-    FILE* file;
-    if (fopen_s(&file, filePath, "rb") != 0) {
+    const uint8_t* bytes = data;
+    uint32_t hash = seed;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#if defined(_WIN32)
+
+const uint8_t* MapFileToMemory(const char* filePath, size_t* size)
+{
+    HANDLE file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
         fprintf(stderr, "Failed to open file: %s\n", filePath);
         return NULL;
     }
 
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    rewind(file);
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        fprintf(stderr, "Failed to get size of file or file is empty: %s\n", filePath);
+        CloseHandle(file);
+        return NULL;
+    }
 
-    char* buffer = malloc(*size);
-    assert(buffer);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        fprintf(stderr, "Failed to create file mapping: %s\n", filePath);
+        return NULL;
+    }
 
-    if (fread(buffer, 1, *size, file) != *size) {
-        fprintf(stderr, "Failed to read full file to memory.\n");
-        fclose(file);
-        free(buffer);
+    // The view keeps the mapping object alive, so the handle can be closed right away
+    const uint8_t* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data) {
+        fprintf(stderr, "Failed to map file to memory: %s\n", filePath);
         return NULL;
     }
 
-    fclose(file);
-    return (uint8_t*)buffer;
-}
\ No newline at end of file
+    *size = (size_t)fileSize.QuadPart;
+    return data;
+}
+
+void UnmapFile(const uint8_t* data, const size_t size)
+{
+    (void)size;
+    if (data)
+        UnmapViewOfFile(data);
+}
+
+#else
+
+const uint8_t* MapFileToMemory(const char* filePath, size_t* size)
+{
+    const int fd = open(filePath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open file: %s\n", filePath);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Failed to get size of file or file is empty: %s\n", filePath);
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping holds its own reference to the file, so the descriptor can be closed right away
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map file to memory: %s\n", filePath);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    return data;
+}
+
+void UnmapFile(const uint8_t* data, const size_t size)
+{
+    if (data)
+        munmap((void*)data, size);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define ARRAY_INIT_CAP 2
@@ -41,6 +42,13 @@
     } while (0)
 
 
-uint8_t* ReadFileToBuffer(const char* filePath, size_t* size);
+#define HASH_SEED 2166136261u
+
+// FNV-1a, pass the result of a previous call as the seed to hash several pieces as one
+uint32_t HashBytes(const void* data, const size_t length, const uint32_t seed);
+
+// Maps the whole file read-only, the returned memory stays valid until UnmapFile is called
+const uint8_t* MapFileToMemory(const char* filePath, size_t* size);
+void UnmapFile(const uint8_t* data, const size_t size);
 
 #endif //UTILS_H
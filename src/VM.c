@@ -1,226 +1,279 @@
 #include "VM.h"
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "Cursor.h"
+#include "Aot.h"
+#include "Descriptor.h"
+#include "Heap.h"
+#include "Jit.h"
+#include "Runtime.h"
+#include "Translator.h"
 #include "Utils.h"
+#include "Verifier.h"
 
-#define ENSURE_READ(result) \
-    do {                    \
-        if (!(result)) {    \
-            fprintf(stderr, "Error reading from cursor: %s:%d\n", __FILE__, __LINE__); \
-            return false;\
-        }\
-    } while(0)
+// Threaded dispatch through GCC computed goto, define VM_SWITCH_DISPATCH to use the portable switch loop instead
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+    #define VM_THREADED_DISPATCH
+#endif
 
-typedef struct
-{
-    const uint16_t MaxStack;
-    const uint16_t MaxLocals;
-    const uint32_t CodeLength;
-    const uint8_t* Code;
-    const uint16_t TableLength;
-    const uint8_t* ExceptionTable; // Not parsed
-    const uint16_t AttributesCount;
-    const AttributeInfo* Attributes;
-} CodeAttribute;
-
-typedef enum
-{
-    OP_CODE_I_CONST_M1     = 0x02,
-    OP_CODE_I_CONST_0      = 0x03,
-    OP_CODE_I_CONST_1      = 0x04,
-    OP_CODE_I_CONST_2      = 0x05,
-    OP_CODE_I_CONST_3      = 0x06,
-    OP_CODE_I_CONST_4      = 0x07,
-    OP_CODE_I_CONST_5      = 0x08,
-    OP_CODE_BI_PUSH        = 0x10,
-    OP_CODE_SI_PUSH        = 0x11,
-    OP_CODE_LDC            = 0x12,
-    OP_CODE_I_LOAD         = 0x15,
-    OP_CODE_I_LOAD_0       = 0x1A,
-    OP_CODE_I_LOAD_1       = 0x1B,
-    OP_CODE_I_LOAD_2       = 0x1C,
-    OP_CODE_I_LOAD_3       = 0x1D,
-    OP_CODE_I_STORE        = 0x36,
-    OP_CODE_I_STORE_0      = 0x3B,
-    OP_CODE_I_STORE_1      = 0x3C,
-    OP_CODE_I_STORE_2      = 0x3D,
-    OP_CODE_I_STORE_3      = 0x3E,
-    OP_CODE_I_ADD          = 0x60,
-    OP_CODE_I_INC          = 0x84,
-    OP_CODE_I_CMP_EQ       = 0x9F,
-    OP_CODE_I_CMP_NE       = 0xA0,
-    OP_CODE_I_CMP_LT       = 0xA1,
-    OP_CODE_I_CMP_GE       = 0xA2,
-    OP_CODE_I_CMP_GT       = 0xA3,
-    OP_CODE_I_CMP_LE       = 0xA4,
-    OP_CODE_GOTO           = 0xA7,
-    OP_CODE_I_RETURN       = 0xAC,
-    OP_CODE_RETURN         = 0xB1,
-    OP_CODE_GET_STATIC     = 0xB2,
-    OP_CODE_INVOKE_VIRTUAL = 0xB6,
-    OP_CODE_INVOKE_STATIC  = 0xB8,
-} OpCode;
-
-typedef enum
-{
-    TYPE_VOID,
-    TYPE_CLASS_TYPE,
-    TYPE_STRING,
-    TYPE_BYTE,
-    TYPE_CHAR,
-    TYPE_BOOL,
-    TYPE_SHORT,
-    TYPE_INT,
-    TYPE_FLOAT,
-} ArgumentType;
-
-typedef union
-{
-    const char* ClassType;
-    const char* String;
-    uint8_t Byte;
-    char Char;
-    bool Bool;
-    int16_t Short;
-    int32_t Int;
-    float Float;
-} ArgumentAs;
+// Static methods of the class library the VM implements itself. The arguments were already popped off the stack
+typedef bool (*Intrinsic)(const ResolvedRef* ref, const Slot* arguments);
 
+// Resolution of a single constant pool entry, cached per class after the first instruction that uses it
+struct ResolvedRef
+{
+    bool Resolved;
+    // NULL for Object's constructor, which does nothing, and for intrinsics
+    const MethodInfo* Method;
+    Intrinsic Intrinsic;
+    // Type of the elements of the array an intrinsic works on
+    ArgumentType ElementType;
+    const CodeAttribute* Code;
+    Descriptor Descriptor;
+    // Includes the receiver of special calls
+    uint8_t ArgumentSlots;
+    // Class a new instantiates, or array an anewarray does
+    const ObjectLayout* Layout;
+    // String every ldc of the entry pushes, 0 until the first one ran
+    uint32_t String;
+};
+
+// Strings hold the symbol of their contents, there are no char arrays to build them from yet
 typedef struct
 {
-    ArgumentType Type;
-    ArgumentAs As;
-} Argument;
+    ObjectHeader Header;
+    const Symbol* Value;
+} StringObject;
 
-// If a method has more than 10 you deserve the crash lol
-#define METHOD_MAX_PARAMS 10
+static ObjectLayout STRING_LAYOUT = { 0 };
+static ObjectLayout PRINT_STREAM_LAYOUT = { 0 };
+// Arrays of every primitive type, indexed by the type of their elements
+static ObjectLayout PRIMITIVE_ARRAY_LAYOUTS[TYPE_DOUBLE + 1] = { 0 };
+// What main gets called with
+static ObjectLayout STRING_ARRAY_LAYOUT = { 0 };
 
-typedef struct
-{
-    uint8_t ParametersCount;
-    ArgumentType ParameterTypes[METHOD_MAX_PARAMS];
-    ArgumentType MethodReturnType;
-} Descriptor;
+#define REFERENCE_ARRAY_LAYOUTS_INIT_CAP 64
 
+// Arrays of classes, one layout per array class name so every anewarray of the same class creates the same type
 typedef struct
 {
-    uint16_t StackSize;
-    Argument* Stack;
-    Argument* StackStart;
-
-    // (DOCS:) A single local variable can hold a value of type boolean, byte, char, short, int, float, reference, or returnAddress.
-    // A pair of local variables can hold a value of type long or double.
-    uint16_t LocalsSize;
-    uint32_t* Locals;
-} Frame;
+    uint32_t Count;
+    uint32_t Capacity;
+    ObjectLayout** Slots;
+    Arena Arena;
+} ArrayLayoutTable;
 
-static Frame* CURRENT_FRAME = NULL;
+static ArrayLayoutTable REFERENCE_ARRAY_LAYOUTS = { 0 };
+// The only PrintStream instance, System.out
+static uint32_t PRINT_STREAM_REFERENCE = 0;
 
-#define ALLOC_NEW_FRAME(ca) \
-    do { \
-        CURRENT_FRAME = malloc(sizeof(Frame)); \
-        assert(CURRENT_FRAME); \
-        CURRENT_FRAME->StackSize = (ca)->MaxStack; \
-        CURRENT_FRAME->Stack = calloc((ca)->MaxStack, sizeof(Argument)); \
-        assert(CURRENT_FRAME->Stack); \
-        CURRENT_FRAME->StackStart = CURRENT_FRAME->Stack; \
-        CURRENT_FRAME->LocalsSize = (ca)->MaxLocals; \
-        if (CURRENT_FRAME->LocalsSize > 0) { \
-            CURRENT_FRAME->Locals = calloc((ca)->MaxLocals, sizeof(uint32_t)); \
-            assert(CURRENT_FRAME->Locals); \
-        } \
-    } while(0)
+typedef struct
+{
+    Slot* Base;
+    Slot* Limit;
+    // Class name of the exception being thrown, NULL when there is none
+    const Symbol* PendingException;
+    const char* PendingExceptionMessage;
+    // Holds the message of exceptions that describe the values that caused them
+    char MessageBuffer[128];
+    // Compiled frames nest on the native stack, which gets exhausted long before the VM stack can be
+    uintptr_t NativeStackLimit;
+} VMStack;
+
+static size_t MAX_STACK_SIZE = VM_DEFAULT_STACK_SIZE;
+static bool USE_JIT = true;
+static uint32_t BASELINE_INVOCATION_THRESHOLD = VM_DEFAULT_BASELINE_INVOCATION_THRESHOLD;
+static uint32_t BASELINE_BACKEDGE_THRESHOLD = VM_DEFAULT_BASELINE_BACKEDGE_THRESHOLD;
+static uint32_t OPTIMIZED_INVOCATION_THRESHOLD = VM_DEFAULT_OPTIMIZED_INVOCATION_THRESHOLD;
+static uint32_t OPTIMIZED_BACKEDGE_THRESHOLD = VM_DEFAULT_OPTIMIZED_BACKEDGE_THRESHOLD;
+static bool PRINT_COMPILATION = false;
+
+// Methods that deoptimized this many times get optimized without speculating
+#define MAX_DEOPTIMIZATIONS 4
+
+// Native stack compiled code and the runtime it calls may take, below the default main thread stack size
+#if defined(_WIN32)
+    #define NATIVE_STACK_BUDGET (768 * 1024)
+#else
+    #define NATIVE_STACK_BUDGET (6 * 1024 * 1024)
+#endif
 
-#define FREE_CURRENT_FRAME() \
-    do { \
-        assert(CURRENT_FRAME); \
-        free((void*)CURRENT_FRAME->Stack); \
-        free((void*)CURRENT_FRAME->Locals); \
-        CURRENT_FRAME = NULL; \
-    } while(0)
+static _Thread_local VMStack THREAD_STACK = { 0 };
+static _Thread_local Frame* CURRENT_FRAME = NULL;
 
-#define STACK_PUSH_BACK(arg) \
-    do { \
-        assert(CURRENT_FRAME && "CURRENT_FRAME WAS NULL"); \
-        assert(CURRENT_FRAME->Stack < CURRENT_FRAME->StackStart + CURRENT_FRAME->StackSize && "Stack overflow"); \
-        (*arg) = CURRENT_FRAME->Stack++; \
-    } while(0)
+// Verified code stays within its operand stack, only debug builds check
+#if defined(APP_DEBUG)
+    #define DEBUG_ASSERT(x) assert(x)
+#else
+    #define DEBUG_ASSERT(x) ((void)0)
+#endif
 
-#define STACK_POP(arg) \
-    do { \
-        assert(CURRENT_FRAME && "CURRENT_FRAME WAS NULL"); \
-        assert(CURRENT_FRAME->Stack > CURRENT_FRAME->StackStart && "Stack frame is empty"); \
-        (*arg) = --CURRENT_FRAME->Stack; \
-    } while(0)
+// The message is optional
+static void ThrowException(const Symbol* className, const char* message)
+{
+    assert(!THREAD_STACK.PendingException);
+    THREAD_STACK.PendingException = className;
+    THREAD_STACK.PendingExceptionMessage = message;
+}
 
-#define STACK_COUNT (CURRENT_FRAME->Stack - CURRENT_FRAME->StackStart)
+// The message is formatted into the thread's buffer, which holds it until the exception is reported
+static void ThrowExceptionFormat(const Symbol* className, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(THREAD_STACK.MessageBuffer, sizeof(THREAD_STACK.MessageBuffer), format, args);
+    va_end(args);
+    ThrowException(className, THREAD_STACK.MessageBuffer);
+}
 
-static bool ExecuteCode(const ClassFile* cf, const CodeAttribute* ca);
+static const Symbol* GetNameOfClass(const ClassFile* cf, const uint16_t classIndex);
 
-static bool CodeAttributeCreate(CodeAttribute* ca, Cursor* c)
+// OSR compiles print the loop header they enter at
+static void PrintCompilation(const MethodProfile* profile, const uint32_t osrIndex)
 {
-    ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&ca->MaxStack));
-    ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&ca->MaxLocals));
-    ENSURE_READ(CursorReadUInt32(c, (uint32_t*)&ca->CodeLength));
-    // This cursor points to ClassFile data so we don't need to copy it, we can just take the pointer to it
-    ca->Code = &c->Data[c->ReadPosition];
-    c->ReadPosition += ca->CodeLength;
-
-    ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&ca->TableLength));
-    ca->ExceptionTable = NULL;
-    if (ca->TableLength > 0) {
-        ca->ExceptionTable = &c->Data[c->ReadPosition];
-        c->ReadPosition += ca->TableLength;
-    }
+    printf("%8u %8u  tier %d  %s.%s%s", profile->InvocationCount, profile->BackedgeCount, profile->Tier,
+        GetNameOfClass(profile->Class, profile->Class->ThisClass)->Bytes, profile->Method->Name->Bytes,
+        profile->Method->Descriptor->Bytes);
+    if (osrIndex != JIT_NO_OSR)
+        printf(" @ %u", osrIndex);
+    printf("\n");
+}
 
-    ca->Attributes = NULL;
-    ENSURE_READ(CursorReadUInt16(c, (uint16_t*)&ca->AttributesCount));
-    if (ca->AttributesCount > 0) {
-        ca->Attributes = calloc(ca->AttributesCount, sizeof(AttributeInfo));
-        assert(ca->Attributes);
-        if (!ReadAttributes((AttributeInfo*)ca->Attributes, ca->AttributesCount, c, false)) {
-            return false;
+// Tiering policy, moves the method to the baseline JIT and then to the optimizing one once either of its counters
+// reached the threshold of the next tier. Frames pushed from then on run the new code
+static void UpdateTier(MethodProfile* profile)
+{
+    if (!USE_JIT || profile->Tier == TIER_OPTIMIZED || profile->Tier == TIER_AOT || profile->CompileFailed)
+        return;
+
+    TranslatedCode* tc = (TranslatedCode*)profile->Method->Code->Translated;
+    if (profile->Tier == TIER_INTERPRETER) {
+        if (profile->InvocationCount < BASELINE_INVOCATION_THRESHOLD && profile->BackedgeCount < BASELINE_BACKEDGE_THRESHOLD)
+            return;
+        // The count only meets the threshold exactly once, one already past it waits for the next invocations
+        const uint32_t optimizeThreshold = profile->BackedgeCount < OPTIMIZED_BACKEDGE_THRESHOLD ? OPTIMIZED_BACKEDGE_THRESHOLD : 0;
+        if (!JitCompile(tc, profile, optimizeThreshold)) {
+            profile->CompileFailed = true;
+            return;
+        }
+        profile->Tier = TIER_BASELINE;
+    } else {
+        if (profile->InvocationCount < OPTIMIZED_INVOCATION_THRESHOLD && profile->BackedgeCount < OPTIMIZED_BACKEDGE_THRESHOLD)
+            return;
+        const CompiledMethod code = JitCompileOptimized(tc, profile, JIT_NO_OSR, profile->Deoptimizations < MAX_DEOPTIMIZATIONS);
+        if (!code) {
+            profile->CompileFailed = true;
+            return;
         }
+        tc->Compiled = (void*)code;
+        profile->Tier = TIER_OPTIMIZED;
     }
 
-    return true;
+    if (PRINT_COMPILATION)
+        PrintCompilation(profile, JIT_NO_OSR);
 }
 
-static void CodeAttributeDestroy(const CodeAttribute* ca)
+// Baseline methods whose loops are past the optimizing threshold already, because they were compiled late or
+// deoptimized, get optimized on their next call
+static inline void CountInvocation(MethodProfile* profile)
 {
-    free((void*)ca->Attributes);
-    free((void*)ca);
+    ++profile->InvocationCount;
+    if ((profile->Tier == TIER_INTERPRETER && profile->InvocationCount >= BASELINE_INVOCATION_THRESHOLD) ||
+        (profile->Tier == TIER_BASELINE && !profile->CompileFailed &&
+            (profile->InvocationCount >= OPTIMIZED_INVOCATION_THRESHOLD || profile->BackedgeCount >= OPTIMIZED_BACKEDGE_THRESHOLD)))
+        UpdateTier(profile);
 }
 
-static CodeAttribute* CreateCodeAttributeFromMethod(const ClassFile* cf, const MethodInfo* method)
+static inline void CountBackedge(MethodProfile* profile)
 {
-    const Constant* methodNameConst = &cf->ConstantPool[method->NameIndex - 1];
-    assert(methodNameConst->Type == CONST_UTF8);
-    const char* methodName = methodNameConst->As.Utf8;
+    if (++profile->BackedgeCount >= BASELINE_BACKEDGE_THRESHOLD && profile->Tier == TIER_INTERPRETER)
+        UpdateTier(profile);
+}
 
-    const AttributeInfo* codeAttInfo = FindAttributeByName(cf, method->Attributes, method->AttributesCount, "Code");
-    if (!codeAttInfo) {
-        fprintf(stderr, "Failed to find attribute 'Code' inside method '%s'\n", methodName);
-        return NULL;
+// Methods the ahead-of-time compiled library has code for run it from their first call on, even without the JIT
+static void BindAotCode(MethodProfile* profile)
+{
+    const CompiledMethod code = AotFindMethod(profile->Class, profile->Method);
+    if (!code)
+        return;
+    ((TranslatedCode*)profile->Method->Code->Translated)->Compiled = (void*)code;
+    profile->Tier = TIER_AOT;
+    if (PRINT_COMPILATION)
+        PrintCompilation(profile, JIT_NO_OSR);
+}
+
+// Pushes a frame for the method whose first argumentSlots locals are the values on top of the current operand stack
+static bool PushFrame(const ClassFile* cf, const MethodInfo* method, const uint8_t argumentSlots)
+{
+    const TranslatedCode* tc = TranslateCode(cf, method);
+    if (!tc) {
+        return false;
     }
 
-    Cursor attCursor = CursorCreate(codeAttInfo->Data, codeAttInfo->Length, false);
-    CodeAttribute* codeAtt = calloc(1, sizeof(CodeAttribute));
-    assert(codeAtt);
+    const CodeAttribute* ca = method->Code;
+    // Checked by the verifier against the method descriptor
+    DEBUG_ASSERT(ca->MaxLocals >= argumentSlots);
 
-    if (!CodeAttributeCreate(codeAtt, &attCursor)) {
-        CodeAttributeDestroy(codeAtt);
-        return NULL;
+    Slot* locals = THREAD_STACK.Base;
+    if (CURRENT_FRAME) {
+        DEBUG_ASSERT(CURRENT_FRAME->Stack - CURRENT_FRAME->StackStart >= argumentSlots);
+        locals = CURRENT_FRAME->Stack - argumentSlots;
+    }
+
+    // Slots are smaller than the alignment of the frame record
+    const size_t padding = ((uintptr_t)(locals + ca->MaxLocals) % _Alignof(Frame)) / sizeof(Slot);
+    if ((size_t)(THREAD_STACK.Limit - locals) < ca->MaxLocals + padding + FRAME_SLOTS + ca->MaxStack) {
+        ThrowException(SYM_STACK_OVERFLOW_ERROR, NULL);
+        return false;
     }
 
-    return codeAtt;
+    Frame* frame = (Frame*)(locals + ca->MaxLocals + padding);
+    frame->Previous = CURRENT_FRAME;
+    frame->Class = cf;
+    frame->Code = tc;
+    frame->Profile = GetMethodProfile(cf, method);
+    frame->Ip = tc->Instructions;
+    frame->LocalsSize = ca->MaxLocals;
+    frame->Locals = locals;
+    frame->StackSize = ca->MaxStack;
+    frame->StackStart = (Slot*)frame + FRAME_SLOTS;
+    frame->Stack = frame->StackStart;
+
+    CURRENT_FRAME = frame;
+    if (frame->Profile->InvocationCount == 0 && frame->Profile->Tier == TIER_INTERPRETER)
+        BindAotCode(frame->Profile);
+    CountInvocation(frame->Profile);
+    return true;
+}
+
+// Pops the current frame along with the arguments it was called with
+static void PopFrame(void)
+{
+    assert(CURRENT_FRAME);
+    Frame* frame = CURRENT_FRAME;
+    CURRENT_FRAME = frame->Previous;
+    if (CURRENT_FRAME)
+        CURRENT_FRAME->Stack = frame->Locals;
 }
 
-static const char* GetNameOfClass(const ClassFile* cf, const uint16_t classIndex)
+#define STACK_PUSH_BACK(slot) \
+    do { \
+        DEBUG_ASSERT(CURRENT_FRAME && "CURRENT_FRAME WAS NULL"); \
+        DEBUG_ASSERT(CURRENT_FRAME->Stack < CURRENT_FRAME->StackStart + CURRENT_FRAME->StackSize && "Stack overflow"); \
+        (*slot) = CURRENT_FRAME->Stack++; \
+    } while(0)
+
+#define STACK_POP(slot) \
+    do { \
+        DEBUG_ASSERT(CURRENT_FRAME && "CURRENT_FRAME WAS NULL"); \
+        DEBUG_ASSERT(CURRENT_FRAME->Stack > CURRENT_FRAME->StackStart && "Stack frame is empty"); \
+        (*slot) = --CURRENT_FRAME->Stack; \
+    } while(0)
+
+static const Symbol* GetNameOfClass(const ClassFile* cf, const uint16_t classIndex)
 {
     const Constant* class = &cf->ConstantPool[classIndex - 1];
     assert(class->Type == CONST_CLASS);
@@ -229,7 +282,7 @@ static const char* GetNameOfClass(const ClassFile* cf, const uint16_t classIndex
     return className->As.Utf8;
 }
 
-static const char* GetNameOfMember(const ClassFile* cf, const uint16_t nameAndTypeIndex)
+static const Symbol* GetNameOfMember(const ClassFile* cf, const uint16_t nameAndTypeIndex)
 {
     const Constant* nameAndType = &cf->ConstantPool[nameAndTypeIndex - 1];
     assert(nameAndType->Type == CONST_NAME_AND_TYPE);
@@ -238,555 +291,2019 @@ static const char* GetNameOfMember(const ClassFile* cf, const uint16_t nameAndTy
     return memberName->As.Utf8;
 }
 
-static ArgumentType GetTypeFromDescriptorChar(const char c)
-{
-    switch (c) {
-        case 'B':
-            return TYPE_BYTE;
-        case 'C':
-            return TYPE_CHAR;
-        case 'F':
-            return TYPE_FLOAT;
-        case 'I':
-            return TYPE_INT;
-        case 'S':
-            return TYPE_SHORT;
-        case 'Z':
-            return TYPE_BOOL;
-        case 'V':
-            return TYPE_VOID;
-        default:
-            fprintf(stderr, "Unsupported argument type %c\n", c);
-            assert(false);
-    }
-}
-
-static void ParseDescriptorStr(const char* descStr, Descriptor* desc)
+static const Symbol* GetStringValue(const uint32_t reference)
 {
-    assert(*descStr == '(' && "Descriptor should start with '('");
-
-    // TODO: this doesn't support objects or arrays
-    while (*++descStr && *descStr != ')') {
-        desc->ParameterTypes[desc->ParametersCount] = GetTypeFromDescriptorChar(*descStr);
-        assert(desc->ParameterTypes[desc->ParametersCount] != TYPE_VOID && "Method parameter can't possibly be of type void!");
-        desc->ParametersCount++;
-        assert(desc->ParametersCount <= METHOD_MAX_PARAMS && "Refactor your garbage code!");
-    }
-
-    assert(descStr);
-    // At this point descriptor points to ')'
-    desc->MethodReturnType = GetTypeFromDescriptorChar(*++descStr);
+    assert(reference != 0 && HeapGetLayout(reference) == &STRING_LAYOUT && "Not a string");
+    return ((const StringObject*)HeapGetObject(reference))->Value;
 }
 
 static bool PushIntConst(const int32_t value)
 {
-    Argument* arg;
-    STACK_PUSH_BACK(&arg);
-    arg->Type = TYPE_INT;
-    arg->As.Int = value;
+    Slot* slot;
+    STACK_PUSH_BACK(&slot);
+    slot->Int = value;
     return true;
 }
 
-static bool BIPush(Cursor* c)
+static bool PushFloatConst(const float value)
 {
-    Argument* arg;
-    STACK_PUSH_BACK(&arg);
-    arg->Type = TYPE_BYTE;
-    ENSURE_READ(CursorReadByte(c, &arg->As.Byte));
+    Slot* slot;
+    STACK_PUSH_BACK(&slot);
+    slot->Float = value;
     return true;
 }
 
-static bool SIPush(Cursor* c)
+static bool PushReference(const uint32_t reference)
 {
-    Argument* arg;
-    STACK_PUSH_BACK(&arg);
-    arg->Type = TYPE_SHORT;
-    ENSURE_READ(CursorReadInt16(c, &arg->As.Short));
+    Slot* slot;
+    STACK_PUSH_BACK(&slot);
+    slot->Reference = reference;
     return true;
 }
 
-static bool LDC(const ClassFile* cf, Cursor* c)
+// Pushes a new object with every field zeroed
+static inline bool NewObject(const ObjectLayout* layout)
 {
-    uint8_t index;
-    ENSURE_READ(CursorReadByte(c, &index));
-    const Constant* constant = &cf->ConstantPool[index - 1];
-
-    Argument* arg;
-    STACK_PUSH_BACK(&arg);
-
-    switch (constant->Type) {
-        case CONST_INT:
-        {
-            const Constant* c1 = &cf->ConstantPool[index - 1];
-            assert(c1->Type == CONST_INT);
-            arg->Type = TYPE_INT;
-            arg->As.Int = c1->As.Int;
-            break;
-        }
-        case CONST_FLOAT:
-        {
-            const Constant* c1 = &cf->ConstantPool[index - 1];
-            assert(c1->Type == CONST_FLOAT);
-            arg->Type = TYPE_FLOAT;
-            arg->As.Float = c1->As.Float;
-            break;
-        }
-        case CONST_STRING:
-        {
-            const Constant* c1 = &cf->ConstantPool[index - 1];
-            assert(c1->Type == CONST_STRING);
-            const Constant* c2 = &cf->ConstantPool[c1->As.String.Index - 1];
-            assert(c2->Type == CONST_UTF8);
-            arg->Type = TYPE_STRING;
-            arg->As.String = c2->As.Utf8;
-            break;
-        }
-        default:
-        {
-            fprintf(stderr, "LDC - Unsupported constant type %d\n", constant->Type);
-            return false;
-        }
+    const uint32_t reference = HeapAllocate(layout);
+    if (!reference) {
+        ThrowException(SYM_OUT_OF_MEMORY_ERROR, "Java heap space");
+        return false;
     }
+    return PushReference(reference);
+}
 
+static bool LoadReference(const uint8_t index)
+{
+    Slot* slot;
+    STACK_PUSH_BACK(&slot);
+    *slot = CURRENT_FRAME->Locals[index];
+    return true;
+}
+
+static bool ReferenceStore(const uint8_t index)
+{
+    Slot* slot;
+    STACK_POP(&slot);
+    CURRENT_FRAME->Locals[index] = *slot;
     return true;
 }
 
 static bool LoadInt(const uint8_t index)
 {
-    Argument* arg;
-    STACK_PUSH_BACK(&arg);
-    arg->Type = TYPE_INT;
-    arg->As.Int = (int32_t)CURRENT_FRAME->Locals[index];
+    Slot* slot;
+    STACK_PUSH_BACK(&slot);
+    *slot = CURRENT_FRAME->Locals[index];
     return true;
 }
 
 static bool IntStore(const uint8_t index)
 {
-    Argument* arg;
-    STACK_POP(&arg);
-    assert(arg->Type == TYPE_INT);
-    CURRENT_FRAME->Locals[index] = (uint32_t)arg->As.Int;
+    Slot* slot;
+    STACK_POP(&slot);
+    CURRENT_FRAME->Locals[index] = *slot;
     return true;
 }
 
-static bool IntAdd(void)
+static bool IntInc(const uint8_t index, const int8_t increase)
 {
-    Argument *val1, *val2;
-    STACK_POP(&val2);
-    STACK_POP(&val1);
-
-    assert(val1->Type == TYPE_INT);
-    assert(val2->Type == TYPE_INT);
-
-    Argument* result;
-    STACK_PUSH_BACK(&result);
-
-    result->Type = TYPE_INT;
-    result->As.Int = val1->As.Int + val2->As.Int;
-
+    // Java int arithmetic wraps around on overflow, which C only defines for unsigned integers
+    Slot* local = &CURRENT_FRAME->Locals[index];
+    local->Int = (int32_t)((uint32_t)local->Int + (uint32_t)(int32_t)increase);
     return true;
 }
 
-static bool IntInc(Cursor* c)
+static bool IntDivide(const bool remainder)
 {
-    uint8_t index;
-    ENSURE_READ(CursorReadByte(c, &index));
-
-    int8_t increase;
-    ENSURE_READ(CursorReadSByte(c, &increase));
+    Slot *val1, *val2;
+    STACK_POP(&val2);
+    STACK_POP(&val1);
 
-    CURRENT_FRAME->Locals[index] += (int32_t)increase;
+    if (val2->Int == 0) {
+        ThrowException(SYM_ARITHMETIC_EXCEPTION, "/ by zero");
+        return false;
+    }
 
-    return true;
+    // (DOCS:) If the dividend is the negative integer of largest possible magnitude and the divisor is -1, overflow
+    // occurs and the result is equal to the dividend. It would trap in C
+    int32_t result;
+    if (val2->Int == -1)
+        result = remainder ? 0 : (int32_t)(0u - (uint32_t)val1->Int);
+    else
+        result = remainder ? val1->Int % val2->Int : val1->Int / val2->Int;
+    return PushIntConst(result);
 }
 
-static bool IntCompare(Cursor* c, const OpCode comparison)
+// Duplicates the count slots on top of the stack and inserts the copy below the skip slots under them
+static void StackDuplicate(const uint8_t count, const uint8_t skip)
 {
-    uint16_t branchOffset;
-    ENSURE_READ(CursorReadUInt16(c, &branchOffset));
-
-    // -3 because this whole opcode should be rewinded.
-    // That means, rewinding 2 bytes for the offset and 1 byte for the actual opcode
-    // (DOCS:) Execution then proceeds at that offset from the address of the opcode of this if_icmp<cond>
-    branchOffset -= 3;
+    Slot* top = CURRENT_FRAME->Stack;
+    DEBUG_ASSERT(top - CURRENT_FRAME->StackStart >= count + skip);
+    DEBUG_ASSERT(top + count <= CURRENT_FRAME->StackStart + CURRENT_FRAME->StackSize);
+
+    Slot values[2];
+    memcpy(values, top - count, count * sizeof(Slot));
+    Slot* insertAt = top - count - skip;
+    memmove(insertAt + count, insertAt, (count + skip) * sizeof(Slot));
+    memcpy(insertAt, values, count * sizeof(Slot));
+    CURRENT_FRAME->Stack += count;
+}
 
-    Argument *val1, *val2;
-    STACK_POP(&val2);
-    STACK_POP(&val1);
+static ResolvedRef* GetResolvedRef(const ClassFile* cf, const uint16_t index)
+{
+    assert(index > 0 && index < cf->ConstantPoolCount && "Constant pool index out of bounds");
+    if (!cf->ResolvedRefs) {
+        // Allocated the first time anything in the class gets resolved and kept for the lifetime of the class
+        ((ClassFile*)cf)->ResolvedRefs = ArenaAlloc((Arena*)&cf->Arena, cf->ConstantPoolCount * sizeof(ResolvedRef));
+    }
+    return &cf->ResolvedRefs[index - 1];
+}
 
-    assert(val1->Type == TYPE_INT);
-    assert(val2->Type == TYPE_INT);
+// Rewrites the instruction into its quick form
+static void Quicken(Instruction* inst, const InstructionOp quickOp)
+{
+    inst->Op = (uint16_t)quickOp;
+}
 
-    switch (comparison) {
-        case OP_CODE_I_CMP_GE:
-        {
-            if (val1->As.Int >= val2->As.Int) {
-                c->ReadPosition += branchOffset;
-            }
-            return true;
-        }
-        default:
-        {
-            fprintf(stderr, "IntCompare - Invalid int comparison OpCode %x (%d)", comparison, comparison);
-            return false;
-        }
-    }
+static void PushPrintStream(void)
+{
+    PushReference(PRINT_STREAM_REFERENCE);
 }
 
-static bool GetStatic(const ClassFile* cf, Cursor* c)
+static bool GetStatic(const ClassFile* cf, Instruction* inst)
 {
-    uint16_t index;
-    ENSURE_READ(CursorReadUInt16(c, &index));
+    const uint16_t index = (uint16_t)inst->B;
     const Constant* constant = &cf->ConstantPool[index - 1];
     assert(constant->Type == CONST_FIELD_REF);
 
-    const char* className = GetNameOfClass(cf, constant->As.FieldRef.ClassIndex);
-    const char* memberName = GetNameOfMember(cf, constant->As.FieldRef.NameAndTypeIndex);
+    const Symbol* className = GetNameOfClass(cf, constant->As.FieldRef.ClassIndex);
+    const Symbol* memberName = GetNameOfMember(cf, constant->As.FieldRef.NameAndTypeIndex);
 
     if (!className || !memberName) {
         fprintf(stderr, "GetStatic - ClassName or MemberName not found!!\n");
         return false;
     }
 
-    if (strcmp(className, "java/lang/System") != 0 || strcmp(memberName, "out") != 0) {
-        fprintf(stderr, "GetStatic - Unsupported class member %s.%s\n", className, memberName);
+    if (className != SYM_JAVA_LANG_SYSTEM || memberName != SYM_OUT) {
+        fprintf(stderr, "GetStatic - Unsupported class member %s.%s\n", className->Bytes, memberName->Bytes);
         return false;
     }
 
-    Argument* arg;
-    STACK_PUSH_BACK(&arg);
-
-    arg->Type = TYPE_CLASS_TYPE;
-    arg->As.ClassType = "FakePrintStream";
+    GetResolvedRef(cf, index)->Resolved = true;
+    Quicken(inst, INST_GET_STATIC_QUICK);
 
+    PushPrintStream();
     return true;
 }
 
-static bool InvokeVirtual(const ClassFile* cf, Cursor* c)
+// Objects other than strings print as Object.toString would, their class name followed by their identity
+static void PrintReference(const uint32_t reference)
 {
-    uint16_t index;
-    ENSURE_READ(CursorReadUInt16(c, &index));
-    const Constant* constant = &cf->ConstantPool[index - 1];
-    assert(constant->Type == CONST_METHOD_REF);
-
-    const char* className = GetNameOfClass(cf, constant->As.MethodRef.ClassIndex);
-    const char* memberName = GetNameOfMember(cf, constant->As.MethodRef.NameAndTypeIndex);
-
-    if (!className || !memberName) {
-        fprintf(stderr, "InvokeVirtual - ClassName or MemberName not found!!\n");
-        return false;
+    if (!reference) {
+        printf("null\n");
+        return;
     }
 
-    if (strcmp(className, "java/io/PrintStream") != 0 || strcmp(memberName, "println") != 0) {
-        fprintf(stderr, "InvokeVirtual - Unsupported class member %s.%s\n", className, memberName);
-        return false;
+    const ObjectLayout* layout = HeapGetLayout(reference);
+    if (layout == &STRING_LAYOUT) {
+        printf("%s\n", GetStringValue(reference)->Bytes);
+        return;
     }
+    for (uint16_t i = 0; i < layout->Name->Length; i++)
+        putchar(layout->Name->Bytes[i] == '/' ? '.' : layout->Name->Bytes[i]);
+    printf("@%x\n", HeapGetIdentityHash(reference));
+}
 
-    if (STACK_COUNT < 2) {
-        fprintf(stderr, "InvokeVirtual - %s.%s expected two arguments but got %zu\n", className, memberName, STACK_COUNT);
-        return false;
+// Prints the UTF-16 code unit as UTF-8. A surrogate on its own isn't a character, PrintStream prints those as '?'
+static void PrintChar(const uint16_t value)
+{
+    char bytes[4];
+    if (value < 0x80) {
+        bytes[0] = (char)value;
+        bytes[1] = '\0';
+    } else if (value < 0x800) {
+        bytes[0] = (char)(0xC0 | (value >> 6));
+        bytes[1] = (char)(0x80 | (value & 0x3F));
+        bytes[2] = '\0';
+    } else if (value >= 0xD800 && value <= 0xDFFF) {
+        bytes[0] = '?';
+        bytes[1] = '\0';
+    } else {
+        bytes[0] = (char)(0xE0 | (value >> 12));
+        bytes[1] = (char)(0x80 | ((value >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (value & 0x3F));
+        bytes[3] = '\0';
     }
+    printf("%s\n", bytes);
+}
 
-    Argument* arg1;
-    STACK_POP(&arg1);
+// The type of the value printed comes from the descriptor println was resolved with
+static bool PrintLn(const ResolvedRef* ref)
+{
+    const Descriptor* descriptor = &ref->Descriptor;
 
-    Argument* arg0;
-    STACK_POP(&arg0);
+    Slot* value = NULL;
+    if (descriptor->ParametersCount > 0)
+        STACK_POP(&value);
 
-    assert(arg0->Type == TYPE_CLASS_TYPE);
-    if (strcmp(arg0->As.ClassType, "FakePrintStream") != 0) {
-        fprintf(stderr, "InvokeVirtual - Unsupported class type %s\n", arg0->As.ClassType);
+    Slot* printStream;
+    STACK_POP(&printStream);
+    if (!printStream->Reference) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
+        return false;
+    }
+    if (printStream->Reference != PRINT_STREAM_REFERENCE) {
+        fprintf(stderr, "InvokeVirtual - Unsupported receiver for println\n");
         assert(false);
     }
 
-    switch (arg1->Type) {
+    if (!value) {
+        printf("\n");
+        return true;
+    }
+
+    switch (descriptor->ParameterTypes[0]) {
         case TYPE_STRING:
+        case TYPE_CLASS_TYPE:
         {
-            printf("%s\n", arg1->As.String);
+            PrintReference(value->Reference);
             break;
         }
-        case TYPE_BYTE:
+        case TYPE_BOOL:
         {
-            printf("%u\n", arg1->As.Byte);
+            printf("%s\n", value->Int ? "true" : "false");
             break;
         }
-        case TYPE_SHORT:
+        case TYPE_CHAR:
         {
-            printf("%d\n", arg1->As.Short);
+            PrintChar((uint16_t)value->Int);
             break;
         }
+        case TYPE_BYTE:
+        case TYPE_SHORT:
         case TYPE_INT:
         {
-            printf("%d\n", arg1->As.Int);
+            printf("%d\n", value->Int);
             break;
         }
         case TYPE_FLOAT:
         {
-            printf("%f\n", arg1->As.Float);
+            printf("%f\n", value->Float);
             break;
         }
         default:
         {
-            fprintf(stderr, "InvokeVirtual - Expected instruction of type constant but got %d\n", arg1->Type);
+            fprintf(stderr, "InvokeVirtual - Unsupported println argument type %d\n", descriptor->ParameterTypes[0]);
             assert(false);
+            return false;
         }
     }
 
     return true;
 }
 
-static bool InvokeStatic(const ClassFile* cf, Cursor* c)
+static const Symbol* GetReferenceClass(const uint32_t reference)
+{
+    assert(reference != 0 && "Null reference has no class");
+    return HeapGetLayout(reference)->Name;
+}
+
+// Records the class of the receiver below the call's arguments. A null one has none, the call throws instead
+static void ProfileCall(ReceiverProfile* profile, const ResolvedRef* ref)
+{
+    const uint32_t receiver = CURRENT_FRAME->Stack[-(ref->ArgumentSlots + 1)].Reference;
+    if (receiver)
+        ProfileReceiver(profile, GetReferenceClass(receiver));
+}
+
+static bool InvokeVirtual(const ClassFile* cf, Instruction* inst, ReceiverProfile* profile)
 {
-    uint16_t index;
-    ENSURE_READ(CursorReadUInt16(c, &index));
+    const uint16_t index = (uint16_t)inst->B;
     const Constant* constant = &cf->ConstantPool[index - 1];
     assert(constant->Type == CONST_METHOD_REF);
 
-    const char* className = GetNameOfClass(cf, constant->As.MethodRef.ClassIndex);
+    const Symbol* className = GetNameOfClass(cf, constant->As.MethodRef.ClassIndex);
+    const Symbol* memberName = GetNameOfMember(cf, constant->As.MethodRef.NameAndTypeIndex);
+
+    if (!className || !memberName) {
+        fprintf(stderr, "InvokeVirtual - ClassName or MemberName not found!!\n");
+        return false;
+    }
+
+    if (className != SYM_JAVA_IO_PRINT_STREAM || memberName != SYM_PRINTLN) {
+        fprintf(stderr, "InvokeVirtual - Unsupported class member %s.%s\n", className->Bytes, memberName->Bytes);
+        return false;
+    }
 
     const Constant* nameAndType = &cf->ConstantPool[constant->As.MethodRef.NameAndTypeIndex - 1];
-    assert(nameAndType->Type == CONST_NAME_AND_TYPE);
-    const char* methodName = cf->ConstantPool[nameAndType->As.NameAndType.NameIndex - 1].As.Utf8;
+    const Symbol* descriptorStr = cf->ConstantPool[nameAndType->As.NameAndType.DescriptorIndex - 1].As.Utf8;
 
-    const MethodInfo* method = FindMethodByName(cf, methodName);
-    if (!method) {
-        fprintf(stderr, "Method %s.%s not found.\n", className, methodName);
+    ResolvedRef* ref = GetResolvedRef(cf, index);
+    if (!ParseMethodDescriptor(descriptorStr->Bytes, &ref->Descriptor)) {
         return false;
     }
+    ref->ArgumentSlots = GetArgumentSlots(&ref->Descriptor);
+    ref->Resolved = true;
+    Quicken(inst, INST_INVOKE_VIRTUAL_QUICK);
 
-    assert((method->AccessFlags & MAF_STATIC) > 0 && "Expected static method!");
+    ProfileCall(profile, ref);
+    return PrintLn(ref);
+}
 
-    const char* descriptorStr = cf->ConstantPool[nameAndType->As.NameAndType.DescriptorIndex - 1].As.Utf8;
-    Descriptor descriptor = {0};
-    ParseDescriptorStr(descriptorStr, &descriptor);
+static bool InvokeVirtualQuick(const ClassFile* cf, const Instruction* inst, ReceiverProfile* profile)
+{
+    const ResolvedRef* ref = &cf->ResolvedRefs[inst->B - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    ProfileCall(profile, ref);
+    return PrintLn(ref);
+}
 
-    assert(STACK_COUNT >= descriptor.ParametersCount);
-#if defined(APP_DEBUG)
-    for (uint8_t i = 0; i < descriptor.ParametersCount; i++) {
-        const Argument* arg = &CURRENT_FRAME->Stack[-i - 1];
-        assert(arg->Type == descriptor.ParameterTypes[i]);
+// Strings are pushed by reference, the string is allocated once per constant and the instruction rewritten to push
+// it directly
+static bool PushString(const ClassFile* cf, Instruction* inst)
+{
+    ResolvedRef* ref = GetResolvedRef(cf, (uint16_t)inst->B);
+    if (!ref->String) {
+        // Compiled code embeds the reference, so the string can never move
+        const uint32_t reference = HeapAllocatePermanent(&STRING_LAYOUT);
+        if (!reference) {
+            ThrowException(SYM_OUT_OF_MEMORY_ERROR, "Java heap space");
+            return false;
+        }
+        ((StringObject*)HeapGetObject(reference))->Value = cf->ConstantPool[inst->B - 1].As.Utf8;
+        ref->String = reference;
+        ref->Resolved = true;
     }
-#endif
+    inst->B = (int32_t)ref->String;
+    Quicken(inst, INST_PUSH_STRING_QUICK);
+    return PushReference(ref->String);
+}
 
-    const CodeAttribute* codeAttribute = CreateCodeAttributeFromMethod(cf, method);
-    if (!codeAttribute) {
+// Only the class being run can be instantiated, nothing else is loaded
+static bool New(const ClassFile* cf, Instruction* inst)
+{
+    const uint16_t index = (uint16_t)inst->B;
+    const Symbol* className = GetNameOfClass(cf, index);
+    if (className != GetNameOfClass(cf, cf->ThisClass)) {
+        fprintf(stderr, "New - Unsupported class %s\n", className->Bytes);
         return false;
     }
 
-    Frame* previousFrame = CURRENT_FRAME;
-    ALLOC_NEW_FRAME(codeAttribute);
+    if (!HeapRegisterLayout((ObjectLayout*)&cf->InstanceLayout))
+        return false;
+    ResolvedRef* ref = GetResolvedRef(cf, index);
+    ref->Layout = &cf->InstanceLayout;
+    ref->Resolved = true;
+    Quicken(inst, INST_NEW_QUICK);
+    return NewObject(ref->Layout);
+}
 
-    // Pop arguments from the previous frame's stack and copy them to the new frame's locals
-    for (uint8_t i = 0; i < descriptor.ParametersCount; i++) {
-        const Argument* arg = --previousFrame->Stack;
-        uint32_t* local = &CURRENT_FRAME->Locals[i];
+static bool NewQuick(const ClassFile* cf, const Instruction* inst)
+{
+    const ResolvedRef* ref = &cf->ResolvedRefs[inst->B - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    return NewObject(ref->Layout);
+}
 
-        switch (arg->Type) {
-            case TYPE_CLASS_TYPE:
-            {
-                assert(false && "COPYING CLASS_TYPE ARG NYI!");
-                // break;
-            }
-            case TYPE_STRING:
-            {
-                assert(false && "COPY NATIVE STRINGS NYI!");
-                // break;
-            }
-            case TYPE_BYTE:
-            {
-                *(uint8_t*)local = arg->As.Byte;
-                break;
-            }
-            case TYPE_SHORT:
-            {
-                *(uint16_t*)local = (uint16_t)arg->As.Short;
-                break;
-            }
-            case TYPE_INT:
-            {
-                *local = (uint32_t)arg->As.Int;
-                break;
-            }
-            case TYPE_FLOAT:
-            {
-                *(float*)local = arg->As.Float;
-                break;
-            }
-            default:
-            {
-                assert(false && "Invalid Type");
-            }
-        }
-    }
+// Rewrites the instruction into its quick form, which holds the type of the field in A and its offset in B
+static bool ResolveField(const ClassFile* cf, Instruction* inst, const InstructionOp quickOp)
+{
+    const Constant* constant = &cf->ConstantPool[inst->B - 1];
+    assert(constant->Type == CONST_FIELD_REF);
 
-    bool result = true;
-    if (!ExecuteCode(cf, codeAttribute)) {
-        fprintf(stderr, "InvokeStatic for %s.%s failed!\n", className, methodName);
-        result = false;
-    }
+    const Symbol* className = GetNameOfClass(cf, constant->As.FieldRef.ClassIndex);
+    const Constant* nameAndType = &cf->ConstantPool[constant->As.FieldRef.NameAndTypeIndex - 1];
+    assert(nameAndType->Type == CONST_NAME_AND_TYPE);
+    const Symbol* fieldName = cf->ConstantPool[nameAndType->As.NameAndType.NameIndex - 1].As.Utf8;
+    const Symbol* descriptorStr = cf->ConstantPool[nameAndType->As.NameAndType.DescriptorIndex - 1].As.Utf8;
 
-    if (result && descriptor.MethodReturnType != TYPE_VOID) {
-        Argument* arg;
-        STACK_POP(&arg);
-        assert(arg->Type == descriptor.MethodReturnType);
-        *previousFrame->Stack++ = *arg;
+    const FieldInfo* field = className == GetNameOfClass(cf, cf->ThisClass) ? FindField(cf, fieldName, descriptorStr) : NULL;
+    if (!field || (field->AccessFlags & FAF_STATIC)) {
+        fprintf(stderr, "Field %s.%s not found.\n", className->Bytes, fieldName->Bytes);
+        return false;
     }
 
-    FREE_CURRENT_FRAME();
-    CURRENT_FRAME = previousFrame;
-    return result;
+    inst->A = (uint16_t)field->Type;
+    inst->B = (int32_t)field->Offset;
+    Quicken(inst, quickOp);
+    return true;
 }
 
-static bool ExecuteCode(const ClassFile* cf, const CodeAttribute* ca)
+// Reads a field or an array element into the slots on top of the stack. Values narrower than an int are widened the
+// way the JVM loads them from fields and arrays
+static void ReadValue(Slot* slot, const uint8_t* from, const ArgumentType type)
 {
-    Cursor codeCursor = CursorCreate(ca->Code, ca->CodeLength, false);
-    bool result = false;
-
-    while (codeCursor.ReadPosition < codeCursor.Size) {
-        OpCode opCode = 0;
-        if (!CursorReadByte(&codeCursor, (uint8_t*)&opCode)) {
-            fprintf(stderr, "Failed to read opcode\n");
+    switch (type) {
+        case TYPE_BYTE:
+            slot->Int = *(const int8_t*)from;
             break;
-        }
-        switch (opCode) {
-            case OP_CODE_I_CONST_M1:
-            case OP_CODE_I_CONST_0:
-            case OP_CODE_I_CONST_1:
-            case OP_CODE_I_CONST_2:
-            case OP_CODE_I_CONST_3:
-            case OP_CODE_I_CONST_4:
-            case OP_CODE_I_CONST_5:
-            {
-                result = PushIntConst((int)opCode - 3);
-                break;
-            }
-            case OP_CODE_BI_PUSH:
-            {
-                result = BIPush(&codeCursor);
-                break;
-            }
-            case OP_CODE_SI_PUSH:
-            {
-                result = SIPush(&codeCursor);
-                break;
-            }
-            case OP_CODE_LDC:
-            {
-                result = LDC(cf, &codeCursor);
-                break;
-            }
-            case OP_CODE_I_LOAD:
-            {
-                uint8_t index;
-                ENSURE_READ(CursorReadByte(&codeCursor, &index));
-                result = LoadInt(index);
-                break;
-            }
-            case OP_CODE_I_LOAD_0:
-            case OP_CODE_I_LOAD_1:
-            case OP_CODE_I_LOAD_2:
-            case OP_CODE_I_LOAD_3:
-            {
-                result = LoadInt((int)opCode - 26);
-                break;
-            }
-            case OP_CODE_I_STORE:
-            {
-                uint8_t index;
-                ENSURE_READ(CursorReadByte(&codeCursor, &index));
-                result = IntStore(index);
-                break;
-            }
-            case OP_CODE_I_STORE_0:
-            case OP_CODE_I_STORE_1:
-            case OP_CODE_I_STORE_2:
-            case OP_CODE_I_STORE_3:
-            {
-                result = IntStore((int)opCode - 59);
-                break;
-            }
-            case OP_CODE_I_ADD:
-            {
-                result = IntAdd();
-                break;
-            }
-            case OP_CODE_I_INC:
-            {
-                result = IntInc(&codeCursor);
-                break;
-            }
-            case OP_CODE_I_CMP_GE:
-            {
-                result = IntCompare(&codeCursor, opCode);
-                break;
-            }
-            case OP_CODE_GOTO:
-            {
-                int16_t branchOffSet; // May be negative
-                ENSURE_READ(CursorReadInt16(&codeCursor, &branchOffSet));
-
-                // -3 because this whole opcode should be rewinded.
-                // That means, rewinding 2 bytes for the offset and 1 byte for the actual opcode
-                // (DOCS:) Execution proceeds at that offset from the address of the opcode of this goto instruction.
-                codeCursor.ReadPosition += (branchOffSet - 3);
-                result = true;
-                break;
-            }
-            case OP_CODE_I_RETURN:
-            {
-                assert(CURRENT_FRAME->Stack->Type == TYPE_INT);
-                result = true;
-                break;
-            }
-            case OP_CODE_RETURN:
-            {
-                result = true;
-                break;
-            }
-            case OP_CODE_GET_STATIC:
-            {
-                result = GetStatic(cf, &codeCursor);
-                break;
-            }
-            case OP_CODE_INVOKE_VIRTUAL:
-            {
-                result = InvokeVirtual(cf, &codeCursor);
-                break;
-            }
-            case OP_CODE_INVOKE_STATIC:
-            {
-                result = InvokeStatic(cf, &codeCursor);
-                break;
-            }
-            default:
-            {
-                fprintf(stderr, "Unsupported OpCode 0x%02x (%d)\n", opCode, opCode);
-                assert(false);
-            }
-        }
-
-        if (!result) {
+        case TYPE_BOOL:
+            slot->Int = *from;
+            break;
+        case TYPE_CHAR:
+            slot->Int = *(const uint16_t*)from;
+            break;
+        case TYPE_SHORT:
+            slot->Int = *(const int16_t*)from;
+            break;
+        default:
+            // Ints, floats and references all take 4 bytes, longs and doubles 8
+            memcpy(slot, from, GetTypeSlots(type) * sizeof(Slot));
             break;
-        }
     }
+}
 
-    return result;
+// Stores anything but a reference, which needs the write barriers
+static void WriteValue(uint8_t* to, const Slot* value, const ArgumentType type)
+{
+    switch (type) {
+        case TYPE_BYTE:
+            *(int8_t*)to = (int8_t)value->Int;
+            break;
+        case TYPE_BOOL:
+            *to = (uint8_t)(value->Int & 1);
+            break;
+        case TYPE_CHAR:
+        case TYPE_SHORT:
+            *(uint16_t*)to = (uint16_t)value->Int;
+            break;
+        default:
+            memcpy(to, value, GetTypeSlots(type) * sizeof(Slot));
+            break;
+    }
 }
 
-bool ExecuteMethod(const ClassFile* cf, const MethodInfo* method)
+// Replaces the object on top of the stack with the value of its field
+static bool GetFieldQuick(const Instruction* inst)
 {
-    const CodeAttribute* ca = CreateCodeAttributeFromMethod(cf, method);
-    if (!ca) {
+    Slot* slot = &CURRENT_FRAME->Stack[-1];
+    if (!slot->Reference) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
         return false;
     }
 
-    ALLOC_NEW_FRAME(ca);
-    const bool result = ExecuteCode(cf, ca);
-    if (!result) {
-        fprintf(stderr, "Execution for method '%s' failed!\n", cf->ConstantPool[method->NameIndex - 1].As.Utf8);
-    }
-    FREE_CURRENT_FRAME();
+    const ArgumentType type = (ArgumentType)inst->A;
+    DEBUG_ASSERT(CURRENT_FRAME->Stack + GetTypeSlots(type) - 1 <= CURRENT_FRAME->StackStart + CURRENT_FRAME->StackSize);
+    ReadValue(slot, (const uint8_t*)HeapGetObject(slot->Reference) + inst->B, type);
+    CURRENT_FRAME->Stack += GetTypeSlots(type) - 1;
+    return true;
+}
+
+// Pops the value and the object below it
+static bool PutFieldQuick(const Instruction* inst)
+{
+    const ArgumentType type = (ArgumentType)inst->A;
+    CURRENT_FRAME->Stack -= GetTypeSlots(type) + 1;
+    const Slot* object = CURRENT_FRAME->Stack;
+    const Slot* value = object + 1;
+    if (!object->Reference) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
+        return false;
+    }
+
+    uint8_t* field = (uint8_t*)HeapGetObject(object->Reference) + inst->B;
+    if (type == TYPE_CLASS_TYPE || type == TYPE_STRING) {
+        HeapPreWriteBarrier(*(const uint32_t*)field);
+        memcpy(field, value, sizeof(Slot));
+        HeapWriteBarrier(object->Reference, (uint32_t)inst->B);
+        return true;
+    }
+    WriteValue(field, value, type);
+    return true;
+}
+
+static bool GetField(const ClassFile* cf, Instruction* inst)
+{
+    return ResolveField(cf, inst, INST_GET_FIELD_QUICK) && GetFieldQuick(inst);
+}
+
+static bool PutField(const ClassFile* cf, Instruction* inst)
+{
+    return ResolveField(cf, inst, INST_PUT_FIELD_QUICK) && PutFieldQuick(inst);
+}
+
+// Pops the length and pushes an array of that many zeroed elements
+static bool NewArray(const ObjectLayout* layout)
+{
+    Slot* slot = &CURRENT_FRAME->Stack[-1];
+    if (slot->Int < 0) {
+        ThrowExceptionFormat(SYM_NEGATIVE_ARRAY_SIZE_EXCEPTION, "%d", slot->Int);
+        return false;
+    }
+
+    const uint32_t length = (uint32_t)slot->Int;
+    const uint32_t reference = HeapAllocateArray(layout, length);
+    if (!reference) {
+        ThrowException(SYM_OUT_OF_MEMORY_ERROR,
+            HeapGetArraySize(layout, length) ? "Java heap space" : "Requested array size exceeds VM limit");
+        return false;
+    }
+    slot->Reference = reference;
+    return true;
+}
+
+// Names are interned, so the symbol itself is the key
+static ObjectLayout** FindArrayLayoutSlot(ObjectLayout** slots, const uint32_t capacity, const Symbol* name)
+{
+    uint32_t slot = name->Hash & (capacity - 1);
+    while (slots[slot] && slots[slot]->Name != name)
+        slot = (slot + 1) & (capacity - 1);
+    return &slots[slot];
+}
+
+static void InsertArrayLayout(ObjectLayout* layout)
+{
+    ArrayLayoutTable* table = &REFERENCE_ARRAY_LAYOUTS;
+    *FindArrayLayoutSlot(table->Slots, table->Capacity, layout->Name) = layout;
+    // Keep the load factor at or below 0.5 so probe sequences stay short
+    if (++table->Count * 2 <= table->Capacity)
+        return;
+
+    const uint32_t newCapacity = table->Capacity * 2;
+    ObjectLayout** newSlots = calloc(newCapacity, sizeof(*newSlots));
+    assert(newSlots && "Out of RAM");
+    for (uint32_t i = 0; i < table->Capacity; i++) {
+        if (table->Slots[i])
+            *FindArrayLayoutSlot(newSlots, newCapacity, table->Slots[i]->Name) = table->Slots[i];
+    }
+    free(table->Slots);
+    table->Slots = newSlots;
+    table->Capacity = newCapacity;
+}
+
+// The layout shared by every array named arrayName, NULL when no more layouts can be registered
+static ObjectLayout* GetReferenceArrayLayout(const Symbol* arrayName, const Symbol* elementClass)
+{
+    ArrayLayoutTable* table = &REFERENCE_ARRAY_LAYOUTS;
+    ObjectLayout* layout = *FindArrayLayoutSlot(table->Slots, table->Capacity, arrayName);
+    if (layout)
+        return layout;
+
+    layout = ArenaAlloc(&table->Arena, sizeof(ObjectLayout));
+    *layout = (ObjectLayout){
+        .Name = arrayName,
+        .InstanceSize = HEAP_ARRAY_DATA_OFFSET,
+        .ElementSize = sizeof(uint32_t),
+        .ReferenceElements = true,
+        .ElementClass = elementClass,
+    };
+    if (!HeapRegisterLayout(layout))
+        return NULL;
+    InsertArrayLayout(layout);
+    return layout;
+}
+
+// Every class can be the element of an array, the class itself is never loaded
+static bool NewReferenceArray(const ClassFile* cf, Instruction* inst)
+{
+    const uint16_t index = (uint16_t)inst->B;
+    const Symbol* className = GetNameOfClass(cf, index);
+    // Arrays of arrays only add a dimension to the name
+    const bool isArray = className->Bytes[0] == '[';
+    const size_t length = className->Length + (isArray ? 1 : 3);
+    if (length > UINT16_MAX) {
+        // The name would be longer than a constant pool string can be, so no class can ever refer to the array
+        ThrowExceptionFormat(SYM_NO_CLASS_DEF_FOUND_ERROR, "Array class name too long: %.64s...", className->Bytes);
+        return false;
+    }
+    char* name = malloc(length + 1);
+    assert(name);
+    snprintf(name, length + 1, isArray ? "[%s" : "[L%s;", className->Bytes);
+    const Symbol* arrayName = SymbolIntern(name, (uint16_t)length);
+    free(name);
+
+    ObjectLayout* layout = GetReferenceArrayLayout(arrayName, className);
+    if (!layout)
+        return false;
+    ResolvedRef* ref = GetResolvedRef(cf, index);
+    ref->Layout = layout;
+    ref->Resolved = true;
+    Quicken(inst, INST_NEW_REFERENCE_ARRAY_QUICK);
+    return NewArray(layout);
+}
+
+static bool NewReferenceArrayQuick(const ClassFile* cf, const Instruction* inst)
+{
+    const ResolvedRef* ref = &cf->ResolvedRefs[inst->B - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    return NewArray(ref->Layout);
+}
+
+// The verifier only knows arrays are references, the elements have to match what the instruction accesses. Byte
+// instructions access boolean arrays too
+static bool IsArrayOf(const ObjectLayout* layout, const ArgumentType type)
+{
+    switch (type) {
+        case TYPE_CLASS_TYPE:
+        case TYPE_STRING:
+            return layout->ReferenceElements;
+        case TYPE_BYTE:
+            return layout == &PRIMITIVE_ARRAY_LAYOUTS[TYPE_BYTE] || layout == &PRIMITIVE_ARRAY_LAYOUTS[TYPE_BOOL];
+        default:
+            return layout == &PRIMITIVE_ARRAY_LAYOUTS[type];
+    }
+}
+
+// Checks the reference is an array of the type, false after throwing. Operands of the wrong type throw the VerifyError
+// a verifier that tracked classes would have rejected the method with
+static bool CheckArray(const uint32_t reference, const ArgumentType type)
+{
+    if (!reference) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
+        return false;
+    }
+    const ObjectLayout* layout = HeapGetLayout(reference);
+    if (!IsArrayOf(layout, type)) {
+        const bool references = type == TYPE_CLASS_TYPE || type == TYPE_STRING;
+        ThrowExceptionFormat(SYM_VERIFY_ERROR, "Bad type on operand stack: expected %s, found %s",
+            references ? "[Ljava/lang/Object;" : PRIMITIVE_ARRAY_LAYOUTS[type].Name->Bytes, layout->Name->Bytes);
+        return false;
+    }
+    return true;
+}
+
+// Checks [from, from + count) is within the array, false after throwing
+static bool CheckArrayRange(const uint32_t reference, const int32_t from, const int32_t count)
+{
+    const uint32_t length = HeapGetArrayLength(reference);
+    if (from < 0 || count < 0 || (uint64_t)from + (uint64_t)count > length) {
+        ThrowExceptionFormat(SYM_ARRAY_INDEX_OUT_OF_BOUNDS_EXCEPTION, "Range [%d, %d + %d) out of bounds for length %u",
+            from, from, count, length);
+        return false;
+    }
+    return true;
+}
+
+// Address of the element the array and index slots refer to, NULL after throwing
+static uint8_t* GetElement(const Slot* array, const Slot* index, const ArgumentType type)
+{
+    if (!CheckArray(array->Reference, type))
+        return NULL;
+    const uint32_t length = HeapGetArrayLength(array->Reference);
+    // Negative indices wrap around past the largest length
+    if ((uint32_t)index->Int >= length) {
+        ThrowExceptionFormat(SYM_ARRAY_INDEX_OUT_OF_BOUNDS_EXCEPTION, "Index %d out of bounds for length %u", index->Int,
+            length);
+        return NULL;
+    }
+    return (uint8_t*)HeapGetArrayData(array->Reference) + (size_t)index->Int * HeapGetLayout(array->Reference)->ElementSize;
+}
+
+static bool ArrayLength(void)
+{
+    Slot* slot = &CURRENT_FRAME->Stack[-1];
+    if (!slot->Reference) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
+        return false;
+    }
+    if (!HeapGetLayout(slot->Reference)->ElementSize) {
+        ThrowExceptionFormat(SYM_VERIFY_ERROR, "Bad type on operand stack: expected array, found %s",
+            GetReferenceClass(slot->Reference)->Bytes);
+        return false;
+    }
+    slot->Int = (int32_t)HeapGetArrayLength(slot->Reference);
+    return true;
+}
+
+// Replaces the array and the index on top of the stack with the element of type A
+static bool LoadElement(const Instruction* inst)
+{
+    const ArgumentType type = (ArgumentType)inst->A;
+    Slot* array = &CURRENT_FRAME->Stack[-2];
+    const uint8_t* element = GetElement(array, array + 1, type);
+    if (!element)
+        return false;
+    ReadValue(array, element, type);
+    CURRENT_FRAME->Stack += GetTypeSlots(type) - 2;
+    return true;
+}
+
+// Elements of an array of some class take objects of that class only, the class hierarchy is Object and the rest
+static bool CanStoreElement(const ObjectLayout* array, const uint32_t value)
+{
+    return !value || array->ElementClass == SYM_JAVA_LANG_OBJECT || GetReferenceClass(value) == array->ElementClass;
+}
+
+// Pops the value of type A, the index and the array below them
+static bool StoreElement(const Instruction* inst)
+{
+    ArgumentType type = (ArgumentType)inst->A;
+    CURRENT_FRAME->Stack -= GetTypeSlots(type) + 2;
+    const Slot* array = CURRENT_FRAME->Stack;
+    const Slot* value = array + 2;
+    uint8_t* element = GetElement(array, array + 1, type);
+    if (!element)
+        return false;
+
+    const ObjectLayout* layout = HeapGetLayout(array->Reference);
+    if (type == TYPE_CLASS_TYPE) {
+        if (!CanStoreElement(layout, value->Reference)) {
+            ThrowException(SYM_ARRAY_STORE_EXCEPTION, GetReferenceClass(value->Reference)->Bytes);
+            return false;
+        }
+        HeapPreWriteBarrier(*(const uint32_t*)element);
+        memcpy(element, value, sizeof(Slot));
+        HeapWriteBarrier(array->Reference, (uint32_t)(element - (uint8_t*)HeapGetObject(array->Reference)));
+        return true;
+    }
+    // bastore keeps only the lowest bit when storing into a boolean array
+    if (layout == &PRIMITIVE_ARRAY_LAYOUTS[TYPE_BOOL])
+        type = TYPE_BOOL;
+    WriteValue(element, value, type);
+    return true;
+}
+
+// System.arraycopy(Object src, int srcPos, Object dest, int destPos, int length). Primitive elements are moved with a
+// single memmove, which the C library vectorizes. References only go element by element when the destination may not
+// take all of them
+static bool ArrayCopy(const ResolvedRef* ref, const Slot* arguments)
+{
+    (void)ref;
+    const uint32_t source = arguments[0].Reference;
+    const int32_t sourcePosition = arguments[1].Int;
+    const uint32_t destination = arguments[2].Reference;
+    const int32_t destinationPosition = arguments[3].Int;
+    const int32_t length = arguments[4].Int;
+    if (!source || !destination) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
+        return false;
+    }
+
+    const ObjectLayout* sourceLayout = HeapGetLayout(source);
+    const ObjectLayout* destinationLayout = HeapGetLayout(destination);
+    if (!sourceLayout->ElementSize || !destinationLayout->ElementSize) {
+        ThrowExceptionFormat(SYM_ARRAY_STORE_EXCEPTION, "arraycopy: %s type %s is not an array",
+            sourceLayout->ElementSize ? "destination" : "source",
+            (sourceLayout->ElementSize ? destinationLayout : sourceLayout)->Name->Bytes);
+        return false;
+    }
+    if (sourceLayout != destinationLayout && (!sourceLayout->ReferenceElements || !destinationLayout->ReferenceElements)) {
+        ThrowExceptionFormat(SYM_ARRAY_STORE_EXCEPTION, "arraycopy: type mismatch: can not copy %s into %s",
+            sourceLayout->Name->Bytes, destinationLayout->Name->Bytes);
+        return false;
+    }
+    if (!CheckArrayRange(source, sourcePosition, length) || !CheckArrayRange(destination, destinationPosition, length))
+        return false;
+
+    const size_t elementSize = sourceLayout->ElementSize;
+    uint8_t* to = (uint8_t*)HeapGetArrayData(destination) + (size_t)destinationPosition * elementSize;
+    const uint8_t* from = (const uint8_t*)HeapGetArrayData(source) + (size_t)sourcePosition * elementSize;
+    if (!sourceLayout->ReferenceElements) {
+        memmove(to, from, (size_t)length * elementSize);
+        return true;
+    }
+
+    // Copies up to the first element the destination can't take, the ones before it stay copied
+    int32_t count = length;
+    const bool checked = destinationLayout->ElementClass != SYM_JAVA_LANG_OBJECT
+        && destinationLayout->ElementClass != sourceLayout->ElementClass;
+    for (int32_t i = 0; checked && i < length; i++) {
+        if (!CanStoreElement(destinationLayout, ((const uint32_t*)from)[i])) {
+            count = i;
+            break;
+        }
+    }
+    HeapPreWriteBarrierRange((const uint32_t*)to, (uint32_t)count);
+    memmove(to, from, (size_t)count * elementSize);
+    const uint32_t offset = (uint32_t)(to - (uint8_t*)HeapGetObject(destination));
+    HeapWriteBarrierRange(destination, offset, offset + (uint32_t)count * (uint32_t)elementSize);
+    if (count < length) {
+        ThrowExceptionFormat(SYM_ARRAY_STORE_EXCEPTION, "arraycopy: element type mismatch: can not store %s into %s",
+            GetReferenceClass(((const uint32_t*)from)[count])->Bytes, destinationLayout->Name->Bytes);
+        return false;
+    }
+    return true;
+}
+
+// Stores the value in count elements. Values whose bytes are all the same, zero above all, are a memset, the loops
+// for the others get vectorized by the C compiler
+static void FillElements(uint8_t* elements, const uint32_t count, const Slot* value, const ArgumentType type)
+{
+    uint8_t bytes[8];
+    const uint8_t size = PRIMITIVE_ARRAY_LAYOUTS[type].ElementSize;
+    WriteValue(bytes, value, type);
+    if (size == 1 || memcmp(bytes, bytes + 1, size - 1) == 0) {
+        memset(elements, bytes[0], (size_t)count * size);
+        return;
+    }
+
+    switch (size) {
+        case 2:
+        {
+            uint16_t element;
+            memcpy(&element, bytes, sizeof(element));
+            for (uint32_t i = 0; i < count; i++)
+                ((uint16_t*)elements)[i] = element;
+            break;
+        }
+        case 4:
+        {
+            uint32_t element;
+            memcpy(&element, bytes, sizeof(element));
+            for (uint32_t i = 0; i < count; i++)
+                ((uint32_t*)elements)[i] = element;
+            break;
+        }
+        default:
+        {
+            uint64_t element;
+            memcpy(&element, bytes, sizeof(element));
+            for (uint32_t i = 0; i < count; i++)
+                ((uint64_t*)elements)[i] = element;
+            break;
+        }
+    }
+}
+
+// Arrays.fill(array, value) and Arrays.fill(array, fromIndex, toIndex, value), for every element type
+static bool ArrayFill(const ResolvedRef* ref, const Slot* arguments)
+{
+    const ArgumentType type = ref->ElementType;
+    const uint32_t array = arguments[0].Reference;
+    if (!CheckArray(array, type))
+        return false;
+
+    int32_t from = 0;
+    int32_t to = (int32_t)HeapGetArrayLength(array);
+    const Slot* value = &arguments[1];
+    if (ref->Descriptor.ParametersCount == 4) {
+        from = arguments[1].Int;
+        to = arguments[2].Int;
+        value = &arguments[3];
+        // Checked in the order Arrays.rangeCheck does, to - from is only computed once both are within the array
+        if (from > to) {
+            ThrowExceptionFormat(SYM_ILLEGAL_ARGUMENT_EXCEPTION, "fromIndex(%d) > toIndex(%d)", from, to);
+            return false;
+        }
+        if (from < 0 || (uint32_t)to > HeapGetArrayLength(array)) {
+            ThrowExceptionFormat(SYM_ARRAY_INDEX_OUT_OF_BOUNDS_EXCEPTION, "Array index out of range: %d",
+                from < 0 ? from : to);
+            return false;
+        }
+    }
+
+    const uint32_t count = (uint32_t)(to - from);
+    if (type != TYPE_CLASS_TYPE) {
+        const ArgumentType elementType = HeapGetLayout(array) == &PRIMITIVE_ARRAY_LAYOUTS[TYPE_BOOL] ? TYPE_BOOL : type;
+        uint8_t* elements = (uint8_t*)HeapGetArrayData(array) + (size_t)from * PRIMITIVE_ARRAY_LAYOUTS[elementType].ElementSize;
+        FillElements(elements, count, value, elementType);
+        return true;
+    }
 
-    CodeAttributeDestroy(ca);
+    const ObjectLayout* layout = HeapGetLayout(array);
+    if (!CanStoreElement(layout, value->Reference)) {
+        ThrowException(SYM_ARRAY_STORE_EXCEPTION, GetReferenceClass(value->Reference)->Bytes);
+        return false;
+    }
+    uint32_t* elements = (uint32_t*)HeapGetArrayData(array) + from;
+    HeapPreWriteBarrierRange(elements, count);
+    for (uint32_t i = 0; i < count; i++)
+        elements[i] = value->Reference;
+    const uint32_t offset = (uint32_t)((uint8_t*)elements - (uint8_t*)HeapGetObject(array));
+    HeapWriteBarrierRange(array, offset, offset + count * (uint32_t)sizeof(uint32_t));
+    return true;
+}
+
+// Type of the elements of the array descriptors start with, false if they don't start with a one dimensional array of
+// a primitive type or of Object
+static bool GetArrayParameterType(const char* descriptor, ArgumentType* type)
+{
+    if (descriptor[0] != '(' || descriptor[1] != '[')
+        return false;
+    if (strncmp(descriptor + 2, "Ljava/lang/Object;", 18) == 0) {
+        *type = TYPE_CLASS_TYPE;
+        return true;
+    }
+    const char element[2] = { descriptor[2], '\0' };
+    return descriptor[2] != 'L' && descriptor[2] != '[' && ParseFieldDescriptor(element, type);
+}
+
+// The intrinsic the static method is, NULL if the VM doesn't implement it
+static Intrinsic FindIntrinsic(ResolvedRef* ref, const Symbol* className, const Symbol* methodName, const Symbol* descriptorStr)
+{
+    if (className == SYM_JAVA_LANG_SYSTEM && methodName == SYM_ARRAYCOPY
+        && strcmp(descriptorStr->Bytes, "(Ljava/lang/Object;ILjava/lang/Object;II)V") == 0)
+        return ArrayCopy;
+
+    if (className == SYM_JAVA_UTIL_ARRAYS && methodName == SYM_FILL && ref->Descriptor.MethodReturnType == TYPE_VOID
+        && GetArrayParameterType(descriptorStr->Bytes, &ref->ElementType)) {
+        // The value has the type of the elements, with the range before it if there is one
+        const Descriptor* descriptor = &ref->Descriptor;
+        const uint8_t count = descriptor->ParametersCount;
+        const ArgumentType value = descriptor->ParameterTypes[count - 1];
+        const bool ranged = count == 4 && descriptor->ParameterTypes[1] == TYPE_INT && descriptor->ParameterTypes[2] == TYPE_INT;
+        const bool matches = ref->ElementType == TYPE_CLASS_TYPE ? value == TYPE_CLASS_TYPE : value == ref->ElementType;
+        if ((count == 2 || ranged) && matches)
+            return ArrayFill;
+    }
+    return NULL;
+}
+
+// Methods are only looked up in the class itself, Object's constructor is the one method of another class that can be
+// called and does nothing. Static methods can also be intrinsics
+static const ResolvedRef* ResolveMethod(const ClassFile* cf, const uint16_t index, const bool isStatic)
+{
+    ResolvedRef* ref = GetResolvedRef(cf, index);
+    if (ref->Resolved)
+        return ref;
+
+    const Constant* constant = &cf->ConstantPool[index - 1];
+    assert(constant->Type == CONST_METHOD_REF);
+
+    const Symbol* className = GetNameOfClass(cf, constant->As.MethodRef.ClassIndex);
+
+    const Constant* nameAndType = &cf->ConstantPool[constant->As.MethodRef.NameAndTypeIndex - 1];
+    assert(nameAndType->Type == CONST_NAME_AND_TYPE);
+    const Symbol* methodName = cf->ConstantPool[nameAndType->As.NameAndType.NameIndex - 1].As.Utf8;
+    const Symbol* descriptorStr = cf->ConstantPool[nameAndType->As.NameAndType.DescriptorIndex - 1].As.Utf8;
+
+    if (!ParseMethodDescriptor(descriptorStr->Bytes, &ref->Descriptor)) {
+        return NULL;
+    }
+    ref->ArgumentSlots = (uint8_t)(GetArgumentSlots(&ref->Descriptor) + (isStatic ? 0 : 1));
+
+    if (!isStatic && className == SYM_JAVA_LANG_OBJECT && methodName == SYM_INIT) {
+        ref->Method = NULL;
+        ref->Resolved = true;
+        return ref;
+    }
+
+    ref->Intrinsic = isStatic ? FindIntrinsic(ref, className, methodName, descriptorStr) : NULL;
+    if (ref->Intrinsic) {
+        ref->Method = NULL;
+        ref->Resolved = true;
+        return ref;
+    }
+
+    const MethodInfo* method = FindMethod(cf, methodName, descriptorStr);
+    if (!method) {
+        fprintf(stderr, "Method %s.%s not found.\n", className->Bytes, methodName->Bytes);
+        return NULL;
+    }
+
+    assert(((method->AccessFlags & MAF_STATIC) > 0) == isStatic && "Static and instance method mixed up!");
+
+    ref->Code = MethodGetCode(cf, method);
+    if (!ref->Code) {
+        return NULL;
+    }
+
+    ref->Method = method;
+    ref->Resolved = true;
+    return ref;
+}
+
+// Intrinsics run right away and push no frame
+static bool InvokeResolvedMethod(const ClassFile* cf, const ResolvedRef* ref)
+{
+    if (ref->Intrinsic) {
+        CURRENT_FRAME->Stack -= ref->ArgumentSlots;
+        return ref->Intrinsic(ref, CURRENT_FRAME->Stack);
+    }
+
+    // The arguments on top of the stack become the first locals of the new frame, which the interpreter loop
+    // continues in
+    if (!PushFrame(cf, ref->Method, ref->ArgumentSlots)) {
+        if (!THREAD_STACK.PendingException)
+            fprintf(stderr, "Invoke for %s failed!\n", ref->Method->Name->Bytes);
+        return false;
+    }
+    return true;
+}
+
+static bool InvokeStatic(const ClassFile* cf, Instruction* inst)
+{
+    const ResolvedRef* ref = ResolveMethod(cf, (uint16_t)inst->B, true);
+    if (!ref) {
+        return false;
+    }
+
+    Quicken(inst, INST_INVOKE_STATIC_QUICK);
+    return InvokeResolvedMethod(cf, ref);
+}
+
+static bool InvokeStaticQuick(const ClassFile* cf, const Instruction* inst)
+{
+    const uint16_t index = (uint16_t)inst->B;
+    const ResolvedRef* ref = &cf->ResolvedRefs[index - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    return InvokeResolvedMethod(cf, ref);
+}
+
+// Constructors and private methods, called without dispatching on the receiver. Pushes no frame for Object's
+// constructor
+static bool InvokeSpecialQuick(const ClassFile* cf, const Instruction* inst)
+{
+    const ResolvedRef* ref = &cf->ResolvedRefs[inst->B - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    if (!CURRENT_FRAME->Stack[-ref->ArgumentSlots].Reference) {
+        ThrowException(SYM_NULL_POINTER_EXCEPTION, NULL);
+        return false;
+    }
+    if (!ref->Method) {
+        CURRENT_FRAME->Stack -= ref->ArgumentSlots;
+        return true;
+    }
+    return InvokeResolvedMethod(cf, ref);
+}
+
+static bool InvokeSpecial(const ClassFile* cf, Instruction* inst)
+{
+    if (!ResolveMethod(cf, (uint16_t)inst->B, false))
+        return false;
+    Quicken(inst, INST_INVOKE_SPECIAL_QUICK);
+    return InvokeSpecialQuick(cf, inst);
+}
+
+// Java int arithmetic wraps around on overflow, which C only defines for unsigned integers. Shift distances only use
+// their low 5 bits
+#define INT_BINARY_OPS(X) \
+    X(INST_ADD_INT,  (int32_t)((uint32_t)a + (uint32_t)b)) \
+    X(INST_SUB_INT,  (int32_t)((uint32_t)a - (uint32_t)b)) \
+    X(INST_MUL_INT,  (int32_t)((uint32_t)a * (uint32_t)b)) \
+    X(INST_SHL_INT,  (int32_t)((uint32_t)a << (b & 0x1F))) \
+    X(INST_SHR_INT,  a >> (b & 0x1F)) \
+    X(INST_USHR_INT, (int32_t)((uint32_t)a >> (b & 0x1F))) \
+    X(INST_AND_INT,  a & b) \
+    X(INST_OR_INT,   a | b) \
+    X(INST_XOR_INT,  a ^ b)
+
+#define INT_UNARY_OPS(X) \
+    X(INST_NEG_INT,      (int32_t)(0u - (uint32_t)a)) \
+    X(INST_INT_TO_BYTE,  (int8_t)a) \
+    X(INST_INT_TO_CHAR,  (uint16_t)a) \
+    X(INST_INT_TO_SHORT, (int16_t)a)
+
+#define INT_CONDITIONS(X) \
+    X(EQ, ==) \
+    X(NE, !=) \
+    X(LT, <) \
+    X(GE, >=) \
+    X(GT, >) \
+    X(LE, <=)
+
+#if defined(VM_PROFILE_INSTRUCTIONS)
+// Counts how often each instruction runs right after another, which is what picks the sequences worth fusing into
+// superinstructions. Printed when the VM is destroyed
+static uint64_t INSTRUCTION_PAIRS[INST_COUNT][INST_COUNT];
+static uint16_t LAST_INSTRUCTION = INST_COUNT - 1;
+
+    #define PROFILE_INSTRUCTION(op) \
+        do { \
+            INSTRUCTION_PAIRS[LAST_INSTRUCTION][op]++; \
+            LAST_INSTRUCTION = (op); \
+        } while(0)
+
+static void PrintInstructionProfile(void)
+{
+    fprintf(stderr, "Most frequent instruction pairs (previous, next):\n");
+    for (int n = 0; n < 20; n++) {
+        uint64_t* best = NULL;
+        uint16_t previous = 0, next = 0;
+        for (uint16_t i = 0; i < INST_COUNT; i++) {
+            for (uint16_t j = 0; j < INST_COUNT; j++) {
+                if (INSTRUCTION_PAIRS[i][j] && (!best || INSTRUCTION_PAIRS[i][j] > *best)) {
+                    best = &INSTRUCTION_PAIRS[i][j];
+                    previous = i;
+                    next = j;
+                }
+            }
+        }
+        if (!best)
+            break;
+        fprintf(stderr, "  %3u %3u %llu\n", previous, next, (unsigned long long)*best);
+        *best = 0;
+    }
+}
+#else
+    #define PROFILE_INSTRUCTION(op) ((void)0)
+#endif
+
+static bool RunFrame(void);
+static void ReturnFromFrame(void);
+static bool RunCompiledLoop(const uint32_t loopHeader);
+
+// Runs the current frame from its saved instruction until entryFrame returns. That is the current frame itself, except
+// after deoptimizing which leaves the frames of inlined callees on top of it. Calls and returns between Java methods
+// stay inside this loop, the frames and their saved instruction pointers live on the VM stack
+static bool ExecuteCode(Frame* const entryFrame)
+{
+    const ClassFile* cf = CURRENT_FRAME->Class;
+    // Writable because instructions get rewritten into their quick forms
+    Instruction* instructions = CURRENT_FRAME->Code->Instructions;
+    Instruction* ip = CURRENT_FRAME->Ip;
+
+#if defined(VM_THREADED_DISPATCH)
+    #define CASE(op) LABEL_##op:
+    #define DISPATCH() \
+        { \
+            PROFILE_INSTRUCTION(ip->Op); \
+            goto *DISPATCH_TABLE[ip->Op]; \
+        }
+
+    static const void* const DISPATCH_TABLE[INST_COUNT] = {
+        [INST_PUSH_INT]             = &&LABEL_INST_PUSH_INT,
+        [INST_PUSH_FLOAT]           = &&LABEL_INST_PUSH_FLOAT,
+        [INST_PUSH_STRING]          = &&LABEL_INST_PUSH_STRING,
+        [INST_PUSH_NULL]            = &&LABEL_INST_PUSH_NULL,
+        [INST_LOAD_INT]             = &&LABEL_INST_LOAD_INT,
+        [INST_STORE_INT]            = &&LABEL_INST_STORE_INT,
+        [INST_LOAD_REFERENCE]       = &&LABEL_INST_LOAD_REFERENCE,
+        [INST_STORE_REFERENCE]      = &&LABEL_INST_STORE_REFERENCE,
+        [INST_POP]                  = &&LABEL_INST_POP,
+        [INST_POP2]                 = &&LABEL_INST_POP2,
+        [INST_DUP]                  = &&LABEL_INST_DUP,
+        [INST_DUP_X1]               = &&LABEL_INST_DUP_X1,
+        [INST_DUP_X2]               = &&LABEL_INST_DUP_X2,
+        [INST_DUP2]                 = &&LABEL_INST_DUP2,
+        [INST_DUP2_X1]              = &&LABEL_INST_DUP2_X1,
+        [INST_DUP2_X2]              = &&LABEL_INST_DUP2_X2,
+        [INST_SWAP]                 = &&LABEL_INST_SWAP,
+        [INST_ADD_INT]              = &&LABEL_INST_ADD_INT,
+        [INST_SUB_INT]              = &&LABEL_INST_SUB_INT,
+        [INST_MUL_INT]              = &&LABEL_INST_MUL_INT,
+        [INST_DIV_INT]              = &&LABEL_INST_DIV_INT,
+        [INST_REM_INT]              = &&LABEL_INST_REM_INT,
+        [INST_NEG_INT]              = &&LABEL_INST_NEG_INT,
+        [INST_SHL_INT]              = &&LABEL_INST_SHL_INT,
+        [INST_SHR_INT]              = &&LABEL_INST_SHR_INT,
+        [INST_USHR_INT]             = &&LABEL_INST_USHR_INT,
+        [INST_AND_INT]              = &&LABEL_INST_AND_INT,
+        [INST_OR_INT]               = &&LABEL_INST_OR_INT,
+        [INST_XOR_INT]              = &&LABEL_INST_XOR_INT,
+        [INST_INC_INT]              = &&LABEL_INST_INC_INT,
+        [INST_INT_TO_BYTE]          = &&LABEL_INST_INT_TO_BYTE,
+        [INST_INT_TO_CHAR]          = &&LABEL_INST_INT_TO_CHAR,
+        [INST_INT_TO_SHORT]         = &&LABEL_INST_INT_TO_SHORT,
+        [INST_IF_EQ]                = &&LABEL_INST_IF_EQ,
+        [INST_IF_NE]                = &&LABEL_INST_IF_NE,
+        [INST_IF_LT]                = &&LABEL_INST_IF_LT,
+        [INST_IF_GE]                = &&LABEL_INST_IF_GE,
+        [INST_IF_GT]                = &&LABEL_INST_IF_GT,
+        [INST_IF_LE]                = &&LABEL_INST_IF_LE,
+        [INST_IF_ICMP_EQ]           = &&LABEL_INST_IF_ICMP_EQ,
+        [INST_IF_ICMP_NE]           = &&LABEL_INST_IF_ICMP_NE,
+        [INST_IF_ICMP_LT]           = &&LABEL_INST_IF_ICMP_LT,
+        [INST_IF_ICMP_GE]           = &&LABEL_INST_IF_ICMP_GE,
+        [INST_IF_ICMP_GT]           = &&LABEL_INST_IF_ICMP_GT,
+        [INST_IF_ICMP_LE]           = &&LABEL_INST_IF_ICMP_LE,
+        [INST_IF_NULL]              = &&LABEL_INST_IF_NULL,
+        [INST_IF_NON_NULL]          = &&LABEL_INST_IF_NON_NULL,
+        [INST_GOTO]                 = &&LABEL_INST_GOTO,
+        [INST_RETURN_INT]           = &&LABEL_INST_RETURN_INT,
+        [INST_RETURN_REFERENCE]     = &&LABEL_INST_RETURN_REFERENCE,
+        [INST_RETURN]               = &&LABEL_INST_RETURN,
+        [INST_GET_STATIC]           = &&LABEL_INST_GET_STATIC,
+        [INST_INVOKE_VIRTUAL]       = &&LABEL_INST_INVOKE_VIRTUAL,
+        [INST_INVOKE_STATIC]        = &&LABEL_INST_INVOKE_STATIC,
+        [INST_INVOKE_SPECIAL]       = &&LABEL_INST_INVOKE_SPECIAL,
+        [INST_NEW]                  = &&LABEL_INST_NEW,
+        [INST_GET_FIELD]            = &&LABEL_INST_GET_FIELD,
+        [INST_PUT_FIELD]            = &&LABEL_INST_PUT_FIELD,
+        [INST_NEW_ARRAY]            = &&LABEL_INST_NEW_ARRAY,
+        [INST_NEW_REFERENCE_ARRAY]  = &&LABEL_INST_NEW_REFERENCE_ARRAY,
+        [INST_ARRAY_LENGTH]         = &&LABEL_INST_ARRAY_LENGTH,
+        [INST_LOAD_ELEMENT]         = &&LABEL_INST_LOAD_ELEMENT,
+        [INST_STORE_ELEMENT]        = &&LABEL_INST_STORE_ELEMENT,
+        [INST_GET_STATIC_QUICK]     = &&LABEL_INST_GET_STATIC_QUICK,
+        [INST_INVOKE_VIRTUAL_QUICK] = &&LABEL_INST_INVOKE_VIRTUAL_QUICK,
+        [INST_INVOKE_STATIC_QUICK]  = &&LABEL_INST_INVOKE_STATIC_QUICK,
+        [INST_PUSH_STRING_QUICK]    = &&LABEL_INST_PUSH_STRING_QUICK,
+        [INST_INVOKE_SPECIAL_QUICK] = &&LABEL_INST_INVOKE_SPECIAL_QUICK,
+        [INST_NEW_QUICK]            = &&LABEL_INST_NEW_QUICK,
+        [INST_GET_FIELD_QUICK]      = &&LABEL_INST_GET_FIELD_QUICK,
+        [INST_PUT_FIELD_QUICK]      = &&LABEL_INST_PUT_FIELD_QUICK,
+        [INST_NEW_REFERENCE_ARRAY_QUICK] = &&LABEL_INST_NEW_REFERENCE_ARRAY_QUICK,
+        [INST_LOAD_LOAD_ADD_INT]    = &&LABEL_INST_LOAD_LOAD_ADD_INT,
+        [INST_LOAD_LOAD_IF_ICMP_EQ] = &&LABEL_INST_LOAD_LOAD_IF_ICMP_EQ,
+        [INST_LOAD_LOAD_IF_ICMP_NE] = &&LABEL_INST_LOAD_LOAD_IF_ICMP_NE,
+        [INST_LOAD_LOAD_IF_ICMP_LT] = &&LABEL_INST_LOAD_LOAD_IF_ICMP_LT,
+        [INST_LOAD_LOAD_IF_ICMP_GE] = &&LABEL_INST_LOAD_LOAD_IF_ICMP_GE,
+        [INST_LOAD_LOAD_IF_ICMP_GT] = &&LABEL_INST_LOAD_LOAD_IF_ICMP_GT,
+        [INST_LOAD_LOAD_IF_ICMP_LE] = &&LABEL_INST_LOAD_LOAD_IF_ICMP_LE,
+        [INST_INC_GOTO]             = &&LABEL_INST_INC_GOTO,
+    };
+
+    DISPATCH();
+    {
+#else
+    #define CASE(op) case op:
+    #define DISPATCH() continue
+
+    for (;;) {
+        PROFILE_INSTRUCTION(ip->Op);
+        switch ((InstructionOp)ip->Op) {
+#endif
+    // Not wrapped in do/while(0) since a continue inside it wouldn't reach the dispatch loop
+    #define NEXT() { ip++; DISPATCH(); }
+    #define SKIP(count) { ip += (count); DISPATCH(); }
+    #define JUMP(target) { ip = &instructions[target]; DISPATCH(); }
+    #define BRANCH_PROFILE(inst) (&CURRENT_FRAME->Profile->Branches[(inst) - instructions])
+    #define RECEIVER_PROFILE(inst) (&CURRENT_FRAME->Profile->Receivers[(inst) - instructions])
+    // Branches that go backwards close a loop and count towards compiling the method. Once it has been compiled the
+    // rest of the frame runs compiled from the loop header, then it returns like the return instructions do
+    #define BRANCH(target) \
+        { \
+            if ((uint32_t)(target) <= (uint32_t)(ip - instructions)) { \
+                CountBackedge(CURRENT_FRAME->Profile); \
+                if (CURRENT_FRAME->Code->OsrEntries) { \
+                    CHECK(RunCompiledLoop((uint32_t)(target))); \
+                    if (CURRENT_FRAME == entryFrame) \
+                        return true; \
+                    ReturnFromFrame(); \
+                    ENTER_FRAME(); \
+                } \
+            } \
+            JUMP(target); \
+        }
+    #define ENTER_FRAME() \
+        { \
+            cf = CURRENT_FRAME->Class; \
+            instructions = CURRENT_FRAME->Code->Instructions; \
+            ip = CURRENT_FRAME->Ip; \
+            DISPATCH(); \
+        }
+    #define CHECK(result) do { if (!(result)) return false; } while(0)
+
+        CASE(INST_PUSH_INT)
+        {
+            CHECK(PushIntConst(ip->B));
+            NEXT();
+        }
+        CASE(INST_PUSH_FLOAT)
+        {
+            float value;
+            memcpy(&value, &ip->B, sizeof(value));
+            CHECK(PushFloatConst(value));
+            NEXT();
+        }
+        CASE(INST_PUSH_STRING)
+        {
+            // Collections find the types of the frame's slots through it
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(PushString(cf, ip));
+            NEXT();
+        }
+        CASE(INST_PUSH_NULL)
+        {
+            CHECK(PushReference(0));
+            NEXT();
+        }
+        CASE(INST_LOAD_INT)
+        {
+            CHECK(LoadInt((uint8_t)ip->A));
+            NEXT();
+        }
+        CASE(INST_STORE_INT)
+        {
+            CHECK(IntStore((uint8_t)ip->A));
+            NEXT();
+        }
+        CASE(INST_LOAD_REFERENCE)
+        {
+            CHECK(LoadReference((uint8_t)ip->A));
+            NEXT();
+        }
+        CASE(INST_STORE_REFERENCE)
+        {
+            CHECK(ReferenceStore((uint8_t)ip->A));
+            NEXT();
+        }
+        CASE(INST_POP)
+        {
+            CURRENT_FRAME->Stack -= 1;
+            NEXT();
+        }
+        CASE(INST_POP2)
+        {
+            CURRENT_FRAME->Stack -= 2;
+            NEXT();
+        }
+        CASE(INST_DUP)
+        {
+            StackDuplicate(1, 0);
+            NEXT();
+        }
+        CASE(INST_DUP_X1)
+        {
+            StackDuplicate(1, 1);
+            NEXT();
+        }
+        CASE(INST_DUP_X2)
+        {
+            StackDuplicate(1, 2);
+            NEXT();
+        }
+        CASE(INST_DUP2)
+        {
+            StackDuplicate(2, 0);
+            NEXT();
+        }
+        CASE(INST_DUP2_X1)
+        {
+            StackDuplicate(2, 1);
+            NEXT();
+        }
+        CASE(INST_DUP2_X2)
+        {
+            StackDuplicate(2, 2);
+            NEXT();
+        }
+        CASE(INST_SWAP)
+        {
+            Slot* top = CURRENT_FRAME->Stack;
+            const Slot value = top[-1];
+            top[-1] = top[-2];
+            top[-2] = value;
+            NEXT();
+        }
+
+    #define INT_BINARY_CASE(op, expression) \
+        CASE(op) \
+        { \
+            Slot *val1, *val2; \
+            STACK_POP(&val2); \
+            STACK_POP(&val1); \
+            const int32_t a = val1->Int; \
+            const int32_t b = val2->Int; \
+            CHECK(PushIntConst(expression)); \
+            NEXT(); \
+        }
+        INT_BINARY_OPS(INT_BINARY_CASE)
+    #undef INT_BINARY_CASE
+
+    #define INT_UNARY_CASE(op, expression) \
+        CASE(op) \
+        { \
+            Slot* val; \
+            STACK_POP(&val); \
+            const int32_t a = val->Int; \
+            CHECK(PushIntConst(expression)); \
+            NEXT(); \
+        }
+        INT_UNARY_OPS(INT_UNARY_CASE)
+    #undef INT_UNARY_CASE
+
+        CASE(INST_DIV_INT)
+        {
+            CHECK(IntDivide(false));
+            NEXT();
+        }
+        CASE(INST_REM_INT)
+        {
+            CHECK(IntDivide(true));
+            NEXT();
+        }
+        CASE(INST_INC_INT)
+        {
+            CHECK(IntInc((uint8_t)ip->A, (int8_t)ip->B));
+            NEXT();
+        }
+
+    #define INT_CONDITION_CASES(condition, operator) \
+        CASE(INST_IF_##condition) \
+        { \
+            Slot* val; \
+            STACK_POP(&val); \
+            const bool taken = val->Int operator 0; \
+            ProfileBranch(BRANCH_PROFILE(ip), taken); \
+            if (taken) \
+                BRANCH(ip->B); \
+            NEXT(); \
+        } \
+        CASE(INST_IF_ICMP_##condition) \
+        { \
+            Slot *val1, *val2; \
+            STACK_POP(&val2); \
+            STACK_POP(&val1); \
+            const bool taken = val1->Int operator val2->Int; \
+            ProfileBranch(BRANCH_PROFILE(ip), taken); \
+            if (taken) \
+                BRANCH(ip->B); \
+            NEXT(); \
+        } \
+        CASE(INST_LOAD_LOAD_IF_ICMP_##condition) \
+        { \
+            const Slot* locals = CURRENT_FRAME->Locals; \
+            const bool taken = locals[ip[0].A].Int operator locals[ip[1].A].Int; \
+            ProfileBranch(BRANCH_PROFILE(&ip[2]), taken); \
+            if (taken) \
+                BRANCH(ip[2].B); \
+            SKIP(3); \
+        }
+        INT_CONDITIONS(INT_CONDITION_CASES)
+    #undef INT_CONDITION_CASES
+
+        CASE(INST_IF_NULL)
+        {
+            Slot* val;
+            STACK_POP(&val);
+            const bool taken = val->Reference == 0;
+            ProfileBranch(BRANCH_PROFILE(ip), taken);
+            if (taken)
+                BRANCH(ip->B);
+            NEXT();
+        }
+        CASE(INST_IF_NON_NULL)
+        {
+            Slot* val;
+            STACK_POP(&val);
+            const bool taken = val->Reference != 0;
+            ProfileBranch(BRANCH_PROFILE(ip), taken);
+            if (taken)
+                BRANCH(ip->B);
+            NEXT();
+        }
+        CASE(INST_GOTO)
+        {
+            BRANCH(ip->B);
+        }
+        CASE(INST_RETURN_INT)
+        {
+            const int32_t result = CURRENT_FRAME->Stack[-1].Int;
+            if (CURRENT_FRAME == entryFrame)
+                return true;
+            PopFrame();
+            PushIntConst(result);
+            ENTER_FRAME();
+        }
+        CASE(INST_RETURN_REFERENCE)
+        {
+            const uint32_t result = CURRENT_FRAME->Stack[-1].Reference;
+            if (CURRENT_FRAME == entryFrame)
+                return true;
+            PopFrame();
+            PushReference(result);
+            ENTER_FRAME();
+        }
+        CASE(INST_RETURN)
+        {
+            if (CURRENT_FRAME == entryFrame)
+                return true;
+            PopFrame();
+            ENTER_FRAME();
+        }
+        CASE(INST_GET_STATIC)
+        {
+            CHECK(GetStatic(cf, ip));
+            NEXT();
+        }
+        CASE(INST_INVOKE_VIRTUAL)
+        {
+            CHECK(InvokeVirtual(cf, ip, RECEIVER_PROFILE(ip)));
+            NEXT();
+        }
+        CASE(INST_INVOKE_STATIC)
+        {
+            // Intrinsics push no frame
+            const Frame* caller = CURRENT_FRAME;
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(InvokeStatic(cf, ip));
+            if (CURRENT_FRAME != caller && CURRENT_FRAME->Code->Compiled)
+                CHECK(RunFrame());
+            ENTER_FRAME();
+        }
+        CASE(INST_INVOKE_SPECIAL)
+        {
+            const Frame* caller = CURRENT_FRAME;
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(InvokeSpecial(cf, ip));
+            if (CURRENT_FRAME != caller && CURRENT_FRAME->Code->Compiled)
+                CHECK(RunFrame());
+            ENTER_FRAME();
+        }
+        CASE(INST_NEW)
+        {
+            // Collections find the types of the frame's slots through it
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(New(cf, ip));
+            NEXT();
+        }
+        CASE(INST_GET_FIELD)
+        {
+            CHECK(GetField(cf, ip));
+            NEXT();
+        }
+        CASE(INST_PUT_FIELD)
+        {
+            CHECK(PutField(cf, ip));
+            NEXT();
+        }
+        CASE(INST_NEW_ARRAY)
+        {
+            // Collections find the types of the frame's slots through it
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(NewArray(&PRIMITIVE_ARRAY_LAYOUTS[ip->A]));
+            NEXT();
+        }
+        CASE(INST_NEW_REFERENCE_ARRAY)
+        {
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(NewReferenceArray(cf, ip));
+            NEXT();
+        }
+        CASE(INST_ARRAY_LENGTH)
+        {
+            CHECK(ArrayLength());
+            NEXT();
+        }
+        CASE(INST_LOAD_ELEMENT)
+        {
+            CHECK(LoadElement(ip));
+            NEXT();
+        }
+        CASE(INST_STORE_ELEMENT)
+        {
+            CHECK(StoreElement(ip));
+            NEXT();
+        }
+        CASE(INST_GET_STATIC_QUICK)
+        {
+            PushPrintStream();
+            NEXT();
+        }
+        CASE(INST_INVOKE_VIRTUAL_QUICK)
+        {
+            CHECK(InvokeVirtualQuick(cf, ip, RECEIVER_PROFILE(ip)));
+            NEXT();
+        }
+        CASE(INST_PUSH_STRING_QUICK)
+        {
+            PushReference((uint32_t)ip->B);
+            NEXT();
+        }
+        CASE(INST_INVOKE_STATIC_QUICK)
+        {
+            const Frame* caller = CURRENT_FRAME;
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(InvokeStaticQuick(cf, ip));
+            if (CURRENT_FRAME != caller && CURRENT_FRAME->Code->Compiled)
+                CHECK(RunFrame());
+            ENTER_FRAME();
+        }
+        CASE(INST_INVOKE_SPECIAL_QUICK)
+        {
+            const Frame* caller = CURRENT_FRAME;
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(InvokeSpecialQuick(cf, ip));
+            if (CURRENT_FRAME != caller && CURRENT_FRAME->Code->Compiled)
+                CHECK(RunFrame());
+            ENTER_FRAME();
+        }
+        CASE(INST_NEW_QUICK)
+        {
+            // Collections find the types of the frame's slots through it
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(NewQuick(cf, ip));
+            NEXT();
+        }
+        CASE(INST_GET_FIELD_QUICK)
+        {
+            CHECK(GetFieldQuick(ip));
+            NEXT();
+        }
+        CASE(INST_PUT_FIELD_QUICK)
+        {
+            CHECK(PutFieldQuick(ip));
+            NEXT();
+        }
+        CASE(INST_NEW_REFERENCE_ARRAY_QUICK)
+        {
+            CURRENT_FRAME->Ip = ip + 1;
+            CHECK(NewReferenceArrayQuick(cf, ip));
+            NEXT();
+        }
+        CASE(INST_LOAD_LOAD_ADD_INT)
+        {
+            const Slot* locals = CURRENT_FRAME->Locals;
+            CHECK(PushIntConst((int32_t)((uint32_t)locals[ip[0].A].Int + (uint32_t)locals[ip[1].A].Int)));
+            SKIP(3);
+        }
+        CASE(INST_INC_GOTO)
+        {
+            CHECK(IntInc((uint8_t)ip[0].A, (int8_t)ip[0].B));
+            BRANCH(ip[1].B);
+        }
+
+#if !defined(VM_THREADED_DISPATCH)
+            default:
+            {
+                fprintf(stderr, "Invalid instruction %d\n", ip->Op);
+                assert(false);
+                return false;
+            }
+        }
+#endif
+    }
+
+    #undef CASE
+    #undef DISPATCH
+    #undef NEXT
+    #undef SKIP
+    #undef JUMP
+    #undef BRANCH
+    #undef BRANCH_PROFILE
+    #undef RECEIVER_PROFILE
+    #undef ENTER_FRAME
+    #undef CHECK
+}
+
+// Runs the current frame until it returns, compiled if it has been. The frame is left on the stack
+static bool ExecuteFrame(void)
+{
+    const uintptr_t nativeStack = (uintptr_t)&nativeStack;
+    if (nativeStack < THREAD_STACK.NativeStackLimit) {
+        ThrowException(SYM_STACK_OVERFLOW_ERROR, NULL);
+        return false;
+    }
+
+    Frame* frame = CURRENT_FRAME;
+    if (frame->Code->Compiled)
+        return ((CompiledMethod)frame->Code->Compiled)(frame);
+    return ExecuteCode(frame);
+}
+
+// Runs the current interpreted frame compiled from the loop header on, the frame is left on the stack once it returns
+static bool RunCompiledLoop(const uint32_t loopHeader)
+{
+    Frame* frame = CURRENT_FRAME;
+    const CompiledMethod entry = JitGetOsrEntry(frame->Code, loopHeader);
+    // Every backward branch target the interpreter reaches has an entry
+    assert(entry && "Missing OSR entry");
+    return entry(frame);
+}
+
+// Runs the frame just pushed until it returns, then pops it and pushes its return value onto the caller's stack
+static bool RunFrame(void)
+{
+    if (!ExecuteFrame())
+        return false;
+    ReturnFromFrame();
+    return true;
+}
+
+// Pops the frame that returned and pushes its return value onto the caller's stack
+static void ReturnFromFrame(void)
+{
+    const uint8_t returnSlots = CURRENT_FRAME->Code->ReturnSlots;
+    const Slot* result = CURRENT_FRAME->Stack - returnSlots;
+    PopFrame();
+    // The result sits above the caller's new stack top, possibly overlapping where it gets moved to
+    memmove(CURRENT_FRAME->Stack, result, returnSlots * sizeof(Slot));
+    CURRENT_FRAME->Stack += returnSlots;
+}
+
+bool RuntimeExecuteInstruction(Frame* frame, Instruction* inst, Slot* stackTop)
+{
+    DEBUG_ASSERT(frame == CURRENT_FRAME);
+    frame->Ip = inst + 1;
+    frame->Stack = stackTop;
+    const ClassFile* cf = frame->Class;
+    ReceiverProfile* receivers = &frame->Profile->Receivers[inst - frame->Code->Instructions];
+
+    switch ((InstructionOp)inst->Op) {
+        case INST_PUSH_STRING:
+            return PushString(cf, inst);
+        case INST_PUSH_STRING_QUICK:
+            return PushReference((uint32_t)inst->B);
+        case INST_DIV_INT:
+            return IntDivide(false);
+        case INST_REM_INT:
+            return IntDivide(true);
+        case INST_GET_STATIC:
+            return GetStatic(cf, inst);
+        case INST_GET_STATIC_QUICK:
+            PushPrintStream();
+            return true;
+        case INST_INVOKE_VIRTUAL:
+            return InvokeVirtual(cf, inst, receivers);
+        case INST_INVOKE_VIRTUAL_QUICK:
+            return InvokeVirtualQuick(cf, inst, receivers);
+        case INST_INVOKE_STATIC:
+            return InvokeStatic(cf, inst) && (CURRENT_FRAME == frame || RunFrame());
+        case INST_INVOKE_STATIC_QUICK:
+            return InvokeStaticQuick(cf, inst) && (CURRENT_FRAME == frame || RunFrame());
+        case INST_INVOKE_SPECIAL:
+        case INST_INVOKE_SPECIAL_QUICK:
+        {
+            const bool resolved = inst->Op == INST_INVOKE_SPECIAL_QUICK;
+            if (!(resolved ? InvokeSpecialQuick(cf, inst) : InvokeSpecial(cf, inst)))
+                return false;
+            return CURRENT_FRAME == frame || RunFrame();
+        }
+        case INST_NEW:
+            return New(cf, inst);
+        case INST_NEW_QUICK:
+            return NewQuick(cf, inst);
+        case INST_GET_FIELD:
+            return GetField(cf, inst);
+        case INST_GET_FIELD_QUICK:
+            return GetFieldQuick(inst);
+        case INST_PUT_FIELD:
+            return PutField(cf, inst);
+        case INST_PUT_FIELD_QUICK:
+            return PutFieldQuick(inst);
+        case INST_NEW_ARRAY:
+            return NewArray(&PRIMITIVE_ARRAY_LAYOUTS[inst->A]);
+        case INST_NEW_REFERENCE_ARRAY:
+            return NewReferenceArray(cf, inst);
+        case INST_NEW_REFERENCE_ARRAY_QUICK:
+            return NewReferenceArrayQuick(cf, inst);
+        case INST_ARRAY_LENGTH:
+            return ArrayLength();
+        case INST_LOAD_ELEMENT:
+            return LoadElement(inst);
+        case INST_STORE_ELEMENT:
+            return StoreElement(inst);
+        default:
+        {
+            fprintf(stderr, "Instruction %d can't be run by the runtime\n", inst->Op);
+            assert(false);
+            return false;
+        }
+    }
+}
+
+// Visits every local and operand stack slot of the current thread's frames the verifier typed as a reference. Every
+// frame's Ip is one past the instruction it is stopped at, and a frame's stack ends where the arguments of the frame
+// it called start
+static void EnumerateRoots(const HeapReferenceVisitor visit, void* context)
+{
+    const Frame* callee = NULL;
+    for (Frame* frame = CURRENT_FRAME; frame; callee = frame, frame = frame->Previous) {
+        DEBUG_ASSERT(frame->Ip > frame->Code->Instructions);
+        const uint8_t* types = VerifierGetFrameTypes(frame->Code, (uint32_t)(frame->Ip - frame->Code->Instructions - 1));
+        for (uint16_t i = 0; i < frame->LocalsSize; i++) {
+            if (types[i] == VTYPE_REFERENCE && frame->Locals[i].Reference)
+                visit(&frame->Locals[i].Reference, context);
+        }
+
+        const uint8_t* stackTypes = types + frame->LocalsSize;
+        const Slot* stackEnd = callee ? callee->Locals : frame->Stack;
+        for (Slot* slot = frame->StackStart; slot < stackEnd; slot++) {
+            if (stackTypes[slot - frame->StackStart] == VTYPE_REFERENCE && slot->Reference)
+                visit(&slot->Reference, context);
+        }
+    }
+}
+
+static bool InitArrayLayouts(void)
+{
+    static const struct
+    {
+        ArgumentType Type;
+        const char* Name;
+        uint8_t ElementSize;
+    } PRIMITIVE_ARRAYS[] = {
+        { TYPE_BYTE,   "[B", 1 },
+        { TYPE_CHAR,   "[C", 2 },
+        { TYPE_BOOL,   "[Z", 1 },
+        { TYPE_SHORT,  "[S", 2 },
+        { TYPE_INT,    "[I", 4 },
+        { TYPE_FLOAT,  "[F", 4 },
+        { TYPE_LONG,   "[J", 8 },
+        { TYPE_DOUBLE, "[D", 8 },
+    };
+    for (size_t i = 0; i < sizeof(PRIMITIVE_ARRAYS) / sizeof(PRIMITIVE_ARRAYS[0]); i++) {
+        ObjectLayout* layout = &PRIMITIVE_ARRAY_LAYOUTS[PRIMITIVE_ARRAYS[i].Type];
+        *layout = (ObjectLayout){
+            .Name = SymbolIntern(PRIMITIVE_ARRAYS[i].Name, 2),
+            .InstanceSize = HEAP_ARRAY_DATA_OFFSET,
+            .ElementSize = PRIMITIVE_ARRAYS[i].ElementSize,
+        };
+        if (!HeapRegisterLayout(layout))
+            return false;
+    }
+
+    STRING_ARRAY_LAYOUT = (ObjectLayout){
+        .Name = SymbolIntern("[Ljava/lang/String;", 19),
+        .InstanceSize = HEAP_ARRAY_DATA_OFFSET,
+        .ElementSize = sizeof(uint32_t),
+        .ReferenceElements = true,
+        .ElementClass = SYM_JAVA_LANG_STRING,
+    };
+    if (!HeapRegisterLayout(&STRING_ARRAY_LAYOUT))
+        return false;
+
+    REFERENCE_ARRAY_LAYOUTS.Capacity = REFERENCE_ARRAY_LAYOUTS_INIT_CAP;
+    REFERENCE_ARRAY_LAYOUTS.Slots = calloc(REFERENCE_ARRAY_LAYOUTS.Capacity, sizeof(*REFERENCE_ARRAY_LAYOUTS.Slots));
+    assert(REFERENCE_ARRAY_LAYOUTS.Slots && "Out of RAM");
+    REFERENCE_ARRAY_LAYOUTS.Arena = ArenaCreate(REFERENCE_ARRAY_LAYOUTS_INIT_CAP * sizeof(ObjectLayout));
+    // anewarray of String creates the same type main gets called with
+    InsertArrayLayout(&STRING_ARRAY_LAYOUT);
+    return true;
+}
+
+bool VMInit(const VMOptions* options)
+{
+    if (options->StackSize < VM_MIN_STACK_SIZE) {
+        fprintf(stderr, "The stack size specified is too small, specify at least %dk\n", VM_MIN_STACK_SIZE / 1024);
+        return false;
+    }
+    MAX_STACK_SIZE = options->StackSize;
+    USE_JIT = options->UseJit;
+    BASELINE_INVOCATION_THRESHOLD = options->BaselineInvocationThreshold;
+    BASELINE_BACKEDGE_THRESHOLD = options->BaselineBackedgeThreshold;
+    OPTIMIZED_INVOCATION_THRESHOLD = options->OptimizedInvocationThreshold;
+    OPTIMIZED_BACKEDGE_THRESHOLD = options->OptimizedBackedgeThreshold;
+    PRINT_COMPILATION = options->PrintCompilation;
+    if (USE_JIT && !JitInit(JIT_DEFAULT_CODE_CACHE_SIZE))
+        return false;
+    if (options->AotLibrary && !AotLoad(options->AotLibrary))
+        return false;
+    if (!HeapInit(&options->Heap, EnumerateRoots))
+        return false;
+    STRING_LAYOUT = (ObjectLayout){ .Name = SYM_JAVA_LANG_STRING, .InstanceSize = HeapAlignSize(sizeof(StringObject)) };
+    PRINT_STREAM_LAYOUT = (ObjectLayout){ .Name = SYM_JAVA_IO_PRINT_STREAM, .InstanceSize = HeapAlignSize(sizeof(ObjectHeader)) };
+    if (!HeapRegisterLayout(&STRING_LAYOUT) || !HeapRegisterLayout(&PRINT_STREAM_LAYOUT))
+        return false;
+    if (!InitArrayLayouts())
+        return false;
+    if (!VMAttachThread())
+        return false;
+    PRINT_STREAM_REFERENCE = HeapAllocatePermanent(&PRINT_STREAM_LAYOUT);
+    assert(PRINT_STREAM_REFERENCE && "Heap too small for System.out");
+    return true;
+}
+
+void RuntimeThrowDivideByZero(void)
+{
+    ThrowException(SYM_ARITHMETIC_EXCEPTION, "/ by zero");
+}
+
+uint8_t RuntimeGetArgumentSlots(const ClassFile* cf, const Instruction* inst)
+{
+    assert(inst->Op == INST_INVOKE_VIRTUAL_QUICK);
+    const ResolvedRef* ref = &cf->ResolvedRefs[inst->B - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    return ref->ArgumentSlots;
+}
+
+bool RuntimeHasClass(const uint32_t reference, const Symbol* cls)
+{
+    return reference != 0 && GetReferenceClass(reference) == cls;
+}
+
+bool RuntimeInvokeDirect(Frame* frame, Instruction* inst, Slot* stackTop)
+{
+    DEBUG_ASSERT(frame == CURRENT_FRAME);
+    assert(inst->Op == INST_INVOKE_VIRTUAL_QUICK);
+    frame->Stack = stackTop;
+    return PrintLn(&frame->Class->ResolvedRefs[inst->B - 1]);
+}
+
+const MethodInfo* RuntimeGetStaticCallee(const ClassFile* cf, const Instruction* inst)
+{
+    if (inst->Op != INST_INVOKE_STATIC_QUICK)
+        return NULL;
+    const ResolvedRef* ref = &cf->ResolvedRefs[inst->B - 1];
+    assert(ref->Resolved && "Quick instruction on an unresolved reference");
+    return ref->Method;
+}
+
+OsrResult RuntimeOptimizeLoop(Frame* frame, const uint32_t loopHeader)
+{
+    DEBUG_ASSERT(frame == CURRENT_FRAME);
+    MethodProfile* profile = frame->Profile;
+    // Calls from now on get the whole method optimized, this frame enters a compile starting at the loop
+    UpdateTier(profile);
+    if (profile->Tier != TIER_OPTIMIZED)
+        return OSR_CONTINUE;
+    // Only this frame enters it, interpreted frames reaching the loop later keep using the baseline entry
+    const CompiledMethod entry = JitCompileOptimized((TranslatedCode*)frame->Code, profile, loopHeader, profile->Deoptimizations < MAX_DEOPTIMIZATIONS);
+    if (!entry)
+        return OSR_CONTINUE;
+    if (PRINT_COMPILATION)
+        PrintCompilation(profile, loopHeader);
+    return entry(frame) ? OSR_RETURNED : OSR_FAILED;
+}
+
+bool RuntimeDeoptimize(Frame* frame, const DeoptInfo* info, const uint64_t* saved)
+{
+    DEBUG_ASSERT(frame == CURRENT_FRAME);
+    MethodProfile* profile = frame->Profile;
+    TranslatedCode* tc = (TranslatedCode*)frame->Code;
+    profile->Deoptimizations++;
+    if (PRINT_COMPILATION)
+        printf("%8u %8u  deoptimized  %s.%s%s @ %u\n", profile->InvocationCount, profile->BackedgeCount,
+            GetNameOfClass(profile->Class, profile->Class->ThisClass)->Bytes, profile->Method->Name->Bytes,
+            profile->Method->Descriptor->Bytes, info->Frames[info->FrameCount - 1].Index);
+
+    // Calls from now on run baseline code, which gets the method optimized again with what the interpreter profiles
+    if (profile->Tier == TIER_OPTIMIZED) {
+        profile->Tier = TIER_BASELINE;
+        tc->Compiled = tc->BaselineCompiled;
+    }
+
+    for (uint32_t f = 0; f < info->FrameCount; f++) {
+        const DeoptFrame* state = &info->Frames[f];
+        // Arguments of the inlined callee are on top of its caller's operand stack already
+        if (f > 0 && !PushFrame(state->Class, state->Method, state->ArgumentSlots))
+            return false;
+
+        Frame* current = CURRENT_FRAME;
+        for (uint32_t i = 0; i < (uint32_t)state->LocalCount + state->StackDepth; i++) {
+            const DeoptValue* value = &state->Values[i];
+            if (value->Kind == DEOPT_EMPTY)
+                continue;
+            Slot* slot = i < state->LocalCount ? &current->Locals[i] : &current->StackStart[i - state->LocalCount];
+            slot->Int = value->Kind == DEOPT_CONSTANT ? value->As : (int32_t)(uint32_t)saved[value->As];
+        }
+        current->Stack = current->StackStart + state->StackDepth;
+        // Callers continue after the call the same as if the interpreter had made it
+        const bool innermost = f + 1 == info->FrameCount;
+        current->Ip = &current->Code->Instructions[innermost ? state->Index : state->Index + 1];
+    }
+    return ExecuteCode(frame);
+}
+
+void VMDestroy(void)
+{
+    VMDetachThread();
+#if defined(VM_PROFILE_INSTRUCTIONS)
+    PrintInstructionProfile();
+#endif
+    JitDestroy();
+    AotUnload();
+    HeapDestroy();
+    PRINT_STREAM_REFERENCE = 0;
+    free(REFERENCE_ARRAY_LAYOUTS.Slots);
+    ArenaDestroy(&REFERENCE_ARRAY_LAYOUTS.Arena);
+    REFERENCE_ARRAY_LAYOUTS = (ArrayLayoutTable){ 0 };
+}
+
+bool VMAttachThread(void)
+{
+    assert(!THREAD_STACK.Base && "Thread already attached");
+    const size_t slots = MAX_STACK_SIZE / sizeof(Slot);
+    THREAD_STACK.Base = malloc(slots * sizeof(Slot));
+    if (!THREAD_STACK.Base) {
+        fprintf(stderr, "Failed to allocate a VM stack of %zu bytes\n", MAX_STACK_SIZE);
+        return false;
+    }
+    THREAD_STACK.Limit = THREAD_STACK.Base + slots;
+    THREAD_STACK.PendingException = NULL;
+    THREAD_STACK.PendingExceptionMessage = NULL;
+    const uintptr_t nativeStack = (uintptr_t)&nativeStack;
+    THREAD_STACK.NativeStackLimit = nativeStack > NATIVE_STACK_BUDGET ? nativeStack - NATIVE_STACK_BUDGET : 0;
+    CURRENT_FRAME = NULL;
+    return true;
+}
+
+void VMDetachThread(void)
+{
+    assert(!CURRENT_FRAME && "Thread detached while running");
+    free(THREAD_STACK.Base);
+    THREAD_STACK = (VMStack){ 0 };
+    HeapDetachThread();
+}
+
+static void PrintUncaughtException(const Symbol* className, const char* message)
+{
+    fprintf(stderr, "Exception in thread \"main\" ");
+    for (uint16_t i = 0; i < className->Length; i++)
+        fputc(className->Bytes[i] == '/' ? '.' : className->Bytes[i], stderr);
+    if (message)
+        fprintf(stderr, ": %s", message);
+    fputc('\n', stderr);
+}
+
+bool ExecuteMethod(const ClassFile* cf, const MethodInfo* method)
+{
+    assert(THREAD_STACK.Base && "Thread not attached to the VM");
+    const CodeAttribute* ca = MethodGetCode(cf, method);
+    if (!ca) {
+        return false;
+    }
+
+    // Arguments aren't passed to the entry point, main gets an empty String[] and other parameters start out as null
+    // and zero. The array is allocated ahead of the frame, which has no roots to enumerate before its first instruction
+    uint32_t arguments = 0;
+    if ((method->AccessFlags & MAF_STATIC) && strncmp(method->Descriptor->Bytes, "([Ljava/lang/String;", 20) == 0) {
+        arguments = HeapAllocateArray(&STRING_ARRAY_LAYOUT, 0);
+        if (!arguments) {
+            PrintUncaughtException(SYM_OUT_OF_MEMORY_ERROR, "Java heap space");
+            return false;
+        }
+    }
+
+    // Frames left behind by a failed execution get unwound along with the entry frame
+    const Frame* caller = CURRENT_FRAME;
+    bool result = PushFrame(cf, method, 0);
+    if (result) {
+        memset(CURRENT_FRAME->Locals, 0, ca->MaxLocals * sizeof(Slot));
+        if (arguments)
+            CURRENT_FRAME->Locals[0].Reference = arguments;
+        result = ExecuteFrame();
+    }
+    while (CURRENT_FRAME != caller)
+        PopFrame();
+
+    if (THREAD_STACK.PendingException) {
+        PrintUncaughtException(THREAD_STACK.PendingException, THREAD_STACK.PendingExceptionMessage);
+        THREAD_STACK.PendingException = NULL;
+        THREAD_STACK.PendingExceptionMessage = NULL;
+    } else if (!result) {
+        fprintf(stderr, "Execution for method '%s' failed!\n", method->Name->Bytes);
+    }
     return result;
-}
\ No newline at end of file
+}
@@ -2,7 +2,42 @@
 #define CODE_H
 
 #include "ClassFile.h"
+#include "Heap.h"
 #include <stdbool.h>
+#include <stddef.h>
+
+// Size in bytes of each thread's VM stack, which bounds the depth of the call stack
+#define VM_DEFAULT_STACK_SIZE (1024 * 1024)
+#define VM_MIN_STACK_SIZE (64 * 1024)
+// A method moves from the interpreter to the baseline JIT after this many invocations or loop backedges
+#define VM_DEFAULT_BASELINE_INVOCATION_THRESHOLD 1000
+#define VM_DEFAULT_BASELINE_BACKEDGE_THRESHOLD 10000
+// And from the baseline JIT to the optimizing one after this many
+#define VM_DEFAULT_OPTIMIZED_INVOCATION_THRESHOLD 5000
+#define VM_DEFAULT_OPTIMIZED_BACKEDGE_THRESHOLD 40000
+
+typedef struct
+{
+    size_t StackSize;
+    HeapOptions Heap;
+    // Hot methods get compiled to machine code when true, otherwise everything is interpreted
+    bool UseJit;
+    uint32_t BaselineInvocationThreshold;
+    uint32_t BaselineBackedgeThreshold;
+    uint32_t OptimizedInvocationThreshold;
+    uint32_t OptimizedBackedgeThreshold;
+    // Prints every method as it moves up a tier
+    bool PrintCompilation;
+    // Shared library built with AotCompileClass, methods it has code for are never interpreted. NULL for none
+    const char* AotLibrary;
+} VMOptions;
+
+// Attaches the calling thread on success
+bool VMInit(const VMOptions* options);
+void VMDestroy(void);
+// Every thread that executes methods needs its own VM stack
+bool VMAttachThread(void);
+void VMDetachThread(void);
 
 bool ExecuteMethod(const ClassFile* cf, const MethodInfo* method);
 
@@ -0,0 +1,494 @@
+#include "Verifier.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Descriptor.h"
+
+typedef struct
+{
+    const ClassFile* Class;
+    const MethodInfo* Method;
+    const CodeAttribute* Code;
+    TranslatedCode* Translated;
+    Descriptor Descriptor;
+
+    // State of the instruction being verified, locals followed by the operand stack
+    uint8_t* Types;
+    uint16_t StackDepth;
+    uint32_t Index;
+
+    // Instructions whose entry state changed and need to be verified (again)
+    uint32_t* Worklist;
+    uint32_t WorklistCount;
+    bool* InWorklist;
+} Verifier;
+
+static bool Fail(const Verifier* v, const char* message)
+{
+    fprintf(stderr, "Verification of %s%s failed at %u: %s\n", v->Method->Name->Bytes, v->Method->Descriptor->Bytes,
+        v->Translated->BytecodePcs[v->Index], message);
+    return false;
+}
+
+static VerificationType GetVerificationType(const ArgumentType type)
+{
+    switch (type) {
+        case TYPE_BYTE:
+        case TYPE_CHAR:
+        case TYPE_BOOL:
+        case TYPE_SHORT:
+        case TYPE_INT:
+            return VTYPE_INT;
+        case TYPE_FLOAT:
+            return VTYPE_FLOAT;
+        case TYPE_LONG:
+            return VTYPE_LONG;
+        case TYPE_DOUBLE:
+            return VTYPE_DOUBLE;
+        case TYPE_CLASS_TYPE:
+        case TYPE_STRING:
+            return VTYPE_REFERENCE;
+        default:
+            assert(false && "Type has no verification type");
+            return VTYPE_TOP;
+    }
+}
+
+static bool IsCategory2(const VerificationType type)
+{
+    return type == VTYPE_LONG || type == VTYPE_DOUBLE;
+}
+
+static bool Push(Verifier* v, const VerificationType type)
+{
+    const uint16_t slots = IsCategory2(type) ? 2 : 1;
+    if (v->StackDepth + slots > v->Code->MaxStack)
+        return Fail(v, "operand stack overflow");
+
+    uint8_t* stack = &v->Types[v->Code->MaxLocals];
+    stack[v->StackDepth++] = (uint8_t)type;
+    if (slots == 2)
+        stack[v->StackDepth++] = VTYPE_TOP;
+    return true;
+}
+
+static bool Pop(Verifier* v, const VerificationType expected)
+{
+    const uint16_t slots = IsCategory2(expected) ? 2 : 1;
+    if (v->StackDepth < slots)
+        return Fail(v, "operand stack underflow");
+
+    v->StackDepth -= slots;
+    if (v->Types[v->Code->MaxLocals + v->StackDepth] != expected)
+        return Fail(v, "operand stack has the wrong type");
+    return true;
+}
+
+// Stack manipulation instructions work on raw slots but can't split a long or double in two, so the slot depth slots
+// below the top has to be where a value starts. Second halves are always VTYPE_TOP on the stack
+static bool CheckValueStart(const Verifier* v, const uint16_t depth)
+{
+    if (v->StackDepth < depth)
+        return Fail(v, "operand stack underflow");
+    if (v->Types[v->Code->MaxLocals + v->StackDepth - depth] == VTYPE_TOP)
+        return Fail(v, "instruction splits a long or double value");
+    return true;
+}
+
+static bool PopSlots(Verifier* v, const uint16_t count)
+{
+    if (!CheckValueStart(v, count))
+        return false;
+    v->StackDepth -= count;
+    return true;
+}
+
+// Same as StackDuplicate in the interpreter, copies the count slots on top of the stack below the skip slots under them
+static bool DuplicateSlots(Verifier* v, const uint16_t count, const uint16_t skip)
+{
+    if (!CheckValueStart(v, count) || (skip > 0 && !CheckValueStart(v, count + skip)))
+        return false;
+    if (v->StackDepth + count > v->Code->MaxStack)
+        return Fail(v, "operand stack overflow");
+
+    uint8_t* top = &v->Types[v->Code->MaxLocals + v->StackDepth];
+    uint8_t values[2];
+    memcpy(values, top - count, count);
+    uint8_t* insertAt = top - count - skip;
+    memmove(insertAt + count, insertAt, count + skip);
+    memcpy(insertAt, values, count);
+    v->StackDepth += count;
+    return true;
+}
+
+static bool SwapSlots(Verifier* v)
+{
+    if (!CheckValueStart(v, 1) || !CheckValueStart(v, 2))
+        return false;
+    uint8_t* top = &v->Types[v->Code->MaxLocals + v->StackDepth];
+    const uint8_t value = top[-1];
+    top[-1] = top[-2];
+    top[-2] = value;
+    return true;
+}
+
+static bool CheckLocal(const Verifier* v, const uint16_t index, const VerificationType expected)
+{
+    if (index >= v->Code->MaxLocals)
+        return Fail(v, "local variable index out of bounds");
+    if (v->Types[index] != expected)
+        return Fail(v, "local variable has the wrong type");
+    return true;
+}
+
+static bool StoreLocal(Verifier* v, const uint16_t index, const VerificationType type)
+{
+    const uint16_t slots = IsCategory2(type) ? 2 : 1;
+    if (index + slots > v->Code->MaxLocals)
+        return Fail(v, "local variable index out of bounds");
+
+    // Overwriting either half of a long or double invalidates the whole value
+    if (index > 0 && IsCategory2(v->Types[index - 1]))
+        v->Types[index - 1] = VTYPE_TOP;
+    v->Types[index] = (uint8_t)type;
+    if (slots == 2)
+        v->Types[index + 1] = VTYPE_TOP;
+    return true;
+}
+
+static void Enqueue(Verifier* v, const uint32_t index)
+{
+    if (v->InWorklist[index])
+        return;
+    v->InWorklist[index] = true;
+    v->Worklist[v->WorklistCount++] = index;
+}
+
+// Merges the current state into the entry state of target, queueing it if it changed
+static bool MergeInto(Verifier* v, const uint32_t target)
+{
+    TranslatedCode* tc = v->Translated;
+    if (target >= tc->Count)
+        return Fail(v, "execution falls off the end of the code");
+
+    uint8_t* types = &tc->FrameTypes[(size_t)target * tc->FrameSize];
+    if (tc->StackDepths[target] == VERIFIER_UNREACHABLE) {
+        tc->StackDepths[target] = v->StackDepth;
+        memcpy(types, v->Types, tc->FrameSize);
+        Enqueue(v, target);
+        return true;
+    }
+
+    if (tc->StackDepths[target] != v->StackDepth)
+        return Fail(v, "operand stack depth differs between paths");
+
+    const uint16_t maxLocals = v->Code->MaxLocals;
+    bool changed = false;
+    for (uint16_t i = 0; i < maxLocals; i++) {
+        if (types[i] != VTYPE_TOP && types[i] != v->Types[i]) {
+            types[i] = VTYPE_TOP;
+            changed = true;
+        }
+    }
+    for (uint16_t i = maxLocals; i < maxLocals + v->StackDepth; i++) {
+        if (types[i] != v->Types[i])
+            return Fail(v, "operand stack types differ between paths");
+    }
+
+    if (changed)
+        Enqueue(v, target);
+    return true;
+}
+
+// Looks up the descriptor of the Fieldref or Methodref at index
+static const Symbol* GetMemberDescriptor(const Verifier* v, const uint16_t index, const ConstType expected)
+{
+    const ClassFile* cf = v->Class;
+    const Constant* constant = &cf->ConstantPool[index - 1];
+    if (constant->Type != expected) {
+        Fail(v, "constant pool entry has the wrong type");
+        return NULL;
+    }
+
+    // Fieldref and Methodref share their layout
+    const uint16_t nameAndTypeIndex = constant->As.MethodRef.NameAndTypeIndex;
+    if (nameAndTypeIndex == 0 || nameAndTypeIndex >= cf->ConstantPoolCount
+        || cf->ConstantPool[nameAndTypeIndex - 1].Type != CONST_NAME_AND_TYPE) {
+        Fail(v, "member reference has an invalid NameAndType");
+        return NULL;
+    }
+
+    const uint16_t descriptorIndex = cf->ConstantPool[nameAndTypeIndex - 1].As.NameAndType.DescriptorIndex;
+    if (descriptorIndex == 0 || descriptorIndex >= cf->ConstantPoolCount
+        || cf->ConstantPool[descriptorIndex - 1].Type != CONST_UTF8) {
+        Fail(v, "member reference has an invalid descriptor");
+        return NULL;
+    }
+
+    return cf->ConstantPool[descriptorIndex - 1].As.Utf8;
+}
+
+static bool VerifyInvoke(Verifier* v, const uint16_t index, const bool hasReceiver)
+{
+    const Symbol* descriptorStr = GetMemberDescriptor(v, index, CONST_METHOD_REF);
+    if (!descriptorStr)
+        return false;
+
+    Descriptor descriptor;
+    if (!ParseMethodDescriptor(descriptorStr->Bytes, &descriptor))
+        return Fail(v, "invalid method descriptor");
+
+    for (uint8_t i = descriptor.ParametersCount; i-- > 0;) {
+        if (!Pop(v, GetVerificationType(descriptor.ParameterTypes[i])))
+            return false;
+    }
+    if (hasReceiver && !Pop(v, VTYPE_REFERENCE))
+        return false;
+
+    if (descriptor.MethodReturnType == TYPE_VOID)
+        return true;
+    return Push(v, GetVerificationType(descriptor.MethodReturnType));
+}
+
+static bool VerifyGetStatic(Verifier* v, const uint16_t index)
+{
+    const Symbol* descriptorStr = GetMemberDescriptor(v, index, CONST_FIELD_REF);
+    if (!descriptorStr)
+        return false;
+
+    ArgumentType type;
+    if (!ParseFieldDescriptor(descriptorStr->Bytes, &type))
+        return Fail(v, "invalid field descriptor");
+    return Push(v, GetVerificationType(type));
+}
+
+static bool VerifyNew(Verifier* v, const uint16_t index)
+{
+    if (v->Class->ConstantPool[index - 1].Type != CONST_CLASS)
+        return Fail(v, "constant pool entry has the wrong type");
+    return Push(v, VTYPE_REFERENCE);
+}
+
+static bool VerifyFieldAccess(Verifier* v, const uint16_t index, const bool isPut)
+{
+    const Symbol* descriptorStr = GetMemberDescriptor(v, index, CONST_FIELD_REF);
+    if (!descriptorStr)
+        return false;
+
+    ArgumentType type;
+    if (!ParseFieldDescriptor(descriptorStr->Bytes, &type))
+        return Fail(v, "invalid field descriptor");
+    if (isPut)
+        return Pop(v, GetVerificationType(type)) && Pop(v, VTYPE_REFERENCE);
+    return Pop(v, VTYPE_REFERENCE) && Push(v, GetVerificationType(type));
+}
+
+static bool VerifyReturn(const Verifier* v, const ArgumentType returnType)
+{
+    const ArgumentType expected = v->Descriptor.MethodReturnType;
+    const bool matches = returnType == TYPE_VOID || expected == TYPE_VOID
+        ? returnType == expected
+        : GetVerificationType(returnType) == GetVerificationType(expected);
+    if (!matches)
+        return Fail(v, "return instruction doesn't match the method return type");
+    return true;
+}
+
+// Applies the instruction to the current state and merges the result into its successors
+static bool VerifyInstruction(Verifier* v, const Instruction* inst)
+{
+    const uint32_t next = v->Index + 1;
+
+    switch ((InstructionOp)inst->Op) {
+        case INST_PUSH_INT:
+            return Push(v, VTYPE_INT) && MergeInto(v, next);
+        case INST_PUSH_FLOAT:
+            return Push(v, VTYPE_FLOAT) && MergeInto(v, next);
+        case INST_PUSH_STRING:
+        case INST_PUSH_STRING_QUICK:
+            return Push(v, VTYPE_REFERENCE) && MergeInto(v, next);
+        case INST_LOAD_INT:
+            return CheckLocal(v, inst->A, VTYPE_INT) && Push(v, VTYPE_INT) && MergeInto(v, next);
+        case INST_STORE_INT:
+            return Pop(v, VTYPE_INT) && StoreLocal(v, inst->A, VTYPE_INT) && MergeInto(v, next);
+        case INST_LOAD_REFERENCE:
+            return CheckLocal(v, inst->A, VTYPE_REFERENCE) && Push(v, VTYPE_REFERENCE) && MergeInto(v, next);
+        case INST_STORE_REFERENCE:
+            return Pop(v, VTYPE_REFERENCE) && StoreLocal(v, inst->A, VTYPE_REFERENCE) && MergeInto(v, next);
+        case INST_PUSH_NULL:
+            return Push(v, VTYPE_REFERENCE) && MergeInto(v, next);
+        case INST_POP:
+            return PopSlots(v, 1) && MergeInto(v, next);
+        case INST_POP2:
+            return PopSlots(v, 2) && MergeInto(v, next);
+        case INST_DUP:
+            return DuplicateSlots(v, 1, 0) && MergeInto(v, next);
+        case INST_DUP_X1:
+            return DuplicateSlots(v, 1, 1) && MergeInto(v, next);
+        case INST_DUP_X2:
+            return DuplicateSlots(v, 1, 2) && MergeInto(v, next);
+        case INST_DUP2:
+            return DuplicateSlots(v, 2, 0) && MergeInto(v, next);
+        case INST_DUP2_X1:
+            return DuplicateSlots(v, 2, 1) && MergeInto(v, next);
+        case INST_DUP2_X2:
+            return DuplicateSlots(v, 2, 2) && MergeInto(v, next);
+        case INST_SWAP:
+            return SwapSlots(v) && MergeInto(v, next);
+        case INST_ADD_INT:
+        case INST_SUB_INT:
+        case INST_MUL_INT:
+        case INST_DIV_INT:
+        case INST_REM_INT:
+        case INST_SHL_INT:
+        case INST_SHR_INT:
+        case INST_USHR_INT:
+        case INST_AND_INT:
+        case INST_OR_INT:
+        case INST_XOR_INT:
+            return Pop(v, VTYPE_INT) && Pop(v, VTYPE_INT) && Push(v, VTYPE_INT) && MergeInto(v, next);
+        case INST_NEG_INT:
+        case INST_INT_TO_BYTE:
+        case INST_INT_TO_CHAR:
+        case INST_INT_TO_SHORT:
+            return Pop(v, VTYPE_INT) && Push(v, VTYPE_INT) && MergeInto(v, next);
+        case INST_INC_INT:
+            return CheckLocal(v, inst->A, VTYPE_INT) && MergeInto(v, next);
+        case INST_IF_EQ:
+        case INST_IF_NE:
+        case INST_IF_LT:
+        case INST_IF_GE:
+        case INST_IF_GT:
+        case INST_IF_LE:
+            return Pop(v, VTYPE_INT) && MergeInto(v, (uint32_t)inst->B) && MergeInto(v, next);
+        case INST_IF_ICMP_EQ:
+        case INST_IF_ICMP_NE:
+        case INST_IF_ICMP_LT:
+        case INST_IF_ICMP_GE:
+        case INST_IF_ICMP_GT:
+        case INST_IF_ICMP_LE:
+            return Pop(v, VTYPE_INT) && Pop(v, VTYPE_INT) && MergeInto(v, (uint32_t)inst->B) && MergeInto(v, next);
+        case INST_IF_NULL:
+        case INST_IF_NON_NULL:
+            return Pop(v, VTYPE_REFERENCE) && MergeInto(v, (uint32_t)inst->B) && MergeInto(v, next);
+        case INST_GOTO:
+            return MergeInto(v, (uint32_t)inst->B);
+        case INST_RETURN_INT:
+            return Pop(v, VTYPE_INT) && VerifyReturn(v, TYPE_INT);
+        case INST_RETURN_REFERENCE:
+            return Pop(v, VTYPE_REFERENCE) && VerifyReturn(v, TYPE_CLASS_TYPE);
+        case INST_RETURN:
+            return VerifyReturn(v, TYPE_VOID);
+        case INST_GET_STATIC:
+        case INST_GET_STATIC_QUICK:
+            return VerifyGetStatic(v, (uint16_t)inst->B) && MergeInto(v, next);
+        case INST_INVOKE_VIRTUAL:
+        case INST_INVOKE_VIRTUAL_QUICK:
+            return VerifyInvoke(v, (uint16_t)inst->B, true) && MergeInto(v, next);
+        case INST_INVOKE_STATIC:
+        case INST_INVOKE_STATIC_QUICK:
+            return VerifyInvoke(v, (uint16_t)inst->B, false) && MergeInto(v, next);
+        case INST_INVOKE_SPECIAL:
+        case INST_INVOKE_SPECIAL_QUICK:
+            return VerifyInvoke(v, (uint16_t)inst->B, true) && MergeInto(v, next);
+        case INST_NEW:
+        case INST_NEW_QUICK:
+            return VerifyNew(v, (uint16_t)inst->B) && MergeInto(v, next);
+        case INST_GET_FIELD:
+            return VerifyFieldAccess(v, (uint16_t)inst->B, false) && MergeInto(v, next);
+        case INST_PUT_FIELD:
+            return VerifyFieldAccess(v, (uint16_t)inst->B, true) && MergeInto(v, next);
+        case INST_GET_FIELD_QUICK:
+            return Pop(v, VTYPE_REFERENCE) && Push(v, GetVerificationType((ArgumentType)inst->A)) && MergeInto(v, next);
+        case INST_PUT_FIELD_QUICK:
+            return Pop(v, GetVerificationType((ArgumentType)inst->A)) && Pop(v, VTYPE_REFERENCE) && MergeInto(v, next);
+        case INST_NEW_ARRAY:
+            return Pop(v, VTYPE_INT) && Push(v, VTYPE_REFERENCE) && MergeInto(v, next);
+        case INST_NEW_REFERENCE_ARRAY:
+        case INST_NEW_REFERENCE_ARRAY_QUICK:
+            return Pop(v, VTYPE_INT) && VerifyNew(v, (uint16_t)inst->B) && MergeInto(v, next);
+        case INST_ARRAY_LENGTH:
+            return Pop(v, VTYPE_REFERENCE) && Push(v, VTYPE_INT) && MergeInto(v, next);
+        case INST_LOAD_ELEMENT:
+            return Pop(v, VTYPE_INT) && Pop(v, VTYPE_REFERENCE) && Push(v, GetVerificationType((ArgumentType)inst->A))
+                && MergeInto(v, next);
+        case INST_STORE_ELEMENT:
+            return Pop(v, GetVerificationType((ArgumentType)inst->A)) && Pop(v, VTYPE_INT) && Pop(v, VTYPE_REFERENCE)
+                && MergeInto(v, next);
+        default:
+            // Superinstructions are only fused after verification
+            return Fail(v, "unknown instruction");
+    }
+}
+
+// Types of the locals on entry to the method, the parameters followed by unusable locals
+static bool InitEntryState(Verifier* v)
+{
+    memset(v->Types, VTYPE_TOP, v->Translated->FrameSize);
+    v->StackDepth = 0;
+
+    uint16_t local = 0;
+    if ((v->Method->AccessFlags & MAF_STATIC) == 0) {
+        if (!StoreLocal(v, local++, VTYPE_REFERENCE))
+            return false;
+    }
+    for (uint8_t i = 0; i < v->Descriptor.ParametersCount; i++) {
+        const VerificationType type = GetVerificationType(v->Descriptor.ParameterTypes[i]);
+        if (!StoreLocal(v, local, type))
+            return false;
+        local += IsCategory2(type) ? 2 : 1;
+    }
+    return true;
+}
+
+bool VerifyCode(const ClassFile* cf, const MethodInfo* method, TranslatedCode* tc)
+{
+    const CodeAttribute* ca = method->Code;
+    Verifier v = {
+        .Class = cf,
+        .Method = method,
+        .Code = ca,
+        .Translated = tc,
+    };
+
+    if (!ParseMethodDescriptor(method->Descriptor->Bytes, &v.Descriptor))
+        return Fail(&v, "invalid method descriptor");
+    tc->ReturnSlots = GetTypeSlots(v.Descriptor.MethodReturnType);
+
+    Arena* arena = (Arena*)&cf->Arena;
+    tc->FrameSize = (uint16_t)(ca->MaxLocals + ca->MaxStack);
+    tc->FrameTypes = ArenaAlloc(arena, (size_t)tc->Count * tc->FrameSize + 1);
+    tc->StackDepths = ArenaAlloc(arena, tc->Count * sizeof(uint16_t));
+    for (uint32_t i = 0; i < tc->Count; i++)
+        tc->StackDepths[i] = VERIFIER_UNREACHABLE;
+
+    v.Types = malloc(tc->FrameSize + 1);
+    v.Worklist = malloc(tc->Count * sizeof(uint32_t));
+    v.InWorklist = calloc(tc->Count, sizeof(bool));
+    assert(v.Types && v.Worklist && v.InWorklist);
+
+    // The entry state is merged into the first instruction as if something jumped to it
+    bool result = InitEntryState(&v);
+    if (result) {
+        tc->StackDepths[0] = 0;
+        memcpy(tc->FrameTypes, v.Types, tc->FrameSize);
+        Enqueue(&v, 0);
+    }
+
+    while (result && v.WorklistCount > 0) {
+        v.Index = v.Worklist[--v.WorklistCount];
+        v.InWorklist[v.Index] = false;
+
+        v.StackDepth = tc->StackDepths[v.Index];
+        memcpy(v.Types, VerifierGetFrameTypes(tc, v.Index), tc->FrameSize);
+        result = VerifyInstruction(&v, &tc->Instructions[v.Index]);
+    }
+
+    free(v.Types);
+    free(v.Worklist);
+    free(v.InWorklist);
+    return result;
+}
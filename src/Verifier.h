@@ -0,0 +1,34 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <stdbool.h>
+
+#include "ClassFile.h"
+#include "Translator.h"
+
+// Types the verifier tracks for every local and operand stack slot
+typedef enum
+{
+    // Unusable, either never written or merged from conflicting types. Also the second slot of long and double
+    VTYPE_TOP,
+    VTYPE_INT,
+    VTYPE_FLOAT,
+    VTYPE_LONG,
+    VTYPE_DOUBLE,
+    VTYPE_REFERENCE,
+} VerificationType;
+
+// Stack depth of instructions no path of execution reaches
+#define VERIFIER_UNREACHABLE UINT16_MAX
+
+// Infers the types on entry to every instruction and checks each instruction gets the types it expects, that the stack
+// stays within MaxStack and locals within MaxLocals. Fills in StackDepths and FrameTypes of the translated code
+bool VerifyCode(const ClassFile* cf, const MethodInfo* method, TranslatedCode* tc);
+
+// Types of the locals followed by the operand stack on entry to the instruction
+static inline const uint8_t* VerifierGetFrameTypes(const TranslatedCode* tc, const uint32_t index)
+{
+    return &tc->FrameTypes[(size_t)index * tc->FrameSize];
+}
+
+#endif //VERIFIER_H